@@ -0,0 +1,361 @@
+#include <sys/resource.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "ast.h"
+#include "corpus.h"
+#include "defs.h"
+#include "interner.h"
+#include "lazy_module.h"
+#include "parser.h"
+#include "scan.h"
+#include "print.h"
+#include "tokenizer.h"
+
+
+//
+//  Heap accounting. Every allocation goes through these, with its size in
+//  a header so that frees can be subtracted from the live total. The bench
+//  is single-threaded.
+//
+namespace {
+
+
+struct HeapStats {
+    klp::u64 allocations = 0;
+    klp::u64 allocated_bytes = 0;
+    klp::u64 live_bytes = 0;
+    klp::u64 peak_bytes = 0;
+};
+
+
+HeapStats heap_stats;
+
+constexpr std::size_t heap_header_size = alignof(std::max_align_t);
+
+
+}
+
+
+void* operator new(std::size_t size) {
+    auto header = static_cast<char*>(std::malloc(heap_header_size + size));
+    if (!header) {
+        throw std::bad_alloc();
+    }
+    std::memcpy(header, &size, sizeof(size));
+
+    ++heap_stats.allocations;
+    heap_stats.allocated_bytes += size;
+    heap_stats.live_bytes += size;
+    heap_stats.peak_bytes = std::max(heap_stats.peak_bytes, heap_stats.live_bytes);
+    return header + heap_header_size;
+}
+
+
+void operator delete(void* ptr) noexcept {
+    if (!ptr) {
+        return;
+    }
+
+    auto header = static_cast<char*>(ptr) - heap_header_size;
+    std::size_t size;
+    std::memcpy(&size, header, sizeof(size));
+    heap_stats.live_bytes -= size;
+    std::free(header);
+}
+
+
+void operator delete(void* ptr, std::size_t) noexcept {
+    operator delete(ptr);
+}
+
+
+namespace klp {
+
+
+namespace {
+
+
+struct Corpus {
+    const char* name;
+    CorpusMix mix;
+    bool program = false;  // generate_program instead of the mix
+};
+
+
+struct BenchResult {
+    const char* corpus;
+    const char* bench;
+    usize bytes;
+    usize tokens;
+    double best_seconds;
+    double median_seconds;
+    u64 allocations;
+    u64 allocated_bytes;
+    u64 peak_heap_bytes;  // above what was live before the run
+    u64 peak_rss_bytes;   // of the whole process so far
+};
+
+
+struct Options {
+    usize size = 16 << 20;
+    u64 seed = 1;
+    usize reps = 5;
+    std::string_view corpus;  // empty for all
+    bool json = false;
+};
+
+
+}
+
+
+static std::vector<Corpus> corpora() {
+    std::vector<Corpus> result;
+    result.push_back(Corpus{"mixed", CorpusMix{}});
+
+    CorpusMix identifiers;
+    identifiers.identifiers = 12;
+    identifiers.keywords = 4;
+    identifiers.numbers = 1;
+    identifiers.strings = 1;
+    identifiers.operators = 4;
+    result.push_back(Corpus{"identifiers", identifiers});
+
+    CorpusMix numbers;
+    numbers.numbers = 16;
+    result.push_back(Corpus{"numbers", numbers});
+
+    CorpusMix strings;
+    strings.strings = 12;
+    strings.multiline_strings = 4;
+    result.push_back(Corpus{"strings", strings});
+
+    CorpusMix operators;
+    operators.operators = 24;
+    result.push_back(Corpus{"operators", operators});
+
+    CorpusMix comments;
+    comments.comment_lines = 12;
+    comments.blank_lines = 4;
+    result.push_back(Corpus{"comments", comments});
+
+    CorpusMix unicode;
+    unicode.unicode = 8;
+    result.push_back(Corpus{"unicode", unicode});
+
+    CorpusMix definitions;
+    definitions.definitions = 39;
+    result.push_back(Corpus{"definitions", definitions});
+
+    result.push_back(Corpus{"program", CorpusMix{}, true});
+
+    return result;
+}
+
+
+static usize bench_next(std::string_view source) {
+    Interner interner;
+    Tokenizer tokenizer(source, interner);
+    usize num_tokens = 1;
+    while (tokenizer.next().type != Token::Type::Eof) {
+        ++num_tokens;
+    }
+    return num_tokens;
+}
+
+
+static usize bench_tokenize_all(std::string_view source) {
+    Interner interner;
+    return tokenize_all(source, interner).size();
+}
+
+
+// Startup of a lazy module: the declaration scan and the top-level code.
+static usize bench_lazy(std::string_view source) {
+    Interner interner;
+    return LazyModule(source, interner).top_level().size();
+}
+
+
+// Lexing and parsing into an Ast.
+static usize bench_parse(std::string_view source) {
+    Interner interner;
+    const TokenBuffer tokens = tokenize_all(source, interner);
+    const Ast ast = parse(tokens);
+    verify(ast.root != Ast::none, "no syntax tree");
+    return tokens.size();
+}
+
+
+// UTF-8 validation of the source at load time, with each kernel. Counts
+// no tokens.
+template <ScanIsa isa>
+static usize bench_validate_utf8(std::string_view source) {
+    const ScanKernels& kernels = *scan_kernels_for(isa);
+    const char* const end = source.data() + source.size();
+    verify(kernels.validate_utf8(source.data(), end) == end, "corpus is not UTF-8");
+    return 0;
+}
+
+
+static u64 peak_rss_bytes() {
+    rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return static_cast<u64>(usage.ru_maxrss) * 1024;
+}
+
+
+template <typename F>
+static BenchResult run(const char* corpus, const char* bench, std::string_view source, usize reps, F f) {
+    using Clock = std::chrono::steady_clock;
+
+    BenchResult result = {};
+    result.corpus = corpus;
+    result.bench = bench;
+    result.bytes = source.size();
+    std::vector<double> seconds;
+
+    for (usize i = 0; i < reps; ++i) {
+        heap_stats.allocations = 0;
+        heap_stats.allocated_bytes = 0;
+        heap_stats.peak_bytes = heap_stats.live_bytes;
+        const u64 live_before = heap_stats.live_bytes;
+
+        const auto start = Clock::now();
+        result.tokens = f(source);
+        seconds.push_back(std::chrono::duration<double>(Clock::now() - start).count());
+
+        result.allocations = heap_stats.allocations;
+        result.allocated_bytes = heap_stats.allocated_bytes;
+        result.peak_heap_bytes = heap_stats.peak_bytes - live_before;
+    }
+
+    std::sort(seconds.begin(), seconds.end());
+    result.best_seconds = seconds.front();
+    result.median_seconds = seconds[seconds.size() / 2];
+    result.peak_rss_bytes = peak_rss_bytes();
+    return result;
+}
+
+
+static void print_text(const std::vector<BenchResult>& results) {
+    println(
+        "{:<12} {:<13} {:>8} {:>8} {:>8} {:>9} {:>9} {:>9}",
+        "corpus", "bench", "MB/s", "Mtok/s", "allocs", "alloc MB", "heap MB", "RSS MB"
+    );
+
+    for (const auto& r : results) {
+        println(
+            "{:<12} {:<13} {:>8.1f} {:>8.2f} {:>8} {:>9.1f} {:>9.1f} {:>9.1f}",
+            r.corpus, r.bench,
+            r.bytes / r.best_seconds / 1e6, r.tokens / r.best_seconds / 1e6,
+            r.allocations, r.allocated_bytes / 1e6, r.peak_heap_bytes / 1e6, r.peak_rss_bytes / 1e6
+        );
+    }
+}
+
+
+static void print_json(const Options& options, const std::vector<BenchResult>& results) {
+    println("{{");
+    println("  \"size\": {},", options.size);
+    println("  \"seed\": {},", options.seed);
+    println("  \"reps\": {},", options.reps);
+    println("  \"results\": [");
+
+    for (usize i = 0; i < results.size(); ++i) {
+        const BenchResult& r = results[i];
+        println(
+            "    {{\"corpus\": \"{}\", \"bench\": \"{}\", \"bytes\": {}, \"tokens\": {}, "
+            "\"best_seconds\": {}, \"median_seconds\": {}, "
+            "\"mb_per_second\": {:.3f}, \"tokens_per_second\": {:.0f}, "
+            "\"allocations\": {}, \"allocated_bytes\": {}, \"peak_heap_bytes\": {}, \"peak_rss_bytes\": {}}}{}",
+            r.corpus, r.bench, r.bytes, r.tokens,
+            r.best_seconds, r.median_seconds,
+            r.bytes / r.best_seconds / 1e6, r.tokens / r.best_seconds,
+            r.allocations, r.allocated_bytes, r.peak_heap_bytes, r.peak_rss_bytes,
+            i + 1 < results.size() ? "," : ""
+        );
+    }
+
+    println("  ]");
+    println("}}");
+}
+
+
+static void print_usage() {
+    eputs("Usage: bench/run [--size=BYTES] [--seed=N] [--reps=N] [--corpus=NAME] [--json]");
+    eputs("Corpora: mixed, identifiers, numbers, strings, operators, comments, unicode, definitions, program");
+}
+
+
+int main(int argc, char* argv[]) {
+    Options options;
+
+    for (int i = 1; i < argc; ++i) {
+        const std::string_view arg = argv[i];
+        if (arg.substr(0, 7) == "--size=") {
+            options.size = std::strtoull(argv[i] + 7, nullptr, 10);
+        } else if (arg.substr(0, 7) == "--seed=") {
+            options.seed = std::strtoull(argv[i] + 7, nullptr, 10);
+        } else if (arg.substr(0, 7) == "--reps=") {
+            options.reps = std::max<usize>(1, std::strtoull(argv[i] + 7, nullptr, 10));
+        } else if (arg.substr(0, 9) == "--corpus=") {
+            options.corpus = arg.substr(9);
+        } else if (arg == "--json") {
+            options.json = true;
+        } else {
+            print_usage();
+            return 1;
+        }
+    }
+
+    std::vector<BenchResult> results;
+    for (const auto& corpus : corpora()) {
+        if (!options.corpus.empty() && options.corpus != corpus.name) {
+            continue;
+        }
+
+        const std::string source = corpus.program ?
+            generate_program(options.seed, options.size) :
+            generate_corpus(options.seed, options.size, corpus.mix);
+        results.push_back(run(corpus.name, "next", source, options.reps, bench_next));
+        results.push_back(run(corpus.name, "tokenize_all", source, options.reps, bench_tokenize_all));
+        results.push_back(run(corpus.name, "lazy", source, options.reps, bench_lazy));
+        results.push_back(run(corpus.name, "parse", source, options.reps, bench_parse));
+        results.push_back(run(corpus.name, "utf8_scalar", source, options.reps, bench_validate_utf8<ScanIsa::Scalar>));
+        if (scan_kernels_for(ScanIsa::Sse2)) {
+            results.push_back(run(corpus.name, "utf8_sse2", source, options.reps, bench_validate_utf8<ScanIsa::Sse2>));
+        }
+        if (scan_kernels_for(ScanIsa::Avx2)) {
+            results.push_back(run(corpus.name, "utf8_avx2", source, options.reps, bench_validate_utf8<ScanIsa::Avx2>));
+        }
+    }
+
+    if (results.empty()) {
+        print_usage();
+        return 1;
+    }
+
+    if (options.json) {
+        print_json(options, results);
+    } else {
+        print_text(results);
+    }
+
+    return 0;
+}
+
+
+}
+
+
+int main(int argc, char* argv[]) {
+    return klp::main(argc, argv);
+}
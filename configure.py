@@ -35,6 +35,10 @@ NINJA_EXEC_TEMPLATE = \
 """build {dst}: link {src}
 """
 
+NINJA_ALIAS_TEMPLATE = \
+"""build {name}: phony {dst}
+"""
+
 
 def main():
     args = parse_args()
@@ -67,12 +71,17 @@ def main():
     test_objs, test_dsts = make_objects(root, "tests")
     test_exec = make_exec(root, "tests/run", kalpa_lib_dsts + test_dsts)
 
+    bench_objs, bench_dsts = make_objects(root, "bench")
+    bench_exec = make_exec(root, "bench/run", kalpa_lib_dsts + bench_dsts)
+    bench_alias = NINJA_ALIAS_TEMPLATE.format(name="bench", dst="bench/run")
+
     ninja = NINJA_TEMPLATE.format(
         cxx=cxx, cxxflags=cxxflags + " " + args.depflags,
         ld=ld, ldflags=ldflags,
         body="".join(
             kalpa_objs + [kalpa, "\n"] +
-            test_objs + [test_exec]
+            test_objs + [test_exec, "\n"] +
+            bench_objs + [bench_exec, bench_alias]
         ),
     )
 
@@ -0,0 +1,106 @@
+#include "arena.h"
+
+#include <algorithm>
+#include <new>
+#include <utility>
+
+
+namespace klp {
+
+
+Arena::Arena(Arena&& other) noexcept :
+    block_size(other.block_size),
+    reserved(std::exchange(other.reserved, 0)),
+    last(std::exchange(other.last, nullptr)),
+    cursor(std::exchange(other.cursor, nullptr)),
+    limit(std::exchange(other.limit, nullptr))
+{}
+
+
+Arena& Arena::operator=(Arena&& other) noexcept {
+    if (this != &other) {
+        clear();
+        block_size = other.block_size;
+        reserved = std::exchange(other.reserved, 0);
+        last = std::exchange(other.last, nullptr);
+        cursor = std::exchange(other.cursor, nullptr);
+        limit = std::exchange(other.limit, nullptr);
+    }
+
+    return *this;
+}
+
+
+Arena::~Arena() {
+    clear();
+}
+
+
+void Arena::absorb(Arena&& other) {
+    if (!other.last) {
+        return;
+    }
+    if (!last) {
+        *this = std::move(other);
+        return;
+    }
+
+    // Link the blocks of `other` behind the current block, which keeps
+    // serving allocations.
+    Block* first = other.last;
+    while (first->prev) {
+        first = first->prev;
+    }
+    first->prev = last->prev;
+    last->prev = other.last;
+    reserved += other.reserved;
+
+    other.reserved = 0;
+    other.last = nullptr;
+    other.cursor = nullptr;
+    other.limit = nullptr;
+}
+
+
+void Arena::clear() {
+    while (last) {
+        Block* prev = last->prev;
+        ::operator delete(last);
+        last = prev;
+    }
+
+    reserved = 0;
+    cursor = nullptr;
+    limit = nullptr;
+}
+
+
+void* Arena::allocate_slow(usize size, usize align) {
+    // Oversized requests get a block of their own so that the current
+    // block's tail is not wasted.
+    const usize header = (sizeof(Block) + align - 1) & ~(align - 1);
+    const usize payload = std::max(size + align, block_size);
+
+    // Blocks come from operator new, so that allocation counters see them.
+    auto block = static_cast<Block*>(::operator new(header + payload));
+    block->size = header + payload;
+    reserved += block->size;
+
+    char* begin = reinterpret_cast<char*>(block) + header;
+    if (size + align > block_size && last) {
+        // Keep bumping in the current block; link the big one behind it.
+        block->prev = last->prev;
+        last->prev = block;
+        const usize misalign = reinterpret_cast<usize>(begin) & (align - 1);
+        return begin + (misalign ? align - misalign : 0);
+    }
+
+    block->prev = last;
+    last = block;
+    cursor = begin;
+    limit = begin + payload;
+    return allocate(size, align);
+}
+
+
+}
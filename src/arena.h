@@ -0,0 +1,95 @@
+#ifndef KALPA_ARENA_H
+#define KALPA_ARENA_H
+
+
+#include <cstddef>
+#include <cstring>
+#include <string_view>
+
+#include "defs.h"
+
+
+namespace klp {
+
+
+//
+//  Bump allocator over a list of blocks. Allocations are never freed one by
+//  one; everything goes away at once when the arena is cleared or
+//  destroyed. Pointers stay valid until then.
+//
+class Arena {
+public:
+    static constexpr usize default_block_size = 64 * 1024;
+
+public:
+    explicit Arena(usize block_size = default_block_size) :
+        block_size(block_size)
+    {}
+
+    Arena(const Arena&) = delete;
+    Arena& operator=(const Arena&) = delete;
+
+    Arena(Arena&& other) noexcept;
+    Arena& operator=(Arena&& other) noexcept;
+
+    ~Arena();
+
+    void* allocate(usize size, usize align = alignof(std::max_align_t)) {
+        const usize misalign = reinterpret_cast<usize>(cursor) & (align - 1);
+        const usize padding = misalign ? align - misalign : 0;
+        if (static_cast<usize>(limit - cursor) < size + padding) {
+            return allocate_slow(size, align);
+        }
+
+        char* ptr = cursor + padding;
+        cursor = ptr + size;
+        return ptr;
+    }
+
+    template <typename T>
+    T* allocate_array(usize count) {
+        return static_cast<T*>(allocate(sizeof(T) * count, alignof(T)));
+    }
+
+    std::string_view copy(std::string_view bytes) {
+        if (bytes.empty()) {
+            return {};
+        }
+
+        char* ptr = static_cast<char*>(allocate(bytes.size(), 1));
+        std::memcpy(ptr, bytes.data(), bytes.size());
+        return std::string_view(ptr, bytes.size());
+    }
+
+    // Takes over the blocks of `other`, which is left empty. Pointers into
+    // them stay valid.
+    void absorb(Arena&& other);
+
+    // Frees every block.
+    void clear();
+
+    // Bytes taken from the system, including unused block tails.
+    usize reserved_bytes() const {
+        return reserved;
+    }
+
+private:
+    struct Block {
+        Block* prev;
+        usize size;
+    };
+
+    usize block_size;
+    usize reserved = 0;
+    Block* last = nullptr;
+    char* cursor = nullptr;
+    char* limit = nullptr;
+
+    void* allocate_slow(usize size, usize align);
+};
+
+
+}
+
+
+#endif
@@ -0,0 +1,190 @@
+#include "ast.h"
+
+#include <fmt/format.h>
+
+#include "keywords.h"
+#include "operators.h"
+#include "print.h"
+
+
+namespace klp {
+
+
+const char* node_kind_name(NodeKind kind) {
+    switch (kind) {
+        case NodeKind::Module: return "Module";
+        case NodeKind::Block: return "Block";
+        case NodeKind::Def: return "Def";
+        case NodeKind::Class: return "Class";
+        case NodeKind::Let: return "Let";
+        case NodeKind::Assign: return "Assign";
+        case NodeKind::If: return "If";
+        case NodeKind::While: return "While";
+        case NodeKind::For: return "For";
+        case NodeKind::Return: return "Return";
+        case NodeKind::Identifier: return "Identifier";
+        case NodeKind::Int: return "Int";
+        case NodeKind::Float: return "Float";
+        case NodeKind::String: return "String";
+        case NodeKind::List: return "List";
+        case NodeKind::Unary: return "Unary";
+        case NodeKind::Binary: return "Binary";
+        case NodeKind::Call: return "Call";
+        case NodeKind::Index: return "Index";
+        case NodeKind::Attribute: return "Attribute";
+        case NodeKind::Error: return "Error";
+    }
+    return "?";
+}
+
+
+const char* describe(ParseError error) {
+    switch (error) {
+        case ParseError::ExpectedExpression: return "expected an expression";
+        case ParseError::ExpectedName: return "expected a name";
+        case ParseError::ExpectedColon: return "expected ':'";
+        case ParseError::ExpectedAssign: return "expected '='";
+        case ParseError::ExpectedIn: return "expected 'in'";
+        case ParseError::ExpectedBlock: return "expected an indented block";
+        case ParseError::ExpectedRightParen: return "expected ')'";
+        case ParseError::ExpectedRightBracket: return "expected ']'";
+        case ParseError::ExpectedLineEnd: return "expected the end of the line";
+        case ParseError::ExpectedOperator: return "expected an operator";
+        case ParseError::InvalidTarget: return "cannot assign to this expression";
+        case ParseError::UnexpectedIndent: return "unexpected indent";
+        case ParseError::NestedTooDeeply: return "expression nested too deeply";
+        case ParseError::BlocksNestedTooDeeply: return "blocks nested too deeply";
+    }
+    return "error";
+}
+
+
+static std::string_view operator_text(Token::Type type) {
+    for (const Operator& op : operator_list) {
+        if (op.type == type) {
+            return op.text;
+        }
+    }
+    for (const Keyword& keyword : keyword_list) {
+        if (keyword.type == type) {
+            return keyword.text;
+        }
+    }
+    return "?";
+}
+
+
+namespace {
+
+
+class AstFormatter {
+public:
+    AstFormatter(const Ast& ast, const TokenBuffer& tokens) : ast(ast), tokens(tokens) {}
+
+    void node(u32 index) {
+        if (index == Ast::none) {
+            out += "none";
+            return;
+        }
+
+        const Node& n = ast[index];
+        switch (n.kind) {
+            case NodeKind::Module: open("module"); list(n.a); break;
+            case NodeKind::Block: open("block"); list(n.a); break;
+
+            case NodeKind::Def:
+                open("def");
+                out += ' ';
+                name(n.token);
+                out += " (";
+                for (const u32 param : ast.list(n.a)) {
+                    if (out.back() != '(') {
+                        out += ' ';
+                    }
+                    name(param);
+                }
+                out += ')';
+                child(n.b);
+                break;
+
+            case NodeKind::Class: open("class"); out += ' '; name(n.token); child(n.a); break;
+            case NodeKind::Let: open("let"); out += ' '; name(n.token); child(n.a); break;
+            case NodeKind::Assign: open(operator_text(n.op)); child(n.a); child(n.b); break;
+
+            case NodeKind::If:
+                open("if");
+                child(n.a);
+                child(ast.if_then(index));
+                if (ast.if_else(index) != Ast::none) {
+                    child(ast.if_else(index));
+                }
+                break;
+
+            case NodeKind::While: open("while"); child(n.a); child(n.b); break;
+            case NodeKind::For: open("for"); out += ' '; name(n.token); child(n.a); child(n.b); break;
+
+            case NodeKind::Return:
+                open("return");
+                if (n.a != Ast::none) {
+                    child(n.a);
+                }
+                break;
+
+            case NodeKind::Identifier: name(n.token); return;
+            case NodeKind::Int: out += fmt::to_string(tokens.tables.int_value(tokens[n.token])); return;
+            case NodeKind::Float: out += fmt::to_string(tokens.tables.float_value(tokens[n.token])); return;
+            case NodeKind::String: out += format("{:?}", tokens.tables.string(tokens[n.token])); return;
+
+            case NodeKind::List: open("list"); list(n.a); break;
+            case NodeKind::Unary: open(operator_text(n.op)); child(n.a); break;
+            case NodeKind::Binary: open(operator_text(n.op)); child(n.a); child(n.b); break;
+            case NodeKind::Call: open("call"); child(n.a); list(n.b); break;
+            case NodeKind::Index: open("index"); child(n.a); child(n.b); break;
+            case NodeKind::Attribute: open("."); child(n.a); out += ' '; name(n.token); break;
+            case NodeKind::Error: out += "(error)"; return;
+        }
+        out += ')';
+    }
+
+    std::string take() {
+        return std::move(out);
+    }
+
+private:
+    const Ast& ast;
+    const TokenBuffer& tokens;
+    std::string out;
+
+    void open(std::string_view head) {
+        out += '(';
+        out += head;
+    }
+
+    void name(u32 token) {
+        out += tokens.tables.identifier(tokens[token]);
+    }
+
+    void child(u32 index) {
+        out += ' ';
+        node(index);
+    }
+
+    void list(u32 at) {
+        for (const u32 item : ast.list(at)) {
+            child(item);
+        }
+    }
+};
+
+
+}
+
+
+std::string format_ast(const Ast& ast, const TokenBuffer& tokens, u32 node) {
+    AstFormatter formatter(ast, tokens);
+    formatter.node(node);
+    return formatter.take();
+}
+
+
+}
@@ -0,0 +1,181 @@
+#ifndef KALPA_AST_H
+#define KALPA_AST_H
+
+
+#include <string>
+#include <vector>
+
+#include "defs.h"
+#include "tokenizer.h"
+
+
+namespace klp {
+
+
+enum class NodeKind : u8 {
+    Module,
+    Block,
+
+    Def,
+    Class,
+    Let,
+    Assign,
+    If,
+    While,
+    For,
+    Return,
+
+    Identifier,
+    Int,
+    Float,
+    String,
+    List,
+    Unary,
+    Binary,
+    Call,
+    Index,
+    Attribute,
+
+    Error,  // what failed to parse; the error is in Ast::diagnostics
+};
+
+
+const char* node_kind_name(NodeKind kind);
+
+
+//
+//  A node is 16 bytes. `token` indexes the TokenBuffer the tree was parsed
+//  from, and `a` and `b` depend on the kind. A list is a range of `extra`:
+//  its size, then its items.
+//
+//      kind        token           a               b
+//      Module      first token     statement list
+//      Block       first token     statement list
+//      Def         name            param list      body Block
+//      Class       name            body Block
+//      Let         name            value
+//      Assign      operator        target          value           op: Assign, AddEq, ...
+//      If          `if`            condition       extra: then Block, else (Block, If or none)
+//      While       `while`         condition       body Block
+//      For         variable        iterable        body Block
+//      Return      `return`        value or none
+//      Identifier  itself
+//      Int, Float, String  itself
+//      List        `[`             item list
+//      Unary       operator        operand                         op: Sub, Not
+//      Binary      operator        left            right           op
+//      Call        callee's first  callee          argument list
+//      Index       `[`             object          index
+//      Attribute   name            object
+//      Error       where it failed
+//
+//  A param list holds the token indices of the names.
+//
+struct Node {
+    NodeKind kind;
+    Token::Type op = Token::Type::Eof;
+    u32 token;
+    u32 a = 0;
+    u32 b = 0;
+};
+
+static_assert(sizeof(Node) == 16);
+
+
+struct NodeList {
+    const u32* first;
+    const u32* last;
+
+    const u32* begin() const {
+        return first;
+    }
+
+    const u32* end() const {
+        return last;
+    }
+
+    usize size() const {
+        return last - first;
+    }
+
+    u32 operator[](usize i) const {
+        return first[i];
+    }
+};
+
+
+enum class ParseError : u8 {
+    ExpectedExpression,
+    ExpectedName,
+    ExpectedColon,
+    ExpectedAssign,
+    ExpectedIn,
+    ExpectedBlock,
+    ExpectedRightParen,
+    ExpectedRightBracket,
+    ExpectedLineEnd,
+    ExpectedOperator,
+    InvalidTarget,
+    UnexpectedIndent,
+    NestedTooDeeply,
+    BlocksNestedTooDeeply,
+};
+
+
+const char* describe(ParseError error);
+
+
+struct ParseDiagnostic {
+    ParseError error;
+    u32 offset;
+};
+
+
+//
+//  A syntax tree in two flat arrays, so that a whole module is freed at
+//  once and nodes refer to each other by index.
+//
+struct Ast {
+    static constexpr u32 none = ~u32(0);
+
+    std::vector<Node> nodes;
+    std::vector<u32> extra;
+    u32 root = none;
+
+    // Parse errors in source order. Lexing errors are not repeated here.
+    std::vector<ParseDiagnostic> diagnostics;
+
+    const Node& operator[](u32 node) const {
+        return nodes[node];
+    }
+
+    NodeList list(u32 at) const {
+        const u32* const items = extra.data() + at + 1;
+        return NodeList{items, items + extra[at]};
+    }
+
+    // Children of a Module or Block.
+    NodeList statements(u32 node) const {
+        return list(nodes[node].a);
+    }
+
+    // Then and else branches of an If.
+    u32 if_then(u32 node) const {
+        return extra[nodes[node].b];
+    }
+
+    u32 if_else(u32 node) const {
+        return extra[nodes[node].b + 1];
+    }
+};
+
+
+// The tree under `node` as an S-expression on one line, like
+// (def fac (n) (block (return (* n (call fac (- n 1)))))).
+std::string format_ast(const Ast& ast, const TokenBuffer& tokens, u32 node);
+
+
+}
+
+
+#endif
@@ -0,0 +1,95 @@
+#include "bytecode.h"
+
+#include "print.h"
+
+
+namespace klp {
+
+
+const char* opcode_name(Opcode op) {
+    switch (op) {
+#define KALPA_OPCODE_NAME(name) case Opcode::name: return #name;
+        KALPA_OPCODES(KALPA_OPCODE_NAME)
+#undef KALPA_OPCODE_NAME
+    }
+    return "?";
+}
+
+
+u32 Program::global(Atom name) {
+    if (name < global_by_atom.size() && global_by_atom[name] != ~u32(0)) {
+        return global_by_atom[name];
+    }
+
+    if (name >= global_by_atom.size()) {
+        global_by_atom.resize(name + 1, ~u32(0));
+    }
+    global_by_atom[name] = globals.size();
+    globals.push_back(Value::undefined());
+    global_names.push_back(name);
+    return globals.size() - 1;
+}
+
+
+std::string disassemble(const Function& function) {
+    std::string out = format("def {} ({} args, {} registers)\n", function.name, function.arity, function.num_registers);
+
+    for (usize i = 0; i < function.code.size(); ++i) {
+        const Instruction insn = function.code[i];
+        out += format("{:5}  {:<14}", i, opcode_name(insn.op()));
+
+        switch (insn.op()) {
+            case Opcode::LoadNone:
+            case Opcode::Return:
+                out += format("{}", insn.a());
+                break;
+
+            case Opcode::LoadInt:
+            case Opcode::JumpIfFalse:
+            case Opcode::JumpIfTrue:
+            case Opcode::ForRange:
+            case Opcode::ForEach:
+                out += format("{} {}", insn.a(), insn.sbx());
+                break;
+
+            case Opcode::LoadConst:
+                out += format("{} {}  ; {}", insn.a(), insn.bx(), format_value(function.constants[insn.bx()]));
+                break;
+
+            case Opcode::GetGlobal:
+            case Opcode::SetGlobal:
+                out += format("{} {}", insn.a(), insn.bx());
+                break;
+
+            case Opcode::AddInt:
+            case Opcode::SubInt:
+                out += format("{} {} {}", insn.a(), insn.b(), insn.sc());
+                break;
+
+            case Opcode::Jump:
+                out += format("{}", insn.sax());
+                break;
+
+            case Opcode::ReturnNone:
+                break;
+
+            case Opcode::Move:
+            case Opcode::Neg:
+            case Opcode::Not:
+            case Opcode::Call:
+                out += format("{} {}", insn.a(), insn.b());
+                break;
+
+            default:
+                out += format("{} {} {}", insn.a(), insn.b(), insn.c());
+                break;
+        }
+
+        out += format("  @{}\n", function.offsets[i]);
+    }
+
+    return out;
+}
+
+
+}
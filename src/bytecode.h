@@ -0,0 +1,237 @@
+#ifndef KALPA_BYTECODE_H
+#define KALPA_BYTECODE_H
+
+
+#include <functional>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "defs.h"
+#include "heap.h"
+#include "interner.h"
+#include "value.h"
+
+
+namespace klp {
+
+
+//
+//  The instruction set, as X(name). Operands are registers of the current
+//  frame unless noted: R[A] is register A, K[Bx] constant Bx of the
+//  function and G[Bx] global Bx. Jump offsets count instructions from the
+//  next one.
+//
+#define KALPA_OPCODES(X) \
+    X(Move)         /* R[A] = R[B] */ \
+    X(LoadNone)     /* R[A] = none */ \
+    X(LoadInt)      /* R[A] = sBx */ \
+    X(LoadConst)    /* R[A] = K[Bx] */ \
+    X(GetGlobal)    /* R[A] = G[Bx] */ \
+    X(SetGlobal)    /* G[Bx] = R[A] */ \
+    X(NewList)      /* R[A] = [R[B], ..., R[B + C - 1]] */ \
+    X(GetIndex)     /* R[A] = R[B][R[C]] */ \
+    X(SetIndex)     /* R[A][R[B]] = R[C] */ \
+    X(Add)          /* R[A] = R[B] + R[C], and so on */ \
+    X(Sub) \
+    X(Mul) \
+    X(Div) \
+    X(IntDiv) \
+    X(Pow) \
+    X(Xor) \
+    X(Equal) \
+    X(NotEqual) \
+    X(Less) \
+    X(LessEq) \
+    X(Greater) \
+    X(GreaterEq) \
+    X(In) \
+    X(AddInt)       /* R[A] = R[B] + sC */ \
+    X(SubInt)       /* R[A] = R[B] - sC */ \
+    X(Neg)          /* R[A] = -R[B] */ \
+    X(Not)          /* R[A] = not R[B] */ \
+    X(Jump)         /* pc += sAx */ \
+    X(JumpIfFalse)  /* if not R[A]: pc += sBx */ \
+    X(JumpIfTrue)   /* if R[A]: pc += sBx */ \
+    X(BranchEqual)  /* if (R[A] == R[B]) == C, take the Jump that follows, else skip it */ \
+    X(BranchLess)   /* the same for R[A] < R[B] */ \
+    X(BranchLessEq) /* the same for R[A] <= R[B] */ \
+    X(ForRange)     /* if R[A] < R[A + 1]: R[A + 2] = R[A], R[A] += 1, else pc += sBx */ \
+    X(ForEach)      /* if R[A] < len R[A + 1]: R[A + 2] = R[A + 1][R[A]], R[A] += 1, else pc += sBx */ \
+    X(Call)         /* R[A] = R[A](R[A + 1], ..., R[A + B]) */ \
+    X(Return)       /* return R[A] */ \
+    X(ReturnNone)
+
+
+enum class Opcode : u8 {
+#define KALPA_OPCODE_ENUMERATOR(name) name,
+    KALPA_OPCODES(KALPA_OPCODE_ENUMERATOR)
+#undef KALPA_OPCODE_ENUMERATOR
+};
+
+
+const char* opcode_name(Opcode op);
+
+
+//
+//  One 32-bit instruction: the opcode in the low byte, then either three
+//  8-bit operands A, B and C, A and a 16-bit Bx, or a 24-bit Ax. Signed
+//  operands are stored with a bias.
+//
+struct Instruction {
+    static constexpr i32 max_sbx = 0x7fff;
+    static constexpr i32 max_sax = 0x7fffff;
+    static constexpr i32 max_sc = 0x7f;
+
+    u32 word;
+
+    static constexpr Instruction abc(Opcode op, u32 a, u32 b, u32 c) {
+        return Instruction{static_cast<u32>(op) | a << 8 | b << 16 | c << 24};
+    }
+
+    static constexpr Instruction abx(Opcode op, u32 a, u32 bx) {
+        return Instruction{static_cast<u32>(op) | a << 8 | bx << 16};
+    }
+
+    static constexpr Instruction asbx(Opcode op, u32 a, i32 sbx) {
+        return abx(op, a, static_cast<u32>(sbx + max_sbx));
+    }
+
+    static constexpr Instruction sax(Opcode op, i32 sax) {
+        return Instruction{static_cast<u32>(op) | static_cast<u32>(sax + max_sax) << 8};
+    }
+
+    constexpr Opcode op() const {
+        return static_cast<Opcode>(word & 0xff);
+    }
+
+    constexpr u32 a() const {
+        return (word >> 8) & 0xff;
+    }
+
+    constexpr u32 b() const {
+        return (word >> 16) & 0xff;
+    }
+
+    constexpr u32 c() const {
+        return word >> 24;
+    }
+
+    constexpr i32 sc() const {
+        return static_cast<i32>(c()) - max_sc;
+    }
+
+    constexpr u32 bx() const {
+        return word >> 16;
+    }
+
+    constexpr i32 sbx() const {
+        return static_cast<i32>(bx()) - max_sbx;
+    }
+
+    constexpr i32 sax() const {
+        return static_cast<i32>(word >> 8) - max_sax;
+    }
+};
+
+static_assert(sizeof(Instruction) == 4);
+
+
+struct NativeCode;
+
+
+//
+//  A compiled function. Its frame is `num_registers` values, of which the
+//  first `arity` are the arguments. `offsets` holds the source offset of
+//  each instruction, for error messages.
+//
+//  A function declared by compile_lazy() has no code until its first
+//  call, when Program::load compiles declaration `declaration` of the
+//  module into it.
+//
+struct Function : Object {
+    std::string name;
+    u32 arity = 0;
+    u32 num_registers = 0;
+    std::vector<Instruction> code;
+    std::vector<u32> offsets;
+    std::vector<Value> constants;
+    u32 declaration = 0;
+
+    // Calls plus backward jumps taken, up to the JIT threshold. The VM
+    // hands the function to the JIT when this reaches it, and runs `native`
+    // from then on if the JIT compiled it.
+    u32 hotness = 0;
+    NativeCode* native = nullptr;
+
+    explicit Function(std::string name) : Object(ObjectKind::Function), name(std::move(name)) {}
+};
+
+
+class Vm;
+
+
+//
+//  A function implemented in C++. It gets its arguments in place on the
+//  stack, writes its result and returns true, or reports an error through
+//  Vm::fail() and returns false.
+//
+struct Builtin : Object {
+    using Native = bool (*)(Vm& vm, Value* args, u32 num_args, Value& result);
+
+    const char* name;
+    i32 arity;  // -1 for any number
+    Native native;
+
+    Builtin(const char* name, i32 arity, Native native) :
+        Object(ObjectKind::Builtin), name(name), arity(arity), native(native)
+    {}
+};
+
+
+struct CompileError {
+    std::string message;
+    u32 offset;
+};
+
+
+//
+//  What the compiler produces and the VM runs: the module-level code,
+//  every object the code refers to, and the globals. Globals are resolved
+//  to slots at compile time, by atom.
+//
+class Program {
+public:
+    Interner* interner;
+    Heap heap;
+    Function* main = nullptr;
+    std::vector<Value> globals;
+    std::vector<Atom> global_names;
+
+    // Compiles a function without code before its first call. Set by
+    // compile_lazy().
+    std::function<std::optional<CompileError>(Function& function)> load;
+
+    explicit Program(Interner& interner) : interner(&interner) {}
+
+    // The slot of global `name`, which is added if needed.
+    u32 global(Atom name);
+
+    u32 global(std::string_view name) {
+        return global(interner->intern(name));
+    }
+
+private:
+    std::vector<u32> global_by_atom;
+};
+
+
+// One instruction per line, with its operands and source offset.
+std::string disassemble(const Function& function);
+
+
+}
+
+
+#endif
@@ -0,0 +1,909 @@
+#include "compiler.h"
+
+#include <algorithm>
+#include <optional>
+#include <vector>
+
+#include "parser.h"
+#include "print.h"
+
+
+namespace klp {
+
+
+namespace {
+
+
+struct Local {
+    Atom name;
+    u32 reg;
+};
+
+
+class Compiler {
+public:
+    Compiler(const Ast& ast, const TokenBuffer& tokens, Program& program) :
+        ast(ast),
+        tokens(tokens),
+        program(program),
+        range_atom(program.interner->intern("range"))
+    {}
+
+    Result<Function*, CompileError> run();
+    Result<Function*, CompileError> run_lazy(LazyModule& module);
+    std::optional<CompileError> run_declaration(Function& f, bool range_is_builtin);
+
+private:
+    static constexpr u32 max_registers = 256;
+    static constexpr usize max_constants = 1 << 16;
+
+    const Ast& ast;
+    const TokenBuffer& tokens;
+    Program& program;
+    const Atom range_atom;
+    bool range_is_builtin = true;  // `for x in range n` may count instead of building a list
+
+    // State of the function being compiled. At the top level, there are
+    // no locals and `function` is the module code.
+    Function* function = nullptr;
+    std::vector<Local> locals;
+    u32 top = 0;     // first free register
+    u32 offset = 0;  // source offset of the node being compiled
+    std::optional<CompileError> error;
+
+    Atom atom(u32 token) const {
+        return tokens.payloads[token];
+    }
+
+    std::string_view name(u32 token) const {
+        return tokens.tables.identifier(tokens[token]);
+    }
+
+    void at(u32 node) {
+        offset = tokens.offsets[ast[node].token];
+    }
+
+    void fail(std::string message) {
+        if (!error) {
+            error = CompileError{std::move(message), offset};
+        }
+    }
+
+    u32 emit(Instruction insn) {
+        function->code.push_back(insn);
+        function->offsets.push_back(offset);
+        return function->code.size() - 1;
+    }
+
+    u32 alloc(u32 count = 1) {
+        const u32 reg = top;
+        top += count;
+        if (top > max_registers) {
+            fail("expression needs too many registers");
+            top = reg;
+            return 0;
+        }
+        function->num_registers = std::max(function->num_registers, top);
+        return reg;
+    }
+
+    u32 constant(Value value) {
+        if (function->constants.size() == max_constants) {
+            fail("too many constants in one function");
+            return 0;
+        }
+        function->constants.push_back(value);
+        return function->constants.size() - 1;
+    }
+
+    std::optional<u32> local(Atom name) const {
+        for (const Local& l : locals) {
+            if (l.name == name) {
+                return l.reg;
+            }
+        }
+        return std::nullopt;
+    }
+
+    void add_local(Atom name) {
+        if (!local(name)) {
+            locals.push_back(Local{name, static_cast<u32>(locals.size())});
+        }
+    }
+
+    void patch(u32 jump, u32 target);
+    void collect_locals(u32 node);
+    void find_globals(u32 node);
+
+    void block(u32 node);
+    void statement(u32 node);
+    void define(u32 node);
+    void function_body(u32 node, Function* f);
+    void declare(LazyModule& module, usize i);
+    void store(u32 name_token, u32 reg);
+    void assignment(u32 node);
+    void if_statement(u32 node);
+    void while_statement(u32 node);
+    void for_statement(u32 node);
+
+    void condition(u32 node, bool jump_if, std::vector<u32>& jumps);
+    u32 operand(u32 node);
+    void expression(u32 node, u32 dest);
+    void logical(u32 node, u32 dest);
+    void call(u32 node, u32 dest);
+};
+
+
+// Small integer literal that fits the immediate of AddInt and SubInt.
+static std::optional<i32> small_int(const Ast& ast, const TokenBuffer& tokens, u32 node) {
+    if (ast[node].kind != NodeKind::Int) {
+        return std::nullopt;
+    }
+    const i64 value = tokens.tables.int_value(tokens[ast[node].token]);
+    if (value < -Instruction::max_sc || value > Instruction::max_sc) {
+        return std::nullopt;
+    }
+    return static_cast<i32>(value);
+}
+
+
+// The first lexing or syntax error in the tokens of a declaration.
+static std::optional<CompileError> first_error(const TokenBuffer& tokens, const Ast& ast) {
+    const std::vector<Diagnostic> diagnostics = collect_diagnostics(tokens);
+    if (!diagnostics.empty()) {
+        return CompileError{describe(diagnostics[0].error), diagnostics[0].offset};
+    }
+    if (!ast.diagnostics.empty()) {
+        return CompileError{describe(ast.diagnostics[0].error), ast.diagnostics[0].offset};
+    }
+    return std::nullopt;
+}
+
+
+static Opcode binary_opcode(Token::Type op) {
+    using T = Token::Type;
+    switch (op) {
+        case T::Add: case T::AddEq: return Opcode::Add;
+        case T::Sub: case T::SubEq: return Opcode::Sub;
+        case T::Mul: case T::MulEq: return Opcode::Mul;
+        case T::Div: case T::DivEq: return Opcode::Div;
+        case T::IntDiv: case T::IntDivEq: return Opcode::IntDiv;
+        case T::Pow: case T::PowEq: return Opcode::Pow;
+        case T::Xor: case T::XorEq: return Opcode::Xor;
+        case T::Equal: return Opcode::Equal;
+        case T::NotEqual: return Opcode::NotEqual;
+        case T::Less: return Opcode::Less;
+        case T::LessEq: return Opcode::LessEq;
+        case T::Greater: return Opcode::Greater;
+        case T::GreaterEq: return Opcode::GreaterEq;
+        case T::In: return Opcode::In;
+        default:
+            verify(false, "not a binary operator");
+            return Opcode::Add;
+    }
+}
+
+
+// Points the forward jump at `jump` to `target`.
+void Compiler::patch(u32 jump, u32 target) {
+    const i32 delta = static_cast<i32>(target) - static_cast<i32>(jump + 1);
+    Instruction& insn = function->code[jump];
+    if (insn.op() == Opcode::Jump) {
+        if (delta < -Instruction::max_sax || delta > Instruction::max_sax) {
+            fail("function too large");
+        }
+        insn = Instruction::sax(Opcode::Jump, delta);
+    } else {
+        if (delta < -Instruction::max_sbx || delta > Instruction::max_sbx) {
+            fail("function too large");
+        }
+        insn = Instruction::asbx(insn.op(), insn.a(), delta);
+    }
+}
+
+
+// Adds the names that the statements under `node` assign to the locals,
+// not looking into nested functions. This, find_globals() and block()
+// recurse once or twice per nested block, at most max_block_depth deep.
+void Compiler::collect_locals(u32 node) {
+    const Node& n = ast[node];
+    switch (n.kind) {
+        case NodeKind::Block:
+            for (const u32 statement : ast.statements(node)) {
+                collect_locals(statement);
+            }
+            break;
+
+        case NodeKind::Let:
+            add_local(atom(n.token));
+            break;
+
+        case NodeKind::Assign:
+            if (ast[n.a].kind == NodeKind::Identifier) {
+                add_local(atom(ast[n.a].token));
+            }
+            break;
+
+        case NodeKind::If:
+            collect_locals(ast.if_then(node));
+            if (ast.if_else(node) != Ast::none) {
+                collect_locals(ast.if_else(node));
+            }
+            break;
+
+        case NodeKind::While:
+            collect_locals(n.b);
+            break;
+
+        case NodeKind::For:
+            add_local(atom(n.token));
+            collect_locals(n.b);
+            break;
+
+        default:
+            break;
+    }
+}
+
+
+// Looks for top-level statements that rebind `range`.
+void Compiler::find_globals(u32 node) {
+    const Node& n = ast[node];
+    switch (n.kind) {
+        case NodeKind::Def:
+        case NodeKind::Class:
+        case NodeKind::Let:
+        case NodeKind::For:
+            if (atom(n.token) == range_atom) {
+                range_is_builtin = false;
+            }
+            break;
+
+        case NodeKind::Assign:
+            if (ast[n.a].kind == NodeKind::Identifier && atom(ast[n.a].token) == range_atom) {
+                range_is_builtin = false;
+            }
+            break;
+
+        default:
+            break;
+    }
+
+    if (n.kind == NodeKind::Module || n.kind == NodeKind::Block) {
+        for (const u32 statement : ast.statements(node)) {
+            find_globals(statement);
+        }
+    } else if (n.kind == NodeKind::If) {
+        find_globals(ast.if_then(node));
+        if (ast.if_else(node) != Ast::none) {
+            find_globals(ast.if_else(node));
+        }
+    } else if (n.kind == NodeKind::While || n.kind == NodeKind::For) {
+        find_globals(n.b);
+    }
+}
+
+
+void Compiler::block(u32 node) {
+    for (const u32 statement : ast.statements(node)) {
+        this->statement(statement);
+    }
+}
+
+
+void Compiler::statement(u32 node) {
+    const Node& n = ast[node];
+    const u32 saved = top;
+    at(node);
+
+    switch (n.kind) {
+        case NodeKind::Def:
+            if (function != program.main) {
+                fail("nested functions are not supported yet");
+                break;
+            }
+            define(node);
+            break;
+
+        case NodeKind::Class:
+            fail("classes are not supported yet");
+            break;
+
+        case NodeKind::Let: {
+            const std::optional<u32> reg = local(atom(n.token));
+            if (reg) {
+                expression(n.a, *reg);
+            } else {
+                store(n.token, operand(n.a));
+            }
+            break;
+        }
+
+        case NodeKind::Assign: assignment(node); break;
+        case NodeKind::If: if_statement(node); break;
+        case NodeKind::While: while_statement(node); break;
+        case NodeKind::For: for_statement(node); break;
+
+        case NodeKind::Return:
+            if (function == program.main) {
+                fail("return outside a function");
+            } else if (n.a == Ast::none) {
+                emit(Instruction::abc(Opcode::ReturnNone, 0, 0, 0));
+            } else {
+                const u32 reg = operand(n.a);
+                at(node);
+                emit(Instruction::abc(Opcode::Return, reg, 0, 0));
+            }
+            break;
+
+        case NodeKind::Error:
+            verify(false, "compiling a tree with parse errors");
+            break;
+
+        default:
+            expression(node, alloc());
+            break;
+    }
+
+    top = saved;
+}
+
+
+void Compiler::define(u32 node) {
+    const Node& n = ast[node];
+    Function* const f = program.heap.make_tenured<Function>(std::string(name(n.token)));
+
+    Function* const outer = function;
+    const u32 outer_top = top;
+    function_body(node, f);
+    function = outer;
+    locals.clear();
+    top = outer_top;
+
+    at(node);
+    const u32 reg = alloc();
+    emit(Instruction::abx(Opcode::LoadConst, reg, constant(Value::from_object(f))));
+    store(n.token, reg);
+}
+
+
+// Compiles the parameters and body of the Def `node` into `f`.
+void Compiler::function_body(u32 node, Function* f) {
+    const Node& n = ast[node];
+    function = f;
+    locals.clear();
+
+    for (const u32 param : ast.list(n.a)) {
+        if (local(atom(param))) {
+            offset = tokens.offsets[param];
+            fail(format("duplicate parameter {}", name(param)));
+        }
+        add_local(atom(param));
+    }
+    f->arity = locals.size();
+    collect_locals(n.b);
+
+    top = 0;
+    alloc(locals.size());
+    block(n.b);
+    emit(Instruction::abc(Opcode::ReturnNone, 0, 0, 0));
+}
+
+
+// Binds the function of declaration `i` of `module` to its global, leaving
+// the function without code.
+void Compiler::declare(LazyModule& module, usize i) {
+    const Declaration& decl = module.declarations()[i];
+    offset = decl.begin;
+
+    // Neither can be called, so they are looked at now. A def without a
+    // name does not parse.
+    if (decl.kind == Token::Type::Class || decl.name == Declaration::no_name) {
+        const TokenBuffer& decl_tokens = module.tokens(i);
+        const Ast decl_ast = parse(decl_tokens);
+        if (std::optional<CompileError> first = first_error(decl_tokens, decl_ast)) {
+            offset = first->offset;
+            fail(std::move(first->message));
+        } else {
+            offset = decl_tokens.offsets[decl_ast[decl_ast.statements(decl_ast.root)[0]].token];
+            fail("classes are not supported yet");
+        }
+        return;
+    }
+
+    Function* const f = program.heap.make_tenured<Function>(std::string(program.interner->name(decl.name)));
+    f->declaration = i;
+
+    const u32 saved = top;
+    const u32 reg = alloc();
+    emit(Instruction::abx(Opcode::LoadConst, reg, constant(Value::from_object(f))));
+    emit(Instruction::abx(Opcode::SetGlobal, reg, program.global(decl.name)));
+    top = saved;
+}
+
+
+// Assigns R[reg] to the variable named by `name_token`.
+void Compiler::store(u32 name_token, u32 reg) {
+    const Atom name = atom(name_token);
+    if (const std::optional<u32> dest = local(name)) {
+        if (*dest != reg) {
+            emit(Instruction::abc(Opcode::Move, *dest, reg, 0));
+        }
+    } else {
+        emit(Instruction::abx(Opcode::SetGlobal, reg, program.global(name)));
+    }
+}
+
+
+void Compiler::assignment(u32 node) {
+    const Node& n = ast[node];
+    const Node& target = ast[n.a];
+    const bool compound = n.op != Token::Type::Assign;
+
+    if (target.kind == NodeKind::Identifier) {
+        const std::optional<u32> reg = local(atom(target.token));
+        if (!compound) {
+            if (reg) {
+                expression(n.b, *reg);
+            } else {
+                store(target.token, operand(n.b));
+            }
+            return;
+        }
+
+        const Opcode op = binary_opcode(n.op);
+        const u32 dest = reg ? *reg : alloc();
+        if (!reg) {
+            emit(Instruction::abx(Opcode::GetGlobal, dest, program.global(atom(target.token))));
+        }
+
+        const std::optional<i32> imm = op == Opcode::Add || op == Opcode::Sub ?
+            small_int(ast, tokens, n.b) : std::nullopt;
+        if (imm) {
+            at(node);
+            emit(Instruction::abc(op == Opcode::Add ? Opcode::AddInt : Opcode::SubInt, dest, dest, static_cast<u32>(*imm + Instruction::max_sc)));
+        } else {
+            const u32 rhs = operand(n.b);
+            at(node);
+            emit(Instruction::abc(op, dest, dest, rhs));
+        }
+
+        if (!reg) {
+            store(target.token, dest);
+        }
+        return;
+    }
+
+    if (target.kind == NodeKind::Index) {
+        const u32 object = operand(target.a);
+        const u32 index = operand(target.b);
+        u32 value = operand(n.b);
+        at(node);
+        if (compound) {
+            const u32 current = alloc();
+            emit(Instruction::abc(Opcode::GetIndex, current, object, index));
+            emit(Instruction::abc(binary_opcode(n.op), current, current, value));
+            value = current;
+        }
+        emit(Instruction::abc(Opcode::SetIndex, object, index, value));
+        return;
+    }
+
+    fail("attributes are not supported yet");
+}
+
+
+void Compiler::if_statement(u32 node) {
+    const Node& n = ast[node];
+    std::vector<u32> to_else;
+    condition(n.a, false, to_else);
+    block(ast.if_then(node));
+
+    const u32 otherwise = ast.if_else(node);
+    if (otherwise == Ast::none) {
+        for (const u32 jump : to_else) {
+            patch(jump, function->code.size());
+        }
+        return;
+    }
+
+    const u32 skip = emit(Instruction::sax(Opcode::Jump, 0));
+    for (const u32 jump : to_else) {
+        patch(jump, function->code.size());
+    }
+    if (ast[otherwise].kind == NodeKind::If) {
+        statement(otherwise);
+    } else {
+        block(otherwise);
+    }
+    patch(skip, function->code.size());
+}
+
+
+// The condition is tested at the bottom, so that an iteration takes one
+// branch.
+void Compiler::while_statement(u32 node) {
+    const Node& n = ast[node];
+    const u32 enter = emit(Instruction::sax(Opcode::Jump, 0));
+    const u32 body = function->code.size();
+    block(n.b);
+    patch(enter, function->code.size());
+
+    std::vector<u32> to_body;
+    condition(n.a, true, to_body);
+    for (const u32 jump : to_body) {
+        patch(jump, body);
+    }
+}
+
+
+// R[base] is the counter, R[base + 1] the limit or the list, and
+// R[base + 2] the item, which is copied to the loop variable.
+void Compiler::for_statement(u32 node) {
+    const Node& n = ast[node];
+    const u32 base = alloc(3);
+
+    const Node& iterable = ast[n.a];
+    const bool counted = range_is_builtin && !local(range_atom) &&
+        iterable.kind == NodeKind::Call &&
+        ast[iterable.a].kind == NodeKind::Identifier && atom(ast[iterable.a].token) == range_atom &&
+        (ast.list(iterable.b).size() == 1 || ast.list(iterable.b).size() == 2);
+
+    if (counted) {
+        const NodeList args = ast.list(iterable.b);
+        if (args.size() == 1) {
+            at(node);
+            emit(Instruction::asbx(Opcode::LoadInt, base, 0));
+            expression(args[0], base + 1);
+        } else {
+            expression(args[0], base);
+            expression(args[1], base + 1);
+        }
+    } else {
+        expression(n.a, base + 1);
+        at(node);
+        emit(Instruction::asbx(Opcode::LoadInt, base, 0));
+    }
+
+    at(node);
+    const u32 loop = function->code.size();
+    const u32 exit = emit(Instruction::asbx(counted ? Opcode::ForRange : Opcode::ForEach, base, 0));
+    store(n.token, base + 2);
+    block(n.b);
+    patch(emit(Instruction::sax(Opcode::Jump, 0)), loop);
+    patch(exit, function->code.size());
+}
+
+
+// Emits jumps, added to `jumps` for patching, that are taken when `node`
+// is `jump_if`. Comparisons branch without materializing a bool.
+void Compiler::condition(u32 node, bool jump_if, std::vector<u32>& jumps) {
+    using T = Token::Type;
+    const Node& n = ast[node];
+
+    if (n.kind == NodeKind::Unary && n.op == T::Not) {
+        condition(n.a, !jump_if, jumps);
+        return;
+    }
+
+    if (n.kind == NodeKind::Binary && (n.op == T::And || n.op == T::Or)) {
+        const bool is_and = n.op == T::And;
+        if (jump_if != is_and) {
+            condition(n.a, jump_if, jumps);
+            condition(n.b, jump_if, jumps);
+        } else {
+            std::vector<u32> skip;
+            condition(n.a, !jump_if, skip);
+            condition(n.b, jump_if, jumps);
+            for (const u32 jump : skip) {
+                patch(jump, function->code.size());
+            }
+        }
+        return;
+    }
+
+    const u32 saved = top;
+    const bool is_comparison = n.kind == NodeKind::Binary &&
+        (n.op == T::Equal || n.op == T::NotEqual || n.op == T::Less ||
+         n.op == T::LessEq || n.op == T::Greater || n.op == T::GreaterEq);
+
+    if (is_comparison) {
+        const u32 lhs = operand(n.a);
+        const u32 rhs = operand(n.b);
+        at(node);
+
+        Instruction branch;
+        switch (n.op) {
+            case T::Equal: branch = Instruction::abc(Opcode::BranchEqual, lhs, rhs, jump_if); break;
+            case T::NotEqual: branch = Instruction::abc(Opcode::BranchEqual, lhs, rhs, !jump_if); break;
+            case T::Less: branch = Instruction::abc(Opcode::BranchLess, lhs, rhs, jump_if); break;
+            case T::LessEq: branch = Instruction::abc(Opcode::BranchLessEq, lhs, rhs, jump_if); break;
+            case T::Greater: branch = Instruction::abc(Opcode::BranchLess, rhs, lhs, jump_if); break;
+            default: branch = Instruction::abc(Opcode::BranchLessEq, rhs, lhs, jump_if); break;
+        }
+        emit(branch);
+        jumps.push_back(emit(Instruction::sax(Opcode::Jump, 0)));
+    } else {
+        const u32 reg = operand(node);
+        at(node);
+        jumps.push_back(emit(Instruction::asbx(jump_if ? Opcode::JumpIfTrue : Opcode::JumpIfFalse, reg, 0)));
+    }
+
+    top = saved;
+}
+
+
+// The register holding the value of `node`: a local's own, or a new
+// temporary.
+u32 Compiler::operand(u32 node) {
+    if (ast[node].kind == NodeKind::Identifier) {
+        if (const std::optional<u32> reg = local(atom(ast[node].token))) {
+            return *reg;
+        }
+    }
+    const u32 reg = alloc();
+    expression(node, reg);
+    return reg;
+}
+
+
+// Compiles `node` into R[dest]. Apart from `and` and `or`, dest is only
+// written once the operands have been read, so it may be a local that
+// the expression uses. This recurses, through operand() and condition()
+// too, a few frames per level of the tree; the parser keeps trees within
+// max_expression_depth, which bounds the stack it takes.
+void Compiler::expression(u32 node, u32 dest) {
+    using T = Token::Type;
+    const Node& n = ast[node];
+    const u32 saved = top;
+    at(node);
+
+    switch (n.kind) {
+        case NodeKind::Identifier: {
+            const Atom name = atom(n.token);
+            if (const std::optional<u32> reg = local(name)) {
+                if (*reg != dest) {
+                    emit(Instruction::abc(Opcode::Move, dest, *reg, 0));
+                }
+            } else {
+                emit(Instruction::abx(Opcode::GetGlobal, dest, program.global(name)));
+            }
+            break;
+        }
+
+        case NodeKind::Int: {
+            const i64 value = tokens.tables.int_value(tokens[n.token]);
+            if (value >= -Instruction::max_sbx && value <= Instruction::max_sbx) {
+                emit(Instruction::asbx(Opcode::LoadInt, dest, static_cast<i32>(value)));
+            } else {
+                const Value constant_value = Value::fits_small_int(value)
+                    ? Value::from_small_int(value)
+                    : Value::from_object(program.heap.make_tenured<IntObject>(value));
+                emit(Instruction::abx(Opcode::LoadConst, dest, constant(constant_value)));
+            }
+            break;
+        }
+
+        case NodeKind::Float:
+            emit(Instruction::abx(Opcode::LoadConst, dest, constant(Value::from_float(tokens.tables.float_value(tokens[n.token])))));
+            break;
+
+        case NodeKind::String: {
+            StringObject* const string = program.heap.make_tenured<StringObject>(std::string(tokens.tables.string(tokens[n.token])));
+            emit(Instruction::abx(Opcode::LoadConst, dest, constant(Value::from_object(string))));
+            break;
+        }
+
+        case NodeKind::List: {
+            const NodeList items = ast.list(n.a);
+            if (items.size() >= max_registers) {
+                fail("list literal too long");
+                break;
+            }
+            const u32 first = alloc(items.size());
+            for (usize i = 0; i < items.size(); ++i) {
+                expression(items[i], first + i);
+            }
+            at(node);
+            emit(Instruction::abc(Opcode::NewList, dest, first, items.size()));
+            break;
+        }
+
+        case NodeKind::Unary: {
+            const u32 reg = operand(n.a);
+            at(node);
+            emit(Instruction::abc(n.op == T::Not ? Opcode::Not : Opcode::Neg, dest, reg, 0));
+            break;
+        }
+
+        case NodeKind::Binary: {
+            if (n.op == T::And || n.op == T::Or) {
+                logical(node, dest);
+                break;
+            }
+
+            const Opcode op = binary_opcode(n.op);
+            const std::optional<i32> imm = op == Opcode::Add || op == Opcode::Sub ?
+                small_int(ast, tokens, n.b) : std::nullopt;
+            const u32 lhs = operand(n.a);
+            if (imm) {
+                at(node);
+                emit(Instruction::abc(op == Opcode::Add ? Opcode::AddInt : Opcode::SubInt, dest, lhs, static_cast<u32>(*imm + Instruction::max_sc)));
+                break;
+            }
+
+            const u32 rhs = operand(n.b);
+            at(node);
+            emit(Instruction::abc(op, dest, lhs, rhs));
+            break;
+        }
+
+        case NodeKind::Call:
+            call(node, dest);
+            break;
+
+        case NodeKind::Index: {
+            const u32 object = operand(n.a);
+            const u32 index = operand(n.b);
+            at(node);
+            emit(Instruction::abc(Opcode::GetIndex, dest, object, index));
+            break;
+        }
+
+        case NodeKind::Attribute:
+            fail("attributes are not supported yet");
+            break;
+
+        default:
+            verify(false, "not an expression");
+            break;
+    }
+
+    top = saved;
+}
+
+
+// `a and b` is a if a is false, else b; `a or b` the other way round.
+void Compiler::logical(u32 node, u32 dest) {
+    const Node& n = ast[node];
+    const u32 into = dest < locals.size() ? alloc() : dest;
+
+    expression(n.a, into);
+    at(node);
+    const u32 skip = emit(Instruction::asbx(n.op == Token::Type::And ? Opcode::JumpIfFalse : Opcode::JumpIfTrue, into, 0));
+    expression(n.b, into);
+    patch(skip, function->code.size());
+
+    if (into != dest) {
+        emit(Instruction::abc(Opcode::Move, dest, into, 0));
+    }
+}
+
+
+// The callee and the arguments go in consecutive registers, which become
+// the start of the callee's frame. That can start at `dest` if it is the
+// last temporary.
+void Compiler::call(u32 node, u32 dest) {
+    const Node& n = ast[node];
+    const NodeList args = ast.list(n.b);
+    if (args.size() >= max_registers) {
+        fail("too many arguments");
+        return;
+    }
+
+    const u32 base = dest + 1 == top && dest >= locals.size() ? dest : alloc();
+    expression(n.a, base);
+    for (const u32 arg : args) {
+        expression(arg, alloc());
+    }
+
+    at(node);
+    emit(Instruction::abc(Opcode::Call, base, args.size(), 0));
+    if (base != dest) {
+        emit(Instruction::abc(Opcode::Move, dest, base, 0));
+    }
+}
+
+
+Result<Function*, CompileError> Compiler::run() {
+    verify(ast.diagnostics.empty(), "compiling a tree with parse errors");
+    verify(tokens.tables.interner == program.interner, "tokens and program use different interners");
+
+    Function* const module = program.heap.make_tenured<Function>("<module>");
+    program.main = module;
+    function = module;
+
+    find_globals(ast.root);
+    block(ast.root);
+    emit(Instruction::abc(Opcode::ReturnNone, 0, 0, 0));
+
+    if (error) {
+        return *error;
+    }
+    return module;
+}
+
+
+// Declarations go between the top-level statements, in source order. No
+// statement spans one: the top-level line after a declaration starts a
+// statement of its own, unless it is an `else` or `elif`, which does not
+// parse there.
+Result<Function*, CompileError> Compiler::run_lazy(LazyModule& module) {
+    verify(ast.diagnostics.empty(), "compiling a tree with parse errors");
+    verify(tokens.tables.interner == program.interner, "tokens and program use different interners");
+
+    Function* const main = program.heap.make_tenured<Function>("<module>");
+    program.main = main;
+    function = main;
+
+    find_globals(ast.root);
+    const auto& decls = module.declarations();
+    for (const Declaration& decl : decls) {
+        if (decl.name == range_atom) {
+            range_is_builtin = false;
+        }
+
+        const usize after = std::lower_bound(tokens.offsets.begin(), tokens.offsets.end(), decl.end) - tokens.offsets.begin();
+        if (tokens.types[after] == Token::Type::Else || tokens.types[after] == Token::Type::Elif) {
+            return CompileError{describe(ParseError::ExpectedExpression), tokens.offsets[after]};
+        }
+    }
+
+    usize next = 0;
+    for (const u32 statement : ast.statements(ast.root)) {
+        while (next < decls.size() && decls[next].begin < tokens.offsets[ast[statement].token]) {
+            declare(module, next++);
+        }
+        this->statement(statement);
+    }
+    while (next < decls.size()) {
+        declare(module, next++);
+    }
+    emit(Instruction::abc(Opcode::ReturnNone, 0, 0, 0));
+
+    if (error) {
+        return *error;
+    }
+
+    program.load = [&module, &program = program, range_is_builtin = range_is_builtin](Function& f) {
+        const TokenBuffer& decl_tokens = module.tokens(f.declaration);
+        const Ast decl_ast = parse(decl_tokens);
+        if (std::optional<CompileError> first = first_error(decl_tokens, decl_ast)) {
+            return first;
+        }
+        return Compiler(decl_ast, decl_tokens, program).run_declaration(f, range_is_builtin);
+    };
+    return main;
+}
+
+
+// Compiles the Def that a declaration of a LazyModule parses to into `f`.
+std::optional<CompileError> Compiler::run_declaration(Function& f, bool range_is_builtin) {
+    this->range_is_builtin = range_is_builtin;
+    const u32 node = ast.statements(ast.root)[0];
+    verify(ast[node].kind == NodeKind::Def, "a declaration that is not a def");
+
+    function_body(node, &f);
+    if (error) {
+        f.code.clear();
+        f.offsets.clear();
+        f.constants.clear();
+    }
+    return error;
+}
+
+
+}
+
+
+Result<Function*, CompileError> compile(const Ast& ast, const TokenBuffer& tokens, Program& program) {
+    return Compiler(ast, tokens, program).run();
+}
+
+
+Result<Function*, CompileError> compile_lazy(const Ast& ast, LazyModule& module, Program& program) {
+    return Compiler(ast, module.top_level(), program).run_lazy(module);
+}
+
+
+}
@@ -0,0 +1,48 @@
+#ifndef KALPA_COMPILER_H
+#define KALPA_COMPILER_H
+
+
+#include "ast.h"
+#include "bytecode.h"
+#include "defs.h"
+#include "lazy_module.h"
+#include "result.h"
+#include "tokenizer.h"
+
+
+namespace klp {
+
+
+//
+//  Compiles a parsed module into `program`, setting program.main to its
+//  module-level code. The tree must have no parse errors, and its
+//  identifiers must be atoms of program.interner. Blocks and expressions
+//  are compiled recursively, so the tree must come from parse(), which
+//  rejects those nested deeper than max_block_depth and
+//  max_expression_depth.
+//
+//  Names assigned at the top level are globals; in a function, its
+//  parameters and every name it assigns or loops over are locals, which
+//  live in registers. Other names are looked up as globals when the code
+//  runs, so functions may call ones defined after them.
+//
+//  Classes, attributes and nested functions are not supported yet.
+//
+Result<Function*, CompileError> compile(const Ast& ast, const TokenBuffer& tokens, Program& program);
+
+
+//
+//  Compiles the top-level code of `module`, parsed into `ast`, like
+//  compile() does a whole file, but only declares its functions. A
+//  function is bound to its global where its `def` stands, and its body is
+//  lexed, parsed and compiled through program.load on its first call, so
+//  errors in a body are reported then, as the error of that call. Classes
+//  are rejected right away. `module` must outlive `program`.
+//
+Result<Function*, CompileError> compile_lazy(const Ast& ast, LazyModule& module, Program& program);
+
+
+}
+
+
+#endif
@@ -0,0 +1,256 @@
+#include "corpus.h"
+
+#include "print.h"
+#include "rng.h"
+
+
+namespace klp {
+
+
+template <usize N>
+static const char* pick(Rng<u64>& rng, const char* const (&words)[N]) {
+    return words[rng.next() % N];
+}
+
+
+// Index of the weight `rng` lands on.
+template <usize N>
+static usize pick_weighted(Rng<u64>& rng, const u32 (&weights)[N]) {
+    u64 total = 0;
+    for (const u32 weight : weights) {
+        total += weight;
+    }
+    verify(total > 0, "corpus mix has no weight");
+
+    u64 r = rng.next() % total;
+    for (usize i = 0; i < N; ++i) {
+        if (r < weights[i]) {
+            return i;
+        }
+        r -= weights[i];
+    }
+    return N - 1;
+}
+
+
+static const char* const identifiers[] = {"x", "total", "fooBar", "i2", "acc"};
+static const char* const keywords[] = {"let", "if", "return", "not", "and", "in"};
+static const char* const numbers[] = {"12345", "3.25", ".5", "0x1f", "1_000", "6.02e23", "7"};
+static const char* const strings[] = {"\"text\"", "\"a\\\\b\\\"c\""};
+static const char* const operators[] = {"==", "+=", "(", ")", "**=", ",", "+", "*", "<=", "//"};
+static const char* const unicode_words[] = {"gr\xc3\xb6\xc3\x9f" "e", "\xe5\xa4\x89\xe6\x95\xb0", "\xce\xbb", "\"\xc3\xa9t\xc3\xa9 \xe2\x9c\x93\""};
+
+
+std::string generate_corpus(u64 seed, usize size, const CorpusMix& mix) {
+    u32 line_weights[] = {mix.code_lines, mix.comment_lines, mix.blank_lines, mix.multiline_strings, 0};
+    const u32 word_weights[] = {mix.identifiers, mix.keywords, mix.numbers, mix.strings, mix.operators, mix.unicode};
+
+    Rng<u64> rng({seed, seed * 31 + 7});
+    std::string source;
+    source.reserve(size + 256);
+    u32 level = 0;
+
+    while (source.size() < size) {
+        line_weights[4] = level == 0 ? mix.definitions : 0;
+        const usize kind = pick_weighted(rng, line_weights);
+        if (kind == 1) {
+            source.append(rng.next() % 12, ' ');
+            source += "# comment\n";
+            continue;
+        }
+
+        if (kind == 2) {
+            source += "\n";
+            continue;
+        }
+
+        if (kind == 4) {
+            source += format("def f{} x y =\n", rng.next() % 1000);
+            level = 1;
+            continue;
+        }
+
+        source.append(level * 4, ' ');
+        const usize num_words = 1 + rng.next() % 8;
+        for (usize i = 0; i < num_words; ++i) {
+            switch (pick_weighted(rng, word_weights)) {
+                case 0: source += pick(rng, identifiers); break;
+                case 1: source += pick(rng, keywords); break;
+                case 2: source += pick(rng, numbers); break;
+                case 3: source += pick(rng, strings); break;
+                case 4: source += pick(rng, operators); break;
+                default: source += pick(rng, unicode_words); break;
+            }
+            source += ' ';
+        }
+
+        if (kind == 3) {
+            source += "\"first line\n  second line\n\nthird\" x";
+        }
+        source += '\n';
+
+        const u64 step = rng.next() % 8;
+        if (step < 2 && level < 6) {
+            ++level;
+        } else if (step < 4 && level > 0) {
+            level -= 1 + rng.next() % level;
+        }
+    }
+
+    return source;
+}
+
+
+namespace {
+
+
+// Appends to a string owned by the caller, which returns it by name.
+class ProgramWriter {
+public:
+    ProgramWriter(u64 seed, std::string& source) : rng({seed, seed * 31 + 7}), source(source) {}
+
+    void write(usize size) {
+        source.reserve(size + 256);
+        while (source.size() < size) {
+            if (rng.next() % 16 == 0) {
+                source += format("class C{}:\n", rng.next() % 1000);
+                definition(1);
+            } else {
+                definition(0);
+            }
+            source += '\n';
+        }
+    }
+
+private:
+    static constexpr u32 max_depth = 3;
+
+    Rng<u64> rng;
+    std::string& source;
+
+    void indent(u32 level) {
+        source.append(level * 4, ' ');
+    }
+
+    void definition(u32 level) {
+        indent(level);
+        source += format("def f{} x y =", rng.next() % 1000);
+        if (rng.next() % 4 == 0) {
+            source += ' ';
+            expression(0);
+            source += '\n';
+            return;
+        }
+        source += '\n';
+        block(level + 1, 0);
+    }
+
+    void block(u32 level, u32 depth) {
+        const usize num_statements = 1 + rng.next() % 4;
+        for (usize i = 0; i < num_statements; ++i) {
+            statement(level, depth);
+        }
+    }
+
+    void statement(u32 level, u32 depth) {
+        indent(level);
+        const u64 kind = rng.next() % (depth < max_depth ? 9 : 5);
+        switch (kind) {
+            case 0: source += format("let {} = ", pick(rng, identifiers)); expression(0); break;
+            case 1: source += format("{} += ", pick(rng, identifiers)); expression(0); break;
+            case 2: source += "return "; expression(0); break;
+            case 3: call(0); break;
+            case 4: source += format("{}.{}[", pick(rng, identifiers), pick(rng, identifiers)); expression(0); source += "] = "; expression(0); break;
+
+            case 5:
+            case 6:
+                source += "if ";
+                expression(0);
+                source += ":\n";
+                block(level + 1, depth + 1);
+                if (rng.next() % 2) {
+                    indent(level);
+                    source += "else:\n";
+                    block(level + 1, depth + 1);
+                }
+                return;
+
+            case 7:
+                source += "while ";
+                expression(0);
+                source += ":\n";
+                block(level + 1, depth + 1);
+                return;
+
+            default:
+                source += format("for {} in ", pick(rng, identifiers));
+                call(0);
+                source += ":\n";
+                block(level + 1, depth + 1);
+                return;
+        }
+        source += '\n';
+    }
+
+    // Something that can be an argument without parentheses.
+    void atom(u32 depth) {
+        switch (rng.next() % (depth < max_depth ? 6 : 4)) {
+            case 0: case 1: source += pick(rng, identifiers); break;
+            case 2: source += pick(rng, program_numbers); break;
+            case 3: source += pick(rng, strings); break;
+            case 4: source += '('; expression(depth + 1); source += ')'; break;
+            default:
+                source += '[';
+                expression(depth + 1);
+                source += ", ";
+                expression(depth + 1);
+                source += ']';
+                break;
+        }
+    }
+
+    void call(u32 depth) {
+        source += pick(rng, identifiers);
+        const usize num_arguments = 1 + rng.next() % 3;
+        for (usize i = 0; i < num_arguments; ++i) {
+            source += ' ';
+            atom(depth + 1);
+        }
+    }
+
+    void expression(u32 depth) {
+        const u64 kind = rng.next() % (depth < max_depth ? 8 : 3);
+        if (kind < 3) {
+            atom(depth);
+            return;
+        }
+        if (kind < 6) {
+            expression(depth + 1);
+            source += format(" {} ", pick(rng, binary_operators));
+            expression(depth + 1);
+            return;
+        }
+        if (kind == 6) {
+            call(depth);
+            return;
+        }
+        source += rng.next() % 2 ? "-" : "not ";
+        atom(depth);
+    }
+
+    static constexpr const char* program_numbers[] = {"12345", "3.25", "0x1f", "1_000", "7"};
+    static constexpr const char* binary_operators[] = {"+", "-", "*", "//", "**", "==", "<=", "and", "or", "in"};
+};
+
+
+}
+
+
+std::string generate_program(u64 seed, usize size) {
+    std::string source;
+    ProgramWriter(seed, source).write(size);
+    return source;
+}
+
+
+}
@@ -0,0 +1,56 @@
+#ifndef KALPA_CORPUS_H
+#define KALPA_CORPUS_H
+
+
+#include <string>
+
+#include "defs.h"
+
+
+namespace klp {
+
+
+//
+//  Relative weights of what generated sources are made of. Lines are code
+//  lines, comment-only lines, blank lines, code lines that end in a string
+//  literal spanning three more lines, or `def` headers. Those are only
+//  picked at level 0, and their body is the code that follows, up to the
+//  next line back at level 0. The words of a code line are picked by the
+//  word weights.
+//
+struct CorpusMix {
+    u32 code_lines = 13;
+    u32 comment_lines = 1;
+    u32 blank_lines = 1;
+    u32 multiline_strings = 1;
+    u32 definitions = 0;
+
+    u32 identifiers = 4;
+    u32 keywords = 3;
+    u32 numbers = 6;
+    u32 strings = 2;
+    u32 operators = 6;
+    u32 unicode = 0;  // non-ASCII identifiers and string literals
+};
+
+
+//
+//  Deterministic generator of valid kalpa sources, for tests and
+//  benchmarks. The output has nested blocks, multi-level dedents,
+//  comment-only lines, blank lines and string literals that span lines.
+//
+std::string generate_corpus(u64 seed, usize size, const CorpusMix& mix = {});
+
+
+//
+//  Deterministic generator of programs that parse without errors: `def`s
+//  whose bodies nest if, while and for blocks around let, assignment,
+//  call and return statements, with the occasional class.
+//
+std::string generate_program(u64 seed, usize size);
+
+
+}
+
+
+#endif
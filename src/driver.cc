@@ -0,0 +1,124 @@
+#include "driver.h"
+
+#include <algorithm>
+#include <filesystem>
+#include <system_error>
+
+#include "print.h"
+#include "source.h"
+#include "source_manager.h"
+#include "unicode.h"
+
+
+namespace klp {
+
+
+std::optional<std::vector<std::string>> collect_sources(const std::vector<std::string>& paths) {
+    namespace fs = std::filesystem;
+    std::vector<std::string> sources;
+
+    for (const auto& path : paths) {
+        std::error_code error;
+        if (path == "-" || !fs::is_directory(path, error)) {
+            if (path != "-") {
+                const bool exists = fs::exists(path, error);
+                if (error) {
+                    eprint("Error: {}: {}\n", path, error.message());
+                    return std::nullopt;
+                }
+                if (!exists) {
+                    eprint("Error: {}: no such file or directory\n", path);
+                    return std::nullopt;
+                }
+            }
+            sources.push_back(path);
+            continue;
+        }
+
+        std::vector<std::string> found;
+        for (fs::recursive_directory_iterator it(path, error), end; !error && it != end; it.increment(error)) {
+            if (it->path().extension() == source_extension && it->is_regular_file(error)) {
+                found.push_back(it->path().string());
+            }
+        }
+        if (error) {
+            eprint("Error: {}: {}\n", path, error.message());
+            return std::nullopt;
+        }
+
+        std::sort(found.begin(), found.end());
+        sources.insert(sources.end(), found.begin(), found.end());
+    }
+
+    return sources;
+}
+
+
+std::string format_diagnostic(std::string_view path, u64 line, u32 column, std::string_view line_text, const char* message) {
+    return format(
+        "{}:{}:{}: error: {}\n    {}\n    {:>{}}\n",
+        path, line, column, message, line_text, "^", column
+    );
+}
+
+
+static void check_file(CheckResult& result, Interner& interner) {
+    std::optional<SourceFile> file = SourceFile::open(result.path.c_str(), &result.report);
+    if (!file) {
+        return;
+    }
+
+    result.read_ok = true;
+    result.num_bytes = file->text().size();
+
+    // A file that is not UTF-8 is not lexed at all.
+    std::vector<Diagnostic> diagnostics;
+    const usize invalid = validate_utf8(file->text());
+    if (invalid != file->text().size()) {
+        diagnostics.push_back(Diagnostic{LexError::InvalidUtf8, static_cast<u32>(invalid)});
+    } else {
+        const TokenBuffer tokens = tokenize_all(file->text(), interner);
+        diagnostics = collect_diagnostics(tokens);
+        result.num_tokens = tokens.size();
+    }
+    result.num_errors = diagnostics.size();
+    if (diagnostics.empty()) {
+        return;
+    }
+
+    // Line tables are only worth building for files with errors.
+    SourceManager sources;
+    if (!sources.add(std::move(*file))) {
+        return;
+    }
+
+    for (const auto& diagnostic : diagnostics) {
+        const SourceLocation location = sources.locate(diagnostic.offset);
+        result.report += format_diagnostic(
+            result.path, location.line, location.column,
+            sources.line_text(diagnostic.offset), describe(diagnostic.error)
+        );
+    }
+}
+
+
+std::vector<CheckResult> check_files(const std::vector<std::string>& paths, ThreadPool& pool, Interner& interner) {
+    std::vector<CheckResult> results(paths.size());
+    std::vector<Interner> interners(pool.size());
+
+    for (usize i = 0; i < paths.size(); ++i) {
+        results[i].path = paths[i];
+        pool.submit([&pool, &interners, &result = results[i]] {
+            check_file(result, interners[pool.worker_index()]);
+        });
+    }
+    pool.wait();
+
+    for (const auto& worker_interner : interners) {
+        interner.absorb(worker_interner);
+    }
+    return results;
+}
+
+
+}
@@ -0,0 +1,56 @@
+#ifndef KALPA_DRIVER_H
+#define KALPA_DRIVER_H
+
+
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "defs.h"
+#include "interner.h"
+#include "thread_pool.h"
+#include "tokenizer.h"
+
+
+namespace klp {
+
+
+// Extension of the source files picked up from directories.
+constexpr std::string_view source_extension = ".kl";
+
+
+// Expands directories to the source files under them, sorted, and keeps
+// other paths as they are. Prints an error and returns nothing if a path
+// does not exist.
+std::optional<std::vector<std::string>> collect_sources(const std::vector<std::string>& paths);
+
+
+// An error as printed: location, message, and the line with a caret under
+// the column.
+std::string format_diagnostic(std::string_view path, u64 line, u32 column, std::string_view line_text, const char* message);
+
+
+struct CheckResult {
+    std::string path;
+    bool read_ok = false;
+    usize num_bytes = 0;
+    usize num_tokens = 0;
+    usize num_errors = 0;
+    std::string report;  // read and lexing errors, formatted
+};
+
+
+//
+//  Lexes every file on `pool` and returns the results in the order of
+//  `paths`. Each worker interns into an interner of its own, and those are
+//  merged into `interner` at the end. Files are unmapped as soon as they
+//  are done, so memory holds one file per worker.
+//
+std::vector<CheckResult> check_files(const std::vector<std::string>& paths, ThreadPool& pool, Interner& interner);
+
+
+}
+
+
+#endif
@@ -0,0 +1,354 @@
+#include "heap.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+
+#include "bytecode.h"
+
+
+namespace klp {
+
+
+// Object::gc_bits
+static constexpr u8 gc_marked = 1;
+static constexpr u8 gc_forwarded = 2;  // a nursery cell copied to the old generation
+static constexpr u8 gc_free = 4;       // an old cell on a free list
+
+
+// What is left of an object in a cell that is free, or was copied out of
+// the nursery. It keeps the kind, and so the size, of the object.
+struct Heap::DeadCell {
+    ObjectKind kind;
+    u8 gc_bits;
+    void* link;  // the next free cell, or where the object was copied
+};
+
+
+//
+//  A block of old generation cells, aligned to its size so the chunk of an
+//  object is found from its address. A card is dirty when an object that
+//  starts in it may refer to the nursery; first_cell tells where, in each
+//  card, the first of those objects starts.
+//
+struct Heap::Chunk {
+    static constexpr usize num_cards = chunk_size / card_size;
+
+    u8 cards[num_cards];
+    u16 first_cell[num_cards];  // offset in the card plus 1, or 0 for none
+    usize top;
+
+    static usize cells_begin() {
+        return (sizeof(Chunk) + 15) & ~usize(15);
+    }
+
+    static Chunk* of(const void* address) {
+        return reinterpret_cast<Chunk*>(reinterpret_cast<uintptr_t>(address) & ~uintptr_t(chunk_size - 1));
+    }
+
+    u8* cell(usize offset) {
+        return reinterpret_cast<u8*>(this) + offset;
+    }
+};
+
+
+// Calls `f` with a null pointer of the type of `kind`.
+template <typename F>
+static decltype(auto) visit_kind(ObjectKind kind, F&& f) {
+    switch (kind) {
+        case ObjectKind::String: return f(static_cast<StringObject*>(nullptr));
+        case ObjectKind::List: return f(static_cast<ListObject*>(nullptr));
+        case ObjectKind::Function: return f(static_cast<Function*>(nullptr));
+        case ObjectKind::Builtin: return f(static_cast<Builtin*>(nullptr));
+        case ObjectKind::Int: return f(static_cast<IntObject*>(nullptr));
+    }
+    verify(false, "bad object kind");
+    return f(static_cast<IntObject*>(nullptr));
+}
+
+
+static usize cell_size(ObjectKind kind) {
+    return visit_kind(kind, [](auto* tag) { return sizeof(*tag); });
+}
+
+
+static usize payload_size(const Object* object) {
+    return visit_kind(object->kind, [object](auto* tag) {
+        using T = std::remove_pointer_t<decltype(tag)>;
+        return payload_bytes(*static_cast<const T*>(object));
+    });
+}
+
+
+static void destroy(Object* object) {
+    visit_kind(object->kind, [object](auto* tag) {
+        using T = std::remove_pointer_t<decltype(tag)>;
+        static_cast<T*>(object)->~T();
+    });
+}
+
+
+// Moves `object` into `memory`, which has room for it.
+static Object* move_object(Object* object, void* memory) {
+    return visit_kind(object->kind, [object, memory](auto* tag) -> Object* {
+        using T = std::remove_pointer_t<decltype(tag)>;
+        T* const moved = new (memory) T(std::move(*static_cast<T*>(object)));
+        moved->gc_bits = 0;
+        return moved;
+    });
+}
+
+
+// Calls `f` on every value held by `object`.
+template <typename F>
+static void for_each_reference(Object* object, F&& f) {
+    switch (object->kind) {
+        case ObjectKind::List:
+            for (Value& item : static_cast<ListObject*>(object)->items) {
+                f(item);
+            }
+            break;
+        case ObjectKind::Function:
+            for (Value& constant : static_cast<Function*>(object)->constants) {
+                f(constant);
+            }
+            break;
+        case ObjectKind::String:
+        case ObjectKind::Builtin:
+        case ObjectKind::Int:
+            break;
+    }
+}
+
+
+Heap::~Heap() {
+    for (u8* cell = nursery.get(); cell < nursery_top; ) {
+        Object* const object = reinterpret_cast<Object*>(cell);
+        cell += cell_size(object->kind);
+        destroy(object);
+    }
+
+    for (Chunk* const chunk : chunks) {
+        for (usize offset = Chunk::cells_begin(); offset < chunk->top; ) {
+            Object* const object = reinterpret_cast<Object*>(chunk->cell(offset));
+            offset += cell_size(object->kind);
+            if (!(object->gc_bits & gc_free)) {
+                destroy(object);
+            }
+        }
+        std::free(chunk);
+    }
+}
+
+
+void Heap::set_nursery_size(usize size) {
+    verify(nursery_top == nursery.get(), "resizing a nursery that is not empty");
+    nursery.reset();
+    nursery_top = nursery_end = nullptr;
+    nursery_size = size;
+}
+
+
+void* Heap::allocate_outside_nursery(usize size) {
+    if (!nursery && size <= nursery_size) {
+        nursery.reset(new u8[nursery_size]);
+        nursery_top = nursery.get() + size;
+        nursery_end = nursery.get() + nursery_size;
+        return nursery.get();
+    }
+    collection_requested = true;
+    return allocate_old(size);
+}
+
+
+void* Heap::allocate_old(usize size) {
+    stats.old_bytes += size;
+    if (old_generation_bytes() > major_threshold) {
+        collection_requested = true;
+    }
+
+    if (DeadCell* const cell = free_cells[size / 8]) {
+        free_cells[size / 8] = static_cast<DeadCell*>(cell->link);
+        return cell;
+    }
+
+    Chunk* chunk = chunks.empty() ? nullptr : chunks.back();
+    if (!chunk || chunk->top + size > chunk_size) {
+        chunk = static_cast<Chunk*>(std::aligned_alloc(chunk_size, chunk_size));
+        verify(chunk != nullptr, "out of memory");
+        std::memset(chunk, 0, sizeof(Chunk));
+        chunk->top = Chunk::cells_begin();
+        chunks.push_back(chunk);
+    }
+
+    const usize offset = chunk->top;
+    chunk->top += size;
+    u16& first = chunk->first_cell[offset / card_size];
+    if (first == 0) {
+        first = static_cast<u16>(offset % card_size + 1);
+    }
+    return chunk->cell(offset);
+}
+
+
+void Heap::remember(const Object* object) {
+    Chunk* const chunk = Chunk::of(object);
+    chunk->cards[(reinterpret_cast<uintptr_t>(object) - reinterpret_cast<uintptr_t>(chunk)) / card_size] = 1;
+}
+
+
+void Heap::collect(const std::vector<RootSpan>& roots, bool major) {
+    const auto start = std::chrono::steady_clock::now();
+
+    collect_minor(roots);
+    ++stats.minor_collections;
+    if (major || old_generation_bytes() > major_threshold) {
+        collect_major(roots);
+        ++stats.major_collections;
+        major_threshold = std::max<usize>(min_major_threshold, 2 * old_generation_bytes());
+    }
+    recent_payload_bytes = 0;
+    collection_requested = false;
+
+    const u64 pause = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+    stats.total_pause_ns += pause;
+    stats.max_pause_ns = std::max(stats.max_pause_ns, pause);
+}
+
+
+// Copies the object `value` refers to out of the nursery, if it is there,
+// and points `value` at the copy.
+void Heap::forward(Value& value) {
+    if (!value.is_object() || !in_nursery(value.as_object())) {
+        return;
+    }
+
+    Object* const object = value.as_object();
+    if (object->gc_bits & gc_forwarded) {
+        value = Value::from_object(static_cast<Object*>(reinterpret_cast<DeadCell*>(object)->link));
+        return;
+    }
+
+    static_assert(sizeof(DeadCell) <= sizeof(IntObject), "every cell must have room for a DeadCell");
+    const ObjectKind kind = object->kind;
+    const usize size = cell_size(kind);
+    Object* const moved = move_object(object, allocate_old(size));
+    destroy(object);
+    new (object) DeadCell{kind, gc_forwarded, moved};
+    stats.promoted_bytes += size;
+    worklist.push_back(moved);
+    value = Value::from_object(moved);
+}
+
+
+void Heap::collect_minor(const std::vector<RootSpan>& roots) {
+    for (const RootSpan& span : roots) {
+        for (Value* value = span.begin; value < span.end; ++value) {
+            forward(*value);
+        }
+    }
+
+    // Old objects written since the last collection. Promoting objects can
+    // add chunks, but not dirty cards.
+    const usize num_chunks = chunks.size();
+    for (usize i = 0; i < num_chunks; ++i) {
+        Chunk* const chunk = chunks[i];
+        for (usize card = 0; card < Chunk::num_cards; ++card) {
+            if (!chunk->cards[card]) {
+                continue;
+            }
+            chunk->cards[card] = 0;
+            if (chunk->first_cell[card] == 0) {
+                continue;
+            }
+
+            const usize end = std::min(chunk->top, (card + 1) * card_size);
+            for (usize offset = card * card_size + chunk->first_cell[card] - 1; offset < end; ) {
+                Object* const object = reinterpret_cast<Object*>(chunk->cell(offset));
+                offset += cell_size(object->kind);
+                if (!(object->gc_bits & gc_free)) {
+                    for_each_reference(object, [this](Value& value) { forward(value); });
+                }
+            }
+        }
+    }
+
+    while (!worklist.empty()) {
+        Object* const object = worklist.back();
+        worklist.pop_back();
+        for_each_reference(object, [this](Value& value) { forward(value); });
+    }
+
+    for (u8* cell = nursery.get(); cell < nursery_top; ) {
+        Object* const object = reinterpret_cast<Object*>(cell);
+        const usize size = cell_size(object->kind);
+        cell += size;
+        if (!(object->gc_bits & gc_forwarded)) {
+            const usize payload = payload_size(object);
+            destroy(object);
+            --num_objects;
+            stats.payload_bytes -= payload;
+            stats.freed_bytes += size + payload;
+        }
+    }
+    nursery_top = nursery.get();
+}
+
+
+void Heap::mark(const Value& value) {
+    if (!value.is_object()) {
+        return;
+    }
+    Object* const object = value.as_object();
+    if (!(object->gc_bits & gc_marked)) {
+        object->gc_bits |= gc_marked;
+        worklist.push_back(object);
+    }
+}
+
+
+// Runs right after a minor collection, so every object is old.
+void Heap::collect_major(const std::vector<RootSpan>& roots) {
+    for (const RootSpan& span : roots) {
+        for (const Value* value = span.begin; value < span.end; ++value) {
+            mark(*value);
+        }
+    }
+    while (!worklist.empty()) {
+        Object* const object = worklist.back();
+        worklist.pop_back();
+        for_each_reference(object, [this](Value& value) { mark(value); });
+    }
+
+    for (Chunk* const chunk : chunks) {
+        for (usize offset = Chunk::cells_begin(); offset < chunk->top; ) {
+            Object* const object = reinterpret_cast<Object*>(chunk->cell(offset));
+            const usize size = cell_size(object->kind);
+            offset += size;
+            if (object->gc_bits & gc_free) {
+                continue;
+            }
+            if (object->gc_bits & gc_marked) {
+                object->gc_bits &= ~gc_marked;
+                continue;
+            }
+            free_cell(object, size);
+        }
+    }
+}
+
+
+void Heap::free_cell(Object* object, usize size) {
+    const ObjectKind kind = object->kind;
+    const usize payload = payload_size(object);
+    destroy(object);
+    free_cells[size / 8] = new (object) DeadCell{kind, gc_free, free_cells[size / 8]};
+    --num_objects;
+    stats.old_bytes -= size;
+    stats.payload_bytes -= payload;
+    stats.freed_bytes += size + payload;
+}
+
+
+}
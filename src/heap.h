@@ -0,0 +1,237 @@
+#ifndef KALPA_HEAP_H
+#define KALPA_HEAP_H
+
+
+#include <cstdint>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "defs.h"
+#include "value.h"
+
+
+namespace klp {
+
+
+// Values the collector takes as references from outside the heap, like
+// the globals or the registers of a frame. It updates them when objects
+// move.
+struct RootSpan {
+    Value* begin;
+    Value* end;
+};
+
+
+struct GcStats {
+    u64 minor_collections = 0;
+    u64 major_collections = 0;
+    u64 allocated_bytes = 0;  // in cells and payloads
+    u64 promoted_bytes = 0;   // copied from the nursery to the old generation
+    u64 freed_bytes = 0;      // in cells and payloads
+    u64 old_bytes = 0;        // in old generation cells now, live or not
+    u64 payload_bytes = 0;    // owned by objects outside their cells now
+    u64 total_pause_ns = 0;
+    u64 max_pause_ns = 0;
+};
+
+
+// Memory that an object owns outside its cell, like the items of a list.
+// The heap counts it towards collections.
+inline usize payload_bytes(const Object&) {
+    return 0;
+}
+
+
+inline usize payload_bytes(const StringObject& string) {
+    return string.text.capacity();
+}
+
+
+inline usize payload_bytes(const ListObject& list) {
+    return list.items.capacity() * sizeof(Value);
+}
+
+
+//
+//  Owner of every object of a program, with a generational collector.
+//
+//  New objects are bump-allocated in the nursery. A minor collection
+//  copies the ones reachable from the roots, or from old objects, into
+//  the old generation, runs the destructors of the rest and empties the
+//  nursery. Old objects never move; they live in chunks of fixed-size
+//  cells and are freed by mark-sweep, which puts their cells on free lists
+//  by size.
+//
+//  Old objects that may refer to young ones are found through a card
+//  table: every store of a value into an existing object must go through
+//  write_barrier(), which marks the card of the object if it is old.
+//
+//  Payloads, the memory that objects own outside their cells, count too:
+//  as much of them as the nursery holds, allocated since the last
+//  collection, calls for another, and they add to the size of the old
+//  generation. A payload that changes size after the object is made must
+//  be reported through payload_changed().
+//
+//  Collections only happen in collect(). When the nursery fills up, or the
+//  old generation has grown enough since the last major collection, the
+//  heap asks for one through wants_collection() and meanwhile allocates in
+//  the old generation. The VM checks at safe points, where it can name
+//  every root.
+//
+class Heap {
+public:
+    static constexpr usize default_nursery_size = 1 << 20;
+    static constexpr usize chunk_size = 256 << 10;
+    static constexpr usize card_size = 512;
+
+    // Old generation size below which there are no major collections.
+    static constexpr usize min_major_threshold = 8 << 20;
+
+public:
+    GcStats stats;
+
+    Heap() = default;
+
+    Heap(const Heap&) = delete;
+    Heap& operator=(const Heap&) = delete;
+
+    ~Heap();
+
+    template <typename T, typename... Args>
+    T* make(Args&&... args) {
+        static_assert(sizeof(T) % 8 == 0 && alignof(T) <= 8 && sizeof(T) <= max_cell_size);
+
+        void* memory = nursery_top;
+        if (static_cast<usize>(nursery_end - nursery_top) >= sizeof(T)) {
+            nursery_top += sizeof(T);
+        } else {
+            memory = allocate_outside_nursery(sizeof(T));
+        }
+
+        T* const object = new (memory) T(std::forward<Args>(args)...);
+        stats.allocated_bytes += sizeof(T);
+        ++num_objects;
+        if (!in_nursery(object)) {
+            remember(object);
+        }
+        add_payload(payload_bytes(*object));
+        return object;
+    }
+
+    // Allocates straight in the old generation, for objects that live as
+    // long as the program, like functions and their constants.
+    template <typename T, typename... Args>
+    T* make_tenured(Args&&... args) {
+        static_assert(sizeof(T) % 8 == 0 && alignof(T) <= 8 && sizeof(T) <= max_cell_size);
+
+        T* const object = new (allocate_old(sizeof(T))) T(std::forward<Args>(args)...);
+        stats.allocated_bytes += sizeof(T);
+        ++num_objects;
+        add_payload(payload_bytes(*object));
+        return object;
+    }
+
+    // Records that the payload of `object` was `old_payload` bytes before
+    // it last changed.
+    template <typename T>
+    void payload_changed(const T& object, usize old_payload) {
+        const usize payload = payload_bytes(object);
+        if (payload > old_payload) {
+            add_payload(payload - old_payload);
+        } else {
+            stats.payload_bytes -= old_payload - payload;
+            stats.freed_bytes += old_payload - payload;
+        }
+    }
+
+    // Records that `value` was stored into `holder`.
+    void write_barrier(const Object* holder, const Value& value) {
+        if (value.is_object() && in_nursery(value.as_object()) && !in_nursery(holder)) {
+            remember(holder);
+        }
+    }
+
+    bool wants_collection() const {
+        return collection_requested;
+    }
+
+    // Runs a minor collection, then a major one if `major` or if one is
+    // due. Objects not reachable from `roots` are freed.
+    void collect(const std::vector<RootSpan>& roots, bool major = false);
+
+    // Only while the nursery is empty.
+    void set_nursery_size(usize size);
+
+    // Objects allocated and not freed yet.
+    usize size() const {
+        return num_objects;
+    }
+
+    bool in_nursery(const void* object) const {
+        const uintptr_t address = reinterpret_cast<uintptr_t>(object);
+        return address - reinterpret_cast<uintptr_t>(nursery.get()) < static_cast<usize>(nursery_top - nursery.get());
+    }
+
+private:
+    static constexpr usize max_cell_size = 256;
+
+    struct Chunk;
+    struct DeadCell;
+
+    std::unique_ptr<u8[]> nursery;
+    u8* nursery_top = nullptr;
+    u8* nursery_end = nullptr;
+    usize nursery_size = default_nursery_size;
+
+    std::vector<Chunk*> chunks;
+    DeadCell* free_cells[max_cell_size / 8 + 1] = {};  // by size / 8
+    usize major_threshold = min_major_threshold;
+    usize recent_payload_bytes = 0;  // allocated since the last collection
+    bool collection_requested = false;
+
+    std::vector<Object*> worklist;
+    usize num_objects = 0;
+
+    void* allocate_outside_nursery(usize size);
+    void* allocate_old(usize size);
+    void remember(const Object* object);
+
+    void add_payload(usize size) {
+        stats.allocated_bytes += size;
+        stats.payload_bytes += size;
+        recent_payload_bytes += size;
+        if (recent_payload_bytes > nursery_size) {
+            collection_requested = true;
+        }
+    }
+
+    // The old generation with the payloads of its objects, which after a
+    // minor collection are all the payloads.
+    u64 old_generation_bytes() const {
+        return stats.old_bytes + stats.payload_bytes;
+    }
+
+    void collect_minor(const std::vector<RootSpan>& roots);
+    void collect_major(const std::vector<RootSpan>& roots);
+    void forward(Value& value);
+    void mark(const Value& value);
+    void free_cell(Object* object, usize size);
+};
+
+
+// `integer` as a Value, boxed on `heap` if it does not fit in one.
+inline Value make_int(Heap& heap, i64 integer) {
+    if (Value::fits_small_int(integer)) {
+        return Value::from_small_int(integer);
+    }
+    return Value::from_object(heap.make<IntObject>(integer));
+}
+
+
+}
+
+
+#endif
@@ -0,0 +1,357 @@
+#include "incremental_tokenizer.h"
+
+#include <algorithm>
+#include <vector>
+
+
+namespace klp {
+
+
+static bool is_line_token(Token::Type type) {
+    return type == Token::Type::Indent || type == Token::Type::Dedent;
+}
+
+
+// Offset of the last '\n' before `pos`, or 0 if there is none.
+static u32 line_break_before(std::string_view text, u32 pos) {
+    const usize found = text.rfind('\n', pos ? pos - 1 : 0);
+    return found == std::string_view::npos || pos == 0 ? 0 : found;
+}
+
+
+// End of the string literal starting at `begin`. Returns `limit` if it
+// does not end before `limit`.
+static u32 string_end(std::string_view text, u32 begin, u32 limit) {
+    for (u32 i = begin + 1; i < limit; ++i) {
+        if (text[i] == '\\') {
+            ++i;
+        } else if (text[i] == '"') {
+            return i + 1;
+        }
+    }
+
+    return limit;
+}
+
+
+static bool is_error(const TokenBuffer& tokens, usize i, LexError error) {
+    return tokens.types[i] == Token::Type::Error && tokens.tables.error(tokens[i]) == error;
+}
+
+
+// Whether the old token `i` is a string literal that covers `pos`. That
+// includes the error for a literal with a bad escape, which spans it too.
+// Only text before `limit` is known to be unchanged.
+static bool string_covers(const TokenBuffer& tokens, std::string_view text, usize i, u32 pos, u32 limit) {
+    const bool literal = tokens.types[i] == Token::Type::String || is_error(tokens, i, LexError::BadEscape);
+    return literal &&
+        tokens.offsets[i] < pos &&
+        string_end(text, tokens.offsets[i], limit) > pos;
+}
+
+
+// Like string_covers(), but also counts an unterminated literal, whose
+// text runs to the end of the file even though the tokenizer went on
+// after its line. Whether the edit leaves it so is not known yet.
+static bool literal_covers(const TokenBuffer& tokens, std::string_view text, usize i, u32 pos, u32 limit) {
+    return string_covers(tokens, text, i, pos, limit) ||
+        (is_error(tokens, i, LexError::UnterminatedString) && tokens.offsets[i] < pos);
+}
+
+
+// Whether the old token `i` is the error for a line indented wrongly, which
+// leaves the tokenizer at the level of the line before.
+static bool is_indent_error(const TokenBuffer& tokens, usize i) {
+    return is_error(tokens, i, LexError::BadIndent) || is_error(tokens, i, LexError::IndentTooDeep);
+}
+
+
+// First token with offset greater than `pos`.
+static usize token_after(const TokenBuffer& tokens, u32 pos) {
+    return std::upper_bound(tokens.offsets.begin(), tokens.offsets.end(), pos) - tokens.offsets.begin();
+}
+
+
+// Offset of the unterminated string literal before `pos`, or `pos` if
+// there is none. It ran to the end of the old text, and an edit after it
+// that adds or removes a '"' or '\\' may end it. Every '"' after its
+// opening one is escaped, so none of them starts a literal or lies in
+// one: walking back from `pos`, the first quote that does ends the search.
+static u32 unterminated_string_before(const TokenBuffer& tokens, std::string_view text, u32 pos) {
+    usize quote = pos;
+    while (quote > 0) {
+        quote = text.rfind('"', quote - 1);
+        if (quote == std::string_view::npos) {
+            return pos;
+        }
+
+        const usize i = token_after(tokens, quote);
+        if (i == 0) {
+            continue;
+        }
+        if (tokens.offsets[i - 1] == quote) {
+            return is_error(tokens, i - 1, LexError::UnterminatedString) ? quote : pos;
+        }
+        if (string_covers(tokens, text, i - 1, quote, pos)) {
+            return pos;
+        }
+    }
+    return pos;
+}
+
+
+// Indentation level of the old tokenizer at the line break `pos`, which
+// lies outside of any token.
+static u32 level_at(const TokenBuffer& tokens, std::string_view text, u32 pos, u32 limit) {
+    usize last = token_after(tokens, pos);
+    if (last == 0) {
+        return 0;
+    }
+    --last;
+
+    // The level was set by the line start of the line holding the last
+    // token, or of the line its first token is continued from, or of the
+    // last line before those that was not indented wrongly.
+    while (true) {
+        const u32 line_break = line_break_before(text, tokens.offsets[last]);
+        if (line_break == 0 && text[0] != '\n') {
+            return 0;
+        }
+
+        const usize first = std::lower_bound(
+            tokens.offsets.begin(), tokens.offsets.end(), line_break + 1
+        ) - tokens.offsets.begin();
+
+        if (first > 0 && string_covers(tokens, text, first - 1, line_break, limit)) {
+            last = first - 1;
+            continue;
+        }
+        if (is_indent_error(tokens, first)) {
+            if (first == 0) {
+                return 0;
+            }
+            last = first - 1;
+            continue;
+        }
+
+        return (tokens.offsets[first] - line_break - 1) / 4;
+    }
+}
+
+
+// Table slots of the replaced tokens, which the fresh tokens take over.
+struct FreeSlots {
+    std::vector<u32> ints;
+    std::vector<u32> floats;
+    std::vector<u32> strings;
+    std::vector<u32> errors;
+
+    usize size() const {
+        return ints.size() + floats.size() + strings.size() + errors.size();
+    }
+};
+
+
+template <typename T>
+static u32 put(std::vector<T>& table, std::vector<u32>& free, const T& value) {
+    if (free.empty()) {
+        table.push_back(value);
+        return table.size() - 1;
+    }
+
+    const u32 slot = free.back();
+    free.pop_back();
+    table[slot] = value;
+    return slot;
+}
+
+
+static FreeSlots free_slots(TokenTables& tables, const TokenBuffer& tokens, usize begin, usize end) {
+    FreeSlots slots;
+    for (usize i = end; i-- > begin;) {
+        const u32 payload = tokens.payloads[i];
+        switch (tokens.types[i]) {
+            case Token::Type::Int: slots.ints.push_back(payload); break;
+            case Token::Type::Float: slots.floats.push_back(payload); break;
+            case Token::Type::Error: slots.errors.push_back(payload); break;
+
+            case Token::Type::String:
+                if (tables.strings[payload].decoded) {
+                    tables.dead_bytes += tables.strings[payload].size;
+                }
+                slots.strings.push_back(payload);
+                break;
+
+            default:
+                break;
+        }
+    }
+    return slots;
+}
+
+
+// Copies the payload of the fresh `token` into `tables`, and points the
+// token at it.
+static Token put_payload(TokenTables& tables, FreeSlots& slots, const TokenTables& fresh, Token token) {
+    switch (token.type) {
+        case Token::Type::Int:
+            token.payload = put(tables.ints, slots.ints, fresh.int_value(token));
+            break;
+
+        case Token::Type::Float:
+            token.payload = put(tables.floats, slots.floats, fresh.float_value(token));
+            break;
+
+        case Token::Type::Error:
+            token.payload = put(tables.errors, slots.errors, fresh.error(token));
+            break;
+
+        case Token::Type::String: {
+            const auto& entry = fresh.strings[token.payload];
+            const char* decoded = entry.decoded ? tables.arena.copy(fresh.string(token)).data() : nullptr;
+            token.payload = put(tables.strings, slots.strings, TokenTables::StringEntry{decoded, entry.size});
+            break;
+        }
+
+        default:
+            break;
+    }
+    return token;
+}
+
+
+// Rebuilds the tables of `tokens` with only the entries its tokens refer to.
+static void compact_tables(TokenBuffer& tokens) {
+    TokenBuffer compacted;
+    compacted.tables.interner = tokens.tables.interner;
+    compacted.tables.source = tokens.tables.source;
+    compacted.tables.source_base = tokens.tables.source_base;
+    compacted.reserve(tokens.size());
+    compacted.append(tokens, 0, tokens.size());
+    tokens = std::move(compacted);
+}
+
+
+template <typename T>
+static void splice(std::vector<T>& values, usize begin, usize end, const std::vector<T>& with) {
+    const usize old_size = values.size();
+    const usize removed = end - begin;
+
+    if (with.size() > removed) {
+        values.resize(old_size + with.size() - removed);
+        std::move_backward(values.begin() + end, values.begin() + old_size, values.end());
+    } else if (with.size() < removed) {
+        std::move(values.begin() + end, values.end(), values.begin() + begin + with.size());
+        values.resize(old_size - (removed - with.size()));
+    }
+
+    std::copy(with.begin(), with.end(), values.begin() + begin);
+}
+
+
+RetokenizeStats retokenize(TokenBuffer& tokens, std::string_view text, const Edit& edit) {
+    const u32 edit_end = edit.offset + edit.inserted.size();
+    const i64 delta = static_cast<i64>(edit.inserted.size()) - edit.removed;
+    verify(edit_end <= text.size(), "edit past the end of the text");
+
+    // Restart at the line break before the edited line, outside of any
+    // string literal, including one that the edit may end: one that adds
+    // or removes a '"' or '\\', or that follows a '\\' and changes what it
+    // escapes. The removed bytes are gone from `text`, so any removal
+    // counts.
+    u32 restart = line_break_before(text, edit.offset);
+    const bool after_backslash = edit.offset > 0 && text[edit.offset - 1] == '\\';
+    if (edit.removed > 0 || after_backslash || edit.inserted.find_first_of("\"\\") != std::string_view::npos) {
+        restart = std::min(restart, line_break_before(text, unterminated_string_before(tokens, text, edit.offset)));
+    }
+    usize keep = 0;
+    while (restart > 0) {
+        keep = token_after(tokens, restart);
+        if (keep > 0 && literal_covers(tokens, text, keep - 1, restart, edit.offset)) {
+            restart = line_break_before(text, tokens.offsets[keep - 1]);
+            keep = 0;
+            continue;
+        }
+        break;
+    }
+
+    Tokenizer::ChunkOptions options;
+    options.base_offset = restart;
+    options.indent_level = restart ? level_at(tokens, text, restart, edit.offset) : 0;
+    Tokenizer tokenizer(text.substr(restart), options, *tokens.tables.interner);
+
+    TokenBuffer fresh;
+    usize resume = tokens.size();
+    u32 resync = text.size();
+    u32 line_break = tokenizer.last_line_break();
+    bool at_line_start = false;
+
+    while (true) {
+        const Token token = tokenizer.next();
+        if (tokenizer.last_line_break() != line_break) {
+            line_break = tokenizer.last_line_break();
+            at_line_start = line_break != Tokenizer::no_line_break && line_break >= edit_end;
+        }
+
+        if (at_line_start && !is_line_token(token.type) && token.type != Token::Type::Eof) {
+            at_line_start = false;
+
+            // The old stream picks up a line here too: the same text
+            // follows, and a line start that succeeded in both leaves both
+            // at its level. After an error either may have kept the level
+            // of an earlier line instead.
+            const i64 old_offset = token.offset - delta;
+            usize i = token_after(tokens, old_offset - 1);
+            while (i < tokens.size() && tokens.offsets[i] == old_offset && is_line_token(tokens.types[i])) {
+                ++i;
+            }
+
+            if (i < tokens.size() && tokens.offsets[i] == old_offset &&
+                tokens.types[i] == token.type && token.type != Token::Type::Error) {
+                resume = i;
+                resync = token.offset;
+                break;
+            }
+        }
+
+        fresh.push(token);
+        if (token.type == Token::Type::Eof) {
+            break;
+        }
+    }
+    fresh.tables = tokenizer.take_tables();
+
+    // Copy the payloads of the fresh tokens into the old tables, in the
+    // slots of the tokens they replace where possible. Strings that were
+    // not decoded are read from the new text from now on; it equals the
+    // old text wherever old tokens are kept.
+    TokenTables& tables = tokens.tables;
+    tables.source = text;
+    FreeSlots slots = free_slots(tables, tokens, keep, resume);
+
+    TokenBuffer staged;
+    staged.reserve(fresh.size());
+    for (usize i = 0; i < fresh.size(); ++i) {
+        staged.push(put_payload(tables, slots, fresh.tables, fresh[i]));
+    }
+    tables.dead_entries += slots.size();
+
+    for (usize i = resume; i < tokens.size(); ++i) {
+        tokens.offsets[i] += delta;
+    }
+
+    splice(tokens.types, keep, resume, staged.types);
+    splice(tokens.offsets, keep, resume, staged.offsets);
+    splice(tokens.payloads, keep, resume, staged.payloads);
+
+    // Compacting takes a pass over all tokens, so it waits until there is
+    // a quarter as much dead in the tables.
+    if (tables.dead_entries > tokens.size() / 4 || tables.dead_bytes > text.size() / 4) {
+        compact_tables(tokens);
+    }
+
+    return RetokenizeStats{restart, resync, fresh.size()};
+}
+
+
+}
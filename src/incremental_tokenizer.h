@@ -0,0 +1,60 @@
+#ifndef KALPA_INCREMENTAL_TOKENIZER_H
+#define KALPA_INCREMENTAL_TOKENIZER_H
+
+
+#include <string_view>
+
+#include "defs.h"
+#include "tokenizer.h"
+
+
+namespace klp {
+
+
+// `removed` bytes at `offset` were replaced with `inserted`.
+struct Edit {
+    u32 offset;
+    u32 removed;
+    std::string_view inserted;
+};
+
+
+struct RetokenizeStats {
+    u32 restart_offset;   // where lexing restarted, in the new text
+    u32 resync_offset;    // where the old tokens were picked up again
+    usize relexed_tokens;
+};
+
+
+//
+//  Brings `tokens`, produced by tokenize_all() for the text before `edit`,
+//  up to date with `text`, the text after it. The result equals
+//  tokenize_all(text) with the interner of `tokens`. Like the source of
+//  tokenize_all(), `text` must outlive `tokens`.
+//
+//  Lexing restarts at the line break before the edited line, skipping
+//  back over string literals that span it, or that ran unterminated and
+//  that an edit touching a '"' or '\\' may end. Its indentation level is read
+//  off the old tokens, skipping lines that were indented wrongly. Lexing
+//  stops at the first line start after the edit whose first token also
+//  starts a line of the old stream, with the same type, and is not an
+//  error in either: from there on the text and the tokenizer state are
+//  the same as before, and the old tokens are reused with shifted
+//  offsets.
+//
+//  Lexing work depends on the size of the edited region only, except for
+//  closing an unterminated literal, which re-lexes all of it. Splicing
+//  the result in moves the tail of the token arrays once.
+//
+//  Fresh payloads take the table slots of the tokens they replace. What
+//  is left over stays in the tables as dead entries until those, or the
+//  dead bytes of decoded strings, pass a quarter of the tokens or of the
+//  text, when the tables are rebuilt.
+//
+RetokenizeStats retokenize(TokenBuffer& tokens, std::string_view text, const Edit& edit);
+
+
+}
+
+
+#endif
@@ -0,0 +1,103 @@
+#include "interner.h"
+
+#include <cstring>
+
+
+namespace klp {
+
+
+static u64 read_u64(const char* ptr) {
+    u64 value;
+    std::memcpy(&value, ptr, sizeof(value));
+    return value;
+}
+
+
+static u64 mix(u64 x) {
+    x ^= x >> 32;
+    x *= 0xd6e8feb86659fd93ull;
+    x ^= x >> 32;
+    return x;
+}
+
+
+u64 hash_bytes(std::string_view bytes) {
+    const char* ptr = bytes.data();
+    usize size = bytes.size();
+    u64 h = 0x9e3779b97f4a7c15ull ^ size;
+
+    for (; size >= 8; ptr += 8, size -= 8) {
+        h = mix(h ^ read_u64(ptr)) * 0xff51afd7ed558ccdull;
+    }
+
+    u64 tail = 0;
+    std::memcpy(&tail, ptr, size);
+    return mix(h ^ tail);
+}
+
+
+Interner::Interner() : slots(1024, Slot{0, 0}) {}
+
+
+Atom Interner::intern(std::string_view name) {
+    const u32 hash = static_cast<u32>(hash_bytes(name));
+    const usize mask = slots.size() - 1;
+
+    for (usize i = hash & mask;; i = (i + 1) & mask) {
+        Slot& slot = slots[i];
+        if (!slot.atom_plus_one) {
+            const Atom atom = names.size();
+            names.push_back(arena.copy(name));
+            slot = Slot{hash, atom + 1};
+
+            // Keep the load factor under 1/2.
+            if (names.size() * 2 > slots.size()) {
+                grow();
+            }
+            return atom;
+        }
+
+        if (slot.hash == hash && names[slot.atom_plus_one - 1] == name) {
+            return slot.atom_plus_one - 1;
+        }
+    }
+}
+
+
+std::vector<Atom> Interner::absorb(const Interner& other) {
+    std::vector<Atom> atoms;
+    atoms.reserve(other.size());
+    for (const auto name : other.names) {
+        atoms.push_back(intern(name));
+    }
+
+    return atoms;
+}
+
+
+void Interner::grow() {
+    std::vector<Slot> old_slots(slots.size() * 2, Slot{0, 0});
+    old_slots.swap(slots);
+
+    const usize mask = slots.size() - 1;
+    for (const auto& old_slot : old_slots) {
+        if (!old_slot.atom_plus_one) {
+            continue;
+        }
+
+        usize i = old_slot.hash & mask;
+        while (slots[i].atom_plus_one) {
+            i = (i + 1) & mask;
+        }
+        slots[i] = old_slot;
+    }
+}
+
+
+Interner& shared_interner() {
+    static Interner* interner = new Interner;
+    return *interner;
+}
+
+
+}
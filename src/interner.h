@@ -0,0 +1,75 @@
+#ifndef KALPA_INTERNER_H
+#define KALPA_INTERNER_H
+
+
+#include <string_view>
+#include <vector>
+
+#include "arena.h"
+#include "defs.h"
+
+
+namespace klp {
+
+
+// Dense id of an interned name. Equal names always get equal atoms.
+using Atom = u32;
+
+
+u64 hash_bytes(std::string_view bytes);
+
+
+//
+//  Symbol table mapping names to atoms. Lookups go through an
+//  open-addressing table with linear probing; name bytes are copied into an
+//  arena, so interned names do not depend on the lifetime of the source.
+//
+//  An Interner is not thread-safe. Parallel stages intern into their own
+//  instance and merge it into the shared one afterwards.
+//
+class Interner {
+public:
+    Interner();
+
+    Interner(const Interner&) = delete;
+    Interner& operator=(const Interner&) = delete;
+
+    Atom intern(std::string_view name);
+
+    std::string_view name(Atom atom) const {
+        return names[atom];
+    }
+
+    usize size() const {
+        return names.size();
+    }
+
+    // Interns every name of `other` and returns the atom of each in this
+    // interner, indexed by its atom in `other`.
+    std::vector<Atom> absorb(const Interner& other);
+
+private:
+    struct Slot {
+        u32 hash;
+        u32 atom_plus_one;  // 0 marks an empty slot
+    };
+
+    std::vector<Slot> slots;
+    std::vector<std::string_view> names;
+    Arena arena;
+
+    void grow();
+};
+
+
+//
+//  The process-wide interner. Atoms from it stay valid across every file
+//  lexed by the process.
+//
+Interner& shared_interner();
+
+
+}
+
+
+#endif
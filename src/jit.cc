@@ -0,0 +1,545 @@
+#include "jit.h"
+
+#include <cstring>
+
+#include <sys/mman.h>
+#include <unistd.h>
+
+
+namespace klp {
+
+
+#ifdef KALPA_JIT
+
+
+namespace {
+
+
+enum Reg : u8 {
+    rax = 0,
+    rcx = 1,
+    rdx = 2,
+    rsi = 6,
+    rdi = 7,
+    r10 = 10,
+};
+
+
+// Condition codes, as jcc and setcc encode them. Flipping the low bit
+// negates one.
+enum Cond : u8 {
+    overflow = 0x0,
+    below = 0x2,
+    equal = 0x4,
+    not_equal = 0x5,
+    less = 0xc,
+    greater_eq = 0xd,
+    less_eq = 0xe,
+    greater = 0xf,
+};
+
+
+Cond negate(Cond cc) {
+    return static_cast<Cond>(cc ^ 1);
+}
+
+
+// The code gets the frame, the globals and the address to start at in
+// rdi, rsi and rdx, following the System V calling convention, and keeps
+// the tag of small ints in r10. It uses nothing but caller-saved registers
+// and calls nothing, so it needs no stack frame.
+constexpr Reg frame = rdi;
+constexpr Reg globals = rsi;
+constexpr Reg int_tag = r10;
+
+// A small int shifted left by this much loses its tag and becomes an i64
+// that overflows exactly when the int would no longer fit.
+constexpr u8 int_shift = 14;
+
+// Set in the instruction the code returns when a type guard failed.
+constexpr u32 guard_failed = 0x80000000;
+
+
+using Entry = u32 (*)(Value* registers, Value* globals, const u8* start);
+
+
+//
+//  Just the x86-64 instructions the translator needs, on 64-bit registers.
+//  Jumps return the position of their rel32 for patch().
+//
+class Assembler {
+public:
+    std::vector<u8> code;
+
+    usize size() const {
+        return code.size();
+    }
+
+    void load(Reg dst, Reg base, u32 index) {
+        memory(0x8b, dst, base, index * sizeof(Value));
+    }
+
+    void store(Reg base, u32 index, Reg src) {
+        memory(0x89, src, base, index * sizeof(Value));
+    }
+
+    void mov(Reg dst, Reg src) { binary(0x89, dst, src); }
+    void add(Reg dst, Reg src) { binary(0x01, dst, src); }
+    void sub(Reg dst, Reg src) { binary(0x29, dst, src); }
+    void xor_(Reg dst, Reg src) { binary(0x31, dst, src); }
+    void or_(Reg dst, Reg src) { binary(0x09, dst, src); }
+    void cmp(Reg a, Reg b) { binary(0x39, a, b); }
+
+    void mov(Reg dst, u64 imm) {
+        byte(0x48 | dst >> 3);
+        byte(0xb8 | (dst & 7));
+        bytes(&imm, 8);
+    }
+
+    void imul(Reg dst, Reg src) {
+        rex(dst, src);
+        byte(0x0f);
+        byte(0xaf);
+        modrm(dst, src);
+    }
+
+    void add(Reg dst, i32 imm) {
+        rex(rax, dst);
+        byte(0x81);
+        modrm(rax, dst);
+        bytes(&imm, 4);
+    }
+
+    void shl(Reg dst, u8 n) { shift(4, dst, n); }
+    void sar(Reg dst, u8 n) { shift(7, dst, n); }
+
+    void neg(Reg dst) {
+        rex(rax, dst);
+        byte(0xf7);
+        byte(0xd8 | (dst & 7));
+    }
+
+    // eax = cc ? 1 : 0
+    void set_eax(Cond cc) {
+        byte(0x0f);
+        byte(0x90 | cc);
+        byte(0xc0);
+        byte(0x0f);
+        byte(0xb6);
+        byte(0xc0);
+    }
+
+    void mov_eax(u32 imm) {
+        byte(0xb8);
+        bytes(&imm, 4);
+    }
+
+    void jmp(Reg target) {
+        byte(0xff);
+        byte(0xe0 | (target & 7));
+    }
+
+    void ret() {
+        byte(0xc3);
+    }
+
+    usize jcc(Cond cc) {
+        byte(0x0f);
+        byte(0x80 | cc);
+        return rel32();
+    }
+
+    usize jmp() {
+        byte(0xe9);
+        return rel32();
+    }
+
+    void patch(usize at, usize target) {
+        const i32 rel = static_cast<i32>(static_cast<i64>(target) - static_cast<i64>(at + 4));
+        std::memcpy(&code[at], &rel, 4);
+    }
+
+private:
+    void byte(u8 b) {
+        code.push_back(b);
+    }
+
+    void bytes(const void* data, usize n) {
+        const u8* p = static_cast<const u8*>(data);
+        code.insert(code.end(), p, p + n);
+    }
+
+    usize rel32() {
+        bytes("\0\0\0\0", 4);
+        return size() - 4;
+    }
+
+    void rex(Reg reg, Reg rm) {
+        byte(0x48 | (reg >> 3) << 2 | rm >> 3);
+    }
+
+    void modrm(Reg reg, Reg rm) {
+        byte(0xc0 | (reg & 7) << 3 | (rm & 7));
+    }
+
+    // op r/m, reg
+    void binary(u8 opcode, Reg rm, Reg reg) {
+        rex(reg, rm);
+        byte(opcode);
+        modrm(reg, rm);
+    }
+
+    void shift(u8 ext, Reg dst, u8 n) {
+        rex(rax, dst);
+        byte(0xc1);
+        byte(0xc0 | ext << 3 | (dst & 7));
+        byte(n);
+    }
+
+    // [base + disp32], for a base other than rsp and r12
+    void memory(u8 opcode, Reg reg, Reg base, u32 disp) {
+        rex(reg, base);
+        byte(opcode);
+        byte(0x80 | (reg & 7) << 3 | (base & 7));
+        bytes(&disp, 4);
+    }
+};
+
+
+class Translator {
+public:
+    explicit Translator(const Function& function) :
+        function(function),
+        code(function.code),
+        guard_stubs(function.code.size(), 0)
+    {}
+
+    // The machine code with entries for each instruction, or false if the
+    // bytecode has a shape the translator does not expect.
+    bool run(std::vector<u8>& out, std::vector<u32>& entries);
+
+private:
+    struct Fixup {
+        usize at;
+        u32 target;  // an instruction, or the guard stub of one
+        bool to_guard;
+    };
+
+    const Function& function;
+    const std::vector<Instruction>& code;
+    Assembler as;
+    std::vector<Fixup> fixups;
+    std::vector<u32> guard_stubs;  // nonzero for instructions with guards
+    u32 pc = 0;
+
+    bool instruction(Instruction insn);
+
+    void jump_to(u32 target) {
+        fixups.push_back({as.jmp(), target, false});
+    }
+
+    void branch_to(Cond cc, u32 target) {
+        fixups.push_back({as.jcc(cc), target, false});
+    }
+
+    // Leaves through the guard stub of the current instruction if cc.
+    void guard(Cond cc) {
+        guard_stubs[pc] = 1;
+        fixups.push_back({as.jcc(cc), pc, true});
+    }
+
+    void guard_small_int(Reg reg) {
+        as.cmp(reg, int_tag);
+        guard(below);
+    }
+
+    // rax = R[x], rcx = R[y], both small ints.
+    void load_ints(u32 x, u32 y) {
+        as.load(rax, frame, x);
+        guard_small_int(rax);
+        as.load(rcx, frame, y);
+        guard_small_int(rcx);
+    }
+
+    // Tags rax, a small int shifted left by int_shift, and stores it.
+    void store_int(u32 reg, Reg value = rax) {
+        as.sar(value, int_shift);
+        as.or_(value, int_tag);
+        as.store(frame, reg, value);
+    }
+
+    void exit() {
+        as.mov_eax(pc);
+        as.ret();
+    }
+};
+
+
+bool Translator::instruction(Instruction insn) {
+    const u32 a = insn.a();
+    const u32 b = insn.b();
+    const u32 c = insn.c();
+
+    switch (insn.op()) {
+        case Opcode::Move:
+            as.load(rax, frame, b);
+            as.store(frame, a, rax);
+            return true;
+
+        case Opcode::LoadNone:
+            as.mov(rax, Value::none().raw());
+            as.store(frame, a, rax);
+            return true;
+
+        case Opcode::LoadInt:
+            as.mov(rax, Value::from_small_int(insn.sbx()).raw());
+            as.store(frame, a, rax);
+            return true;
+
+        case Opcode::LoadConst:
+            as.mov(rax, function.constants[insn.bx()].raw());
+            as.store(frame, a, rax);
+            return true;
+
+        case Opcode::GetGlobal:
+            as.load(rax, globals, insn.bx());
+            as.mov(rcx, Value::undefined().raw());
+            as.cmp(rax, rcx);
+            guard(equal);
+            as.store(frame, a, rax);
+            return true;
+
+        case Opcode::SetGlobal:
+            as.load(rax, frame, a);
+            as.store(globals, insn.bx(), rax);
+            return true;
+
+        case Opcode::Add:
+        case Opcode::Sub:
+            load_ints(b, c);
+            as.shl(rax, int_shift);
+            as.shl(rcx, int_shift);
+            if (insn.op() == Opcode::Add) {
+                as.add(rax, rcx);
+            } else {
+                as.sub(rax, rcx);
+            }
+            guard(overflow);
+            store_int(a);
+            return true;
+
+        case Opcode::Mul:
+            load_ints(b, c);
+            as.shl(rax, int_shift);
+            as.shl(rcx, int_shift);
+            as.sar(rcx, int_shift);
+            as.imul(rax, rcx);
+            guard(overflow);
+            store_int(a);
+            return true;
+
+        case Opcode::Xor:
+            // The tags cancel out.
+            load_ints(b, c);
+            as.xor_(rax, rcx);
+            as.or_(rax, int_tag);
+            as.store(frame, a, rax);
+            return true;
+
+        case Opcode::AddInt:
+        case Opcode::SubInt:
+            // Adding -sC overflows exactly when subtracting sC does.
+            as.load(rax, frame, b);
+            guard_small_int(rax);
+            as.shl(rax, int_shift);
+            as.add(rax, (insn.op() == Opcode::AddInt ? insn.sc() : -insn.sc()) * (1 << int_shift));
+            guard(overflow);
+            store_int(a);
+            return true;
+
+        case Opcode::Neg:
+            as.load(rax, frame, b);
+            guard_small_int(rax);
+            as.shl(rax, int_shift);
+            as.neg(rax);
+            guard(overflow);
+            store_int(a);
+            return true;
+
+        case Opcode::Equal:
+        case Opcode::NotEqual:
+        case Opcode::Less:
+        case Opcode::LessEq:
+        case Opcode::Greater:
+        case Opcode::GreaterEq: {
+            static constexpr Cond conditions[] = {equal, not_equal, less, less_eq, greater, greater_eq};
+            load_ints(b, c);
+            // Shifting keeps the order; equality can compare the words.
+            as.shl(rax, int_shift);
+            as.shl(rcx, int_shift);
+            as.cmp(rax, rcx);
+            as.set_eax(conditions[static_cast<u32>(insn.op()) - static_cast<u32>(Opcode::Equal)]);
+            as.mov(rcx, Value::from_bool(false).raw());
+            as.or_(rax, rcx);
+            as.store(frame, a, rax);
+            return true;
+        }
+
+        case Opcode::Jump:
+            jump_to(pc + 1 + insn.sax());
+            return true;
+
+        case Opcode::JumpIfFalse:
+        case Opcode::JumpIfTrue: {
+            const bool jump_if = insn.op() == Opcode::JumpIfTrue;
+            as.load(rax, frame, a);
+            as.mov(rcx, Value::from_bool(jump_if).raw());
+            as.cmp(rax, rcx);
+            branch_to(equal, pc + 1 + insn.sbx());
+            as.mov(rcx, Value::from_bool(!jump_if).raw());
+            as.cmp(rax, rcx);
+            guard(not_equal);
+            return true;
+        }
+
+        case Opcode::BranchEqual:
+        case Opcode::BranchLess:
+        case Opcode::BranchLessEq: {
+            if (pc + 2 >= code.size() || code[pc + 1].op() != Opcode::Jump) {
+                return false;
+            }
+            const Cond cc = insn.op() == Opcode::BranchEqual ? equal : insn.op() == Opcode::BranchLess ? less : less_eq;
+            load_ints(a, b);
+            as.shl(rax, int_shift);
+            as.shl(rcx, int_shift);
+            as.cmp(rax, rcx);
+            branch_to(c ? cc : negate(cc), pc + 2 + code[pc + 1].sax());
+            jump_to(pc + 2);
+            return true;
+        }
+
+        case Opcode::ForRange:
+            load_ints(a, a + 1);
+            as.mov(rdx, rax);
+            as.shl(rdx, int_shift);
+            as.shl(rcx, int_shift);
+            as.cmp(rdx, rcx);
+            branch_to(greater_eq, pc + 1 + insn.sbx());
+            as.store(frame, a + 2, rax);
+            as.add(rdx, 1 << int_shift);
+            store_int(a, rdx);
+            return true;
+
+        default:
+            exit();
+            return true;
+    }
+}
+
+
+bool Translator::run(std::vector<u8>& out, std::vector<u32>& entries) {
+    as.mov(int_tag, Value::from_small_int(0).raw());
+    as.jmp(rdx);
+
+    entries.resize(code.size());
+    for (pc = 0; pc < code.size(); ++pc) {
+        entries[pc] = as.size();
+        if (!instruction(code[pc])) {
+            return false;
+        }
+    }
+
+    for (u32 i = 0; i < code.size(); ++i) {
+        if (guard_stubs[i]) {
+            guard_stubs[i] = as.size();
+            as.mov_eax(i | guard_failed);
+            as.ret();
+        }
+    }
+
+    for (const Fixup& fixup : fixups) {
+        if (fixup.target >= code.size()) {
+            return false;
+        }
+        as.patch(fixup.at, fixup.to_guard ? guard_stubs[fixup.target] : entries[fixup.target]);
+    }
+
+    out = std::move(as.code);
+    return true;
+}
+
+
+}
+
+
+Jit::~Jit() {
+    for (Compiled& c : compiled) {
+        c.function->native = nullptr;
+        munmap(c.code->code, c.code->size);
+    }
+}
+
+
+bool Jit::compile(Function& function) {
+    auto native = std::make_unique<NativeCode>();
+    std::vector<u8> bytes;
+    if (!Translator(function).run(bytes, native->entries)) {
+        return false;
+    }
+
+    const usize page = sysconf(_SC_PAGESIZE);
+    const usize size = (bytes.size() + page - 1) / page * page;
+    void* const pages = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (pages == MAP_FAILED) {
+        return false;
+    }
+    std::memcpy(pages, bytes.data(), bytes.size());
+    if (mprotect(pages, size, PROT_READ | PROT_EXEC) != 0) {
+        munmap(pages, size);
+        return false;
+    }
+
+    native->code = static_cast<u8*>(pages);
+    native->size = size;
+    function.native = native.get();
+    compiled.push_back(Compiled{&function, std::move(native)});
+    return true;
+}
+
+
+u32 Jit::enter(Function& function, Value* registers, Value* globals, u32 pc) {
+    NativeCode& native = *function.native;
+    const Entry entry = reinterpret_cast<Entry>(native.code);
+    const u32 next = entry(registers, globals, native.code + native.entries[pc]);
+
+    if (next & guard_failed) {
+        if (++native.guard_failures == max_guard_failures) {
+            function.native = nullptr;
+        }
+        return next & ~guard_failed;
+    }
+    return next;
+}
+
+
+#else
+
+
+Jit::~Jit() = default;
+
+
+bool Jit::compile(Function&) {
+    return false;
+}
+
+
+u32 Jit::enter(Function&, Value*, Value*, u32 pc) {
+    verify(false, "no JIT in this build");
+    return pc;
+}
+
+
+#endif
+
+
+}
@@ -0,0 +1,94 @@
+#ifndef KALPA_JIT_H
+#define KALPA_JIT_H
+
+
+#include <memory>
+#include <vector>
+
+#include "bytecode.h"
+#include "defs.h"
+#include "value.h"
+
+
+namespace klp {
+
+
+#if defined(__x86_64__) && !defined(KALPA_NO_JIT)
+#define KALPA_JIT 1
+#endif
+
+
+//
+//  Machine code for one function, in pages of its own. It can be entered
+//  at any instruction: `entries` holds the offset of the code for each.
+//
+struct NativeCode {
+    u8* code = nullptr;
+    usize size = 0;
+    std::vector<u32> entries;
+    u32 guard_failures = 0;
+};
+
+
+//
+//  A baseline compiler from bytecode to x86-64. Each instruction becomes a
+//  fixed sequence of machine code working on the interpreter's own
+//  registers, so the interpreter can stop and resume the native code at any
+//  instruction boundary with nothing to translate.
+//
+//  Moves, loads, globals, jumps, and arithmetic, comparisons, branches and
+//  range loops on small ints are compiled inline. Whatever else the code
+//  meets, like a call, a float, or a small int result that needs promoting,
+//  makes it return to the interpreter at that instruction. Returns where a
+//  type guard failed are counted, and a function that keeps failing them
+//  is sent back to the interpreter for good.
+//
+//  Without x86-64, or when built with -DKALPA_NO_JIT, nothing is compiled.
+//
+class Jit {
+public:
+#ifdef KALPA_JIT
+    static constexpr bool available = true;
+#else
+    static constexpr bool available = false;
+#endif
+
+    // Guard failures after which native code is dropped.
+    static constexpr u32 max_guard_failures = 64;
+
+public:
+    Jit() = default;
+
+    Jit(const Jit&) = delete;
+    Jit& operator=(const Jit&) = delete;
+
+    // Frees the code and detaches it from its functions.
+    ~Jit();
+
+    // Compiles `function` and sets function.native. Returns false if it
+    // cannot, which leaves the function to the interpreter.
+    bool compile(Function& function);
+
+    // Runs the native code of `function` from instruction `pc`, with the
+    // frame at `registers`, until it returns to the interpreter. Returns the
+    // instruction the interpreter is to run next.
+    u32 enter(Function& function, Value* registers, Value* globals, u32 pc);
+
+    usize num_compiled() const {
+        return compiled.size();
+    }
+
+private:
+    struct Compiled {
+        Function* function;
+        std::unique_ptr<NativeCode> code;
+    };
+
+    std::vector<Compiled> compiled;
+};
+
+
+}
+
+
+#endif
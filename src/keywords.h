@@ -0,0 +1,113 @@
+#ifndef KALPA_KEYWORDS_H
+#define KALPA_KEYWORDS_H
+
+
+#include <array>
+#include <string_view>
+
+#include "defs.h"
+#include "tokenizer.h"
+
+
+namespace klp {
+
+
+struct Keyword {
+    std::string_view text;
+    Token::Type type = Token::Type::Identifier;
+};
+
+
+//
+//  The single list of keywords. Everything else below is derived from it at
+//  compile time.
+//
+constexpr Keyword keyword_list[] = {
+    { "def",    Token::Type::Def },
+    { "class",  Token::Type::Class },
+    { "let",    Token::Type::Let },
+    { "for",    Token::Type::For },
+    { "while",  Token::Type::While },
+    { "if",     Token::Type::If },
+    { "else",   Token::Type::Else },
+    { "elif",   Token::Type::Elif },
+    { "return", Token::Type::Return },
+    { "in",     Token::Type::In },
+    { "not",    Token::Type::Not },
+    { "or",     Token::Type::Or },
+    { "and",    Token::Type::And },
+};
+
+
+//
+//  Perfect hash over (length, first byte, last byte). The seed is searched
+//  at compile time until every keyword lands in its own slot, so a lookup
+//  is one hash and one string compare.
+//
+class KeywordTable {
+public:
+    static constexpr u32 bits = 5;
+    static constexpr u32 size = 1u << bits;
+
+    static constexpr u32 hash(u32 seed, std::string_view text) {
+        u32 h = seed;
+        h = (h ^ static_cast<u32>(text.size())) * 0x9e3779b1u;
+        h = (h ^ static_cast<u8>(text.front())) * 0x85ebca77u;
+        h = (h ^ static_cast<u8>(text.back())) * 0xc2b2ae3du;
+        return h >> (32 - bits);
+    }
+
+    constexpr KeywordTable() : seed(find_seed()), slots() {
+        for (const auto& keyword : keyword_list) {
+            slots[hash(seed, keyword.text)] = keyword;
+        }
+    }
+
+    constexpr Token::Type lookup(std::string_view text) const {
+        const auto& slot = slots[hash(seed, text)];
+        return slot.text == text ? slot.type : Token::Type::Identifier;
+    }
+
+private:
+    u32 seed;
+    std::array<Keyword, size> slots;
+
+    static constexpr bool is_perfect(u32 seed) {
+        bool used[size] = {};
+        for (const auto& keyword : keyword_list) {
+            const u32 slot = hash(seed, keyword.text);
+            if (used[slot]) {
+                return false;
+            }
+            used[slot] = true;
+        }
+        return true;
+    }
+
+    static constexpr u32 find_seed() {
+        u32 seed = 1;
+        while (!is_perfect(seed)) {
+            ++seed;
+        }
+        return seed;
+    }
+};
+
+
+constexpr KeywordTable keyword_table;
+
+
+// Returns Token::Type::Identifier if `text` is not a keyword.
+constexpr Token::Type keyword_type(std::string_view text) {
+    return keyword_table.lookup(text);
+}
+
+
+static_assert(keyword_type("elif") == Token::Type::Elif);
+static_assert(keyword_type("el") == Token::Type::Identifier);
+
+
+}
+
+
+#endif
@@ -0,0 +1,187 @@
+#include "lazy_module.h"
+
+#include <algorithm>
+#include <cstring>
+
+#include "keywords.h"
+#include "scan.h"
+#include "unicode.h"
+
+
+namespace klp {
+
+
+// Start of the line after the one `begin` is on. A string literal that
+// opens on the line may carry it over several more.
+static const char* next_line(const ScanKernels& scan, const char* begin, const char* end) {
+    while (true) {
+        const char* const newline = scan.find_newline(begin, end);
+        const void* const quote = std::memchr(begin, '"', newline - begin);
+
+        // No literal, or one inside a comment.
+        if (!quote || std::memchr(begin, '#', static_cast<const char*>(quote) - begin)) {
+            return newline == end ? end : newline + 1;
+        }
+
+        const char* at = static_cast<const char*>(quote) + 1;
+        while (true) {
+            at = scan.find_string_special(at, end);
+            if (at == end) {
+                return end;
+            }
+            if (*at == '"') {
+                break;
+            }
+            at += 2;
+            if (at >= end) {
+                return end;
+            }
+        }
+        begin = at + 1;
+    }
+}
+
+
+std::vector<Declaration> scan_declarations(std::string_view source, Interner& interner) {
+    const ScanKernels& scan = scan_kernels();
+    const char* const begin = source.data();
+    const char* const end = begin + source.size();
+
+    std::vector<Declaration> decls;
+    bool in_decl = false;
+
+    for (const char* line = begin; line < end; line = next_line(scan, line, end)) {
+        const char* const text = scan.skip_spaces(line, end);
+        if (text != line || *line == '\n' || *line == '#') {
+            continue;
+        }
+
+        const u32 offset = line - begin;
+        if (in_decl) {
+            decls.back().end = offset;
+            in_decl = false;
+        }
+
+        if (!is_ascii_alpha(*line)) {
+            continue;
+        }
+
+        const char* const word_end = skip_identifier(scan, line, end);
+        const Token::Type kind = keyword_type(std::string_view(line, word_end - line));
+        if (kind != Token::Type::Def && kind != Token::Type::Class) {
+            continue;
+        }
+
+        Atom name = Declaration::no_name;
+        const char* const name_begin = scan.skip_spaces(word_end, end);
+        const u32 start_size = name_begin < end ? identifier_start_size(name_begin, end) : 0;
+        if (name_begin != word_end && start_size) {
+            const std::string_view word(name_begin, skip_identifier(scan, name_begin + start_size, end) - name_begin);
+            if (keyword_type(word) == Token::Type::Identifier) {
+                name = interner.intern(word);
+            }
+        }
+
+        decls.push_back(Declaration{kind, name, offset, static_cast<u32>(source.size())});
+        in_decl = true;
+    }
+
+    return decls;
+}
+
+
+// Tokenizes [begin, end) of `source`, which starts at the first column of
+// a line at level 0, closing its indentation at the end.
+static TokenBuffer tokenize_range(std::string_view source, u32 begin, u32 end, Interner& interner) {
+    Tokenizer::ChunkOptions options;
+    options.base_offset = begin;
+
+    TokenBuffer tokens;
+    tokens.reserve((end - begin) / bytes_per_token_estimate + 1);
+    Tokenizer tokenizer(source.substr(begin, end - begin), options, interner);
+    tokens.push(tokenizer.next_all(tokens));
+    tokens.tables = tokenizer.take_tables();
+    return tokens;
+}
+
+
+LazyModule::LazyModule(std::string_view source, Interner& interner) :
+    source(source),
+    interner(&interner),
+    decls(scan_declarations(source, interner)),
+    lexed(decls.size())
+{
+    usize top_level_size = source.size();
+    for (const Declaration& decl : decls) {
+        top_level_size -= decl.end - decl.begin;
+    }
+
+    // One tokenizer over the whole source, stepping over each declaration.
+    // It reaches the keyword after closing the indentation of the code
+    // before, and the body leaves the level at 0 again.
+    TokenBuffer& tokens = top_level_tokens;
+    tokens.reserve(top_level_size / bytes_per_token_estimate + 1);
+    Tokenizer tokenizer(source, interner);
+    bool failed = false;
+
+    for (usize i = 0; i < decls.size(); ++i) {
+        Token token = tokenizer.next();
+        while (token.offset < decls[i].begin || token.type == Token::Type::Dedent) {
+            failed |= token.type == Token::Type::Error;
+            tokens.push(token);
+            token = tokenizer.next();
+        }
+
+        // After a lexing error the scan and the tokenizer may disagree on
+        // where a line starts, and the tokenizer may already be past the
+        // keyword. The rest of the file is then lexed as top-level code.
+        if (failed || token.offset != decls[i].begin || token.type != decls[i].kind) {
+            decls.resize(i);
+            lexed.resize(i);
+            tokens.push(token);
+            if (token.type != Token::Type::Eof) {
+                tokens.push(tokenizer.next_all(tokens));
+            }
+            tokens.tables = tokenizer.take_tables();
+            index_names();
+            return;
+        }
+        tokenizer.skip_to(decls[i].end);
+    }
+
+    tokens.push(tokenizer.next_all(tokens));
+    tokens.tables = tokenizer.take_tables();
+    index_names();
+}
+
+
+void LazyModule::index_names() {
+    for (u32 i = 0; i < decls.size(); ++i) {
+        const Atom name = decls[i].name;
+        if (name != Declaration::no_name) {
+            by_name.resize(std::max<usize>(by_name.size(), name + 1), ~u32(0));
+            by_name[name] = i;
+        }
+    }
+}
+
+
+std::optional<usize> LazyModule::find(Atom name) const {
+    if (name >= by_name.size() || by_name[name] == ~u32(0)) {
+        return std::nullopt;
+    }
+    return by_name[name];
+}
+
+
+const TokenBuffer& LazyModule::tokens(usize i) {
+    if (!lexed[i]) {
+        const Declaration& decl = decls[i];
+        lexed[i] = std::make_unique<TokenBuffer>(tokenize_range(source, decl.begin, decl.end, *interner));
+        ++num_lexed_decls;
+    }
+    return *lexed[i];
+}
+
+
+}
@@ -0,0 +1,102 @@
+#ifndef KALPA_LAZY_MODULE_H
+#define KALPA_LAZY_MODULE_H
+
+
+#include <memory>
+#include <optional>
+#include <string_view>
+#include <vector>
+
+#include "defs.h"
+#include "interner.h"
+#include "tokenizer.h"
+
+
+namespace klp {
+
+
+// A top-level `def` or `class`: its header line and the indented body
+// after it.
+struct Declaration {
+    static constexpr Atom no_name = ~Atom(0);
+
+    Token::Type kind;  // Def or Class
+    Atom name;         // no_name if the keyword is not followed by one
+    u32 begin;         // offset of the keyword, at the start of a line
+    u32 end;           // start of the next top-level line, or the end of the source
+};
+
+
+//
+//  Finds the top-level declarations of `source` without tokenizing it. A
+//  declaration starts at a line that begins with `def` or `class` in the
+//  first column, and its body runs up to the next line that has code in
+//  the first column. Blank and comment-only lines do not end a body.
+//
+//  The scan looks at the first bytes of each line and otherwise only for
+//  quotes, so that string literals spanning lines are skipped. It agrees
+//  with the tokenizer on every line without lexing errors.
+//
+std::vector<Declaration> scan_declarations(std::string_view source, Interner& interner = shared_interner());
+
+
+//
+//  A source file whose declarations are lexed on first use. Construction
+//  scans for declarations and lexes only the code between them, so its
+//  cost is one cheap pass plus the top-level code. Errors in a body are
+//  found when the body is first lexed. compile_lazy() runs a program
+//  from a module, lexing each declaration on its first call.
+//
+//  Every piece starts at the first column of a line at indentation level
+//  0, where the tokenizer of the whole file would be too, so its tokens
+//  are exactly those tokenize_all() gives for that range: the top-level
+//  tokens followed by those of each declaration, merged by offset, are
+//  tokenize_all(source). A lexing error in the top-level code ends the
+//  lazy part: the rest of the file, declarations included, is lexed as
+//  top-level code. `source` must outlive the module.
+//
+class LazyModule {
+public:
+    explicit LazyModule(std::string_view source, Interner& interner = shared_interner());
+
+    const std::vector<Declaration>& declarations() const {
+        return decls;
+    }
+
+    // The tokens outside of declarations, ending with Eof.
+    const TokenBuffer& top_level() const {
+        return top_level_tokens;
+    }
+
+    // The declaration a name refers to: the last one that defines it.
+    std::optional<usize> find(Atom name) const;
+
+    // The tokens of declaration `i`, from its keyword to the Dedent that
+    // closes its body, then Eof at its end. Lexed on the first call.
+    const TokenBuffer& tokens(usize i);
+
+    bool is_lexed(usize i) const {
+        return lexed[i] != nullptr;
+    }
+
+    usize num_lexed() const {
+        return num_lexed_decls;
+    }
+
+private:
+    std::string_view source;
+    Interner* interner;
+    std::vector<Declaration> decls;
+    std::vector<u32> by_name;  // declaration index by atom, or ~0
+    std::vector<std::unique_ptr<TokenBuffer>> lexed;
+    usize num_lexed_decls = 0;
+    TokenBuffer top_level_tokens;
+
+    void index_names();
+};
+
+
+}
+
+
+#endif
@@ -1,151 +1,410 @@
 #include <cerrno>
-#include <cstdio>
+#include <chrono>
+#include <cstdlib>
 #include <cstring>
-#include <optional>
+#include <filesystem>
+#include <string>
+#include <string_view>
+#include <system_error>
 #include <vector>
 
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "ast.h"
+#include "compiler.h"
 #include "defs.h"
-#include "tokenizer.h"
+#include "driver.h"
+#include "lazy_module.h"
+#include "parallel_tokenizer.h"
+#include "parser.h"
 #include "print.h"
+#include "source.h"
+#include "source_manager.h"
+#include "stream_tokenizer.h"
+#include "thread_pool.h"
+#include "token_dump.h"
+#include "tokenizer.h"
+#include "unicode.h"
+#include "vm.h"
+#include "write_buffer.h"
 
 
 namespace klp {
 
 
-void print_file_error(const char* path) {
-    eprint("Error: {}: {}\n", path, std::strerror(errno));
-}
-
-
-std::optional<std::vector<char>> read_file(const char* path) {
-    std::optional<std::vector<char>> ret;
-
-    const auto file = std::fopen(path, "r");
-    if (!file) {
-        print_file_error(path);
-        return ret;
-    }
-
-    if (std::fseek(file, 0, SEEK_END) < 0) {
-        print_file_error(path);
-        return ret;
-    }
-
-    const auto file_size = std::ftell(file);
-    if (file_size < 0) {
-        print_file_error(path);
-        return ret;
-    }
-
-    if (file_size == 0) {
-        ret.emplace();
-        return ret;
-    }
-
-    if (std::fseek(file, 0, SEEK_SET) < 0) {
-        print_file_error(path);
-        return ret;
-    }
-
-    std::vector<char> file_bytes(file_size);
-    if (std::fread(file_bytes.data(), file_size, 1, file) != 1) {
-        print_file_error(path);
-        return ret;
-    }
-
-    ret = std::move(file_bytes);
-    return ret;
-}
-
-void print_token(Token& token) {
-    switch (token.type) {
-        case Token::Type::Identifier            : eputs("Identifier"); break;
-        case Token::Type::Indent                : eputs("Indent"); break;
-        case Token::Type::Dedent                : eputs("Dedent"); break;
-        case Token::Type::LeftParen             : eputs("LeftParen"); break;
-        case Token::Type::RightParen            : eputs("RightParen"); break;
-        case Token::Type::Colon         : eputs("Colon"); break;
-        case Token::Type::Comma         : eputs("Comma"); break;
-        case Token::Type::Dot           : eputs("Dot"); break;
-        case Token::Type::Def           : eputs("Def"); break;
-        case Token::Type::Class         : eputs("Class"); break;
-        case Token::Type::Let           : eputs("Let"); break;
-        case Token::Type::For           : eputs("For"); break;
-        case Token::Type::While         : eputs("While"); break;
-        case Token::Type::If            : eputs("If"); break;
-        case Token::Type::Else          : eputs("Else"); break;
-        case Token::Type::Elif          : eputs("Elif"); break;
-        case Token::Type::In            : eputs("In"); break;
-        case Token::Type::Not           : eputs("Not"); break;
-        case Token::Type::Or            : eputs("Or"); break;
-        case Token::Type::And           : eputs("And"); break;
-        case Token::Type::Return                : eputs("Return"); break;
-        case Token::Type::Int           : eputs("Int"); break;
-        case Token::Type::Float         : eputs("Float"); break;
-        case Token::Type::String                : eputs("String"); break;
-        case Token::Type::Assign                : eputs("Assign"); break;
-        case Token::Type::Equal         : eputs("Equal"); break;
-        case Token::Type::NotEqual              : eputs("NotEqual"); break;
-        case Token::Type::Less          : eputs("Less"); break;
-        case Token::Type::LessEq                : eputs("LessEq"); break;
-        case Token::Type::Greater               : eputs("Greater"); break;
-        case Token::Type::GreaterEq             : eputs("GreaterEq"); break;
-        case Token::Type::Add           : eputs("Add"); break;
-        case Token::Type::Sub           : eputs("Sub"); break;
-        case Token::Type::Mul           : eputs("Mul"); break;
-        case Token::Type::Pow           : eputs("Pow"); break;
-        case Token::Type::Div           : eputs("Div"); break;
-        case Token::Type::IntDiv                : eputs("IntDiv"); break;
-        case Token::Type::AddEq         : eputs("AddEq"); break;
-        case Token::Type::SubEq         : eputs("SubEq"); break;
-        case Token::Type::MulEq         : eputs("MulEq"); break;
-        case Token::Type::PowEq         : eputs("PowEq"); break;
-        case Token::Type::DivEq         : eputs("DivEq"); break;
-        case Token::Type::IntDivEq              : eputs("IntDivEq"); break;
-        case Token::Type::Xor           : eputs("Xor"); break;
-        case Token::Type::XorEq         : eputs("XorEq"); break;
-        case Token::Type::LeftBracket           : eputs("LeftBracket"); break;
-        case Token::Type::RightBracket          : eputs("RightBracket"); break;
-        case Token::Type::LeftBrace             : eputs("LeftBrace"); break;
-        case Token::Type::RightBrace            : eputs("RightBrace"); break;
-        case Token::Type::Eof           : eputs("Eof"); break;
+void print_token(const Token& token) {
+    eputs(token_type_name(token.type));
+}
+
+void print_error(std::string_view path, u64 line, u32 column, std::string_view line_text, const char* message) {
+    eprint("{}", format_diagnostic(path, line, column, line_text, message));
+}
+
+void print_error_at(const SourceManager& sources, u32 offset, const char* message) {
+    const SourceLocation location = sources.locate(offset);
+    print_error(location.file->path(), location.line, location.column, sources.line_text(offset), message);
+}
+
+template <typename D>
+void print_diagnostic(const SourceManager& sources, const D& diagnostic) {
+    print_error_at(sources, diagnostic.offset, describe(diagnostic.error));
+}
+
+void print_tokens_debug(const TokenBuffer& tokens) {
+    const auto& tables = tokens.tables;
+
+    for (usize i = 0; i < tokens.size(); ++i) {
+        const Token token = tokens[i];
+        print_token(token);
+        if (token.type == Token::Type::Eof) {
+            break;
+        }
+
+        switch (token.type) {
+            case Token::Type::Identifier: print("{}\n", tables.identifier(token)); break;
+            case Token::Type::String: print("{}\n", tables.string(token)); break;
+            case Token::Type::Int: print("{}\n", tables.int_value(token)); break;
+            case Token::Type::Float: print("{}\n", tables.float_value(token)); break;
+            case Token::Type::Error: print("{}\n", describe(tables.error(token))); break;
+            default: break;
+        }
+
+        eputs("---");
+    }
+}
+
+enum class DumpMode {
+    Debug,   // one token at a time to stderr, payloads to stdout
+    Text,
+    Binary,
+};
+
+// Writes the tokens to stdout. Returns false if writing failed.
+bool dump_tokens(const TokenBuffer& tokens, DumpMode mode) {
+    WriteBuffer out(STDOUT_FILENO);
+    if (mode == DumpMode::Binary) {
+        return write_token_dump(tokens, out);
+    }
+
+    write_token_dump_text(tokens, out);
+    return out.flush();
+}
+
+// Tokenizes `path` a chunk at a time in bounded memory, for input that
+// need not fit in memory, like a pipe from a code generator.
+int run_stream(const char* path, DumpMode mode) {
+    if (mode == DumpMode::Binary) {
+        eputs("Error: --stream cannot write a binary token dump");
+        return 1;
+    }
+
+    const bool is_stdin = std::strcmp(path, "-") == 0;
+    const int fd = is_stdin ? STDIN_FILENO : ::open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        eprint("Error: {}: {}\n", path, std::strerror(errno));
+        return 1;
+    }
+
+    StreamTokenizer stream(fd);
+    WriteBuffer out(STDOUT_FILENO);
+    TokenBuffer tokens;
+    usize num_errors = 0;
+
+    while (stream.next_chunk(tokens)) {
+        if (mode == DumpMode::Debug) {
+            print_tokens_debug(tokens);
+        } else {
+            write_token_dump_text(tokens, out);
+        }
+
+        for (const auto& diagnostic : collect_diagnostics(tokens)) {
+            const auto location = stream.locate(diagnostic.offset);
+            print_error(path, location.line, location.column, location.line_text, describe(diagnostic.error));
+            ++num_errors;
+        }
+    }
+
+    if (!is_stdin) {
+        close(fd);
+    }
+
+    if (!out.flush()) {
+        eprint("Error: cannot write the token dump\n");
+        return 1;
+    }
+    return stream.ok() && num_errors == 0 ? 0 : 1;
+}
+
+// Parses the tokens and prints each top-level statement as an S-expression
+// on its own line. Returns false if there were syntax errors.
+bool dump_ast(const SourceManager& sources, const TokenBuffer& tokens) {
+    const Ast ast = parse(tokens);
+
+    WriteBuffer out(STDOUT_FILENO);
+    for (const u32 statement : ast.statements(ast.root)) {
+        out.write(format_ast(ast, tokens, statement));
+        out.put('\n');
+    }
+    if (!out.flush()) {
+        eprint("Error: cannot write the syntax tree\n");
+        return false;
+    }
+
+    for (const auto& diagnostic : ast.diagnostics) {
+        print_diagnostic(sources, diagnostic);
+    }
+    return ast.diagnostics.empty();
+}
+
+void print_gc_stats(const GcStats& stats) {
+    eprintln(
+        "gc: {} minor and {} major collections, {:.1f} MB allocated, {:.1f} MB promoted, {:.1f} MB freed, "
+        "{:.1f} MB old, {:.1f} MB in payloads, pauses {:.3f} ms in total and {:.3f} ms at most",
+        stats.minor_collections, stats.major_collections, stats.allocated_bytes / 1e6, stats.promoted_bytes / 1e6,
+        stats.freed_bytes / 1e6, stats.old_bytes / 1e6, stats.payload_bytes / 1e6, stats.total_pause_ns / 1e6,
+        stats.max_pause_ns / 1e6
+    );
+}
+
+// Runs a compiled program. Returns false on any error.
+bool execute(const SourceManager& sources, Program& program, const VmOptions& options, bool gc_stats) {
+    WriteBuffer out(STDOUT_FILENO);
+    Vm vm(program, out, options);
+    const auto result = vm.run();
+    out.flush();
+    if (gc_stats) {
+        print_gc_stats(program.heap.stats);
+    }
+    if (!result) {
+        print_error_at(sources, result.error().offset, result.error().message.c_str());
+        return false;
+    }
+    return true;
+}
+
+// Compiles the tokens to bytecode and runs the program. Returns false on
+// any error.
+bool run_program(const SourceManager& sources, const TokenBuffer& tokens, const VmOptions& options, bool gc_stats) {
+    const Ast ast = parse(tokens);
+    for (const auto& diagnostic : ast.diagnostics) {
+        print_diagnostic(sources, diagnostic);
+    }
+    if (!ast.diagnostics.empty()) {
+        return false;
+    }
+
+    Program program(*tokens.tables.interner);
+    const auto compiled = compile(ast, tokens, program);
+    if (!compiled) {
+        print_error_at(sources, compiled.error().offset, compiled.error().message.c_str());
+        return false;
+    }
+    return execute(sources, program, options, gc_stats);
+}
+
+// Like run_program(), but only lexes, parses and compiles the top-level
+// code up front, and each function on its first call.
+bool run_lazy_program(const SourceManager& sources, std::string_view text, const VmOptions& options, bool gc_stats) {
+    LazyModule module(text);
+    const TokenBuffer& tokens = module.top_level();
+    const auto diagnostics = collect_diagnostics(tokens);
+    for (const auto& diagnostic : diagnostics) {
+        print_diagnostic(sources, diagnostic);
+    }
+
+    const Ast ast = parse(tokens);
+    for (const auto& diagnostic : ast.diagnostics) {
+        print_diagnostic(sources, diagnostic);
+    }
+    if (!diagnostics.empty() || !ast.diagnostics.empty()) {
+        return false;
+    }
+
+    Program program(*tokens.tables.interner);
+    const auto compiled = compile_lazy(ast, module, program);
+    if (!compiled) {
+        print_error_at(sources, compiled.error().offset, compiled.error().message.c_str());
+        return false;
     }
+    return execute(sources, program, options, gc_stats);
+}
+
+// Lexes many files, or the files under directories, and reports errors
+// and totals in the order of `paths`.
+int run_check(const std::vector<std::string>& paths, usize num_jobs) {
+    const auto sources = collect_sources(paths);
+    if (!sources) {
+        return 1;
+    }
+
+    using Clock = std::chrono::steady_clock;
+    const auto start = Clock::now();
+
+    ThreadPool pool(num_jobs);
+    const auto results = check_files(*sources, pool, shared_interner());
+    const double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+
+    usize num_failed = 0;
+    usize num_bytes = 0;
+    usize num_tokens = 0;
+    usize num_errors = 0;
+    for (const auto& result : results) {
+        eprint("{}", result.report);
+        num_failed += !result.read_ok || result.num_errors;
+        num_bytes += result.num_bytes;
+        num_tokens += result.num_tokens;
+        num_errors += result.num_errors;
+    }
+
+    eprintln(
+        "{} files, {} with errors: {:.1f} MB, {} tokens, {} identifiers, {} errors in {:.3f} s on {} threads",
+        results.size(), num_failed, num_bytes / 1e6, num_tokens, shared_interner().size(), num_errors,
+        seconds, pool.size()
+    );
+    return num_failed ? 1 : 0;
+}
+
+void print_usage() {
+    eputs("Usage: kalpa [--jobs=N] [--dump-tokens=text|binary] [--stream] <path/to/source.kl>");
+    eputs("       kalpa [--jobs=N] --dump-ast <path/to/source.kl>");
+    eputs("       kalpa --run [--lazy] [--no-jit] [--gc-stats] <path/to/source.kl>");
+    eputs("       kalpa [--jobs=N] --check <path>...");
+    eputs("Paths may be directories, which stand for the .kl files under them. With more than one");
+    eputs("path or a directory, kalpa checks the files for lexing errors on N threads (all cores");
+    eputs("by default). With --lazy, --run compiles each function on its first call.");
 }
 
 int main(int argc, char* argv[]) {
-    if (argc != 2) {
-        eputs("Usage: kalpa <path/to/source.kl>");
+    std::vector<std::string> paths;
+    usize num_jobs = 1;
+    bool jobs_given = false;
+    DumpMode dump_mode = DumpMode::Debug;
+    bool stream = false;
+    bool check = false;
+    bool ast = false;
+    bool run = false;
+    bool gc_stats = false;
+    bool lazy = false;
+    VmOptions vm_options;
+
+    for (int i = 1; i < argc; ++i) {
+        const std::string_view arg = argv[i];
+        if (arg.substr(0, 7) == "--jobs=") {
+            num_jobs = std::strtoul(argv[i] + 7, nullptr, 10);
+            if (num_jobs == 0) {
+                num_jobs = default_num_threads();
+            }
+            jobs_given = true;
+        } else if (arg == "--dump-tokens=text") {
+            dump_mode = DumpMode::Text;
+        } else if (arg == "--dump-tokens=binary") {
+            dump_mode = DumpMode::Binary;
+        } else if (arg == "--stream") {
+            stream = true;
+        } else if (arg == "--run") {
+            run = true;
+        } else if (arg == "--no-jit") {
+            vm_options.jit_threshold = 0;
+        } else if (arg == "--gc-stats") {
+            gc_stats = true;
+        } else if (arg == "--lazy") {
+            lazy = true;
+        } else if (arg == "--dump-ast") {
+            ast = true;
+        } else if (arg == "--check") {
+            check = true;
+        } else if (arg == "-" || arg.substr(0, 1) != "-") {
+            paths.push_back(argv[i]);
+        } else {
+            print_usage();
+            return 1;
+        }
+    }
+
+    if (paths.empty()) {
+        print_usage();
         return 1;
     }
 
-    auto source = read_file(argv[1]);
-    if (!source) {
+    // A path that cannot be examined is left to SourceFile::open to report.
+    std::error_code error;
+    check = check || paths.size() > 1 || std::filesystem::is_directory(paths[0], error);
+    if (check) {
+        if (stream || ast || run || dump_mode != DumpMode::Debug) {
+            eputs("Error: --stream, --dump-tokens, --dump-ast and --run take a single file");
+            return 1;
+        }
+        return run_check(paths, jobs_given ? num_jobs : default_num_threads());
+    }
+
+    if (((ast || run) && (stream || dump_mode != DumpMode::Debug)) || (ast && run)) {
+        eputs("Error: --dump-ast and --run cannot be combined with each other, --stream or --dump-tokens");
         return 1;
     }
 
-    source->push_back('\0');
-    std::string_view s(source->data(), source->size());
-    Tokenizer tokenizer(s);
+    if ((vm_options.jit_threshold == 0 || gc_stats || lazy) && !run) {
+        eputs("Error: --lazy, --no-jit and --gc-stats only apply to --run");
+        return 1;
+    }
 
-    while (true) {
-        auto token = tokenizer.next();
-        print_token(token);
-        if (token.type == Token::Type::Eof) {
-            break;
+    const char* const path = paths[0].c_str();
+    if (stream) {
+        return run_stream(path, dump_mode);
+    }
+
+    SourceManager sources;
+    auto source = SourceFile::open(path);
+    if (!source || !sources.add(std::move(*source))) {
+        return 1;
+    }
+    const std::string_view text = sources.file(0).text();
+
+    const usize invalid = validate_utf8(text);
+    if (invalid != text.size()) {
+        print_diagnostic(sources, Diagnostic{LexError::InvalidUtf8, static_cast<u32>(invalid)});
+        return 1;
+    }
+
+    if (lazy) {
+        return run_lazy_program(sources, text, vm_options, gc_stats) ? 0 : 1;
+    }
+
+    TokenBuffer tokens;
+    if (num_jobs > 1) {
+        ThreadPool pool(num_jobs);
+        tokens = tokenize_parallel(text, pool);
+    } else {
+        tokens = tokenize_all(text);
+    }
+
+    const auto diagnostics = collect_diagnostics(tokens);
+    if (ast) {
+        for (const auto& diagnostic : diagnostics) {
+            print_diagnostic(sources, diagnostic);
         }
+        return dump_ast(sources, tokens) && diagnostics.empty() ? 0 : 1;
+    }
 
-        if (token.type == Token::Type::Identifier ||
-            token.type == Token::Type::String ||
-            token.type == Token::Type::Int ||
-            token.type == Token::Type::Float)
-        std::visit([] (auto& x) {
-            print("{}\n", x);
-        }, token.value);
+    if (run) {
+        for (const auto& diagnostic : diagnostics) {
+            print_diagnostic(sources, diagnostic);
+        }
+        return diagnostics.empty() && run_program(sources, tokens, vm_options, gc_stats) ? 0 : 1;
+    }
 
-        eputs("---");
+    if (dump_mode == DumpMode::Debug) {
+        print_tokens_debug(tokens);
+    } else if (!dump_tokens(tokens, dump_mode)) {
+        eprint("Error: cannot write the token dump\n");
+        return 1;
+    }
+
+    for (const auto& diagnostic : diagnostics) {
+        print_diagnostic(sources, diagnostic);
     }
 
-    return 0;
+    return diagnostics.empty() ? 0 : 1;
 }
 
 
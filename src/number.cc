@@ -0,0 +1,269 @@
+#include "number.h"
+
+#include <charconv>
+#include <cstring>
+#include <limits>
+#include <string>
+
+#include "scan.h"
+
+
+namespace klp {
+
+
+namespace {
+
+
+struct DigitScan {
+    u64 value = 0;
+    u32 num_digits = 0;
+    bool overflow = false;
+    bool malformed = false;
+    bool has_underscores = false;
+
+    void accumulate(u32 n, u64 scale, u64 digits) {
+        num_digits += n;
+        overflow |= __builtin_mul_overflow(value, scale, &value);
+        overflow |= __builtin_add_overflow(value, digits, &value);
+    }
+};
+
+
+}
+
+
+//
+//  SWAR parsing of up to eight decimal digits at once. The eight bytes are
+//  read as one little-endian word; the digit test and the conversion work
+//  on all lanes together, so a run of up to eight digits costs no branch
+//  per digit.
+//
+constexpr bool swar_digits = __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__;
+
+
+constexpr u64 powers_of_10[] = {
+    1, 10, 100, 1000, 10000, 100000, 1000000, 10000000, 100000000,
+    1000000000, 10000000000, 100000000000, 1000000000000, 10000000000000,
+    100000000000000, 1000000000000000, 10000000000000000,
+};
+
+
+// Powers of ten that are exact doubles.
+constexpr double exact_powers_of_10[] = {
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22,
+};
+
+
+// Number of digits the word starts with.
+static inline u32 leading_digits(u64 word) {
+    // A byte is a digit if its high nibble is 3 and adding 6 does not carry
+    // into the high nibble. Carries out of non-digit bytes only disturb
+    // the bytes after them.
+    const u64 high = word & 0xf0f0f0f0f0f0f0f0;
+    const u64 carry = (word + 0x0606060606060606) & 0xf0f0f0f0f0f0f0f0;
+    const u64 non_digits = (high | (carry >> 4)) ^ 0x3333333333333333;
+
+    // The top bit stops the count at 7 without a branch on zero.
+    return __builtin_ctzll(non_digits | (u64(1) << 63)) / 8 + (non_digits == 0);
+}
+
+
+// Value of the first `n` digits of the word, 0 <= n <= 8.
+static inline u64 digits_value(u64 word, u32 n) {
+    // Move the digits to the top and fill the bottom with '0'. Each shift
+    // is split in two so that n == 0 and n == 8 need no branch.
+    const u32 half = 4 * (8 - n);
+    word = (word << half << half) | (0x3030303030303030 >> (4 * n) >> (4 * n));
+
+    word -= 0x3030303030303030;
+    word = word * 10 + (word >> 8);  // pairs of digits
+
+    const u64 mask = 0x000000ff000000ff;
+    const u64 mul_100 = 100 + (1000000ull << 32);
+    const u64 mul_1 = 1 + (10000ull << 32);
+    return (((word & mask) * mul_100) + (((word >> 16) & mask) * mul_1)) >> 32;
+}
+
+
+// Decimal digits with single underscores between them.
+static const char* scan_decimal(const char* p, const char* end, DigitScan& scan) {
+    const char* const begin = p;
+    while (true) {
+        // Runs of up to 16 digits take no branch that depends on their
+        // length; longer ones loop.
+        bool more = swar_digits && end - p >= 16;
+        while (more) {
+            u64 first;
+            u64 second;
+            std::memcpy(&first, p, 8);
+            std::memcpy(&second, p + 8, 8);
+
+            const u32 first_size = leading_digits(first);
+            const u32 second_size = leading_digits(second) * (first_size == 8);
+            const u64 value = digits_value(first, first_size) * powers_of_10[second_size] +
+                digits_value(second, second_size);
+
+            const u32 size = first_size + second_size;
+            scan.accumulate(size, powers_of_10[size], value);
+            p += size;
+            more = size == 16 && end - p >= 16;
+        }
+
+        for (; p < end && is_ascii_digit(*p); ++p) {
+            scan.accumulate(1, 10, *p - '0');
+        }
+
+        if (p == end || *p != '_' || p == begin) {
+            return p;
+        }
+        if (p + 1 == end || !is_ascii_digit(p[1])) {
+            scan.malformed = true;
+            return p;
+        }
+        scan.has_underscores = true;
+        ++p;
+    }
+}
+
+
+static u32 hex_digit_value(char c) {
+    if (is_ascii_digit(c)) {
+        return c - '0';
+    }
+    if ((c | 0x20) >= 'a' && (c | 0x20) <= 'f') {
+        return (c | 0x20) - 'a' + 10;
+    }
+    return 16;
+}
+
+
+// Digits of a 0x, 0o or 0b literal, `bits` bits per digit.
+static const char* scan_prefixed(const char* p, const char* end, u32 bits, DigitScan& scan) {
+    const u32 base = 1u << bits;
+    if (p == end || hex_digit_value(*p) >= base) {
+        scan.malformed = true;
+        return p;
+    }
+
+    while (p < end) {
+        const u32 digit = hex_digit_value(*p);
+        if (digit < base) {
+            scan.overflow |= (scan.value >> (64 - bits)) != 0;
+            scan.value = scan.value << bits | digit;
+            ++p;
+        } else if (*p == '_' && p + 1 < end && hex_digit_value(p[1]) < base) {
+            scan.has_underscores = true;
+            ++p;
+        } else if (*p == '_') {
+            scan.malformed = true;
+            return p;
+        } else {
+            break;
+        }
+    }
+
+    return p;
+}
+
+
+static Result<NumberLiteral, NumberError> int_literal(const char* begin, const char* end, const DigitScan& scan) {
+    if (scan.malformed) {
+        return NumberError::Malformed;
+    }
+    if (scan.overflow || scan.value > static_cast<u64>(std::numeric_limits<i64>::max())) {
+        return NumberError::OutOfRange;
+    }
+
+    return NumberLiteral{false, static_cast<u32>(end - begin), static_cast<i64>(scan.value), 0};
+}
+
+
+static Result<NumberLiteral, NumberError> float_literal(const char* begin, const char* end, bool has_underscores) {
+    std::string digits;
+    const char* first = begin;
+    const char* last = end;
+    if (has_underscores) {
+        digits.reserve(end - begin);
+        for (const char* p = begin; p < end; ++p) {
+            if (*p != '_') {
+                digits += *p;
+            }
+        }
+        first = digits.data();
+        last = first + digits.size();
+    }
+
+    double value = 0;
+    const auto [ptr, ec] = std::from_chars(first, last, value);
+    if (ec == std::errc::result_out_of_range) {
+        return NumberError::OutOfRange;
+    }
+    verify(ec == std::errc() && ptr == last, "float literal not consumed");
+
+    return NumberLiteral{true, static_cast<u32>(end - begin), 0, value};
+}
+
+
+Result<NumberLiteral, NumberError> parse_number(const char* begin, const char* end) {
+    const char* p = begin;
+    DigitScan scan;
+
+    if (end - p >= 2 && p[0] == '0') {
+        const char prefix = p[1] | 0x20;
+        const u32 bits = prefix == 'x' ? 4 : prefix == 'o' ? 3 : prefix == 'b' ? 1 : 0;
+        if (bits) {
+            p = scan_prefixed(p + 2, end, bits, scan);
+            return int_literal(begin, p, scan);
+        }
+    }
+
+    p = scan_decimal(p, end, scan);
+    bool is_float = false;
+
+    // Fraction digits continue the significand in `scan`.
+    const u32 int_digits = scan.num_digits;
+    if (!scan.malformed && p < end && *p == '.') {
+        is_float = true;
+        p = scan_decimal(p + 1, end, scan);
+    }
+    const u32 fraction_digits = scan.num_digits - int_digits;
+
+    DigitScan exponent;
+    bool negative_exponent = false;
+    if (!scan.malformed && p < end && (*p | 0x20) == 'e') {
+        const char* digits = p + 1;
+        if (digits < end && (*digits == '+' || *digits == '-')) {
+            negative_exponent = *digits++ == '-';
+        }
+        if (digits < end && is_ascii_digit(*digits)) {
+            is_float = true;
+            p = scan_decimal(digits, end, exponent);
+        }
+    }
+
+    if (!is_float) {
+        return int_literal(begin, p, scan);
+    }
+    if (scan.malformed || exponent.malformed) {
+        return NumberError::Malformed;
+    }
+
+    // Clinger's fast path: a significand and a power of ten that are both
+    // exact doubles give a correctly rounded result with one operation.
+    if (!scan.overflow && scan.value <= (u64(1) << 53) && !exponent.overflow && exponent.value <= 22) {
+        const i64 power = (negative_exponent ? -static_cast<i64>(exponent.value) : exponent.value) - fraction_digits;
+        if (power >= -22 && power <= 22) {
+            const double significand = static_cast<double>(scan.value);
+            const double value = power >= 0 ?
+                significand * exact_powers_of_10[power] :
+                significand / exact_powers_of_10[-power];
+            return NumberLiteral{true, static_cast<u32>(p - begin), 0, value};
+        }
+    }
+
+    return float_literal(begin, p, scan.has_underscores || exponent.has_underscores);
+}
+
+
+}
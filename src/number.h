@@ -0,0 +1,45 @@
+#ifndef KALPA_NUMBER_H
+#define KALPA_NUMBER_H
+
+
+#include "defs.h"
+#include "result.h"
+
+
+namespace klp {
+
+
+//
+//  Numeric literals:
+//
+//      decimal     0  42  1_000_000
+//      prefixed    0xff_ff  0b1010  0o755
+//      float       1.5  .5  1.  6.02e23  1e-9  1_000.000_1
+//
+//  An underscore may stand between two digits. Integers must fit in i64,
+//  and floats are rounded correctly. An exponent is only taken when digits
+//  follow the 'e', so `1else` is still `1` and `else`.
+//
+struct NumberLiteral {
+    bool is_float;
+    u32 size;  // bytes of the literal
+    i64 int_value;
+    double float_value;
+};
+
+
+enum class NumberError : u8 {
+    Malformed,  // a prefix or underscore without digits after it
+    OutOfRange, // the value does not fit in i64, or overflows or underflows double
+};
+
+
+// Parses the literal at `begin`, which is a digit or a '.' followed by a
+// digit. Reads nothing at or past `end`.
+Result<NumberLiteral, NumberError> parse_number(const char* begin, const char* end);
+
+
+}
+
+
+#endif
@@ -0,0 +1,218 @@
+#ifndef KALPA_OPERATORS_H
+#define KALPA_OPERATORS_H
+
+
+#include <algorithm>
+#include <string_view>
+
+#include "defs.h"
+#include "scan.h"
+#include "tokenizer.h"
+
+
+namespace klp {
+
+
+struct Operator {
+    std::string_view text;
+    Token::Type type;
+};
+
+
+//
+//  The single list of operators and punctuation. The character classes and
+//  the matcher below are derived from it at compile time, so a new
+//  operator is one more line here.
+//
+constexpr Operator operator_list[] = {
+    { "(",   Token::Type::LeftParen },
+    { ")",   Token::Type::RightParen },
+    { "[",   Token::Type::LeftBracket },
+    { "]",   Token::Type::RightBracket },
+    { "{",   Token::Type::LeftBrace },
+    { "}",   Token::Type::RightBrace },
+    { ":",   Token::Type::Colon },
+    { ",",   Token::Type::Comma },
+    { ".",   Token::Type::Dot },
+    { "=",   Token::Type::Assign },
+    { "==",  Token::Type::Equal },
+    { "!=",  Token::Type::NotEqual },
+    { "<",   Token::Type::Less },
+    { "<=",  Token::Type::LessEq },
+    { ">",   Token::Type::Greater },
+    { ">=",  Token::Type::GreaterEq },
+    { "+",   Token::Type::Add },
+    { "+=",  Token::Type::AddEq },
+    { "-",   Token::Type::Sub },
+    { "-=",  Token::Type::SubEq },
+    { "*",   Token::Type::Mul },
+    { "*=",  Token::Type::MulEq },
+    { "**",  Token::Type::Pow },
+    { "**=", Token::Type::PowEq },
+    { "/",   Token::Type::Div },
+    { "/=",  Token::Type::DivEq },
+    { "//",  Token::Type::IntDiv },
+    { "//=", Token::Type::IntDivEq },
+    { "^",   Token::Type::Xor },
+    { "^=",  Token::Type::XorEq },
+};
+
+
+//
+//  What the first byte of a token says about it. Tokenizer::next()
+//  switches on this once instead of testing bytes one by one.
+//
+enum class CharClass : u8 {
+    Invalid,
+    Nul,
+    Alpha,
+    Digit,
+    Dot,       // an operator, or the start of a number like .5
+    Quote,
+    Operator,
+    NonAscii,  // the lead byte of a UTF-8 character, or not valid UTF-8
+};
+
+
+class CharClassTable {
+public:
+    constexpr CharClassTable() : classes() {
+        for (const auto& op : operator_list) {
+            classes[static_cast<u8>(op.text[0])] = CharClass::Operator;
+        }
+
+        for (u32 c = 0; c < 256; ++c) {
+            if (is_ascii_alpha(static_cast<char>(c))) {
+                classes[c] = CharClass::Alpha;
+            } else if (is_ascii_digit(static_cast<char>(c))) {
+                classes[c] = CharClass::Digit;
+            } else if (c >= 0x80) {
+                classes[c] = CharClass::NonAscii;
+            }
+        }
+
+        classes[0] = CharClass::Nul;
+        classes[static_cast<u8>('.')] = CharClass::Dot;
+        classes[static_cast<u8>('"')] = CharClass::Quote;
+    }
+
+    constexpr CharClass operator[](char c) const {
+        return classes[static_cast<u8>(c)];
+    }
+
+private:
+    CharClass classes[256];
+};
+
+
+constexpr CharClassTable char_classes;
+
+
+struct OperatorMatch {
+    Token::Type type;
+    u32 size;  // 0 if no operator starts here
+};
+
+
+//
+//  A DFA over the prefixes of all operators. State 0 is the start, and a
+//  transition to 0 means no operator continues this way. Bytes that occur
+//  in no operator share column 0, so the table is a few hundred bytes.
+//
+//  match() returns the longest operator at `begin`: `**=` rather than `**`
+//  or `*`. It remembers the last accepting state, so it would also back
+//  off correctly if an operator's prefix were not an operator itself,
+//  like `!` of `!=`.
+//
+constexpr usize max_operator_size = [] {
+    usize size = 0;
+    for (const auto& op : operator_list) {
+        size = std::max(size, op.text.size());
+    }
+    return size;
+}();
+
+
+class OperatorDfa {
+public:
+    static constexpr u32 max_states = 48;
+    static constexpr u32 max_columns = 24;
+
+    constexpr OperatorDfa() : columns(), next(), types(), num_states(1), num_columns(1) {
+        for (auto& type : types) {
+            type = Token::Type::Eof;
+        }
+
+        for (const auto& op : operator_list) {
+            u32 state = 0;
+            for (const char c : op.text) {
+                u8& column = columns[static_cast<u8>(c)];
+                if (column == 0) {
+                    column = num_columns++;
+                }
+
+                u8& target = next[state][column];
+                if (target == 0) {
+                    target = num_states++;
+                }
+                state = target;
+            }
+
+            types[state] = op.type;
+        }
+    }
+
+    constexpr OperatorMatch match(const char* begin, const char* end) const {
+        OperatorMatch result = {Token::Type::Eof, 0};
+        const usize size = std::min<usize>(end - begin, max_operator_size);
+        u32 state = 0;
+        for (usize i = 0; i < size; ++i) {
+            state = next[state][columns[static_cast<u8>(begin[i])]];
+            if (state == 0) {
+                break;
+            }
+            if (types[state] != Token::Type::Eof) {
+                result = OperatorMatch{types[state], static_cast<u32>(i + 1)};
+            }
+        }
+        return result;
+    }
+
+    constexpr u32 size() const {
+        return num_states;
+    }
+
+    constexpr u32 width() const {
+        return num_columns;
+    }
+
+private:
+    u8 columns[256];
+    u8 next[max_states][max_columns];
+    Token::Type types[max_states];  // Eof if the state does not accept
+    u32 num_states;
+    u32 num_columns;
+};
+
+
+constexpr OperatorDfa operator_dfa;
+
+static_assert(operator_dfa.size() <= OperatorDfa::max_states);
+static_assert(operator_dfa.width() <= OperatorDfa::max_columns);
+
+
+constexpr OperatorMatch match_operator(std::string_view text) {
+    return operator_dfa.match(text.data(), text.data() + text.size());
+}
+
+
+static_assert(match_operator("**=x").type == Token::Type::PowEq);
+static_assert(match_operator("//2").type == Token::Type::IntDiv);
+static_assert(match_operator("=<").size == 1);
+static_assert(match_operator("!x").size == 0);
+
+
+}
+
+
+#endif
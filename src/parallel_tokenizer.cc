@@ -0,0 +1,276 @@
+#include "parallel_tokenizer.h"
+
+#include <algorithm>
+#include <memory>
+#include <vector>
+
+#include "scan.h"
+
+
+namespace klp {
+
+
+namespace {
+
+
+struct Chunk {
+    u32 begin = 0;
+    u32 end = 0;
+
+    TokenBuffer tokens;
+    std::unique_ptr<Interner> interner;
+    Token eof = {};
+
+    Tokenizer::Status status = Tokenizer::Status::Ok;
+    bool has_first_indent = false;
+    Tokenizer::FirstIndent first_indent = {};
+    u32 end_indent_level = 0;
+};
+
+
+}
+
+
+// Chunk boundaries: 0, then positions of '\n' spread evenly, then the size.
+static std::vector<u32> split_source(std::string_view source, usize num_chunks) {
+    const ScanKernels& scan = scan_kernels();
+    const char* const begin = source.data();
+    const char* const end = begin + source.size();
+
+    std::vector<u32> bounds = {0};
+    for (usize i = 1; i < num_chunks; ++i) {
+        const usize target = source.size() / num_chunks * i;
+        if (target <= bounds.back()) {
+            continue;
+        }
+
+        const u32 bound = scan.find_newline(begin + target, end) - begin;
+        if (bound >= source.size()) {
+            break;
+        }
+        bounds.push_back(bound);
+    }
+    bounds.push_back(source.size());
+
+    return bounds;
+}
+
+
+static void lex_chunk(std::string_view source, Chunk& chunk, const Tokenizer::ChunkOptions& options) {
+    const std::string_view text = source.substr(chunk.begin, chunk.end - chunk.begin);
+
+    chunk.interner = std::make_unique<Interner>();
+    Tokenizer tokenizer(text, options, *chunk.interner);
+    chunk.tokens.reserve(text.size() / bytes_per_token_estimate + 1);
+    chunk.eof = tokenizer.next_all(chunk.tokens);
+    chunk.tokens.tables = tokenizer.take_tables();
+
+    chunk.status = tokenizer.status();
+    chunk.end_indent_level = tokenizer.get_indent_level();
+    if (const auto first_indent = tokenizer.first_indent()) {
+        chunk.has_first_indent = true;
+        chunk.first_indent = *first_indent;
+    }
+}
+
+
+// What the sequential tokenizer emits at the first line of a chunk when it
+// comes from `level`. An indent of more than one level is an error, and
+// the chunk must be lexed again to report it.
+static void push_indentation(std::vector<Token>& tokens, u32 level, const Tokenizer::FirstIndent& first) {
+    if (first.level > level) {
+        tokens.push_back(Token{Token::Type::Indent, first.offset});
+    }
+
+    for (u32 i = first.level; i < level; ++i) {
+        tokens.push_back(Token{Token::Type::Dedent, first.offset});
+    }
+}
+
+
+namespace {
+
+
+// Where a chunk's tokens and payloads go in the stitched buffer.
+struct Segment {
+    Chunk* chunk;
+    std::vector<Token> indentation;
+    std::vector<Atom> atoms;
+
+    usize token_base;
+    u32 int_base;
+    u32 float_base;
+    u32 string_base;
+    u32 error_base;
+};
+
+
+}
+
+
+static void copy_segment(TokenBuffer& out, const Segment& segment) {
+    const TokenBuffer& in = segment.chunk->tokens;
+    const TokenTables& tables = in.tables;
+
+    usize pos = segment.token_base;
+    for (const auto& token : segment.indentation) {
+        out.types[pos] = token.type;
+        out.offsets[pos] = token.offset;
+        out.payloads[pos] = 0;
+        ++pos;
+    }
+
+    std::copy(in.types.begin(), in.types.end(), out.types.begin() + pos);
+    std::copy(in.offsets.begin(), in.offsets.end(), out.offsets.begin() + pos);
+    for (usize i = 0; i < in.size(); ++i, ++pos) {
+        u32 payload = in.payloads[i];
+        switch (in.types[i]) {
+            case Token::Type::Identifier: payload = segment.atoms[payload]; break;
+            case Token::Type::Int: payload += segment.int_base; break;
+            case Token::Type::Float: payload += segment.float_base; break;
+            case Token::Type::String: payload += segment.string_base; break;
+            case Token::Type::Error: payload += segment.error_base; break;
+            default: break;
+        }
+        out.payloads[pos] = payload;
+    }
+
+    std::copy(tables.ints.begin(), tables.ints.end(), out.tables.ints.begin() + segment.int_base);
+    std::copy(tables.floats.begin(), tables.floats.end(), out.tables.floats.begin() + segment.float_base);
+    std::copy(tables.strings.begin(), tables.strings.end(), out.tables.strings.begin() + segment.string_base);
+    std::copy(tables.errors.begin(), tables.errors.end(), out.tables.errors.begin() + segment.error_base);
+}
+
+
+TokenBuffer tokenize_parallel(std::string_view source, ThreadPool& pool, Interner& interner) {
+    const usize max_chunks = source.size() / min_parallel_chunk_size;
+    if (pool.size() < 2 || max_chunks < 2) {
+        return tokenize_all(source, interner);
+    }
+
+    const auto bounds = split_source(source, std::min(pool.size(), max_chunks));
+    const usize num_chunks = bounds.size() - 1;
+
+    std::vector<Chunk> chunks(num_chunks);
+    for (usize i = 0; i < num_chunks; ++i) {
+        chunks[i].begin = bounds[i];
+        chunks[i].end = bounds[i + 1];
+
+        Tokenizer::ChunkOptions options;
+        options.base_offset = bounds[i];
+        options.is_last = i + 1 == num_chunks;
+        options.defer_first_indent = i != 0;
+        options.speculative = true;
+
+        pool.submit([source, &chunk = chunks[i], options] {
+            lex_chunk(source, chunk, options);
+        });
+    }
+    pool.wait();
+
+    // Stitch sequentially: fix up indentation between chunks, re-lex the
+    // chunks that need it, and lay out where every chunk's output goes.
+    std::vector<Segment> segments;
+    usize num_tokens = 0;
+    usize num_ints = 0;
+    usize num_floats = 0;
+    usize num_strings = 0;
+    usize num_errors = 0;
+    u32 level = 0;
+
+    for (usize i = 0; i < num_chunks;) {
+        Chunk* chunk = &chunks[i];
+        usize next = i + 1;
+        Segment segment = {};
+
+        const bool indent_ok = !chunk->has_first_indent || chunk->first_indent.level <= level + 1;
+        if (chunk->status == Tokenizer::Status::Ok && indent_ok) {
+            if (chunk->has_first_indent) {
+                push_indentation(segment.indentation, level, chunk->first_indent);
+                level = chunk->end_indent_level;
+            } else if (i == 0) {
+                level = chunk->end_indent_level;
+            } else if (next == num_chunks) {
+                // Only comments and blank lines are left, lexed as if at
+                // level 0, so the dedents at the end are emitted here.
+                segment.indentation.assign(level, Token{Token::Type::Dedent, chunk->eof.offset});
+                level = 0;
+            }
+        } else {
+            // The chunk starts outside of a string, since everything before
+            // it has been lexed for real. Lex it again from its real state,
+            // and let a string literal pull in the following chunks.
+            Chunk redo;
+            redo.begin = chunk->begin;
+
+            while (true) {
+                redo.end = chunks[next - 1].end;
+
+                Tokenizer::ChunkOptions options;
+                options.base_offset = redo.begin;
+                options.indent_level = level;
+                options.is_last = next == num_chunks;
+                lex_chunk(source, redo, options);
+
+                if (redo.status != Tokenizer::Status::Straddle) {
+                    break;
+                }
+                redo.tokens = TokenBuffer();
+                ++next;
+            }
+
+            *chunk = std::move(redo);
+            level = chunk->end_indent_level;
+        }
+
+        const TokenTables& tables = chunk->tokens.tables;
+        segment.chunk = chunk;
+        segment.atoms = interner.absorb(*chunk->interner);
+        segment.token_base = num_tokens;
+        segment.int_base = num_ints;
+        segment.float_base = num_floats;
+        segment.string_base = num_strings;
+        segment.error_base = num_errors;
+
+        num_tokens += segment.indentation.size() + chunk->tokens.size();
+        num_ints += tables.ints.size();
+        num_floats += tables.floats.size();
+        num_strings += tables.strings.size();
+        num_errors += tables.errors.size();
+
+        segments.push_back(std::move(segment));
+        i = next;
+    }
+
+    TokenBuffer tokens;
+    tokens.types.resize(num_tokens + 1);
+    tokens.offsets.resize(num_tokens + 1);
+    tokens.payloads.resize(num_tokens + 1);
+    tokens.tables.interner = &interner;
+    tokens.tables.ints.resize(num_ints);
+    tokens.tables.floats.resize(num_floats);
+    tokens.tables.source = source;
+    tokens.tables.strings.resize(num_strings);
+    tokens.tables.errors.resize(num_errors);
+
+    for (const auto& segment : segments) {
+        pool.submit([&tokens, &segment] {
+            copy_segment(tokens, segment);
+        });
+    }
+    pool.wait();
+
+    // Decoded string literals stay where the chunks put them.
+    for (auto& segment : segments) {
+        tokens.tables.arena.absorb(std::move(segment.chunk->tokens.tables.arena));
+    }
+
+    const Token eof = segments.back().chunk->eof;
+    tokens.types[num_tokens] = eof.type;
+    tokens.offsets[num_tokens] = eof.offset;
+    tokens.payloads[num_tokens] = eof.payload;
+    return tokens;
+}
+
+
+}
@@ -0,0 +1,44 @@
+#ifndef KALPA_PARALLEL_TOKENIZER_H
+#define KALPA_PARALLEL_TOKENIZER_H
+
+
+#include <string_view>
+
+#include "defs.h"
+#include "interner.h"
+#include "thread_pool.h"
+#include "tokenizer.h"
+
+
+namespace klp {
+
+
+// Inputs below this size per chunk are not worth splitting.
+constexpr usize min_parallel_chunk_size = 256 * 1024;
+
+
+//
+//  Tokenizes `source` in chunks on `pool`. The result is identical to
+//  tokenize_all(source, interner), atoms included.
+//
+//  The source is split right before newlines. Every chunk is lexed
+//  speculatively with a private interner, assuming it starts outside of a
+//  string literal, and with its first line's indentation deferred. A
+//  sequential pass then emits the Indent/Dedent tokens between chunks and
+//  merges the interners. A chunk whose speculative lexing failed or ran
+//  into a string that continues past its end is lexed again from its
+//  real starting state, together with as many following chunks as the
+//  string needs. Chunks with errors in them are among those, so errors
+//  are reported just like tokenize_all() does.
+//
+TokenBuffer tokenize_parallel(
+    std::string_view source,
+    ThreadPool& pool,
+    Interner& interner = shared_interner()
+);
+
+
+}
+
+
+#endif
@@ -0,0 +1,717 @@
+#include "parser.h"
+
+#include <string_view>
+#include <vector>
+
+
+namespace klp {
+
+
+namespace {
+
+
+//
+//  Binding powers of the Pratt loop. An infix operator takes the operand
+//  on its left if its left power is at least what the caller asked for,
+//  and parses its right operand with its right power. A right power above
+//  the left one makes it left-associative.
+//
+struct BindingPower {
+    u8 left = 0;
+    u8 right = 0;
+};
+
+
+constexpr u8 not_power = 25;          // not a == b is not (a == b)
+constexpr u8 negate_power = 70;       // -x ** 2 is -(x ** 2)
+constexpr u8 application_power = 90;  // f x ** 2 is (f x) ** 2
+
+
+class InfixTable {
+public:
+    constexpr InfixTable() : powers() {
+        using T = Token::Type;
+        left_associative(T::Or, 10);
+        left_associative(T::And, 20);
+        for (const T type : {T::Equal, T::NotEqual, T::Less, T::LessEq, T::Greater, T::GreaterEq, T::In}) {
+            left_associative(type, 30);
+        }
+        left_associative(T::Xor, 40);
+        left_associative(T::Add, 50);
+        left_associative(T::Sub, 50);
+        left_associative(T::Mul, 60);
+        left_associative(T::Div, 60);
+        left_associative(T::IntDiv, 60);
+        powers[static_cast<u8>(T::Pow)] = BindingPower{80, 80};
+    }
+
+    constexpr BindingPower operator[](Token::Type type) const {
+        return powers[static_cast<u8>(type)];
+    }
+
+private:
+    BindingPower powers[static_cast<u8>(Token::Type::Eof) + 1];
+
+    constexpr void left_associative(Token::Type type, u8 power) {
+        powers[static_cast<u8>(type)] = BindingPower{power, static_cast<u8>(power + 1)};
+    }
+};
+
+
+constexpr InfixTable infix_powers;
+
+static_assert(infix_powers[Token::Type::Pow].left > negate_power);
+static_assert(infix_powers[Token::Type::Equal].left > not_power);
+
+
+constexpr bool is_assignment(Token::Type type) {
+    using T = Token::Type;
+    switch (type) {
+        case T::Assign: case T::AddEq: case T::SubEq: case T::MulEq:
+        case T::PowEq: case T::DivEq: case T::IntDivEq: case T::XorEq:
+            return true;
+        default:
+            return false;
+    }
+}
+
+
+// Tokens that start an argument of a call.
+constexpr bool starts_argument(Token::Type type) {
+    using T = Token::Type;
+    return type == T::Identifier || type == T::Int || type == T::Float || type == T::String ||
+        type == T::LeftParen || type == T::LeftBracket;
+}
+
+
+class Parser {
+public:
+    explicit Parser(const TokenBuffer& tokens) :
+        tokens(tokens),
+        types(tokens.types.data()),
+        offsets(tokens.offsets.data()),
+        source(tokens.tables.source),
+        source_base(tokens.tables.source_base)
+    {
+        ast.nodes.reserve(tokens.size());
+        ast.extra.reserve(tokens.size() / 2);
+    }
+
+    Ast run();
+
+private:
+    using T = Token::Type;
+
+    const TokenBuffer& tokens;
+    const T* types;
+    const u32* offsets;
+    std::string_view source;
+    u32 source_base;
+
+    u32 pos = 0;
+    u32 statement_start = 0;
+    bool panicking = false;  // an error was reported and the statement is being abandoned
+    u32 depth = 0;           // of the expression node being built, counted from the statement
+    u32 block_depth = 0;     // indented blocks around the current statement
+    Ast ast;
+    std::vector<u32> scratch;  // items of the lists being parsed, innermost last
+
+    T peek() const {
+        return types[pos];
+    }
+
+    void advance() {
+        if (types[pos] != T::Eof) {
+            ++pos;
+        }
+    }
+
+    // Whether token `i` is the first on its line. Chunks of a larger
+    // source start at a line, so the start of the text counts as one.
+    bool starts_line(u32 i) const {
+        u32 at = offsets[i] - source_base;
+        while (at > 0 && source[at - 1] == ' ') {
+            --at;
+        }
+        return at == 0 || source[at - 1] == '\n';
+    }
+
+    // Whether the current statement has no more tokens.
+    bool line_ended() const {
+        const T type = peek();
+        if (type == T::Eof || type == T::Dedent || type == T::Indent) {
+            return true;
+        }
+        return pos != statement_start && starts_line(pos);
+    }
+
+    // Whether `node` can evaluate to a function, so that arguments after
+    // it make a call. Literals, and operators other than `and` and `or`,
+    // cannot.
+    bool can_call(u32 node) const {
+        const Node& n = ast[node];
+        switch (n.kind) {
+            case NodeKind::Identifier:
+            case NodeKind::Call:
+            case NodeKind::Index:
+            case NodeKind::Attribute:
+                return true;
+            case NodeKind::Binary:
+                return n.op == T::And || n.op == T::Or;
+            default:
+                return false;
+        }
+    }
+
+    u32 add(const Node& node) {
+        ast.nodes.push_back(node);
+        return ast.nodes.size() - 1;
+    }
+
+    // Moves the scratch items from `base` on into a list.
+    u32 add_list(usize base) {
+        const u32 at = ast.extra.size();
+        ast.extra.push_back(scratch.size() - base);
+        ast.extra.insert(ast.extra.end(), scratch.begin() + base, scratch.end());
+        scratch.resize(base);
+        return at;
+    }
+
+    u32 fail(ParseError error);
+    void skip_statement(u32 start);
+    u32 parse_line();
+    u32 parse_statement();
+    u32 parse_simple_statement();
+    u32 parse_block();
+    u32 parse_def();
+    u32 parse_class();
+    u32 parse_let();
+    u32 parse_if();
+    u32 parse_while();
+    u32 parse_for();
+    u32 parse_return();
+    u32 parse_expression(u8 min_power);
+    u32 parse_operators(u8 min_power);
+    u32 parse_prefix();
+    u32 parse_list();
+};
+
+
+// Records an error at the current token, unless one was already reported
+// for this statement or the lexer reported it, and returns an Error node.
+u32 Parser::fail(ParseError error) {
+    if (!panicking && peek() != T::Error) {
+        // Something missing at the end of a line is reported at the last
+        // token of the line rather than at the next one.
+        const u32 at = pos > statement_start && line_ended() ? pos - 1 : pos;
+        ast.diagnostics.push_back(ParseDiagnostic{error, offsets[at]});
+    }
+    panicking = true;
+    return add(Node{NodeKind::Error, T::Eof, pos});
+}
+
+
+// Skips to the next line of the block that the failed statement starting
+// at `start` is in, over any blocks nested in it.
+void Parser::skip_statement(u32 start) {
+    u32 depth = 0;
+    while (true) {
+        const T type = peek();
+        if (type == T::Eof) {
+            return;
+        }
+
+        if (type == T::Dedent) {
+            if (depth == 0) {
+                return;
+            }
+            --depth;
+        } else if (type == T::Indent) {
+            ++depth;
+        } else if (depth == 0 && pos > start && starts_line(pos)) {
+            return;
+        }
+        advance();
+    }
+}
+
+
+u32 Parser::parse_line() {
+    const u32 start = pos;
+    statement_start = pos;
+
+    const u32 node = parse_statement();
+    if (panicking) {
+        skip_statement(start);
+        panicking = false;
+    }
+    return node;
+}
+
+
+u32 Parser::parse_statement() {
+    switch (peek()) {
+        case T::Def: return parse_def();
+        case T::Class: return parse_class();
+        case T::If: return parse_if();
+        case T::While: return parse_while();
+        case T::For: return parse_for();
+        case T::Indent: return fail(ParseError::UnexpectedIndent);
+        default: break;
+    }
+
+    const u32 node = parse_simple_statement();
+    if (!panicking && !line_ended()) {
+        return fail(ParseError::ExpectedLineEnd);
+    }
+    return node;
+}
+
+
+// A statement without a block: let, return, an assignment or an
+// expression.
+u32 Parser::parse_simple_statement() {
+    if (peek() == T::Let) {
+        return parse_let();
+    }
+    if (peek() == T::Return) {
+        return parse_return();
+    }
+
+    const u32 target = parse_expression(0);
+    if (panicking || !is_assignment(peek()) || line_ended()) {
+        return target;
+    }
+
+    const NodeKind kind = ast[target].kind;
+    if (kind != NodeKind::Identifier && kind != NodeKind::Index && kind != NodeKind::Attribute) {
+        return fail(ParseError::InvalidTarget);
+    }
+
+    const u32 op = pos;
+    advance();
+    const u32 value = parse_expression(0);
+    return panicking ? value : add(Node{NodeKind::Assign, types[op], op, target, value});
+}
+
+
+// An indented block, or a single simple statement on the same line, as
+// in `if done: return x`.
+u32 Parser::parse_block() {
+    const u32 first = pos;
+    const usize base = scratch.size();
+
+    if (peek() == T::Indent) {
+        // Left at the Indent, so that skipping the failed statement also
+        // skips the block.
+        if (block_depth == max_block_depth) {
+            return fail(ParseError::BlocksNestedTooDeeply);
+        }
+
+        ++block_depth;
+        advance();
+        while (peek() != T::Dedent && peek() != T::Eof) {
+            const u32 statement = parse_line();
+            scratch.push_back(statement);
+        }
+        advance();
+        --block_depth;
+        return add(Node{NodeKind::Block, T::Eof, first, add_list(base)});
+    }
+
+    if (line_ended()) {
+        return fail(ParseError::ExpectedBlock);
+    }
+
+    const u32 statement = parse_simple_statement();
+    if (panicking) {
+        return statement;
+    }
+    if (!line_ended()) {
+        return fail(ParseError::ExpectedLineEnd);
+    }
+    scratch.push_back(statement);
+    return add(Node{NodeKind::Block, T::Eof, first, add_list(base)});
+}
+
+
+u32 Parser::parse_def() {
+    advance();
+    if (peek() != T::Identifier) {
+        return fail(ParseError::ExpectedName);
+    }
+    const u32 name = pos;
+    advance();
+
+    const usize base = scratch.size();
+    while (peek() == T::Identifier) {
+        scratch.push_back(pos);
+        advance();
+    }
+    const u32 params = add_list(base);
+
+    if (peek() != T::Assign) {
+        return fail(ParseError::ExpectedAssign);
+    }
+    const u32 assign = pos;
+    advance();
+
+    if (peek() == T::Indent || line_ended()) {
+        const u32 body = parse_block();
+        return panicking ? body : add(Node{NodeKind::Def, T::Eof, name, params, body});
+    }
+
+    // `def square x = x * x` returns the expression.
+    const u32 value = parse_expression(0);
+    if (panicking) {
+        return value;
+    }
+    if (!line_ended()) {
+        return fail(ParseError::ExpectedLineEnd);
+    }
+    scratch.push_back(add(Node{NodeKind::Return, T::Eof, assign, value}));
+    const u32 body = add(Node{NodeKind::Block, T::Eof, assign, add_list(base)});
+    return add(Node{NodeKind::Def, T::Eof, name, params, body});
+}
+
+
+u32 Parser::parse_class() {
+    advance();
+    if (peek() != T::Identifier) {
+        return fail(ParseError::ExpectedName);
+    }
+    const u32 name = pos;
+    advance();
+
+    if (peek() != T::Colon) {
+        return fail(ParseError::ExpectedColon);
+    }
+    advance();
+
+    const u32 body = parse_block();
+    return panicking ? body : add(Node{NodeKind::Class, T::Eof, name, body});
+}
+
+
+u32 Parser::parse_let() {
+    advance();
+    if (peek() != T::Identifier) {
+        return fail(ParseError::ExpectedName);
+    }
+    const u32 name = pos;
+    advance();
+
+    if (peek() != T::Assign) {
+        return fail(ParseError::ExpectedAssign);
+    }
+    advance();
+
+    const u32 value = parse_expression(0);
+    return panicking ? value : add(Node{NodeKind::Let, T::Eof, name, value});
+}
+
+
+// Also parses `elif`, as an If in the else branch.
+u32 Parser::parse_if() {
+    const u32 keyword = pos;
+    advance();
+
+    const u32 condition = parse_expression(0);
+    if (panicking) {
+        return condition;
+    }
+    if (peek() != T::Colon) {
+        return fail(ParseError::ExpectedColon);
+    }
+    advance();
+
+    const u32 then = parse_block();
+    if (panicking) {
+        return then;
+    }
+
+    u32 otherwise = Ast::none;
+    if (peek() == T::Elif) {
+        otherwise = parse_if();
+    } else if (peek() == T::Else) {
+        advance();
+        if (peek() != T::Colon) {
+            return fail(ParseError::ExpectedColon);
+        }
+        advance();
+        otherwise = parse_block();
+    }
+    if (panicking) {
+        return otherwise;
+    }
+
+    const u32 branches = ast.extra.size();
+    ast.extra.push_back(then);
+    ast.extra.push_back(otherwise);
+    return add(Node{NodeKind::If, T::Eof, keyword, condition, branches});
+}
+
+
+u32 Parser::parse_while() {
+    const u32 keyword = pos;
+    advance();
+
+    const u32 condition = parse_expression(0);
+    if (panicking) {
+        return condition;
+    }
+    if (peek() != T::Colon) {
+        return fail(ParseError::ExpectedColon);
+    }
+    advance();
+
+    const u32 body = parse_block();
+    return panicking ? body : add(Node{NodeKind::While, T::Eof, keyword, condition, body});
+}
+
+
+u32 Parser::parse_for() {
+    advance();
+    if (peek() != T::Identifier) {
+        return fail(ParseError::ExpectedName);
+    }
+    const u32 variable = pos;
+    advance();
+
+    if (peek() != T::In) {
+        return fail(ParseError::ExpectedIn);
+    }
+    advance();
+
+    const u32 iterable = parse_expression(0);
+    if (panicking) {
+        return iterable;
+    }
+    if (peek() != T::Colon) {
+        return fail(ParseError::ExpectedColon);
+    }
+    advance();
+
+    const u32 body = parse_block();
+    return panicking ? body : add(Node{NodeKind::For, T::Eof, variable, iterable, body});
+}
+
+
+u32 Parser::parse_return() {
+    const u32 keyword = pos;
+    advance();
+
+    u32 value = Ast::none;
+    if (!line_ended()) {
+        value = parse_expression(0);
+        if (panicking) {
+            return value;
+        }
+    }
+    return add(Node{NodeKind::Return, T::Eof, keyword, value});
+}
+
+
+// Each call, and each node an operator wraps around the left operand,
+// takes a level of max_expression_depth. Both left- and right-nested
+// chains count, so the limit bounds the height of the tree.
+u32 Parser::parse_expression(u8 min_power) {
+    const u32 outer_depth = depth;
+    const u32 node = ++depth > max_expression_depth ? fail(ParseError::NestedTooDeeply) : parse_operators(min_power);
+    depth = outer_depth;
+    return node;
+}
+
+
+u32 Parser::parse_operators(u8 min_power) {
+    const u32 start = pos;
+    u32 left = parse_prefix();
+
+    while (!panicking) {
+        const T type = peek();
+        const BindingPower power = infix_powers[type];
+        const bool postfix = type == T::Dot || type == T::LeftBracket;
+        if (!postfix && !starts_argument(type) && power.left == 0) {
+            break;
+        }
+        if (line_ended()) {
+            break;
+        }
+        if (++depth > max_expression_depth) {
+            return fail(ParseError::NestedTooDeeply);
+        }
+
+        if (type == T::Dot) {
+            advance();
+            if (peek() != T::Identifier || line_ended()) {
+                return fail(ParseError::ExpectedName);
+            }
+            left = add(Node{NodeKind::Attribute, T::Eof, pos, left});
+            advance();
+            continue;
+        }
+
+        // a[i] is an index, f [i] a call with a list.
+        const u32 offset = offsets[pos] - source_base;
+        if (type == T::LeftBracket && offset > 0 && source[offset - 1] != ' ') {
+            const u32 bracket = pos;
+            advance();
+            const u32 index = parse_expression(0);
+            if (panicking) {
+                return index;
+            }
+            if (peek() != T::RightBracket) {
+                return fail(ParseError::ExpectedRightBracket);
+            }
+            advance();
+            left = add(Node{NodeKind::Index, T::Eof, bracket, left, index});
+            continue;
+        }
+
+        if (starts_argument(type)) {
+            if (application_power < min_power) {
+                break;
+            }
+            if (!can_call(left)) {
+                return fail(ParseError::ExpectedOperator);
+            }
+
+            const usize base = scratch.size();
+            do {
+                const u32 argument = parse_expression(application_power + 1);
+                if (panicking) {
+                    scratch.resize(base);
+                    return argument;
+                }
+                scratch.push_back(argument);
+            } while (starts_argument(peek()) && !line_ended());
+
+            left = add(Node{NodeKind::Call, T::Eof, start, left, add_list(base)});
+            continue;
+        }
+
+        if (power.left < min_power) {
+            break;
+        }
+
+        const u32 op = pos;
+        advance();
+        const u32 right = parse_expression(power.right);
+        if (panicking) {
+            return right;
+        }
+        left = add(Node{NodeKind::Binary, type, op, left, right});
+    }
+
+    return left;
+}
+
+
+u32 Parser::parse_prefix() {
+    if (line_ended()) {
+        return fail(ParseError::ExpectedExpression);
+    }
+
+    const u32 token = pos;
+    switch (peek()) {
+        case T::Identifier:
+            advance();
+            return add(Node{NodeKind::Identifier, T::Eof, token});
+
+        case T::Int:
+            advance();
+            return add(Node{NodeKind::Int, T::Eof, token});
+
+        case T::Float:
+            advance();
+            return add(Node{NodeKind::Float, T::Eof, token});
+
+        case T::String:
+            advance();
+            return add(Node{NodeKind::String, T::Eof, token});
+
+        case T::LeftParen: {
+            advance();
+            const u32 inner = parse_expression(0);
+            if (panicking) {
+                return inner;
+            }
+            if (peek() != T::RightParen) {
+                return fail(ParseError::ExpectedRightParen);
+            }
+            advance();
+            return inner;
+        }
+
+        case T::LeftBracket:
+            return parse_list();
+
+        case T::Sub:
+        case T::Not: {
+            const T op = peek();
+            advance();
+            const u32 operand = parse_expression(op == T::Sub ? negate_power : not_power);
+            return panicking ? operand : add(Node{NodeKind::Unary, op, token, operand});
+        }
+
+        default:
+            return fail(ParseError::ExpectedExpression);
+    }
+}
+
+
+// [a, b, c], with an optional trailing comma.
+u32 Parser::parse_list() {
+    const u32 bracket = pos;
+    advance();
+
+    const usize base = scratch.size();
+    while (peek() != T::RightBracket && !line_ended()) {
+        const u32 item = parse_expression(0);
+        if (panicking) {
+            scratch.resize(base);
+            return item;
+        }
+        scratch.push_back(item);
+
+        if (peek() != T::Comma) {
+            break;
+        }
+        advance();
+    }
+
+    if (peek() != T::RightBracket) {
+        scratch.resize(base);
+        return fail(ParseError::ExpectedRightBracket);
+    }
+    advance();
+    return add(Node{NodeKind::List, T::Eof, bracket, add_list(base)});
+}
+
+
+Ast Parser::run() {
+    const usize base = scratch.size();
+    while (peek() != T::Eof) {
+        if (peek() == T::Dedent) {
+            advance();
+            continue;
+        }
+        const u32 statement = parse_line();
+        scratch.push_back(statement);
+    }
+
+    ast.root = add(Node{NodeKind::Module, T::Eof, 0, add_list(base)});
+    return std::move(ast);
+}
+
+
+}
+
+
+Ast parse(const TokenBuffer& tokens) {
+    verify(tokens.size() > 0 && tokens.types.back() == Token::Type::Eof, "token buffer does not end with Eof");
+    return Parser(tokens).run();
+}
+
+
+}
@@ -0,0 +1,39 @@
+#ifndef KALPA_PARSER_H
+#define KALPA_PARSER_H
+
+
+#include "ast.h"
+#include "defs.h"
+#include "tokenizer.h"
+
+
+namespace klp {
+
+
+constexpr u32 max_expression_depth = 1000;
+constexpr u32 max_block_depth = 100;
+
+
+//
+//  Parses a module: the tokens of a whole file, or of one declaration from
+//  LazyModule. Line breaks are not tokens, so `tokens.tables.source` must
+//  still hold the text: an expression or statement ends at the first token
+//  that starts a line.
+//
+//  Calls are written by juxtaposition, `f x (y + 1)`, and bind tighter than
+//  any operator. Syntax errors do not stop the parser: the statement is
+//  replaced by an Error node and parsing resumes at the next line of the
+//  same block.
+//
+//  No expression is deeper than max_expression_depth nodes, and no block
+//  is nested in more than max_block_depth others, so that the parser, and
+//  whatever walks the tree recursively after it, stay within the stack on
+//  any input. Deeper ones are errors.
+//
+Ast parse(const TokenBuffer& tokens);
+
+
+}
+
+
+#endif
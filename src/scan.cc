@@ -0,0 +1,552 @@
+#include "scan.h"
+
+#include <cstdlib>
+#include <cstring>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define KALPA_SCAN_X86
+#include <immintrin.h>
+#endif
+
+
+namespace klp {
+
+
+static const char* scalar_skip_spaces(const char* p, const char* end) {
+    while (p < end && *p == ' ') {
+        ++p;
+    }
+    return p;
+}
+
+
+static const char* scalar_skip_ident(const char* p, const char* end) {
+    while (p < end && is_ascii_alnum(*p)) {
+        ++p;
+    }
+    return p;
+}
+
+
+static const char* scalar_skip_digits(const char* p, const char* end) {
+    while (p < end && is_ascii_digit(*p)) {
+        ++p;
+    }
+    return p;
+}
+
+
+static const char* scalar_find_newline(const char* p, const char* end) {
+    while (p < end && *p != '\n') {
+        ++p;
+    }
+    return p;
+}
+
+
+static const char* scalar_find_string_special(const char* p, const char* end) {
+    while (p < end && *p != '"' && *p != '\\') {
+        ++p;
+    }
+    return p;
+}
+
+
+static usize scalar_count_newlines(const char* p, const char* end) {
+    usize count = 0;
+    for (; p < end; ++p) {
+        count += *p == '\n';
+    }
+    return count;
+}
+
+
+static const char* scalar_validate_utf8(const char* p, const char* end) {
+    while (p < end) {
+        if (static_cast<u8>(*p) < 0x80) {
+            ++p;
+            continue;
+        }
+
+        const u32 size = decode_utf8(p, end).size;
+        if (size == 0) {
+            return p;
+        }
+        p += size;
+    }
+    return p;
+}
+
+
+// Line starts in [p, end), as offsets from `begin`.
+static u32* scalar_line_starts_from(const char* begin, const char* p, const char* end, u32* out) {
+    for (; p < end; ++p) {
+        if (*p == '\n') {
+            *out++ = p - begin + 1;
+        }
+    }
+    return out;
+}
+
+
+static u32* scalar_line_starts(const char* begin, const char* end, u32* out) {
+    return scalar_line_starts_from(begin, begin, end, out);
+}
+
+
+static const ScanKernels scalar_kernels = {
+    "scalar",
+    scalar_skip_spaces,
+    scalar_skip_ident,
+    scalar_skip_digits,
+    scalar_find_newline,
+    scalar_find_string_special,
+    scalar_count_newlines,
+    scalar_validate_utf8,
+    scalar_line_starts,
+};
+
+
+#ifdef KALPA_SCAN_X86
+
+
+//
+//  All vector kernels share one shape: classify a whole block into a bit
+//  mask of bytes that end the run, stop at its lowest set bit, and finish
+//  the last partial block with the scalar kernel.
+//
+#define KALPA_SCAN_KERNEL(isa, name, vec, load, movemask, width, stop) \
+    static const char* isa ## _ ## name(const char* p, const char* end) { \
+        while (end - p >= width) { \
+            const vec v = load(reinterpret_cast<const vec*>(p)); \
+            const u32 mask = static_cast<u32>(movemask(stop)); \
+            if (mask) { \
+                return p + __builtin_ctz(mask); \
+            } \
+            p += width; \
+        } \
+        return scalar_ ## name(p, end); \
+    }
+
+
+//
+//  Newline kernels look at every byte instead of stopping at the first
+//  match: they turn each block into a mask of '\n' bytes and count its bits
+//  or walk them.
+//
+#define KALPA_NEWLINE_KERNELS(attr, isa, vec, load, movemask, width, newlines) \
+    attr static usize isa ## _count_newlines(const char* p, const char* end) { \
+        usize count = 0; \
+        for (; end - p >= width; p += width) { \
+            const vec v = load(reinterpret_cast<const vec*>(p)); \
+            count += __builtin_popcount(static_cast<u32>(movemask(newlines))); \
+        } \
+        return count + scalar_count_newlines(p, end); \
+    } \
+    \
+    attr static u32* isa ## _line_starts(const char* begin, const char* end, u32* out) { \
+        const char* p = begin; \
+        for (; end - p >= width; p += width) { \
+            const vec v = load(reinterpret_cast<const vec*>(p)); \
+            u32 mask = static_cast<u32>(movemask(newlines)); \
+            const u32 offset = p - begin + 1; \
+            for (; mask; mask &= mask - 1) { \
+                *out++ = offset + __builtin_ctz(mask); \
+            } \
+        } \
+        return scalar_line_starts_from(begin, p, end, out); \
+    }
+
+
+static inline __m128i sse2_in_range(__m128i v, char lo, char hi) {
+    return _mm_and_si128(
+        _mm_cmpgt_epi8(v, _mm_set1_epi8(lo - 1)),
+        _mm_cmplt_epi8(v, _mm_set1_epi8(hi + 1))
+    );
+}
+
+
+static inline __m128i sse2_ident_mask(__m128i v) {
+    const __m128i lower = _mm_or_si128(v, _mm_set1_epi8(0x20));
+    return _mm_or_si128(
+        sse2_in_range(lower, 'a', 'z'),
+        sse2_in_range(v, '0', '9')
+    );
+}
+
+
+#define KALPA_SSE2_KERNEL(name, stop) \
+    KALPA_SCAN_KERNEL( \
+        sse2, name, __m128i, _mm_loadu_si128, _mm_movemask_epi8, 16, stop \
+    )
+
+KALPA_SSE2_KERNEL(skip_spaces,
+    _mm_xor_si128(
+        _mm_cmpeq_epi8(v, _mm_set1_epi8(' ')), _mm_set1_epi8(-1)
+    )
+)
+
+KALPA_SSE2_KERNEL(skip_ident,
+    _mm_xor_si128(sse2_ident_mask(v), _mm_set1_epi8(-1))
+)
+
+KALPA_SSE2_KERNEL(skip_digits,
+    _mm_xor_si128(sse2_in_range(v, '0', '9'), _mm_set1_epi8(-1))
+)
+
+KALPA_SSE2_KERNEL(find_newline,
+    _mm_cmpeq_epi8(v, _mm_set1_epi8('\n'))
+)
+
+KALPA_SSE2_KERNEL(find_string_special,
+    _mm_or_si128(
+        _mm_cmpeq_epi8(v, _mm_set1_epi8('"')),
+        _mm_cmpeq_epi8(v, _mm_set1_epi8('\\'))
+    )
+)
+
+#undef KALPA_SSE2_KERNEL
+
+KALPA_NEWLINE_KERNELS(,
+    sse2, __m128i, _mm_loadu_si128, _mm_movemask_epi8, 16,
+    _mm_cmpeq_epi8(v, _mm_set1_epi8('\n'))
+)
+
+
+// SSE2 has no byte shuffle for the table lookups of the AVX2 kernel, so
+// it only skips ASCII blocks and decodes the others one by one.
+static const char* sse2_validate_utf8(const char* p, const char* end) {
+    while (end - p >= 16) {
+        const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+        if (_mm_movemask_epi8(v) == 0) {
+            p += 16;
+            continue;
+        }
+
+        const char* const block_end = p + 16;
+        while (p < block_end) {
+            const u32 size = decode_utf8(p, end).size;
+            if (size == 0) {
+                return p;
+            }
+            p += size;
+        }
+    }
+    return scalar_validate_utf8(p, end);
+}
+
+
+static const ScanKernels sse2_kernels = {
+    "sse2",
+    sse2_skip_spaces,
+    sse2_skip_ident,
+    sse2_skip_digits,
+    sse2_find_newline,
+    sse2_find_string_special,
+    sse2_count_newlines,
+    sse2_validate_utf8,
+    sse2_line_starts,
+};
+
+
+// Every CPU with AVX2 also has POPCNT.
+#define KALPA_AVX2 __attribute__((target("avx2,popcnt")))
+
+
+KALPA_AVX2
+static inline __m256i avx2_in_range(__m256i v, char lo, char hi) {
+    return _mm256_and_si256(
+        _mm256_cmpgt_epi8(v, _mm256_set1_epi8(lo - 1)),
+        _mm256_cmpgt_epi8(_mm256_set1_epi8(hi + 1), v)
+    );
+}
+
+
+KALPA_AVX2
+static inline __m256i avx2_ident_mask(__m256i v) {
+    const __m256i lower = _mm256_or_si256(v, _mm256_set1_epi8(0x20));
+    return _mm256_or_si256(
+        avx2_in_range(lower, 'a', 'z'),
+        avx2_in_range(v, '0', '9')
+    );
+}
+
+
+#define KALPA_AVX2_KERNEL(name, stop) \
+    KALPA_AVX2 KALPA_SCAN_KERNEL( \
+        avx2, name, __m256i, _mm256_loadu_si256, _mm256_movemask_epi8, \
+        32, stop \
+    )
+
+KALPA_AVX2_KERNEL(skip_spaces,
+    _mm256_xor_si256(
+        _mm256_cmpeq_epi8(v, _mm256_set1_epi8(' ')), _mm256_set1_epi8(-1)
+    )
+)
+
+KALPA_AVX2_KERNEL(skip_ident,
+    _mm256_xor_si256(avx2_ident_mask(v), _mm256_set1_epi8(-1))
+)
+
+KALPA_AVX2_KERNEL(skip_digits,
+    _mm256_xor_si256(avx2_in_range(v, '0', '9'), _mm256_set1_epi8(-1))
+)
+
+KALPA_AVX2_KERNEL(find_newline,
+    _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\n'))
+)
+
+KALPA_AVX2_KERNEL(find_string_special,
+    _mm256_or_si256(
+        _mm256_cmpeq_epi8(v, _mm256_set1_epi8('"')),
+        _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\\'))
+    )
+)
+
+#undef KALPA_AVX2_KERNEL
+
+KALPA_NEWLINE_KERNELS(KALPA_AVX2,
+    avx2, __m256i, _mm256_loadu_si256, _mm256_movemask_epi8, 32,
+    _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\n'))
+)
+
+//
+//  UTF-8 validation after Keiser and Lemire, "Validating UTF-8 in less
+//  than one instruction per byte", as in simdjson and simdutf. Every
+//  error shows up in a pair of adjacent bytes: three 16-entry tables,
+//  indexed by the high and low nibble of the first byte and the high
+//  nibble of the second, give bit sets of the errors each one allows,
+//  and an error is a bit that survives all three. The third and fourth
+//  bytes of long sequences are checked against the byte two or three
+//  back. ASCII blocks are only checked for a sequence left open before.
+//
+//  The kernel only tells whether a block has an error. To report the
+//  first one exactly, the scalar kernel takes over from the start of the
+//  character the block begins in.
+//
+namespace utf8_errors {
+    constexpr u8 too_short = 1 << 0;       // lead byte not followed by a continuation
+    constexpr u8 too_long = 1 << 1;        // continuation after ASCII
+    constexpr u8 overlong_3 = 1 << 2;
+    constexpr u8 too_large = 1 << 3;
+    constexpr u8 surrogate = 1 << 4;
+    constexpr u8 overlong_2 = 1 << 5;
+    constexpr u8 too_large_1000 = 1 << 6;
+    constexpr u8 overlong_4 = 1 << 6;
+    constexpr u8 two_conts = 1 << 7;       // a continuation after a continuation
+    constexpr u8 carry = too_short | too_long | two_conts;
+}
+
+
+// The bytes of `input` moved up by N, with the last N of `prev` in front.
+template <int N>
+KALPA_AVX2
+static inline __m256i avx2_prev(__m256i input, __m256i prev) {
+    return _mm256_alignr_epi8(input, _mm256_permute2x128_si256(prev, input, 0x21), 16 - N);
+}
+
+
+KALPA_AVX2
+static inline __m256i avx2_high_nibbles(__m256i v) {
+    return _mm256_and_si256(_mm256_srli_epi16(v, 4), _mm256_set1_epi8(0x0f));
+}
+
+
+#define KALPA_TABLE16(...) _mm256_setr_epi8(__VA_ARGS__, __VA_ARGS__)
+
+
+KALPA_AVX2
+static inline __m256i avx2_utf8_errors(__m256i input, __m256i prev_input) {
+    using namespace utf8_errors;
+
+    const __m256i prev1 = avx2_prev<1>(input, prev_input);
+    const __m256i byte_1_high = _mm256_shuffle_epi8(KALPA_TABLE16(
+        // 0_______ ASCII
+        too_long, too_long, too_long, too_long, too_long, too_long, too_long, too_long,
+        // 10______ continuation
+        two_conts, two_conts, two_conts, two_conts,
+        // 1100____, 1101____ two-byte lead
+        too_short | overlong_2,
+        too_short,
+        // 1110____ three-byte lead
+        too_short | overlong_3 | surrogate,
+        // 1111____ four-byte lead
+        too_short | too_large | too_large_1000 | overlong_4
+    ), avx2_high_nibbles(prev1));
+
+    const __m256i byte_1_low = _mm256_shuffle_epi8(KALPA_TABLE16(
+        carry | overlong_3 | overlong_2 | overlong_4,  // ____0000
+        carry | overlong_2,                            // ____0001
+        carry,                                         // ____001_
+        carry,
+        carry | too_large,                             // ____0100
+        carry | too_large | too_large_1000,            // ____0101 and up
+        carry | too_large | too_large_1000,
+        carry | too_large | too_large_1000,
+        carry | too_large | too_large_1000,
+        carry | too_large | too_large_1000,
+        carry | too_large | too_large_1000,
+        carry | too_large | too_large_1000,
+        carry | too_large | too_large_1000,
+        carry | too_large | too_large_1000 | surrogate,  // ____1101
+        carry | too_large | too_large_1000,
+        carry | too_large | too_large_1000
+    ), _mm256_and_si256(prev1, _mm256_set1_epi8(0x0f)));
+
+    const __m256i byte_2_high = _mm256_shuffle_epi8(KALPA_TABLE16(
+        // 0_______ ASCII
+        too_short, too_short, too_short, too_short, too_short, too_short, too_short, too_short,
+        // 1000____
+        too_long | overlong_2 | two_conts | overlong_3 | too_large_1000 | overlong_4,
+        // 1001____
+        too_long | overlong_2 | two_conts | overlong_3 | too_large,
+        // 101_____
+        too_long | overlong_2 | two_conts | surrogate | too_large,
+        too_long | overlong_2 | two_conts | surrogate | too_large,
+        // 11______ lead
+        too_short, too_short, too_short, too_short
+    ), avx2_high_nibbles(input));
+
+    const __m256i special_cases = _mm256_and_si256(_mm256_and_si256(byte_1_high, byte_1_low), byte_2_high);
+
+    // Bytes that must be the third or fourth of a sequence have 0x80 set
+    // here, and two_conts marked them in special_cases; they must agree.
+    const __m256i is_third = _mm256_subs_epu8(avx2_prev<2>(input, prev_input), _mm256_set1_epi8(0xe0 - 0x80));
+    const __m256i is_fourth = _mm256_subs_epu8(avx2_prev<3>(input, prev_input), _mm256_set1_epi8(0xf0 - 0x80));
+    const __m256i must_be_continuation = _mm256_and_si256(
+        _mm256_or_si256(is_third, is_fourth), _mm256_set1_epi8(static_cast<char>(0x80))
+    );
+    return _mm256_xor_si256(must_be_continuation, special_cases);
+}
+
+
+#undef KALPA_TABLE16
+
+
+// Start of the character that `p`, the start of a block after a
+// validated one, is inside of.
+static const char* utf8_character_start(const char* begin, const char* p) {
+    for (isize back = 1; back <= 3 && p - back >= begin; ++back) {
+        const u8 c = static_cast<u8>(p[-back]);
+        if (c < 0x80) {
+            break;
+        }
+        if (c >= 0xc0) {
+            const isize size = c >= 0xf0 ? 4 : c >= 0xe0 ? 3 : 2;
+            return size > back ? p - back : p;
+        }
+    }
+    return p;
+}
+
+
+KALPA_AVX2
+static const char* avx2_validate_utf8(const char* begin, const char* end) {
+    // Nonzero where the last bytes of a block start a sequence that does
+    // not fit in it.
+    const __m256i incomplete_limits = _mm256_setr_epi8(
+        -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+        -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+        static_cast<char>(0xf0 - 1), static_cast<char>(0xe0 - 1), static_cast<char>(0xc0 - 1)
+    );
+
+    const char* p = begin;
+    __m256i prev_input = _mm256_setzero_si256();
+    __m256i prev_incomplete = _mm256_setzero_si256();
+
+    for (; end - p >= 32; p += 32) {
+        const __m256i input = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+        __m256i error = prev_incomplete;
+        if (_mm256_movemask_epi8(input) != 0) {
+            error = avx2_utf8_errors(input, prev_input);
+            prev_incomplete = _mm256_subs_epu8(input, incomplete_limits);
+        }
+
+        if (!_mm256_testz_si256(error, error)) {
+            break;
+        }
+        prev_input = input;
+    }
+
+    return scalar_validate_utf8(utf8_character_start(begin, p), end);
+}
+
+
+#undef KALPA_AVX2
+
+
+static const ScanKernels avx2_kernels = {
+    "avx2",
+    avx2_skip_spaces,
+    avx2_skip_ident,
+    avx2_skip_digits,
+    avx2_find_newline,
+    avx2_find_string_special,
+    avx2_count_newlines,
+    avx2_validate_utf8,
+    avx2_line_starts,
+};
+
+
+#undef KALPA_NEWLINE_KERNELS
+#undef KALPA_SCAN_KERNEL
+
+
+#endif
+
+
+const ScanKernels* scan_kernels_for(ScanIsa isa) {
+    switch (isa) {
+        case ScanIsa::Scalar:
+            return &scalar_kernels;
+
+#ifdef KALPA_SCAN_X86
+        case ScanIsa::Sse2:
+            return &sse2_kernels;
+
+        case ScanIsa::Avx2:
+            return __builtin_cpu_supports("avx2") ? &avx2_kernels : nullptr;
+#else
+        case ScanIsa::Sse2:
+        case ScanIsa::Avx2:
+            return nullptr;
+#endif
+    }
+
+    return nullptr;
+}
+
+
+static const ScanKernels* select_scan_kernels() {
+    if (const char* forced = std::getenv("KALPA_SCAN")) {
+        const ScanKernels* kernels = nullptr;
+        if (std::strcmp(forced, "scalar") == 0) {
+            kernels = scan_kernels_for(ScanIsa::Scalar);
+        } else if (std::strcmp(forced, "sse2") == 0) {
+            kernels = scan_kernels_for(ScanIsa::Sse2);
+        } else if (std::strcmp(forced, "avx2") == 0) {
+            kernels = scan_kernels_for(ScanIsa::Avx2);
+        }
+
+        if (kernels) {
+            return kernels;
+        }
+    }
+
+    for (const auto isa : {ScanIsa::Avx2, ScanIsa::Sse2}) {
+        if (const auto kernels = scan_kernels_for(isa)) {
+            return kernels;
+        }
+    }
+
+    return &scalar_kernels;
+}
+
+
+const ScanKernels& scan_kernels() {
+    static const ScanKernels* const kernels = select_scan_kernels();
+    return *kernels;
+}
+
+
+}
@@ -0,0 +1,141 @@
+#ifndef KALPA_SCAN_H
+#define KALPA_SCAN_H
+
+
+#include "defs.h"
+
+
+namespace klp {
+
+
+//
+//  Locale-independent ASCII character classes. The tokenizer only accepts
+//  ASCII identifiers and digits, and these never go through the C locale.
+//
+constexpr bool is_ascii_digit(char c) {
+    return c >= '0' && c <= '9';
+}
+
+constexpr bool is_ascii_alpha(char c) {
+    return (c | 0x20) >= 'a' && (c | 0x20) <= 'z';
+}
+
+constexpr bool is_ascii_alnum(char c) {
+    return is_ascii_alpha(c) || is_ascii_digit(c);
+}
+
+
+struct Utf8Char {
+    u32 code_point;
+    u32 size;  // 0 if the bytes are not valid UTF-8
+};
+
+
+//
+//  Decodes the character at `p`, which must be before `end`. Overlong
+//  forms, surrogates, code points past U+10FFFF and truncated sequences
+//  are invalid.
+//
+constexpr Utf8Char decode_utf8(const char* p, const char* end) {
+    const u8 lead = static_cast<u8>(p[0]);
+    if (lead < 0x80) {
+        return Utf8Char{lead, 1};
+    }
+
+    u32 size = 0;
+    u32 code_point = 0;
+    u32 min_code_point = 0;
+    if (lead >= 0xc2 && lead <= 0xdf) {
+        size = 2;
+        code_point = lead & 0x1f;
+        min_code_point = 0x80;
+    } else if (lead >= 0xe0 && lead <= 0xef) {
+        size = 3;
+        code_point = lead & 0x0f;
+        min_code_point = 0x800;
+    } else if (lead >= 0xf0 && lead <= 0xf4) {
+        size = 4;
+        code_point = lead & 0x07;
+        min_code_point = 0x10000;
+    } else {
+        return Utf8Char{0, 0};
+    }
+
+    if (end - p < static_cast<isize>(size)) {
+        return Utf8Char{0, 0};
+    }
+    for (u32 i = 1; i < size; ++i) {
+        const u8 c = static_cast<u8>(p[i]);
+        if ((c & 0xc0) != 0x80) {
+            return Utf8Char{0, 0};
+        }
+        code_point = code_point << 6 | (c & 0x3f);
+    }
+
+    if (code_point < min_code_point || code_point > 0x10ffff || (code_point >= 0xd800 && code_point <= 0xdfff)) {
+        return Utf8Char{0, 0};
+    }
+    return Utf8Char{code_point, size};
+}
+
+
+//
+//  Byte scanning kernels. Each kernel takes a [begin, end) range and, unless
+//  noted otherwise, returns a pointer to the first byte that ends the run,
+//  or `end` if the run reaches the end of the range. Kernels never read
+//  past `end`.
+//
+struct ScanKernels {
+    const char* name;
+
+    // First byte that is not ' '.
+    const char* (*skip_spaces)(const char* begin, const char* end);
+
+    // First byte that is not [A-Za-z0-9].
+    const char* (*skip_ident)(const char* begin, const char* end);
+
+    // First byte that is not [0-9].
+    const char* (*skip_digits)(const char* begin, const char* end);
+
+    // First '\n'.
+    const char* (*find_newline)(const char* begin, const char* end);
+
+    // First '"' or '\\'.
+    const char* (*find_string_special)(const char* begin, const char* end);
+
+    // Number of '\n' bytes.
+    usize (*count_newlines)(const char* begin, const char* end);
+
+    // First byte of the first character that is not valid UTF-8, as
+    // decode_utf8() defines it.
+    const char* (*validate_utf8)(const char* begin, const char* end);
+
+    // Writes the offset from `begin` of the byte after every '\n' to `out`,
+    // which must have room for count_newlines() of them, and returns the
+    // end of what it wrote.
+    u32* (*line_starts)(const char* begin, const char* end, u32* out);
+};
+
+
+enum class ScanIsa {
+    Scalar,
+    Sse2,
+    Avx2,
+};
+
+
+// Returns nullptr if the ISA is not supported by this build or this CPU.
+const ScanKernels* scan_kernels_for(ScanIsa isa);
+
+
+//
+//  The best kernels for the running CPU, selected once on first use. The
+//  selection can be overridden with KALPA_SCAN=scalar|sse2|avx2.
+//
+const ScanKernels& scan_kernels();
+
+
+}
+
+
+#endif
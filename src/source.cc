@@ -0,0 +1,196 @@
+#include "source.h"
+
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <limits>
+#include <utility>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "print.h"
+
+
+namespace klp {
+
+
+static void report_file_error(const std::string& path, std::string* error) {
+    std::string message = format("Error: {}: {}\n", path, std::strerror(errno));
+    if (error) {
+        *error = std::move(message);
+    } else {
+        eprint("{}", message);
+    }
+}
+
+
+// Token offsets are u32, so a source must fit in that range.
+static constexpr usize max_source_size = std::numeric_limits<u32>::max() - SourceFile::padding;
+
+
+SourceFile::SourceFile(SourceFile&& other) noexcept :
+    file_path(std::move(other.file_path)),
+    data(std::exchange(other.data, nullptr)),
+    size(std::exchange(other.size, 0)),
+    mapped_size(std::exchange(other.mapped_size, 0))
+{}
+
+
+SourceFile& SourceFile::operator=(SourceFile&& other) noexcept {
+    if (this != &other) {
+        release();
+        file_path = std::move(other.file_path);
+        data = std::exchange(other.data, nullptr);
+        size = std::exchange(other.size, 0);
+        mapped_size = std::exchange(other.mapped_size, 0);
+    }
+
+    return *this;
+}
+
+
+SourceFile::~SourceFile() {
+    release();
+}
+
+
+void SourceFile::release() {
+    if (mapped_size) {
+        munmap(data, mapped_size);
+    } else {
+        std::free(data);
+    }
+
+    data = nullptr;
+    size = 0;
+    mapped_size = 0;
+}
+
+
+std::optional<SourceFile> SourceFile::open(const char* path, std::string* error) {
+    std::optional<SourceFile> ret;
+    SourceFile file(path);
+
+    const bool is_stdin = std::strcmp(path, "-") == 0;
+    const int fd = is_stdin ? STDIN_FILENO : ::open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        report_file_error(file.file_path, error);
+        return ret;
+    }
+
+    struct stat st;
+    bool ok = fstat(fd, &st) == 0;
+    if (ok) {
+        if (S_ISREG(st.st_mode) && st.st_size > 0) {
+            ok = file.map(fd, st.st_size) || file.read_all(fd);
+        } else {
+            ok = file.read_all(fd);
+        }
+    }
+
+    if (!ok) {
+        report_file_error(file.file_path, error);
+    }
+
+    if (!is_stdin) {
+        close(fd);
+    }
+
+    if (ok) {
+        ret = std::move(file);
+    }
+    return ret;
+}
+
+
+SourceFile SourceFile::from_string(std::string_view text, std::string path) {
+    SourceFile file(std::move(path));
+    file.data = static_cast<char*>(std::calloc(text.size() + padding, 1));
+    verify(file.data != nullptr, "out of memory");
+    std::memcpy(file.data, text.data(), text.size());
+    file.size = text.size();
+    return file;
+}
+
+
+bool SourceFile::map(int fd, usize file_size) {
+    if (file_size > max_source_size) {
+        errno = EFBIG;
+        return false;
+    }
+
+    // Reserve the file plus padding as zeroed anonymous memory, then map
+    // the file over its head. The padding stays zero even when the file
+    // ends exactly on a page boundary.
+    const usize page = sysconf(_SC_PAGESIZE);
+    const usize total = (file_size + padding + page - 1) / page * page;
+
+    void* reserved = mmap(nullptr, total, PROT_READ, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (reserved == MAP_FAILED) {
+        return false;
+    }
+
+    void* mapped = mmap(reserved, file_size, PROT_READ, MAP_PRIVATE | MAP_FIXED, fd, 0);
+    if (mapped == MAP_FAILED) {
+        munmap(reserved, total);
+        return false;
+    }
+
+    madvise(mapped, file_size, MADV_SEQUENTIAL);
+
+    data = static_cast<char*>(mapped);
+    size = file_size;
+    mapped_size = total;
+    return true;
+}
+
+
+bool SourceFile::read_all(int fd) {
+    usize capacity = 64 * 1024;
+    usize used = 0;
+    char* buffer = static_cast<char*>(std::malloc(capacity));
+
+    while (buffer) {
+        if (capacity - used <= padding) {
+            capacity *= 2;
+            char* grown = static_cast<char*>(std::realloc(buffer, capacity));
+            if (!grown) {
+                break;
+            }
+            buffer = grown;
+        }
+
+        const ssize_t n = ::read(fd, buffer + used, capacity - used - padding);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            std::free(buffer);
+            return false;
+        }
+
+        if (n == 0) {
+            std::memset(buffer + used, 0, padding);
+            data = buffer;
+            size = used;
+            return true;
+        }
+
+        used += n;
+        if (used > max_source_size) {
+            std::free(buffer);
+            errno = EFBIG;
+            return false;
+        }
+    }
+
+    std::free(buffer);
+    errno = ENOMEM;
+    return false;
+}
+
+
+}
@@ -0,0 +1,73 @@
+#ifndef KALPA_SOURCE_H
+#define KALPA_SOURCE_H
+
+
+#include <optional>
+#include <string>
+#include <string_view>
+
+#include "defs.h"
+
+
+namespace klp {
+
+
+//
+//  Read-only contents of a source file. Regular files are memory-mapped;
+//  pipes, terminals and stdin ("-") are read into a buffer.
+//
+//  Either way `text()` is followed by at least `padding` zero bytes, so
+//  text().data()[text().size()] is a '\0' sentinel and vector kernels may
+//  load a full block starting anywhere inside the text.
+//
+class SourceFile {
+public:
+    static constexpr usize padding = 64;
+
+public:
+    SourceFile(const SourceFile&) = delete;
+    SourceFile& operator=(const SourceFile&) = delete;
+
+    SourceFile(SourceFile&& other) noexcept;
+    SourceFile& operator=(SourceFile&& other) noexcept;
+
+    ~SourceFile();
+
+    // Prints an error and returns nothing if the file cannot be read. With
+    // `error`, the message is stored there instead of printed.
+    static std::optional<SourceFile> open(const char* path, std::string* error = nullptr);
+
+    // Copies `text` into a padded buffer.
+    static SourceFile from_string(std::string_view text, std::string path = "<string>");
+
+    std::string_view text() const {
+        return std::string_view(data, size);
+    }
+
+    const std::string& path() const {
+        return file_path;
+    }
+
+    bool is_mapped() const {
+        return mapped_size != 0;
+    }
+
+private:
+    std::string file_path;
+    char* data = nullptr;
+    usize size = 0;
+    usize mapped_size = 0;  // 0 if `data` was allocated with malloc
+
+    explicit SourceFile(std::string path) : file_path(std::move(path)) {}
+
+    void release();
+
+    bool map(int fd, usize file_size);
+    bool read_all(int fd);
+};
+
+
+}
+
+
+#endif
@@ -0,0 +1,70 @@
+#include "source_manager.h"
+
+#include <algorithm>
+#include <limits>
+
+#include "scan.h"
+
+
+namespace klp {
+
+
+static std::vector<u32> build_line_starts(std::string_view text) {
+    const ScanKernels& scan = scan_kernels();
+    const char* const begin = text.data();
+    const char* const end = begin + text.size();
+
+    std::vector<u32> line_starts(1 + scan.count_newlines(begin, end));
+    line_starts[0] = 0;
+    scan.line_starts(begin, end, line_starts.data() + 1);
+    return line_starts;
+}
+
+
+std::optional<u32> SourceManager::add(SourceFile file) {
+    const u64 base = next_base;
+    if (base + file.text().size() >= std::numeric_limits<u32>::max()) {
+        eprint("Error: {}: sources exceed the 4 GiB offset space\n", file.path());
+        return std::nullopt;
+    }
+
+    auto line_starts = build_line_starts(file.text());
+    next_base = base + file.text().size() + 1;
+    bases.push_back(base);
+    files.push_back(Entry{std::move(file), std::move(line_starts)});
+    return base;
+}
+
+
+usize SourceManager::file_index(u32 offset) const {
+    verify(!bases.empty() && offset < next_base, "offset outside of every source file");
+    return std::upper_bound(bases.begin(), bases.end(), offset) - bases.begin() - 1;
+}
+
+
+SourceLocation SourceManager::locate(u32 offset) const {
+    const usize index = file_index(offset);
+    const Entry& entry = files[index];
+    const u32 local = offset - bases[index];
+
+    // The line is the number of line starts at or before `local`.
+    const auto& starts = entry.line_starts;
+    const usize line = std::upper_bound(starts.begin(), starts.end(), local) - starts.begin();
+    return SourceLocation{&entry.file, static_cast<u32>(line), local - starts[line - 1] + 1};
+}
+
+
+std::string_view SourceManager::line_text(u32 offset) const {
+    const usize index = file_index(offset);
+    const Entry& entry = files[index];
+    const u32 local = offset - bases[index];
+
+    const auto& starts = entry.line_starts;
+    const auto next = std::upper_bound(starts.begin(), starts.end(), local);
+    const u32 begin = next[-1];
+    const u32 end = next == starts.end() ? entry.file.text().size() : *next - 1;
+    return entry.file.text().substr(begin, end - begin);
+}
+
+
+}
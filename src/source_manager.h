@@ -0,0 +1,74 @@
+#ifndef KALPA_SOURCE_MANAGER_H
+#define KALPA_SOURCE_MANAGER_H
+
+
+#include <deque>
+#include <optional>
+#include <string_view>
+#include <vector>
+
+#include "defs.h"
+#include "source.h"
+
+
+namespace klp {
+
+
+struct SourceLocation {
+    const SourceFile* file;
+    u32 line;    // 1-based
+    u32 column;  // 1-based, in bytes
+};
+
+
+//
+//  The source files of one run, laid out one after another in a single
+//  u32 offset space, so that a token position stays 4 bytes no matter how
+//  many files there are. A file covers [base, base + size]; the extra
+//  offset is where its Eof token goes.
+//
+//  Every file gets a table of its line starts when it is added. Turning an
+//  offset into a location is then two binary searches, never a rescan.
+//
+class SourceManager {
+public:
+    // Takes `file` and returns its base offset. Prints an error and
+    // returns nothing if the offset space is exhausted.
+    std::optional<u32> add(SourceFile file);
+
+    usize num_files() const {
+        return files.size();
+    }
+
+    const SourceFile& file(usize index) const {
+        return files[index].file;
+    }
+
+    u32 base(usize index) const {
+        return bases[index];
+    }
+
+    // Index of the file that covers `offset`.
+    usize file_index(u32 offset) const;
+
+    SourceLocation locate(u32 offset) const;
+
+    // Text of the line holding `offset`, without its '\n'.
+    std::string_view line_text(u32 offset) const;
+
+private:
+    struct Entry {
+        SourceFile file;
+        std::vector<u32> line_starts;  // offsets in the file, starting with 0
+    };
+
+    std::deque<Entry> files;  // stable addresses for SourceLocation::file
+    std::vector<u32> bases;
+    u64 next_base = 0;
+};
+
+
+}
+
+
+#endif
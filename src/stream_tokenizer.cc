@@ -0,0 +1,153 @@
+#include "stream_tokenizer.h"
+
+#include <cerrno>
+#include <cstring>
+#include <limits>
+
+#include <unistd.h>
+
+#include "print.h"
+#include "scan.h"
+#include "unicode.h"
+
+
+namespace klp {
+
+
+StreamTokenizer::StreamTokenizer(int fd, Interner& interner, usize buffer_size) :
+    fd(fd),
+    interner(&interner),
+    buffer(std::max<usize>(buffer_size, 1))
+{}
+
+
+// Moves the unconsumed input to the front of the buffer, doubles the
+// buffer if that input fills it, and reads until the buffer is full or
+// the input ends.
+bool StreamTokenizer::fill() {
+    if (begin > 0) {
+        std::memmove(buffer.data(), buffer.data() + begin, filled - begin);
+        buffer_offset += begin;
+        filled -= begin;
+        chunk_begin = 0;
+        begin = 0;
+    }
+
+    if (filled == buffer.size()) {
+        buffer.resize(buffer.size() * 2);
+    }
+
+    while (filled < buffer.size() && !at_eof) {
+        const ssize_t n = ::read(fd, buffer.data() + filled, buffer.size() - filled);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            eprint("Error: cannot read input: {}\n", std::strerror(errno));
+            return false;
+        }
+
+        at_eof = n == 0;
+        filled += n;
+    }
+
+    if (buffer_offset + filled > std::numeric_limits<u32>::max()) {
+        eprint("Error: input is larger than 4 GiB\n");
+        return false;
+    }
+    return true;
+}
+
+
+bool StreamTokenizer::next_chunk(TokenBuffer& tokens) {
+    if (done || failed) {
+        return false;
+    }
+
+    const ScanKernels& scan = scan_kernels();
+    chunk_line += scan.count_newlines(buffer.data() + chunk_begin, buffer.data() + begin);
+    chunk_begin = begin;
+
+    while (true) {
+        if (!at_eof && !fill()) {
+            failed = true;
+            return false;
+        }
+
+        // Cut before the last '\n', or take everything at the end. A chunk
+        // after the first starts with a '\n', so look for one after that.
+        const char* const text = buffer.data() + begin;
+        usize cut = filled - begin;
+        if (!at_eof) {
+            const void* newline = cut > 1 ? memrchr(text + 1, '\n', cut - 1) : nullptr;
+            if (!newline) {
+                continue;
+            }
+            cut = static_cast<const char*>(newline) - text;
+        }
+
+        // Validated before lexing, as a whole file is when it is loaded.
+        const usize invalid = validate_utf8(std::string_view(text, cut));
+        if (invalid != cut) {
+            begin += cut;
+            const Location location = locate(buffer_offset + chunk_begin + invalid);
+            eprint("Error: invalid UTF-8 at line {}, column {}\n", location.line, location.column);
+            failed = true;
+            return false;
+        }
+
+        Tokenizer::ChunkOptions options;
+        options.base_offset = buffer_offset + begin;
+        options.indent_level = indent_level;
+        options.is_last = at_eof;
+
+        tokens = TokenBuffer();
+        tokens.reserve(cut / bytes_per_token_estimate + 1);
+        Tokenizer tokenizer(std::string_view(text, cut), options, *interner);
+        const Token eof = tokenizer.next_all(tokens);
+
+        if (tokenizer.status() == Tokenizer::Status::Straddle) {
+            continue;
+        }
+
+        tokens.tables = tokenizer.take_tables();
+        if (at_eof) {
+            tokens.push(eof);
+            done = true;
+        }
+
+        // The buffer is reused, so literals must not point into it.
+        TokenTables& tables = tokens.tables;
+        for (usize i = 0; i < tokens.size(); ++i) {
+            if (tokens.types[i] == Token::Type::String && !tables.strings[tokens.payloads[i]].decoded) {
+                tables.strings[tokens.payloads[i]].decoded = tables.arena.copy(tables.string(tokens[i])).data();
+            }
+        }
+        tables.source = {};
+
+        indent_level = tokenizer.get_indent_level();
+        begin += cut;
+        return true;
+    }
+}
+
+
+StreamTokenizer::Location StreamTokenizer::locate(u32 offset) const {
+    const char* const chunk = buffer.data() + chunk_begin;
+    const char* const chunk_end = buffer.data() + begin;
+    const char* const at = buffer.data() + (offset - buffer_offset);
+
+    const char* line_begin = at;
+    while (line_begin > chunk && line_begin[-1] != '\n') {
+        --line_begin;
+    }
+
+    const void* newline = std::memchr(at, '\n', chunk_end - at);
+    const char* const line_end = newline ? static_cast<const char*>(newline) : chunk_end;
+
+    const u64 line = chunk_line + scan_kernels().count_newlines(chunk, at) + 1;
+    return Location{line, static_cast<u32>(at - line_begin + 1), std::string_view(line_begin, line_end - line_begin)};
+}
+
+
+}
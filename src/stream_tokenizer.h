@@ -0,0 +1,91 @@
+#ifndef KALPA_STREAM_TOKENIZER_H
+#define KALPA_STREAM_TOKENIZER_H
+
+
+#include <string_view>
+#include <vector>
+
+#include "defs.h"
+#include "interner.h"
+#include "tokenizer.h"
+
+
+namespace klp {
+
+
+//
+//  Tokenizes a file descriptor, such as a pipe, without holding all of its
+//  contents. Input is read into a fixed-size buffer and handed out one
+//  chunk of tokens at a time; the next chunk reuses the buffer.
+//
+//  A chunk ends right before the last '\n' read so far, so only a string
+//  literal can run past it. The tokenizer reports that as a straddle, and
+//  the chunk is lexed again once more input is in. The buffer grows only
+//  when a single line or string literal does not fit in it, so memory is
+//  bounded by the buffer size and the longest of those, not by the input.
+//
+//  The tokens of a chunk own their payloads: string literals are copied
+//  out of the buffer into the chunk's arena. Offsets count from the start
+//  of the stream, which must not exceed the u32 offset space.
+//
+class StreamTokenizer {
+public:
+    static constexpr usize default_buffer_size = 1 << 20;
+
+    struct Location {
+        u64 line;     // 1-based
+        u32 column;   // 1-based, in bytes
+        std::string_view line_text;
+    };
+
+public:
+    explicit StreamTokenizer(int fd, Interner& interner = shared_interner(), usize buffer_size = default_buffer_size);
+
+    // Replaces `tokens` with the tokens of the next chunk. The last chunk
+    // ends with Eof. Returns false once the stream is done, or on a read
+    // error or input that is not UTF-8, which is printed and makes ok()
+    // false.
+    bool next_chunk(TokenBuffer& tokens);
+
+    bool ok() const {
+        return !failed;
+    }
+
+    // Where `offset` is, for an offset in the last chunk returned. Valid
+    // until the next call to next_chunk().
+    Location locate(u32 offset) const;
+
+    usize buffer_capacity() const {
+        return buffer.size();
+    }
+
+    u64 bytes_read() const {
+        return buffer_offset + filled;
+    }
+
+private:
+    int fd;
+    Interner* interner;
+    std::vector<char> buffer;
+    u64 buffer_offset = 0;  // stream offset of buffer[0]
+    usize begin = 0;        // start of the unconsumed input
+    usize filled = 0;
+
+    // The last chunk returned, as [chunk_begin, begin) of the buffer, and
+    // the number of lines before it.
+    usize chunk_begin = 0;
+    u64 chunk_line = 0;
+
+    u32 indent_level = 0;
+    bool at_eof = false;
+    bool done = false;
+    bool failed = false;
+
+    bool fill();
+};
+
+
+}
+
+
+#endif
@@ -0,0 +1,141 @@
+#include "thread_pool.h"
+
+#include <utility>
+
+
+namespace klp {
+
+
+namespace {
+
+
+// The pool and queue index of the calling worker thread.
+thread_local const void* current_pool = nullptr;
+thread_local usize current_index = 0;
+
+
+}
+
+
+usize default_num_threads() {
+    const usize n = std::thread::hardware_concurrency();
+    return n ? n : 1;
+}
+
+
+ThreadPool::ThreadPool(usize num_threads) {
+    queues.reserve(num_threads);
+    for (usize i = 0; i < num_threads; ++i) {
+        queues.push_back(std::make_unique<Queue>());
+    }
+
+    workers.reserve(num_threads);
+    for (usize i = 0; i < num_threads; ++i) {
+        workers.emplace_back([this, i] { work(i); });
+    }
+}
+
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    task_ready.notify_all();
+
+    for (auto& worker : workers) {
+        worker.join();
+    }
+}
+
+
+usize ThreadPool::worker_index() const {
+    return current_pool == this ? current_index : workers.size();
+}
+
+
+void ThreadPool::submit(Task task) {
+    usize index = worker_index();
+    if (index == workers.size()) {
+        index = next_queue.fetch_add(1, std::memory_order_relaxed) % queues.size();
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(queues[index]->mutex);
+        queues[index]->tasks.push_back(std::move(task));
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        ++num_queued;
+        ++num_unfinished;
+    }
+    task_ready.notify_one();
+}
+
+
+void ThreadPool::wait() {
+    std::unique_lock<std::mutex> lock(mutex);
+    all_done.wait(lock, [this] { return num_unfinished == 0; });
+}
+
+
+// Takes the newest task of queue `index`, or else the oldest task of the
+// first other queue that has one.
+bool ThreadPool::try_take(usize index, Task& task) {
+    {
+        Queue& own = *queues[index];
+        std::lock_guard<std::mutex> lock(own.mutex);
+        if (!own.tasks.empty()) {
+            task = std::move(own.tasks.back());
+            own.tasks.pop_back();
+            return true;
+        }
+    }
+
+    for (usize i = 1; i < queues.size(); ++i) {
+        Queue& victim = *queues[(index + i) % queues.size()];
+        std::lock_guard<std::mutex> lock(victim.mutex);
+        if (!victim.tasks.empty()) {
+            task = std::move(victim.tasks.front());
+            victim.tasks.pop_front();
+            return true;
+        }
+    }
+
+    return false;
+}
+
+
+void ThreadPool::work(usize index) {
+    current_pool = this;
+    current_index = index;
+
+    while (true) {
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            task_ready.wait(lock, [this] { return stopping || num_queued > 0; });
+            if (num_queued == 0) {
+                return;
+            }
+            --num_queued;
+        }
+
+        // A claimed task has been pushed already, though another worker
+        // may take it from under us and leave us a later one.
+        Task task;
+        while (!try_take(index, task)) {
+            std::this_thread::yield();
+        }
+
+        task();
+
+        std::lock_guard<std::mutex> lock(mutex);
+        if (--num_unfinished == 0) {
+            all_done.notify_all();
+        }
+    }
+}
+
+
+}
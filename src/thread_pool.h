@@ -0,0 +1,84 @@
+#ifndef KALPA_THREAD_POOL_H
+#define KALPA_THREAD_POOL_H
+
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "defs.h"
+
+
+namespace klp {
+
+
+// Number of hardware threads, at least 1.
+usize default_num_threads();
+
+
+//
+//  Fixed set of worker threads with a task queue each. Tasks submitted from
+//  outside the pool are spread over the queues round-robin; a task
+//  submitted by a worker goes to that worker's queue. A worker runs its
+//  newest task first and, when its queue is empty, steals the oldest task
+//  of another worker, so uneven tasks still keep every worker busy.
+//
+class ThreadPool {
+public:
+    using Task = std::function<void()>;
+
+public:
+    explicit ThreadPool(usize num_threads = default_num_threads());
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    ~ThreadPool();
+
+    void submit(Task task);
+
+    // Blocks until every submitted task has finished.
+    void wait();
+
+    usize size() const {
+        return workers.size();
+    }
+
+    // Index of the calling worker in [0, size()), for per-worker state,
+    // or size() when called from outside the pool.
+    usize worker_index() const;
+
+private:
+    struct Queue {
+        std::mutex mutex;
+        std::deque<Task> tasks;
+    };
+
+    std::vector<std::thread> workers;
+    std::vector<std::unique_ptr<Queue>> queues;
+    std::atomic<usize> next_queue = 0;
+
+    // Guards the counts. A task counts as queued from when it is pushed
+    // until a worker claims it; a claimed task is then taken from some
+    // queue.
+    std::mutex mutex;
+    std::condition_variable task_ready;
+    std::condition_variable all_done;
+    usize num_queued = 0;
+    usize num_unfinished = 0;
+    bool stopping = false;
+
+    void work(usize index);
+    bool try_take(usize index, Task& task);
+};
+
+
+}
+
+
+#endif
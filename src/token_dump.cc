@@ -0,0 +1,289 @@
+#include "token_dump.h"
+
+#include <algorithm>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "print.h"
+
+
+namespace klp {
+
+
+static void write_escaped(std::string_view text, WriteBuffer& out) {
+    out.put('"');
+    for (const char c : text) {
+        switch (c) {
+            case '\n': out.write("\\n"); break;
+            case '\r': out.write("\\r"); break;
+            case '\t': out.write("\\t"); break;
+            case '\\': out.write("\\\\"); break;
+            case '"': out.write("\\\""); break;
+            default:
+                if (static_cast<u8>(c) < 0x20) {
+                    out.print("\\x{:02x}", static_cast<u8>(c));
+                } else {
+                    out.put(c);
+                }
+                break;
+        }
+    }
+    out.put('"');
+}
+
+
+void write_token_dump_text(const TokenBuffer& tokens, WriteBuffer& out) {
+    const TokenTables& tables = tokens.tables;
+
+    for (usize i = 0; i < tokens.size(); ++i) {
+        const Token token = tokens[i];
+        out.print("{} {}", token.offset, token_type_name(token.type));
+
+        switch (token.type) {
+            case Token::Type::Identifier: out.put(' '); out.write(tables.identifier(token)); break;
+            case Token::Type::Int: out.print(" {}", tables.int_value(token)); break;
+            case Token::Type::Float: out.print(" {}", tables.float_value(token)); break;
+            case Token::Type::String: out.put(' '); write_escaped(tables.string(token), out); break;
+            case Token::Type::Error: out.put(' '); out.write(describe(tables.error(token))); break;
+            default: break;
+        }
+
+        out.put('\n');
+    }
+}
+
+
+namespace {
+
+
+// Lays out the sections of a binary dump one after another.
+class SectionLayout {
+public:
+    explicit SectionLayout(TokenDumpHeader& header) : header(header), end(sizeof(TokenDumpHeader)) {}
+
+    void add(TokenDumpHeader::Section section, u64 size) {
+        end = (end + 7) / 8 * 8;
+        header.section_offsets[section] = end;
+        header.section_sizes[section] = size;
+        end += size;
+    }
+
+private:
+    TokenDumpHeader& header;
+    u64 end;
+};
+
+
+}
+
+
+bool write_token_dump(const TokenBuffer& tokens, WriteBuffer& out) {
+    using Header = TokenDumpHeader;
+    using Span = Header::Span;
+    const TokenTables& tables = tokens.tables;
+
+    // Payloads as written: identifiers renumbered in order of first use.
+    std::vector<u32> payloads = tokens.payloads;
+    std::vector<u32> identifier_index(tables.interner->size(), ~u32(0));
+    std::vector<Span> identifiers;
+    std::string identifier_bytes;
+
+    for (usize i = 0; i < tokens.size(); ++i) {
+        if (tokens.types[i] != Token::Type::Identifier) {
+            continue;
+        }
+
+        u32& index = identifier_index[payloads[i]];
+        if (index == ~u32(0)) {
+            const std::string_view name = tables.interner->name(payloads[i]);
+            index = identifiers.size();
+            identifiers.push_back(Span{static_cast<u32>(identifier_bytes.size()), static_cast<u32>(name.size())});
+            identifier_bytes += name;
+        }
+        payloads[i] = index;
+    }
+
+    std::vector<Span> strings;
+    std::string string_bytes;
+    strings.reserve(tables.strings.size());
+    for (usize i = 0; i < tokens.size(); ++i) {
+        if (tokens.types[i] == Token::Type::String) {
+            const std::string_view text = tables.string(tokens[i]);
+            strings.resize(std::max<usize>(strings.size(), tokens.payloads[i] + 1));
+            strings[tokens.payloads[i]] = Span{static_cast<u32>(string_bytes.size()), static_cast<u32>(text.size())};
+            string_bytes += text;
+        }
+    }
+
+    Header header = {};
+    std::memcpy(header.magic, Header::expected_magic, sizeof(header.magic));
+    header.version = Header::current_version;
+    header.byte_order = Header::expected_byte_order;
+    header.num_tokens = tokens.size();
+    header.num_ints = tables.ints.size();
+    header.num_floats = tables.floats.size();
+    header.num_strings = strings.size();
+    header.num_identifiers = identifiers.size();
+    header.num_errors = tables.errors.size();
+
+    SectionLayout layout(header);
+    layout.add(Header::Types, tokens.size() * sizeof(u8));
+    layout.add(Header::Offsets, tokens.size() * sizeof(u32));
+    layout.add(Header::Payloads, tokens.size() * sizeof(u32));
+    layout.add(Header::Ints, tables.ints.size() * sizeof(i64));
+    layout.add(Header::Floats, tables.floats.size() * sizeof(double));
+    layout.add(Header::Strings, strings.size() * sizeof(Span));
+    layout.add(Header::StringBytes, string_bytes.size());
+    layout.add(Header::Identifiers, identifiers.size() * sizeof(Span));
+    layout.add(Header::IdentifierBytes, identifier_bytes.size());
+    layout.add(Header::Errors, tables.errors.size() * sizeof(u8));
+
+    static_assert(sizeof(Token::Type) == sizeof(u8) && sizeof(LexError) == sizeof(u8));
+
+    // Padding follows from the end of the previous section in the layout.
+    out.write(&header, sizeof(header));
+    u64 end = sizeof(header);
+    const auto section = [&](Header::Section section, const void* data) {
+        static const char zeros[8] = {};
+        const u64 padding = header.section_offsets[section] - end;
+        verify(padding <= sizeof(zeros), "section padding larger than the alignment");
+        out.write(zeros, padding);
+        out.write(data, header.section_sizes[section]);
+        end = header.section_offsets[section] + header.section_sizes[section];
+    };
+
+    section(Header::Types, tokens.types.data());
+    section(Header::Offsets, tokens.offsets.data());
+    section(Header::Payloads, payloads.data());
+    section(Header::Ints, tables.ints.data());
+    section(Header::Floats, tables.floats.data());
+    section(Header::Strings, strings.data());
+    section(Header::StringBytes, string_bytes.data());
+    section(Header::Identifiers, identifiers.data());
+    section(Header::IdentifierBytes, identifier_bytes.data());
+    section(Header::Errors, tables.errors.data());
+
+    return out.flush();
+}
+
+
+std::optional<TokenDump> TokenDump::open(const char* path) {
+    auto file = SourceFile::open(path);
+    if (!file) {
+        return std::nullopt;
+    }
+    return from_file(std::move(*file));
+}
+
+
+std::optional<TokenDump> TokenDump::from_file(SourceFile file) {
+    TokenDump dump(std::move(file));
+    if (const char* error = dump.validate()) {
+        eprint("Error: {}: {}\n", dump.file.path(), error);
+        return std::nullopt;
+    }
+    return dump;
+}
+
+
+// Checks the header, the sections and every payload, so that accessors
+// never read out of bounds. Returns what is wrong, or nullptr.
+const char* TokenDump::validate() {
+    using Header = TokenDumpHeader;
+
+    const std::string_view bytes = file.text();
+    if (bytes.size() < sizeof(Header)) {
+        return "not a token dump";
+    }
+
+    header = reinterpret_cast<const Header*>(bytes.data());
+    if (std::memcmp(header->magic, Header::expected_magic, sizeof(header->magic)) != 0) {
+        return "not a token dump";
+    }
+    if (header->byte_order != Header::expected_byte_order) {
+        return "token dump of another byte order";
+    }
+    if (header->version != Header::current_version) {
+        return "unsupported token dump version";
+    }
+
+    const u64 expected_sizes[Header::NumSections] = {
+        header->num_tokens * u64(sizeof(u8)),
+        header->num_tokens * u64(sizeof(u32)),
+        header->num_tokens * u64(sizeof(u32)),
+        header->num_ints * u64(sizeof(i64)),
+        header->num_floats * u64(sizeof(double)),
+        header->num_strings * u64(sizeof(Span)),
+        header->section_sizes[Header::StringBytes],
+        header->num_identifiers * u64(sizeof(Span)),
+        header->section_sizes[Header::IdentifierBytes],
+        header->num_errors * u64(sizeof(u8)),
+    };
+
+    const char* sections[Header::NumSections];
+    for (u32 i = 0; i < Header::NumSections; ++i) {
+        const u64 offset = header->section_offsets[i];
+        const u64 size = header->section_sizes[i];
+        if (size != expected_sizes[i] || offset % 8 != 0 || offset > bytes.size() || size > bytes.size() - offset) {
+            return "corrupt token dump section";
+        }
+        sections[i] = bytes.data() + offset;
+    }
+
+    types = reinterpret_cast<const u8*>(sections[Header::Types]);
+    offsets = reinterpret_cast<const u32*>(sections[Header::Offsets]);
+    payloads = reinterpret_cast<const u32*>(sections[Header::Payloads]);
+    ints = reinterpret_cast<const i64*>(sections[Header::Ints]);
+    floats = reinterpret_cast<const double*>(sections[Header::Floats]);
+    strings = reinterpret_cast<const Span*>(sections[Header::Strings]);
+    string_bytes = sections[Header::StringBytes];
+    identifiers = reinterpret_cast<const Span*>(sections[Header::Identifiers]);
+    identifier_bytes = sections[Header::IdentifierBytes];
+    errors = reinterpret_cast<const u8*>(sections[Header::Errors]);
+
+    const auto spans_fit = [](const Span* spans, u32 count, u64 num_bytes) {
+        for (u32 i = 0; i < count; ++i) {
+            if (spans[i].offset > num_bytes || spans[i].size > num_bytes - spans[i].offset) {
+                return false;
+            }
+        }
+        return true;
+    };
+
+    if (!spans_fit(strings, header->num_strings, header->section_sizes[Header::StringBytes]) ||
+        !spans_fit(identifiers, header->num_identifiers, header->section_sizes[Header::IdentifierBytes])) {
+        return "corrupt token dump string table";
+    }
+
+    for (u32 i = 0; i < header->num_errors; ++i) {
+        if (errors[i] > static_cast<u8>(LexError::InvalidUtf8)) {
+            return "corrupt token dump error table";
+        }
+    }
+
+    for (u32 i = 0; i < header->num_tokens; ++i) {
+        u32 limit = ~u32(0);
+        switch (static_cast<Token::Type>(types[i])) {
+            case Token::Type::Identifier: limit = header->num_identifiers; break;
+            case Token::Type::Int: limit = header->num_ints; break;
+            case Token::Type::Float: limit = header->num_floats; break;
+            case Token::Type::String: limit = header->num_strings; break;
+            case Token::Type::Error: limit = header->num_errors; break;
+            default:
+                if (types[i] > static_cast<u8>(Token::Type::Eof)) {
+                    return "corrupt token dump token type";
+                }
+                break;
+        }
+
+        if (payloads[i] >= limit) {
+            return "corrupt token dump payload";
+        }
+    }
+
+    return nullptr;
+}
+
+
+}
@@ -0,0 +1,165 @@
+#ifndef KALPA_TOKEN_DUMP_H
+#define KALPA_TOKEN_DUMP_H
+
+
+#include <optional>
+#include <string_view>
+
+#include "defs.h"
+#include "source.h"
+#include "tokenizer.h"
+#include "write_buffer.h"
+
+
+namespace klp {
+
+
+//
+//  Text dump: one line per token,
+//
+//      <offset> <type> [<payload>]
+//
+//  where the payload is the name of an identifier, the value of a number,
+//  a string literal quoted and escaped so that it stays on its line, or
+//  the description of an error.
+//
+void write_token_dump_text(const TokenBuffer& tokens, WriteBuffer& out);
+
+
+//
+//  Binary dump, meant to be mapped and read in place. All integers are in
+//  the byte order of the writer, which the reader checks through
+//  `byte_order`. The file is the header followed by sections, each at an
+//  8-byte aligned offset given in the header:
+//
+//      types           u8[num_tokens]        Token::Type
+//      offsets         u32[num_tokens]
+//      payloads        u32[num_tokens]       as in TokenBuffer, except that
+//                                            identifiers index `identifiers`
+//      ints            i64[num_ints]
+//      floats          f64[num_floats]
+//      strings         Span[num_strings]     into string_bytes
+//      string_bytes    u8[]
+//      identifiers     Span[num_identifiers] into identifier_bytes
+//      identifier_bytes u8[]
+//      errors          u8[num_errors]        LexError
+//
+//  Identifiers get dense indices in order of first use, so a dump does not
+//  depend on the interner that produced it.
+//
+struct TokenDumpHeader {
+    static constexpr char expected_magic[8] = {'K', 'L', 'P', 'T', 'O', 'K', 'S', '\0'};
+    static constexpr u32 current_version = 1;
+    static constexpr u32 expected_byte_order = 0x01020304;
+
+    enum Section : u32 {
+        Types,
+        Offsets,
+        Payloads,
+        Ints,
+        Floats,
+        Strings,
+        StringBytes,
+        Identifiers,
+        IdentifierBytes,
+        Errors,
+        NumSections,
+    };
+
+    struct Span {
+        u32 offset;
+        u32 size;
+    };
+
+    char magic[8];
+    u32 version;
+    u32 byte_order;
+
+    u32 num_tokens;
+    u32 num_ints;
+    u32 num_floats;
+    u32 num_strings;
+    u32 num_identifiers;
+    u32 num_errors;
+
+    // Where each section starts in the file, and its size in bytes.
+    u64 section_offsets[NumSections];
+    u64 section_sizes[NumSections];
+};
+
+
+// Returns false if writing failed.
+bool write_token_dump(const TokenBuffer& tokens, WriteBuffer& out);
+
+
+//
+//  A binary dump opened for reading. The file is memory-mapped, and every
+//  accessor reads it in place.
+//
+class TokenDump {
+public:
+    // Prints an error and returns nothing if the file cannot be read or is
+    // not a valid dump.
+    static std::optional<TokenDump> open(const char* path);
+
+    // Same as open(), for a dump already in memory.
+    static std::optional<TokenDump> from_file(SourceFile file);
+
+    usize size() const {
+        return header->num_tokens;
+    }
+
+    Token operator[](usize i) const {
+        return Token{ static_cast<Token::Type>(types[i]), offsets[i], payloads[i] };
+    }
+
+    i64 int_value(const Token& token) const {
+        return ints[token.payload];
+    }
+
+    double float_value(const Token& token) const {
+        return floats[token.payload];
+    }
+
+    std::string_view identifier(const Token& token) const {
+        return span_text(identifiers[token.payload], identifier_bytes);
+    }
+
+    std::string_view string(const Token& token) const {
+        return span_text(strings[token.payload], string_bytes);
+    }
+
+    LexError error(const Token& token) const {
+        return static_cast<LexError>(errors[token.payload]);
+    }
+
+private:
+    using Span = TokenDumpHeader::Span;
+
+    SourceFile file;
+    const TokenDumpHeader* header = nullptr;
+    const u8* types = nullptr;
+    const u32* offsets = nullptr;
+    const u32* payloads = nullptr;
+    const i64* ints = nullptr;
+    const double* floats = nullptr;
+    const Span* strings = nullptr;
+    const char* string_bytes = nullptr;
+    const Span* identifiers = nullptr;
+    const char* identifier_bytes = nullptr;
+    const u8* errors = nullptr;
+
+    explicit TokenDump(SourceFile file) : file(std::move(file)) {}
+
+    static std::string_view span_text(const Span& span, const char* bytes) {
+        return std::string_view(bytes + span.offset, span.size);
+    }
+
+    const char* validate();
+};
+
+
+}
+
+
+#endif
@@ -1,349 +1,401 @@
-#include "tokenizer.h"
-
-#include <algorithm>
-#include <cctype>
-
-#include "defs.h"
-
-namespace klp {
-void Tokenizer::trim(u32 trim_size) {
-    source.remove_prefix(trim_size);
-    offset += trim_size;
-}
-
-Token Tokenizer::handle_eof() {  // Returns an Eof token or a Dedent token if indentation level != 0
-    if (indent_level) {
-        --indent_level;
-        return Token{Token::Type::Dedent, offset};
-    } else {
-        return Token{Token::Type::Eof, offset};
-    }
-}
-
-// TODO Token construction gives warnings
-// TODO dedent/indent offset is not calculated correctly
-// TODO test for possible eof issues
-// TODO add tokenization error handling
-Token Tokenizer::next() {
-    if (dedent_counder) {
-        --dedent_counder;
-        --indent_level;
-        return handle_eof();
-    }
-
-    trim(std::min(source.find_first_not_of(' '), source.size()));
-    if (source.empty()) {
-        return handle_eof();
-    }
-
-    u32 token_offset = offset;
-    u32 token_size = 0;  // may not be a correct value
-    char last_char = source[0];
-
-    if (last_char == '#') {
-        while (token_size < source.size() && source[token_size] != '\n') {
-            ++token_size;
-        }
-        trim(token_size);
-        if (source.empty()) {
-            return handle_eof();
-        }
-
-        last_char = source[0];
-        token_size = 0;
-    }
-
-    if (last_char == 0) {
-        todo();
-    }
-
-    while (last_char == '\n') {
-        trim(1);
-        u32 num_zeros = std::min(source.find_first_not_of(' '), source.size());
-        trim(num_zeros);
-        if (source.empty()) {
-            return handle_eof();
-        } else if ((last_char = source[0]) != '\n') {
-            if (num_zeros % 4 != 0) {
-                todo();
-            }
-
-            u32 current_indent_level = num_zeros / 4;
-            if (current_indent_level > indent_level) {
-                if (current_indent_level - indent_level == 1) {
-                    indent_level = current_indent_level;
-                    return Token{Token::Type::Indent, offset};
-                } else {
-                    todo();
-                }
-            } else if (current_indent_level < indent_level) {
-                dedent_counder = (--indent_level) - current_indent_level;
-                return Token{Token::Type::Dedent, offset};
-            }
-        }
-    }
-
-    if (std::isalpha(last_char)) {
-        while (token_size < source.size() && std::isalnum(source[token_size])) {
-            last_char = source[token_size++];
-        }
-        std::string_view token = source.substr(0, token_size);
-        trim(token_size);
-
-        if (token == "def") {
-            return Token{ Token::Type::Def, token_offset };
-        } else if (token == "class") {
-            return Token{ Token::Type::Class, token_offset };
-        } else if (token == "let") {
-            return Token{ Token::Type::Let, token_offset };
-        } else if (token == "for") {
-            return Token{ Token::Type::For, token_offset };
-        } else if (token == "while") {
-            return Token{ Token::Type::While, token_offset };
-        } else if (token == "if") {
-            return Token{ Token::Type::If, token_offset };
-        } else if (token == "else") {
-            return Token{ Token::Type::Else, token_offset };
-        } else if (token == "elif") {
-            return Token{ Token::Type::Let, token_offset };
-        } else if (token == "return") {
-            return Token{ Token::Type::Return, token_offset };
-        } else if (token == "in") {
-            return Token{ Token::Type::In, token_offset };
-        } else if (token == "not") {
-            return Token{ Token::Type::Not, token_offset };
-        } else if (token == "or") {
-            return Token{ Token::Type::Or, token_offset };
-        } else if (token == "and") {
-            return Token{ Token::Type::And, token_offset };
-        } else {
-            return Token{ Token::Type::Identifier, token_offset, token };
-        }
-    }
-
-    if (std::isdigit(last_char)) {  // TODO make the solution prettier
-        i64 int_value = 0;
-        while (token_size < source.size() && std::isdigit(source[token_size])) {
-            last_char = source[token_size++];
-            int_value = int_value * 10 + (last_char - '0');
-        }
-
-        if (source[token_size] != '.') {  // result is an integer
-            trim(token_size);
-            return Token{ Token::Type::Int, token_offset, int_value };
-        } else {  // result is a float
-            ++token_size;
-            double float_value = 0;
-            double pos_multiplicator = 1;
-            while (token_size < source.size() && std::isdigit(source[token_size])) {
-                last_char = source[token_size++];
-                float_value += (pos_multiplicator /= 10) * (last_char - '0');
-            }
-            trim(token_size);
-            return Token{ Token::Type::Float, token_offset, static_cast<double>(int_value) + float_value };
-        }
-    }
-
-    if (last_char == '(') {
-        trim(1);
-        return Token{ Token::Type::LeftParen, token_offset };
-    }
-
-    if (last_char == ')') {
-        trim(1);
-        return Token{ Token::Type::RightParen, token_offset };
-    }
-
-    if (last_char == ':') {
-        trim(1);
-        return Token{ Token::Type::Colon, token_offset };
-    }
-
-    if (last_char == ',') {
-        trim(1);
-        return Token{ Token::Type::Comma, token_offset };
-    }
-
-    if (last_char == '.') {
-        if (source.size() > 1 && std::isdigit(source[++token_size])) {
-            double float_value = 0;
-            double pos_multiplicator = 1;
-            while (token_size < source.size() && std::isdigit(source[token_size])) {
-                last_char = source[token_size++];
-                float_value += (pos_multiplicator /= 10) * (last_char - '0');
-            }
-            trim(token_size);
-            return Token{ Token::Type::Float, token_offset, float_value };
-        } else {
-            trim(1);
-            return Token{ Token::Type::Dot, token_offset };
-        }
-    }
-
-    if (last_char == '"') {
-        ++token_size;
-        std::string value;
-
-        while (token_size < source.size() && source[token_size] != '"') {
-            last_char = source[token_size++];
-            if (last_char == '\\') {
-                if (token_size < source.size()) {
-                    last_char = source[token_size++];
-                    if (last_char == 'n') {
-                        value += '\n';
-                    } else if (last_char == 'r') {
-                        value += '\r';
-                    } else if (last_char == '\\') {
-                        value += '\\';
-                    } else if (last_char == '"') {
-                        value += '"';
-                    } else {
-                        todo();
-                    }
-                }
-                else {
-                    todo();
-                }
-            } else {
-                value += last_char;
-            }
-        }
-
-        if (source[token_size++] != '"') {
-            todo();
-        }
-
-        trim(token_size);
-        return Token{ Token::Type::String, token_offset, value };
-    }
-
-    if (last_char == '=') {
-        if (source.size() > 1 && source[1] == '=') {
-            trim(2);
-            return Token{ Token::Type::Equal, token_offset };
-        } else {
-            trim(1);
-            return Token{ Token::Type::Assign, token_offset };
-        }
-    }
-
-    if (last_char == '!') {
-        if (source.size() > 1 && source[1] == '=') {
-            trim(2);
-            return Token{ Token::Type::NotEqual, token_offset };
-        } else {
-            todo();
-        }
-    }
-
-    if (last_char == '<') {
-        if (source.size() > 1 && source[1] == '=') {
-            trim(2);
-            return Token{ Token::Type::LessEq, token_offset };
-        } else {
-            trim(1);
-            return Token{ Token::Type::Less, token_offset };
-        }
-    }
-
-    if (last_char == '>') {
-        if (source.size() > 1 && source[1] == '=') {
-            trim(2);
-            return Token{ Token::Type::GreaterEq, token_offset };
-        } else {
-            trim(1);
-            return Token{ Token::Type::Greater, token_offset };
-        }
-    }
-
-    if (last_char == '+') {
-        if (source.size() > 1 && source[1] == '=') {
-            trim(2);
-            return Token{ Token::Type::AddEq, token_offset };
-        } else {
-            trim(1);
-            return Token{ Token::Type::Add, token_offset };
-        }
-    }
-
-    if (last_char == '-') {
-        if (source.size() > 1 && source[1] == '=') {
-            trim(2);
-            return Token{ Token::Type::SubEq, token_offset };
-        } else {
-            trim(1);
-            return Token{ Token::Type::Sub, token_offset };
-        }
-    }
-
-    if (last_char == '*') {
-        if (source.size() > 1 && source[1] == '*') {
-            if (source.size() > 2 && source[2] == '=') {
-                trim(3);
-                return Token{ Token::Type::PowEq, token_offset };
-            } else {
-                trim(2);
-                return Token{ Token::Type::Pow, token_offset };
-            }
-        } else {
-            if (source.size() > 1 && source[1] == '=') {
-                trim(2);
-                return Token{ Token::Type::MulEq, token_offset };
-            } else {
-                trim(1);
-                return Token{ Token::Type::Mul, token_offset };
-            }
-        }
-    }
-
-    if (last_char == '/') {
-        if (source.size() > 1 && source[1] == '/') {
-            if (source.size() > 2 && source[2] == '=') {
-                trim(3);
-                return Token{ Token::Type::IntDivEq, token_offset };
-            } else {
-                trim(2);
-                return Token{ Token::Type::IntDiv, token_offset };
-            }
-        } else {
-            if (source.size() > 1 && source[1] == '=') {
-                trim(2);
-                return Token{ Token::Type::DivEq, token_offset };
-            } else {
-                trim(1);
-                return Token{ Token::Type::Div, token_offset };
-            }
-        }
-    }
-
-    if (last_char == '^') {
-        if (source.size() > 1 && source[1] == '=') {
-            trim(2);
-            return Token{ Token::Type::XorEq, token_offset };
-        } else {
-            trim(1);
-            return Token{ Token::Type::Xor, token_offset };
-        }
-    }
-
-    if (last_char == '[') {
-        trim(1);
-        return Token{ Token::Type::LeftBracket, token_offset };
-    }
-
-    if (last_char == ']') {
-        trim(1);
-        return Token{ Token::Type::RightBracket, token_offset };
-    }
-
-    if (last_char == '{') {
-        trim(1);
-        return Token{ Token::Type::LeftBrace, token_offset };
-    }
-
-    if (last_char == '}') {
-        trim(1);
-        return Token{ Token::Type::RightBrace, token_offset };
-    }
-}
-}
+#include "tokenizer.h"
+
+#include <cstring>
+
+#include "defs.h"
+#include "keywords.h"
+#include "number.h"
+#include "operators.h"
+#include "scan.h"
+#include "unicode.h"
+
+namespace klp {
+void Tokenizer::trim(u32 trim_size) {
+    source.remove_prefix(trim_size);
+    offset += trim_size;
+}
+
+Token Tokenizer::handle_eof() {  // Returns an Eof token or a Dedent token if indentation level != 0
+    if (indent_level && is_last) {
+        --indent_level;
+        return Token{Token::Type::Dedent, offset};
+    } else {
+        return Token{Token::Type::Eof, offset};
+    }
+}
+
+const char* token_type_name(Token::Type type) {
+    switch (type) {
+        case Token::Type::Identifier: return "Identifier";
+        case Token::Type::Indent: return "Indent";
+        case Token::Type::Dedent: return "Dedent";
+        case Token::Type::LeftParen: return "LeftParen";
+        case Token::Type::RightParen: return "RightParen";
+        case Token::Type::Colon: return "Colon";
+        case Token::Type::Comma: return "Comma";
+        case Token::Type::Dot: return "Dot";
+        case Token::Type::Def: return "Def";
+        case Token::Type::Class: return "Class";
+        case Token::Type::Let: return "Let";
+        case Token::Type::For: return "For";
+        case Token::Type::While: return "While";
+        case Token::Type::If: return "If";
+        case Token::Type::Else: return "Else";
+        case Token::Type::Elif: return "Elif";
+        case Token::Type::In: return "In";
+        case Token::Type::Not: return "Not";
+        case Token::Type::Or: return "Or";
+        case Token::Type::And: return "And";
+        case Token::Type::Return: return "Return";
+        case Token::Type::Int: return "Int";
+        case Token::Type::Float: return "Float";
+        case Token::Type::String: return "String";
+        case Token::Type::Assign: return "Assign";
+        case Token::Type::Equal: return "Equal";
+        case Token::Type::NotEqual: return "NotEqual";
+        case Token::Type::Less: return "Less";
+        case Token::Type::LessEq: return "LessEq";
+        case Token::Type::Greater: return "Greater";
+        case Token::Type::GreaterEq: return "GreaterEq";
+        case Token::Type::Add: return "Add";
+        case Token::Type::Sub: return "Sub";
+        case Token::Type::Mul: return "Mul";
+        case Token::Type::Pow: return "Pow";
+        case Token::Type::Div: return "Div";
+        case Token::Type::IntDiv: return "IntDiv";
+        case Token::Type::AddEq: return "AddEq";
+        case Token::Type::SubEq: return "SubEq";
+        case Token::Type::MulEq: return "MulEq";
+        case Token::Type::PowEq: return "PowEq";
+        case Token::Type::DivEq: return "DivEq";
+        case Token::Type::IntDivEq: return "IntDivEq";
+        case Token::Type::Xor: return "Xor";
+        case Token::Type::XorEq: return "XorEq";
+        case Token::Type::LeftBracket: return "LeftBracket";
+        case Token::Type::RightBracket: return "RightBracket";
+        case Token::Type::LeftBrace: return "LeftBrace";
+        case Token::Type::RightBrace: return "RightBrace";
+        case Token::Type::Error: return "Error";
+        case Token::Type::Eof: return "Eof";
+    }
+    return "?";
+}
+
+const char* describe(LexError error) {
+    switch (error) {
+        case LexError::UnexpectedChar: return "unexpected character";
+        case LexError::NulByte: return "unexpected NUL byte";
+        case LexError::BadIndent: return "indentation is not a multiple of 4 spaces";
+        case LexError::IndentTooDeep: return "indented more than one level";
+        case LexError::UnterminatedString: return "unterminated string literal";
+        case LexError::BadEscape: return "invalid escape sequence";
+        case LexError::MalformedNumber: return "malformed number";
+        case LexError::NumberOutOfRange: return "number out of range";
+        case LexError::InvalidUtf8: return "invalid UTF-8";
+    }
+    return "error";
+}
+
+// Returns an Error token for the token at `token_offset` and resumes at
+// the next line. A speculative tokenizer stops instead.
+Token Tokenizer::fail(LexError error, u32 token_offset) {
+    if (speculative) {
+        chunk_status = Status::Failed;
+        trim(source.size());
+        return Token{Token::Type::Eof, offset};
+    }
+
+    const char* const end = source.data() + source.size();
+    trim(scan_kernels().find_newline(source.data(), end) - source.data());
+    return Token{Token::Type::Error, token_offset, token_tables.add_error(error)};
+}
+
+Token Tokenizer::straddle() {
+    if (is_last) {
+        return fail(LexError::UnterminatedString, offset);
+    }
+
+    chunk_status = Status::Straddle;
+    trim(source.size());
+    return Token{Token::Type::Eof, offset};
+}
+
+// Called with the indentation of a line that has a token on it.
+Token Tokenizer::handle_line_start(u32 num_spaces) {
+    line_break = offset - num_spaces - 1;
+    if (num_spaces % 4 != 0) {
+        return fail(LexError::BadIndent, offset);
+    }
+
+    u32 current_indent_level = num_spaces / 4;
+    if (defer_first_indent) {
+        defer_first_indent = false;
+        has_first_indent = true;
+        first_indent_value = FirstIndent{current_indent_level, offset};
+        indent_level = current_indent_level;
+        return next();
+    }
+
+    if (current_indent_level > indent_level) {
+        if (current_indent_level - indent_level == 1) {
+            indent_level = current_indent_level;
+            return Token{Token::Type::Indent, offset};
+        } else {
+            return fail(LexError::IndentTooDeep, offset);
+        }
+    } else if (current_indent_level < indent_level) {
+        dedent_counder = indent_level - current_indent_level - 1;
+        indent_level = current_indent_level;
+        return Token{Token::Type::Dedent, offset};
+    }
+
+    return next();
+}
+
+// Lexes the string literal at the start of `source`.
+Result<Token, LexError> Tokenizer::lex_string(u32 token_offset) {
+    const ScanKernels& scan = scan_kernels();
+    const char* const end = source.data() + source.size();
+
+    // Find the closing quote first. Every escape is two bytes that
+    // decode to one, so that fixes the decoded size too.
+    u32 num_escapes = 0;
+    u32 token_size = 1;
+    while (true) {
+        token_size = scan.find_string_special(source.data() + token_size, end) - source.data();
+        if (token_size == source.size()) {
+            return straddle();
+        }
+        if (source[token_size] == '"') {
+            break;
+        }
+
+        ++num_escapes;
+        token_size += 2;
+        if (token_size > source.size()) {
+            return straddle();
+        }
+    }
+
+    const u32 raw_size = token_size - 1;
+    if (num_escapes == 0) {
+        trim(token_size + 1);
+        return Token{ Token::Type::String, token_offset, token_tables.add_string(nullptr, raw_size) };
+    }
+
+    // Decode into the arena, copying the runs between escapes whole.
+    const u32 size = raw_size - num_escapes;
+    char* const decoded = token_tables.arena.allocate_array<char>(size);
+    char* out = decoded;
+    const char* in = source.data() + 1;
+    const char* const literal_end = source.data() + token_size;
+
+    while (true) {
+        const char* special = scan.find_string_special(in, literal_end);
+        std::memcpy(out, in, special - in);
+        out += special - in;
+        if (special == literal_end) {
+            break;
+        }
+
+        switch (special[1]) {
+            case 'n': *out++ = '\n'; break;
+            case 'r': *out++ = '\r'; break;
+            case '\\': *out++ = '\\'; break;
+            case '"': *out++ = '"'; break;
+            default:
+                // Resume after the literal, not inside it.
+                trim(token_size + 1);
+                return LexError::BadEscape;
+        }
+        in = special + 2;
+    }
+
+    trim(token_size + 1);
+    return Token{ Token::Type::String, token_offset, token_tables.add_string(decoded, size) };
+}
+
+// TODO dedent/indent offset is not calculated correctly
+Token Tokenizer::next() {
+    if (dedent_counder) {
+        --dedent_counder;
+        return Token{Token::Type::Dedent, offset};
+    }
+
+    const ScanKernels& scan = scan_kernels();
+    const char* const end = source.data() + source.size();
+
+    // Skip spaces, comments and blank lines. Lines that hold nothing but a
+    // comment do not take part in indentation.
+    while (true) {
+        trim(scan.skip_spaces(source.data(), end) - source.data());
+        if (source.empty()) {
+            return handle_eof();
+        }
+
+        if (source[0] == '#') {
+            trim(scan.find_newline(source.data(), end) - source.data());
+            continue;
+        }
+
+        if (source[0] != '\n') {
+            break;
+        }
+
+        trim(1);
+        const u32 num_spaces = scan.skip_spaces(source.data(), end) - source.data();
+        trim(num_spaces);
+        if (source.empty()) {
+            return handle_eof();
+        }
+
+        if (source[0] != '\n' && source[0] != '#') {
+            return handle_line_start(num_spaces);
+        }
+    }
+
+    const u32 token_offset = offset;
+
+    switch (char_classes[source[0]]) {
+        case CharClass::Alpha: {
+            const u32 token_size = skip_identifier(scan, source.data(), end) - source.data();
+            const std::string_view token = source.substr(0, token_size);
+            trim(token_size);
+
+            const Token::Type type = keyword_type(token);
+            if (type != Token::Type::Identifier) {
+                return Token{ type, token_offset };
+            }
+            return Token{ Token::Type::Identifier, token_offset, token_tables.interner->intern(token) };
+        }
+
+        case CharClass::NonAscii: {
+            const Utf8Char c = decode_utf8(source.data(), end);
+            if (c.size == 0) {
+                return fail(LexError::InvalidUtf8, token_offset);
+            }
+            if (!is_xid_start(c.code_point)) {
+                return fail(LexError::UnexpectedChar, token_offset);
+            }
+
+            // Never a keyword.
+            const u32 token_size = skip_identifier(scan, source.data() + c.size, end) - source.data();
+            const std::string_view token = source.substr(0, token_size);
+            trim(token_size);
+            return Token{ Token::Type::Identifier, token_offset, token_tables.interner->intern(token) };
+        }
+
+        case CharClass::Dot:
+            if (source.size() < 2 || !is_ascii_digit(source[1])) {
+                break;
+            }
+            [[fallthrough]];
+
+        case CharClass::Digit: {
+            const auto number = parse_number(source.data(), end);
+            if (!number) {
+                const bool malformed = number.error() == NumberError::Malformed;
+                return fail(malformed ? LexError::MalformedNumber : LexError::NumberOutOfRange, token_offset);
+            }
+
+            trim(number->size);
+            if (number->is_float) {
+                return Token{ Token::Type::Float, token_offset, token_tables.add_float(number->float_value) };
+            }
+            return Token{ Token::Type::Int, token_offset, token_tables.add_int(number->int_value) };
+        }
+
+        case CharClass::Quote: {
+            auto token = lex_string(token_offset);
+            if (!token) {
+                return fail(token.error(), token_offset);
+            }
+            return *token;
+        }
+
+        case CharClass::Operator:
+            break;
+
+        case CharClass::Nul:
+            return fail(LexError::NulByte, token_offset);
+
+        case CharClass::Invalid:
+            return fail(LexError::UnexpectedChar, token_offset);
+    }
+
+    const OperatorMatch op = operator_dfa.match(source.data(), end);
+    if (op.size == 0) {
+        return fail(LexError::UnexpectedChar, token_offset);
+    }
+
+    trim(op.size);
+    return Token{ op.type, token_offset };
+}
+
+Token Tokenizer::next_all(TokenBuffer& buffer) {
+    while (true) {
+        const Token token = next();
+        if (token.type == Token::Type::Eof) {
+            return token;
+        }
+        buffer.push(token);
+    }
+}
+
+void TokenBuffer::append(const TokenBuffer& other, usize begin, usize end, const std::vector<Atom>& atoms) {
+    for (usize i = begin; i < end; ++i) {
+        Token token = other[i];
+        switch (token.type) {
+            case Token::Type::Identifier:
+                if (!atoms.empty()) {
+                    token.payload = atoms[token.payload];
+                }
+                break;
+
+            case Token::Type::Int:
+                token.payload = tables.add_int(other.tables.int_value(token));
+                break;
+
+            case Token::Type::Float:
+                token.payload = tables.add_float(other.tables.float_value(token));
+                break;
+
+            case Token::Type::Error:
+                token.payload = tables.add_error(other.tables.error(token));
+                break;
+
+            case Token::Type::String: {
+                const auto& entry = other.tables.strings[token.payload];
+                const char* decoded = entry.decoded ? tables.arena.copy(other.tables.string(token)).data() : nullptr;
+                token.payload = tables.add_string(decoded, entry.size);
+                break;
+            }
+
+            default:
+                break;
+        }
+        push(token);
+    }
+}
+
+TokenBuffer tokenize_all(std::string_view source, Interner& interner) {
+    TokenBuffer buffer;
+    buffer.reserve(source.size() / bytes_per_token_estimate + 1);
+
+    Tokenizer tokenizer(source, interner);
+    buffer.push(tokenizer.next_all(buffer));
+
+    buffer.tables = tokenizer.take_tables();
+    return buffer;
+}
+
+std::vector<Diagnostic> collect_diagnostics(const TokenBuffer& tokens) {
+    std::vector<Diagnostic> diagnostics;
+    for (usize i = 0; i < tokens.size(); ++i) {
+        if (tokens.types[i] == Token::Type::Error) {
+            diagnostics.push_back(Diagnostic{tokens.tables.errors[tokens.payloads[i]], tokens.offsets[i]});
+        }
+    }
+    return diagnostics;
+}
+}
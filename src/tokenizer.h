@@ -3,13 +3,16 @@
 
 #include <string>
 #include <string_view>
-#include <variant>
+#include <vector>
 
+#include "arena.h"
 #include "defs.h"
+#include "interner.h"
+#include "result.h"
 
 namespace klp {
 struct Token {
-    enum class Type {  // TODO add bit operations and lambdas
+    enum class Type : u8 {  // TODO add bit operations and lambdas
         Identifier,
 
         Indent,
@@ -80,30 +83,303 @@ struct Token {
         LeftBrace,
         RightBrace,
 
+        Error,  // payload: index into TokenTables::errors
+
         Eof
     };
 
     Type type;
     u32 offset;
-    std::variant<std::string, std::string_view, i64, double> value;
+    u32 payload = 0;  // index into the TokenTables list matching `type`
 };
 
+static_assert(sizeof(Token) == 12);
+
+
+// The enumerator name, like "LeftParen".
+const char* token_type_name(Token::Type type);
+
+
+enum class LexError : u8 {
+    UnexpectedChar,
+    NulByte,
+    BadIndent,         // not a multiple of 4 spaces
+    IndentTooDeep,     // more than one level deeper than the previous line
+    UnterminatedString,
+    BadEscape,
+    MalformedNumber,
+    NumberOutOfRange,
+    InvalidUtf8,
+};
+
+
+const char* describe(LexError error);
+
+
+// A lexing error at a source offset.
+struct Diagnostic {
+    LexError error;
+    u32 offset;
+};
+
+
+// Typed payloads of Int, Float and String tokens. The payload of an
+// Identifier token is its atom in `interner`.
+struct TokenTables {
+    Interner* interner = &shared_interner();
+
+    std::vector<i64> ints;
+    std::vector<double> floats;
+    std::vector<LexError> errors;
+
+    // A string literal without escapes is not copied: its bytes follow the
+    // opening quote in `source`, which holds the text from offset
+    // `source_base` on and must outlive the tables. Decoded literals live
+    // in `arena`.
+    struct StringEntry {
+        const char* decoded;  // nullptr if the literal is in the source
+        u32 size;
+    };
+
+    std::string_view source;
+    u32 source_base = 0;
+    std::vector<StringEntry> strings;
+    Arena arena;
+
+    // Entries, and decoded bytes in `arena`, that no token refers to any
+    // more. Only retokenize() leaves them behind.
+    usize dead_entries = 0;
+    usize dead_bytes = 0;
+
+    u32 add_int(i64 value) {
+        ints.push_back(value);
+        return ints.size() - 1;
+    }
+
+    u32 add_float(double value) {
+        floats.push_back(value);
+        return floats.size() - 1;
+    }
+
+    u32 add_error(LexError error) {
+        errors.push_back(error);
+        return errors.size() - 1;
+    }
+
+    u32 add_string(const char* decoded, u32 size) {
+        strings.push_back(StringEntry{decoded, size});
+        return strings.size() - 1;
+    }
+
+    i64 int_value(const Token& token) const {
+        return ints[token.payload];
+    }
+
+    double float_value(const Token& token) const {
+        return floats[token.payload];
+    }
+
+    LexError error(const Token& token) const {
+        return errors[token.payload];
+    }
+
+    Atom atom(const Token& token) const {
+        return token.payload;
+    }
+
+    std::string_view identifier(const Token& token) const {
+        return interner->name(token.payload);
+    }
+
+    std::string_view string(const Token& token) const {
+        const StringEntry& entry = strings[token.payload];
+        if (entry.decoded) {
+            return std::string_view(entry.decoded, entry.size);
+        }
+        return std::string_view(source.data() + (token.offset - source_base) + 1, entry.size);
+    }
+};
+
+
+//
+//  A whole token stream in struct-of-arrays form. Every token is spread
+//  over `types`, `offsets` and `payloads` at the same index, and the
+//  payloads point into `tables`.
+//
+struct TokenBuffer {
+    std::vector<Token::Type> types;
+    std::vector<u32> offsets;
+    std::vector<u32> payloads;
+    TokenTables tables;
 
+    usize size() const {
+        return types.size();
+    }
+
+    Token operator[](usize i) const {
+        return Token{ types[i], offsets[i], payloads[i] };
+    }
+
+    void reserve(usize num_tokens) {
+        types.reserve(num_tokens);
+        offsets.reserve(num_tokens);
+        payloads.reserve(num_tokens);
+    }
+
+    void push(const Token& token) {
+        types.push_back(token.type);
+        offsets.push_back(token.offset);
+        payloads.push_back(token.payload);
+    }
+
+    // Appends tokens [begin, end) of `other`, copying their payloads into
+    // this buffer's tables. `atoms` maps atoms of `other.tables.interner`
+    // to atoms of ours; it may be empty if both use the same interner.
+    // Both buffers must come from the same source text, since string
+    // literals without escapes keep pointing into it.
+    void append(const TokenBuffer& other, usize begin, usize end, const std::vector<Atom>& atoms = {});
+};
+
+
+//
+//  Errors do not stop the tokenizer. A malformed token becomes an Error
+//  token at its offset, and lexing resumes at the next line, with the
+//  indentation level of the last good line. One pass over a file thus
+//  reports every line that has an error.
+//
 class Tokenizer {
 public:
-    Tokenizer(std::string_view source) : source(source) {}
+    enum class Status : u8 {
+        Ok,
+        Straddle,  // a token runs past the end of a chunk
+        Failed,    // a speculative tokenizer hit an error
+    };
+
+    //
+    //  Tokenizing a piece of a larger input, as the parallel and
+    //  incremental tokenizers do. A chunk other than the first starts at a
+    //  '\n' and ends right before one.
+    //
+    struct ChunkOptions {
+        u32 base_offset = 0;  // offset of the chunk in the whole input
+        u32 indent_level = 0;
+
+        // The chunk ends where the input ends. Otherwise end of chunk
+        // yields Eof without closing Dedent tokens.
+        bool is_last = true;
+
+        // Take the indentation of the first line as the starting level
+        // and report it through first_indent() instead of emitting Indent
+        // or Dedent tokens for it.
+        bool defer_first_indent = false;
+
+        // Stop at the first error and report it through status() instead
+        // of recovering.
+        bool speculative = false;
+    };
+
+    struct FirstIndent {
+        u32 level;
+        u32 offset;
+    };
+
+public:
+    Tokenizer(std::string_view source, Interner& interner = shared_interner()) : source(source) {
+        token_tables.interner = &interner;
+        token_tables.source = source;
+    }
+
+    Tokenizer(std::string_view source, const ChunkOptions& options, Interner& interner = shared_interner()) :
+        source(source),
+        offset(options.base_offset),
+        indent_level(options.indent_level),
+        is_last(options.is_last),
+        defer_first_indent(options.defer_first_indent),
+        speculative(options.speculative)
+    {
+        token_tables.interner = &interner;
+        token_tables.source = source;
+        token_tables.source_base = options.base_offset;
+    }
 
     Token next();
 
+    // Pushes tokens into `buffer` up to, but not including, Eof and
+    // returns the Eof token.
+    Token next_all(TokenBuffer& buffer);
+
+    const TokenTables& tables() const {
+        return token_tables;
+    }
+
+    TokenTables take_tables() {
+        return std::move(token_tables);
+    }
+
+    Status status() const {
+        return chunk_status;
+    }
+
+    // Skips ahead to `target`, which must be the first column of a line,
+    // with the indentation level at 0. Lets a caller lex around regions it
+    // handles itself.
+    void skip_to(u32 target) {
+        verify(target >= offset, "skipping backwards");
+        trim(target - offset);
+    }
+
+    u32 get_indent_level() const {
+        return indent_level;
+    }
+
+    // Offset of the '\n' that started the current line, or no_line_break
+    // before the first line break that is followed by a token.
+    u32 last_line_break() const {
+        return line_break;
+    }
+
+    static constexpr u32 no_line_break = ~u32(0);
+
+    // Set once a tokenizer created with defer_first_indent has read the
+    // indentation of its first line.
+    const FirstIndent* first_indent() const {
+        return has_first_indent ? &first_indent_value : nullptr;
+    }
+
 private:
     std::string_view source;
+    TokenTables token_tables;
     u32 offset = 0;
     u32 indent_level = 0;
     u32 dedent_counder = 0;
+    u32 line_break = no_line_break;
+
+    bool is_last = true;
+    bool defer_first_indent = false;
+    bool speculative = false;
+    bool has_first_indent = false;
+    Status chunk_status = Status::Ok;
+    FirstIndent first_indent_value = {};
 
     void trim(u32 trim_size);
     Token handle_eof();
+    Token fail(LexError error, u32 token_offset);
+    Token straddle();
+    Result<Token, LexError> lex_string(u32 token_offset);
+    Token handle_line_start(u32 num_spaces);
 };
+
+
+// Average source bytes per token, measured on generated corpora. Used to
+// size token buffers up front.
+constexpr usize bytes_per_token_estimate = 6;
+
+// Tokenizes all of `source`. The last token of the buffer is Eof. String
+// literals may point into `source`, which must outlive the buffer.
+TokenBuffer tokenize_all(std::string_view source, Interner& interner = shared_interner());
+
+// The errors in `tokens`, in source order.
+std::vector<Diagnostic> collect_diagnostics(const TokenBuffer& tokens);
 }
 
 #endif
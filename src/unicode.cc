@@ -0,0 +1,36 @@
+#include "unicode.h"
+
+#include <algorithm>
+
+#include "unicode_tables.h"
+
+
+namespace klp {
+
+
+template <usize N>
+static bool in_ranges(const UnicodeRange (&ranges)[N], u32 code_point) {
+    const auto after = std::upper_bound(
+        std::begin(ranges), std::end(ranges), code_point,
+        [](u32 c, const UnicodeRange& range) { return c < range.first; }
+    );
+    return after != std::begin(ranges) && code_point <= after[-1].last;
+}
+
+
+bool is_xid_start(u32 code_point) {
+    return in_ranges(xid_start_ranges, code_point);
+}
+
+
+bool is_xid_continue(u32 code_point) {
+    return in_ranges(xid_continue_ranges, code_point);
+}
+
+
+usize validate_utf8(std::string_view text) {
+    return scan_kernels().validate_utf8(text.data(), text.data() + text.size()) - text.data();
+}
+
+
+}
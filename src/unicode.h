@@ -0,0 +1,63 @@
+#ifndef KALPA_UNICODE_H
+#define KALPA_UNICODE_H
+
+
+#include <string_view>
+
+#include "defs.h"
+#include "scan.h"
+
+
+namespace klp {
+
+
+//
+//  Unicode identifier classes (UAX #31) of non-ASCII code points. ASCII
+//  keeps the language's own rules, [A-Za-z] to start and [A-Za-z0-9] after,
+//  which callers test first.
+//
+bool is_xid_start(u32 code_point);
+bool is_xid_continue(u32 code_point);
+
+
+//
+//  First byte after the identifier characters at `p`: ASCII letters and
+//  digits or XID_Continue characters. Pure ASCII identifiers take one scan
+//  kernel call and one compare.
+//
+inline const char* skip_identifier(const ScanKernels& scan, const char* p, const char* end) {
+    p = scan.skip_ident(p, end);
+    while (p != end && static_cast<u8>(*p) >= 0x80) {
+        const Utf8Char c = decode_utf8(p, end);
+        if (c.size == 0 || !is_xid_continue(c.code_point)) {
+            break;
+        }
+        p = scan.skip_ident(p + c.size, end);
+    }
+    return p;
+}
+
+
+// Size of the identifier start character at `p`, or 0 if there is none.
+inline u32 identifier_start_size(const char* p, const char* end) {
+    if (is_ascii_alpha(*p)) {
+        return 1;
+    }
+    if (static_cast<u8>(*p) < 0x80) {
+        return 0;
+    }
+
+    const Utf8Char c = decode_utf8(p, end);
+    return c.size && is_xid_start(c.code_point) ? c.size : 0;
+}
+
+
+// Offset of the first character of `text` that is not valid UTF-8, or
+// text.size() if it is all valid.
+usize validate_utf8(std::string_view text);
+
+
+}
+
+
+#endif
@@ -0,0 +1,216 @@
+#include "value.h"
+
+#include <algorithm>
+#include <cmath>
+#include <set>
+#include <utility>
+#include <vector>
+
+#include "bytecode.h"
+#include "print.h"
+
+
+namespace klp {
+
+
+bool is_truthy(const Value& value) {
+    if (value.is_bool()) {
+        return value.as_bool();
+    }
+    if (value.is_small_int()) {
+        return value.as_small_int() != 0;
+    }
+    if (value.is_float()) {
+        return value.as_float() != 0;
+    }
+    if (!value.is_object()) {
+        return false;  // none or undefined
+    }
+
+    switch (value.as_object()->kind) {
+        case ObjectKind::String: return !as_string(value).text.empty();
+        case ObjectKind::List: return !as_list(value).items.empty();
+        default: return true;  // boxed ints are never zero
+    }
+}
+
+
+// Equality of `a` and `b` without looking into lists. Sets `lists` when
+// both are lists and their items decide it.
+static bool shallow_equal(const Value& a, const Value& b, bool& lists) {
+    lists = false;
+    if (a.is_number() && b.is_number()) {
+        if (a.is_int() && b.is_int()) {
+            return a.as_int() == b.as_int();
+        }
+        return a.to_float() == b.to_float();
+    }
+    if (a.identical(b)) {
+        return true;
+    }
+    if (!a.is_object() || !b.is_object() || a.as_object()->kind != b.as_object()->kind) {
+        return false;
+    }
+
+    if (a.as_object()->kind == ObjectKind::String) {
+        return as_string(a).text == as_string(b).text;
+    }
+    lists = a.as_object()->kind == ObjectKind::List;
+    return lists;
+}
+
+
+// Compares lists item by item with a stack of pairs instead of recursion,
+// so that nesting does not use up the native stack. A pair of lists met
+// again counts as equal: if anything in it differs, that shows where it
+// was first met. So lists that hold themselves compare in bounded work.
+static bool lists_equal(const ListObject* a, const ListObject* b) {
+    using Pair = std::pair<const ListObject*, const ListObject*>;
+    std::vector<Pair> pending = {{a, b}};
+    std::set<Pair> seen = {{a, b}};
+
+    while (!pending.empty()) {
+        const auto [x, y] = pending.back();
+        pending.pop_back();
+        if (x->items.size() != y->items.size()) {
+            return false;
+        }
+
+        for (usize i = 0; i < x->items.size(); ++i) {
+            bool lists;
+            if (!shallow_equal(x->items[i], y->items[i], lists)) {
+                return false;
+            }
+            if (!lists) {
+                continue;
+            }
+            const Pair pair = {&as_list(x->items[i]), &as_list(y->items[i])};
+            if (seen.insert(pair).second) {
+                pending.push_back(pair);
+            }
+        }
+    }
+    return true;
+}
+
+
+bool values_equal(const Value& a, const Value& b) {
+    bool lists;
+    if (!shallow_equal(a, b, lists)) {
+        return false;
+    }
+    return !lists || lists_equal(&as_list(a), &as_list(b));
+}
+
+
+const char* type_name(const Value& value) {
+    if (value.is_undefined()) {
+        return "undefined";
+    }
+    if (value.is_none()) {
+        return "none";
+    }
+    if (value.is_bool()) {
+        return "bool";
+    }
+    if (value.is_small_int()) {
+        return "int";
+    }
+    if (value.is_float()) {
+        return "float";
+    }
+
+    switch (value.as_object()->kind) {
+        case ObjectKind::String: return "string";
+        case ObjectKind::List: return "list";
+        case ObjectKind::Function: return "function";
+        case ObjectKind::Builtin: return "builtin";
+        case ObjectKind::Int: return "int";
+    }
+    return "?";
+}
+
+
+// A list that is already being printed further out, one that holds itself,
+// prints as [...], like in Python. So do lists nested deeper than this,
+// which bounds the recursion.
+static constexpr u32 max_format_depth = 64;
+
+
+// `path` holds the lists that `value` is inside of, outermost first.
+static void format_into(const Value& value, bool quote, std::vector<const ListObject*>& path, std::string& out) {
+    if (value.is_undefined()) {
+        out += "undefined";
+        return;
+    }
+    if (value.is_none()) {
+        out += "none";
+        return;
+    }
+    if (value.is_bool()) {
+        out += value.as_bool() ? "true" : "false";
+        return;
+    }
+    if (value.is_small_int()) {
+        out += fmt::to_string(value.as_small_int());
+        return;
+    }
+    if (value.is_float()) {
+        const double number = value.as_float();
+        const std::string text = fmt::to_string(number);
+        out += text;
+        if (std::isfinite(number) && text.find_first_of(".e") == std::string::npos) {
+            out += ".0";
+        }
+        return;
+    }
+
+    switch (value.as_object()->kind) {
+        case ObjectKind::String:
+            out += quote ? format("{:?}", as_string(value).text) : as_string(value).text;
+            return;
+
+        case ObjectKind::List: {
+            const ListObject* const list = &as_list(value);
+            if (path.size() == max_format_depth || std::find(path.begin(), path.end(), list) != path.end()) {
+                out += "[...]";
+                return;
+            }
+
+            path.push_back(list);
+            out += '[';
+            for (usize i = 0; i < list->items.size(); ++i) {
+                if (i > 0) {
+                    out += ", ";
+                }
+                format_into(list->items[i], true, path, out);
+            }
+            out += ']';
+            path.pop_back();
+            return;
+        }
+
+        case ObjectKind::Function:
+            out += format("<def {}>", static_cast<const Function*>(value.as_object())->name);
+            return;
+
+        case ObjectKind::Builtin:
+            out += format("<builtin {}>", static_cast<const Builtin*>(value.as_object())->name);
+            return;
+
+        case ObjectKind::Int:
+            out += fmt::to_string(value.as_int());
+            return;
+    }
+}
+
+
+std::string format_value(const Value& value) {
+    std::string out;
+    std::vector<const ListObject*> path;
+    format_into(value, false, path, out);
+    return out;
+}
+
+
+}
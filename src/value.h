@@ -0,0 +1,249 @@
+#ifndef KALPA_VALUE_H
+#define KALPA_VALUE_H
+
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "defs.h"
+
+
+namespace klp {
+
+
+enum class ObjectKind : u8 {
+    String,
+    List,
+    Function,
+    Builtin,
+    Int,  // an int too large to fit in a Value
+};
+
+
+struct Object {
+    ObjectKind kind;
+    u8 gc_bits = 0;  // belongs to the Heap
+
+    explicit Object(ObjectKind kind) : kind(kind) {}
+};
+
+
+//
+//  A runtime value in one 64-bit word. A float is stored as its own bits;
+//  every other value is a negative quiet NaN. NaNs are made canonical on
+//  the way in, so no arithmetic result can be mistaken for one of those:
+//
+//      0xfff9 + 48 bits     object pointer
+//      0xfffa + 48 bits     false, true, none or undefined
+//      top 14 bits set      small int in the low 50 bits
+//
+//  Ints that do not fit in 50 bits are promoted to an IntObject: is_int()
+//  and as_int() accept both, and only the fast paths of the VM look at
+//  small ints directly.
+//
+//  It is trivially constructible, so that the VM stack can be allocated
+//  without touching it; make one with the factories.
+//
+class Value {
+public:
+    static constexpr i64 min_small_int = -(i64(1) << 49);
+    static constexpr i64 max_small_int = (i64(1) << 49) - 1;
+
+public:
+    Value() = default;
+
+    static Value undefined() {
+        return Value(tag_undefined);
+    }
+
+    static Value none() {
+        return Value(tag_none);
+    }
+
+    static Value from_bool(bool boolean) {
+        return Value(tag_false | static_cast<u64>(boolean));
+    }
+
+    // `integer` must fit; see make_int() for any i64. The sign bits of a
+    // negative one already match the tag.
+    static Value from_small_int(i64 integer) {
+        return Value(tag_int | static_cast<u64>(integer));
+    }
+
+    static Value from_float(double number) {
+        if (number != number) {
+            return Value(canonical_nan);
+        }
+        u64 bits;
+        std::memcpy(&bits, &number, sizeof(bits));
+        return Value(bits);
+    }
+
+    static Value from_object(Object* object) {
+        return Value(tag_object | reinterpret_cast<uintptr_t>(object));
+    }
+
+    static bool fits_small_int(i64 integer) {
+        return static_cast<i64>(static_cast<u64>(integer) << 14) >> 14 == integer;
+    }
+
+    bool is_undefined() const {
+        return bits == tag_undefined;
+    }
+
+    bool is_none() const {
+        return bits == tag_none;
+    }
+
+    bool is_bool() const {
+        return (bits | 1) == tag_true;
+    }
+
+    bool is_small_int() const {
+        return bits >= tag_int;
+    }
+
+    bool is_float() const {
+        return bits < first_tag;
+    }
+
+    bool is_object() const {
+        return (bits >> 48) == (tag_object >> 48);
+    }
+
+    inline bool is_object(ObjectKind kind) const;
+    inline bool is_int() const;
+
+    bool is_number() const {
+        return is_float() || is_int();
+    }
+
+    bool as_bool() const {
+        return bits & 1;
+    }
+
+    i64 as_small_int() const {
+        return static_cast<i64>(bits << 14) >> 14;
+    }
+
+    inline i64 as_int() const;
+
+    double as_float() const {
+        double number;
+        std::memcpy(&number, &bits, sizeof(number));
+        return number;
+    }
+
+    Object* as_object() const {
+        return reinterpret_cast<Object*>(bits & payload_mask);
+    }
+
+    double to_float() const {
+        return is_float() ? as_float() : static_cast<double>(as_int());
+    }
+
+    // The encoding, for the JIT to build and test values in machine code.
+    u64 raw() const {
+        return bits;
+    }
+
+    // Whether both are the same word: the same object, or equal values
+    // of any other type, except that NaN is identical to itself.
+    bool identical(const Value& other) const {
+        return bits == other.bits;
+    }
+
+private:
+    static constexpr u64 payload_mask = (u64(1) << 48) - 1;
+    static constexpr u64 canonical_nan = u64(0x7ff8) << 48;
+    static constexpr u64 first_tag = u64(0xfff9) << 48;
+    static constexpr u64 tag_object = u64(0xfff9) << 48;
+    static constexpr u64 tag_false = u64(0xfffa) << 48;
+    static constexpr u64 tag_true = tag_false | 1;
+    static constexpr u64 tag_none = tag_false | 2;
+    static constexpr u64 tag_undefined = tag_false | 3;
+    static constexpr u64 tag_int = u64(0xfffc) << 48;
+
+    u64 bits;
+
+    explicit constexpr Value(u64 bits) : bits(bits) {}
+};
+
+static_assert(sizeof(Value) == 8);
+static_assert(std::is_trivially_default_constructible_v<Value>);
+static_assert(std::is_trivially_copyable_v<Value>);
+
+
+struct StringObject : Object {
+    std::string text;
+
+    explicit StringObject(std::string text) : Object(ObjectKind::String), text(std::move(text)) {}
+};
+
+
+struct ListObject : Object {
+    std::vector<Value> items;
+
+    explicit ListObject(std::vector<Value> items) : Object(ObjectKind::List), items(std::move(items)) {}
+};
+
+
+struct IntObject : Object {
+    i64 value;
+
+    explicit IntObject(i64 value) : Object(ObjectKind::Int), value(value) {}
+};
+
+
+bool Value::is_object(ObjectKind kind) const {
+    return is_object() && as_object()->kind == kind;
+}
+
+
+bool Value::is_int() const {
+    return is_small_int() || is_object(ObjectKind::Int);
+}
+
+
+i64 Value::as_int() const {
+    return is_small_int() ? as_small_int() : static_cast<const IntObject*>(as_object())->value;
+}
+
+
+inline bool is_object(const Value& value, ObjectKind kind) {
+    return value.is_object(kind);
+}
+
+
+inline StringObject& as_string(const Value& value) {
+    return *static_cast<StringObject*>(value.as_object());
+}
+
+
+inline ListObject& as_list(const Value& value) {
+    return *static_cast<ListObject*>(value.as_object());
+}
+
+
+// Whether `value` counts as true in a condition. None, false, zero and
+// empty strings and lists are false.
+bool is_truthy(const Value& value);
+
+bool values_equal(const Value& a, const Value& b);
+
+// The name of the type of `value`, for error messages.
+const char* type_name(const Value& value);
+
+// `value` as print shows it. Strings are quoted only inside lists.
+std::string format_value(const Value& value);
+
+
+}
+
+
+#endif
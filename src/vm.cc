@@ -0,0 +1,880 @@
+#include "vm.h"
+
+#include <climits>
+#include <cmath>
+
+#include "print.h"
+
+
+namespace klp {
+
+
+#if defined(__GNUC__) && !defined(KALPA_SWITCH_DISPATCH)
+#define KALPA_COMPUTED_GOTO 1
+#endif
+
+
+static const char* operator_symbol(Opcode op) {
+    switch (op) {
+        case Opcode::Add: case Opcode::AddInt: return "+";
+        case Opcode::Sub: case Opcode::SubInt: return "-";
+        case Opcode::Mul: return "*";
+        case Opcode::Div: return "/";
+        case Opcode::IntDiv: return "//";
+        case Opcode::Pow: return "**";
+        case Opcode::Xor: return "^";
+        case Opcode::Less: return "<";
+        case Opcode::LessEq: return "<=";
+        case Opcode::Greater: return ">";
+        case Opcode::GreaterEq: return ">=";
+        case Opcode::Neg: return "-";
+        default: return opcode_name(op);
+    }
+}
+
+
+// x ** y for y >= 0, or false on overflow.
+static bool int_pow(i64 x, i64 y, i64& result) {
+    i64 acc = 1;
+    while (y > 0) {
+        if (y & 1 && __builtin_mul_overflow(acc, x, &acc)) {
+            return false;
+        }
+        y >>= 1;
+        if (y > 0 && __builtin_mul_overflow(x, x, &x)) {
+            return false;
+        }
+    }
+    result = acc;
+    return true;
+}
+
+
+// The sum and difference of two small ints never overflow an i64; these
+// stand in for __builtin_add_overflow and __builtin_sub_overflow there.
+static bool small_int_add(i64 x, i64 y, i64* result) {
+    *result = x + y;
+    return false;
+}
+
+
+static bool small_int_sub(i64 x, i64 y, i64* result) {
+    *result = x - y;
+    return false;
+}
+
+
+static bool builtin_print(Vm& vm, Value* args, u32 num_args, Value& result) {
+    for (u32 i = 0; i < num_args; ++i) {
+        if (i > 0) {
+            vm.out.put(' ');
+        }
+        vm.out.write(format_value(args[i]));
+    }
+    vm.out.put('\n');
+    result = Value::none();
+    return true;
+}
+
+
+static bool builtin_len(Vm& vm, Value* args, u32, Value& result) {
+    if (is_object(args[0], ObjectKind::String)) {
+        result = make_int(vm.program.heap, as_string(args[0]).text.size());
+    } else if (is_object(args[0], ObjectKind::List)) {
+        result = make_int(vm.program.heap, as_list(args[0]).items.size());
+    } else {
+        return vm.fail(format("{} has no length", type_name(args[0])));
+    }
+    return true;
+}
+
+
+// range n is [0, n), range a b is [a, b).
+static bool builtin_range(Vm& vm, Value* args, u32 num_args, Value& result) {
+    if (num_args < 1 || num_args > 2) {
+        return vm.fail(format("range takes 1 or 2 arguments, got {}", num_args));
+    }
+    for (u32 i = 0; i < num_args; ++i) {
+        if (!args[i].is_int()) {
+            return vm.fail("range needs integers");
+        }
+    }
+
+    const i64 begin = num_args == 2 ? args[0].as_int() : 0;
+    const i64 end = args[num_args - 1].as_int();
+    std::vector<Value> items;
+    for (i64 i = begin; i < end; ++i) {
+        items.push_back(make_int(vm.program.heap, i));
+    }
+    result = Value::from_object(vm.program.heap.make<ListObject>(std::move(items)));
+    return true;
+}
+
+
+static bool builtin_append(Vm& vm, Value* args, u32, Value& result) {
+    if (!is_object(args[0], ObjectKind::List)) {
+        return vm.fail(format("cannot append to {}", type_name(args[0])));
+    }
+    ListObject& list = as_list(args[0]);
+    const usize payload = payload_bytes(list);
+    list.items.push_back(args[1]);
+    vm.program.heap.write_barrier(&list, args[1]);
+    vm.program.heap.payload_changed(list, payload);
+    result = Value::none();
+    return true;
+}
+
+
+static bool builtin_str(Vm& vm, Value* args, u32, Value& result) {
+    result = Value::from_object(vm.program.heap.make<StringObject>(format_value(args[0])));
+    return true;
+}
+
+
+Vm::Vm(Program& program, WriteBuffer& out, const VmOptions& options) :
+    program(program),
+    out(out),
+    stack(new Value[options.stack_size]),
+    stack_size(options.stack_size),
+    jit_threshold(Jit::available ? options.jit_threshold : 0)
+{
+    frames.reserve(max_frames);
+    program.heap.set_nursery_size(options.nursery_size);
+
+    const Builtin builtins[] = {
+        {"print", -1, builtin_print},
+        {"len", 1, builtin_len},
+        {"range", -1, builtin_range},
+        {"append", 2, builtin_append},
+        {"str", 1, builtin_str},
+    };
+    for (const Builtin& builtin : builtins) {
+        const u32 slot = program.global(builtin.name);
+        program.globals[slot] = Value::from_object(program.heap.make_tenured<Builtin>(builtin));
+    }
+
+    program.globals[program.global("none")] = Value::none();
+    program.globals[program.global("true")] = Value::from_bool(true);
+    program.globals[program.global("false")] = Value::from_bool(false);
+}
+
+
+bool Vm::fail(std::string message) {
+    error = std::move(message);
+    return false;
+}
+
+
+bool Vm::arithmetic(Opcode op, const Value& a, const Value& b, Value& result) {
+    if (a.is_int() && b.is_int()) {
+        const i64 x = a.as_int();
+        const i64 y = b.as_int();
+        i64 r = 0;
+        bool overflow = false;
+
+        switch (op) {
+            case Opcode::Add: case Opcode::AddInt: overflow = __builtin_add_overflow(x, y, &r); break;
+            case Opcode::Sub: case Opcode::SubInt: overflow = __builtin_sub_overflow(x, y, &r); break;
+            case Opcode::Mul: overflow = __builtin_mul_overflow(x, y, &r); break;
+            case Opcode::Xor: r = x ^ y; break;
+
+            case Opcode::Div:
+                if (y == 0) {
+                    return fail("division by zero");
+                }
+                result = Value::from_float(static_cast<double>(x) / static_cast<double>(y));
+                return true;
+
+            case Opcode::IntDiv:
+                if (y == 0) {
+                    return fail("division by zero");
+                }
+                if (x == INT64_MIN && y == -1) {
+                    overflow = true;
+                    break;
+                }
+                r = x / y;
+                if (x % y != 0 && (x < 0) != (y < 0)) {
+                    --r;
+                }
+                break;
+
+            case Opcode::Pow:
+                if (y < 0) {
+                    result = Value::from_float(std::pow(static_cast<double>(x), static_cast<double>(y)));
+                    return true;
+                }
+                overflow = !int_pow(x, y, r);
+                break;
+
+            default:
+                verify(false, "not an arithmetic opcode");
+        }
+
+        if (overflow) {
+            return fail(format("integer overflow in {}", operator_symbol(op)));
+        }
+        result = make_int(program.heap, r);
+        return true;
+    }
+
+    if (a.is_number() && b.is_number() && op != Opcode::Xor) {
+        const double x = a.to_float();
+        const double y = b.to_float();
+        switch (op) {
+            case Opcode::Add: case Opcode::AddInt: result = Value::from_float(x + y); return true;
+            case Opcode::Sub: case Opcode::SubInt: result = Value::from_float(x - y); return true;
+            case Opcode::Mul: result = Value::from_float(x * y); return true;
+            case Opcode::Pow: result = Value::from_float(std::pow(x, y)); return true;
+            default: break;
+        }
+        if (y == 0) {
+            return fail("division by zero");
+        }
+        result = Value::from_float(op == Opcode::Div ? x / y : std::floor(x / y));
+        return true;
+    }
+
+    if (op == Opcode::Add && is_object(a, ObjectKind::String) && is_object(b, ObjectKind::String)) {
+        result = Value::from_object(program.heap.make<StringObject>(as_string(a).text + as_string(b).text));
+        return true;
+    }
+
+    if (op == Opcode::Add && is_object(a, ObjectKind::List) && is_object(b, ObjectKind::List)) {
+        std::vector<Value> items = as_list(a).items;
+        items.insert(items.end(), as_list(b).items.begin(), as_list(b).items.end());
+        result = Value::from_object(program.heap.make<ListObject>(std::move(items)));
+        return true;
+    }
+
+    return fail(format("unsupported operands for {}: {} and {}", operator_symbol(op), type_name(a), type_name(b)));
+}
+
+
+bool Vm::compare(Opcode op, const Value& a, const Value& b, bool& result) {
+    switch (op) {
+        case Opcode::Equal: result = values_equal(a, b); return true;
+        case Opcode::NotEqual: result = !values_equal(a, b); return true;
+
+        case Opcode::In:
+            if (is_object(b, ObjectKind::List)) {
+                result = false;
+                for (const Value& item : as_list(b).items) {
+                    if (values_equal(a, item)) {
+                        result = true;
+                        break;
+                    }
+                }
+                return true;
+            }
+            if (is_object(b, ObjectKind::String) && is_object(a, ObjectKind::String)) {
+                result = as_string(b).text.find(as_string(a).text) != std::string::npos;
+                return true;
+            }
+            return fail(format("unsupported operands for in: {} and {}", type_name(a), type_name(b)));
+
+        default:
+            break;
+    }
+
+    int order;
+    if (a.is_int() && b.is_int()) {
+        const i64 x = a.as_int();
+        const i64 y = b.as_int();
+        order = (x > y) - (x < y);
+    } else if (a.is_number() && b.is_number()) {
+        const double x = a.to_float();
+        const double y = b.to_float();
+        if (std::isnan(x) || std::isnan(y)) {
+            result = false;
+            return true;
+        }
+        order = (x > y) - (x < y);
+    } else if (is_object(a, ObjectKind::String) && is_object(b, ObjectKind::String)) {
+        order = as_string(a).text.compare(as_string(b).text);
+    } else {
+        return fail(format("cannot compare {} and {}", type_name(a), type_name(b)));
+    }
+
+    switch (op) {
+        case Opcode::Less: result = order < 0; break;
+        case Opcode::LessEq: result = order <= 0; break;
+        case Opcode::Greater: result = order > 0; break;
+        case Opcode::GreaterEq: result = order >= 0; break;
+        default: verify(false, "not a comparison opcode");
+    }
+    return true;
+}
+
+
+// A list index, counting from the end if negative.
+static bool normalize_index(Vm& vm, const Value& index, usize size, usize& at) {
+    if (!index.is_int()) {
+        return vm.fail(format("index is a {}, not an int", type_name(index)));
+    }
+    const i64 i = index.as_int() < 0 ? index.as_int() + static_cast<i64>(size) : index.as_int();
+    if (i < 0 || static_cast<u64>(i) >= size) {
+        return vm.fail(format("index {} out of range for length {}", index.as_int(), size));
+    }
+    at = static_cast<usize>(i);
+    return true;
+}
+
+
+bool Vm::get_index(const Value& object, const Value& index, Value& result) {
+    usize at;
+    if (is_object(object, ObjectKind::List)) {
+        const auto& items = as_list(object).items;
+        if (!normalize_index(*this, index, items.size(), at)) {
+            return false;
+        }
+        result = items[at];
+        return true;
+    }
+    if (is_object(object, ObjectKind::String)) {
+        const std::string& text = as_string(object).text;
+        if (!normalize_index(*this, index, text.size(), at)) {
+            return false;
+        }
+        result = Value::from_object(program.heap.make<StringObject>(std::string(1, text[at])));
+        return true;
+    }
+    return fail(format("cannot index {}", type_name(object)));
+}
+
+
+bool Vm::set_index(const Value& object, const Value& index, const Value& value) {
+    if (!is_object(object, ObjectKind::List)) {
+        return fail(format("cannot assign to an item of {}", type_name(object)));
+    }
+    auto& items = as_list(object).items;
+    usize at;
+    if (!normalize_index(*this, index, items.size(), at)) {
+        return false;
+    }
+    items[at] = value;
+    program.heap.write_barrier(&as_list(object), value);
+    return true;
+}
+
+
+// The roots are the registers of every frame, including the one running
+// `fn` at `r`, the globals and the module code, which holds every function.
+void Vm::collect_garbage(Function* fn, Value* r) {
+    Value main = Value::from_object(program.main);
+    std::vector<RootSpan> roots;
+    roots.reserve(frames.size() + 3);
+    for (const Frame& frame : frames) {
+        roots.push_back({frame.base, frame.base + frame.function->num_registers});
+    }
+    roots.push_back({r, r + fn->num_registers});
+    roots.push_back({program.globals.data(), program.globals.data() + program.globals.size()});
+    roots.push_back({&main, &main + 1});
+    program.heap.collect(roots);
+}
+
+
+// Compiles a function declared by compile_lazy() on its first call. An
+// error in it is reported where it is in the source.
+bool Vm::load(Function& function) {
+    verify(bool(program.load), "calling a function that was not compiled");
+    if (std::optional<CompileError> compile_error = program.load(function)) {
+        error_offset = compile_error->offset;
+        return fail(std::move(compile_error->message));
+    }
+    return true;
+}
+
+
+Result<Value, RuntimeError> Vm::run() {
+    Function* fn = program.main;
+    verify(fn->num_registers < stack_size, "stack too small for the module code");
+
+    // The slot below the first frame takes the place of a callee.
+    Value* r = stack.get() + 1;
+    Value* const stack_end = stack.get() + stack_size;
+    const Instruction* pc = fn->code.data();
+    const Value* k = fn->constants.data();
+    Instruction insn;
+    frames.clear();
+
+    for (u32 i = 0; i < fn->num_registers; ++i) {
+        r[i] = Value::none();
+    }
+
+#define A (insn.a())
+#define B (insn.b())
+#define C (insn.c())
+#define RA (r[insn.a()])
+#define RB (r[insn.b()])
+#define RC (r[insn.c()])
+#define CHECK(call) if (!(call)) goto error
+
+    // Whether `function` has machine code, compiling it if it just got hot.
+    // The count stops at the threshold, so it cannot wrap around to it, and
+    // never starts with a threshold of 0.
+#define NATIVE(function) \
+    ((function)->native || \
+     ((function)->hotness < jit_threshold && ++(function)->hotness == jit_threshold && jit.compile(*(function))))
+
+    // Runs the machine code of fn from pc, up to where it hands back.
+#define ENTER_NATIVE() \
+    (pc = fn->code.data() + jit.enter(*fn, r, program.globals.data(), pc - fn->code.data()))
+
+    // Collects garbage if the heap asks for it. Calls and backward jumps
+    // check, so loops that allocate do too; every value is in a register or
+    // a global there.
+#define SAFEPOINT() do { if (program.heap.wants_collection()) collect_garbage(fn, r); } while (0)
+
+#ifdef KALPA_COMPUTED_GOTO
+    static const void* const labels[] = {
+#define KALPA_OPCODE_LABEL(name) &&op_ ## name,
+        KALPA_OPCODES(KALPA_OPCODE_LABEL)
+#undef KALPA_OPCODE_LABEL
+    };
+
+#define CASE(name) op_ ## name:
+#define DISPATCH() do { insn = *pc++; goto *labels[insn.word & 0xff]; } while (0)
+
+    DISPATCH();
+#else
+#define CASE(name) case Opcode::name:
+#define DISPATCH() continue
+
+    while (true) {
+        insn = *pc++;
+        switch (insn.op()) {
+#endif
+
+    CASE(Move) {
+        RA = RB;
+        DISPATCH();
+    }
+
+    CASE(LoadNone) {
+        RA = Value::none();
+        DISPATCH();
+    }
+
+    CASE(LoadInt) {
+        RA = Value::from_small_int(insn.sbx());
+        DISPATCH();
+    }
+
+    CASE(LoadConst) {
+        RA = k[insn.bx()];
+        DISPATCH();
+    }
+
+    CASE(GetGlobal) {
+        const Value& value = program.globals[insn.bx()];
+        if (value.is_undefined()) {
+            fail(format("{} is not defined", program.interner->name(program.global_names[insn.bx()])));
+            goto error;
+        }
+        RA = value;
+        DISPATCH();
+    }
+
+    CASE(SetGlobal) {
+        program.globals[insn.bx()] = RA;
+        DISPATCH();
+    }
+
+    CASE(NewList) {
+        std::vector<Value> items(r + B, r + B + C);
+        RA = Value::from_object(program.heap.make<ListObject>(std::move(items)));
+        DISPATCH();
+    }
+
+    CASE(GetIndex) {
+        Value result;
+        CHECK(get_index(RB, RC, result));
+        RA = result;
+        DISPATCH();
+    }
+
+    CASE(SetIndex) {
+        CHECK(set_index(RA, RB, RC));
+        DISPATCH();
+    }
+
+    // Small ints and floats are handled inline. Anything else, including
+    // a result that needs promoting to a boxed int, takes the slow path.
+#define ARITHMETIC(name, builtin, float_op) \
+    CASE(name) { \
+        const Value x = RB; \
+        const Value y = RC; \
+        if (x.is_small_int() && y.is_small_int()) { \
+            i64 result; \
+            if (!builtin(x.as_small_int(), y.as_small_int(), &result) && Value::fits_small_int(result)) { \
+                RA = Value::from_small_int(result); \
+                DISPATCH(); \
+            } \
+        } else if (x.is_float() && y.is_float()) { \
+            RA = Value::from_float(x.as_float() float_op y.as_float()); \
+            DISPATCH(); \
+        } \
+        Value result; \
+        CHECK(arithmetic(Opcode::name, x, y, result)); \
+        RA = result; \
+        DISPATCH(); \
+    }
+
+    ARITHMETIC(Add, small_int_add, +)
+    ARITHMETIC(Sub, small_int_sub, -)
+    ARITHMETIC(Mul, __builtin_mul_overflow, *)
+#undef ARITHMETIC
+
+    CASE(Xor) {
+        const Value x = RB;
+        const Value y = RC;
+        if (x.is_small_int() && y.is_small_int()) {
+            RA = Value::from_small_int(x.as_small_int() ^ y.as_small_int());
+            DISPATCH();
+        }
+        Value result;
+        CHECK(arithmetic(Opcode::Xor, x, y, result));
+        RA = result;
+        DISPATCH();
+    }
+
+    CASE(IntDiv) {
+        const Value x = RB;
+        const Value y = RC;
+        if (x.is_small_int() && y.is_small_int() && y.as_small_int() != 0) {
+            const i64 a = x.as_small_int();
+            const i64 b = y.as_small_int();
+            const i64 q = a / b - (a % b != 0 && (a < 0) != (b < 0));
+            if (Value::fits_small_int(q)) {
+                RA = Value::from_small_int(q);
+                DISPATCH();
+            }
+        }
+        Value result;
+        CHECK(arithmetic(Opcode::IntDiv, x, y, result));
+        RA = result;
+        DISPATCH();
+    }
+
+    CASE(Pow) {
+        const Value x = RB;
+        const Value y = RC;
+        i64 power;
+        if (x.is_small_int() && y.is_small_int() && y.as_small_int() >= 0 &&
+            int_pow(x.as_small_int(), y.as_small_int(), power) && Value::fits_small_int(power)) {
+            RA = Value::from_small_int(power);
+            DISPATCH();
+        }
+        Value result;
+        CHECK(arithmetic(Opcode::Pow, x, y, result));
+        RA = result;
+        DISPATCH();
+    }
+
+    CASE(Div) {
+        Value result;
+        CHECK(arithmetic(Opcode::Div, RB, RC, result));
+        RA = result;
+        DISPATCH();
+    }
+
+#define COMPARISON(name, primitive_op) \
+    CASE(name) { \
+        const Value x = RB; \
+        const Value y = RC; \
+        if (x.is_small_int() && y.is_small_int()) { \
+            RA = Value::from_bool(x.as_small_int() primitive_op y.as_small_int()); \
+            DISPATCH(); \
+        } \
+        if (x.is_float() && y.is_float()) { \
+            RA = Value::from_bool(x.as_float() primitive_op y.as_float()); \
+            DISPATCH(); \
+        } \
+        bool result; \
+        CHECK(compare(Opcode::name, x, y, result)); \
+        RA = Value::from_bool(result); \
+        DISPATCH(); \
+    }
+
+    COMPARISON(Equal, ==)
+    COMPARISON(NotEqual, !=)
+    COMPARISON(Less, <)
+    COMPARISON(LessEq, <=)
+    COMPARISON(Greater, >)
+    COMPARISON(GreaterEq, >=)
+#undef COMPARISON
+
+    CASE(In) {
+        bool result;
+        CHECK(compare(Opcode::In, RB, RC, result));
+        RA = Value::from_bool(result);
+        DISPATCH();
+    }
+
+    CASE(AddInt) {
+        const Value x = RB;
+        if (x.is_small_int()) {
+            const i64 result = x.as_small_int() + insn.sc();
+            if (Value::fits_small_int(result)) {
+                RA = Value::from_small_int(result);
+                DISPATCH();
+            }
+        }
+        Value sum;
+        CHECK(arithmetic(Opcode::AddInt, x, Value::from_small_int(insn.sc()), sum));
+        RA = sum;
+        DISPATCH();
+    }
+
+    CASE(SubInt) {
+        const Value x = RB;
+        if (x.is_small_int()) {
+            const i64 result = x.as_small_int() - insn.sc();
+            if (Value::fits_small_int(result)) {
+                RA = Value::from_small_int(result);
+                DISPATCH();
+            }
+        }
+        Value difference;
+        CHECK(arithmetic(Opcode::SubInt, x, Value::from_small_int(insn.sc()), difference));
+        RA = difference;
+        DISPATCH();
+    }
+
+    CASE(Neg) {
+        const Value x = RB;
+        if (x.is_float()) {
+            RA = Value::from_float(-x.as_float());
+        } else if (x.is_int() && x.as_int() != INT64_MIN) {
+            RA = make_int(program.heap, -x.as_int());
+        } else {
+            fail(x.is_int() ? "integer overflow in -" : format("unsupported operand for -: {}", type_name(x)));
+            goto error;
+        }
+        DISPATCH();
+    }
+
+    CASE(Not) {
+        RA = Value::from_bool(!is_truthy(RB));
+        DISPATCH();
+    }
+
+    CASE(Jump) {
+        pc += insn.sax();
+        if (insn.sax() < 0) {
+            SAFEPOINT();
+            if (NATIVE(fn)) {
+                ENTER_NATIVE();
+            }
+        }
+        DISPATCH();
+    }
+
+    CASE(JumpIfFalse) {
+        const Value& x = RA;
+        if (x.is_bool() ? !x.as_bool() : !is_truthy(x)) {
+            pc += insn.sbx();
+        }
+        DISPATCH();
+    }
+
+    CASE(JumpIfTrue) {
+        const Value& x = RA;
+        if (x.is_bool() ? x.as_bool() : is_truthy(x)) {
+            pc += insn.sbx();
+        }
+        DISPATCH();
+    }
+
+    // The Jump after a branch is never dispatched; its offset is taken
+    // from here.
+#define BRANCH(name, compare_op, primitive_op) \
+    CASE(name) { \
+        const Value x = RA; \
+        const Value y = RB; \
+        bool result; \
+        if (x.is_small_int() && y.is_small_int()) { \
+            result = x.as_small_int() primitive_op y.as_small_int(); \
+        } else if (x.is_float() && y.is_float()) { \
+            result = x.as_float() primitive_op y.as_float(); \
+        } else { \
+            CHECK(compare(Opcode::compare_op, x, y, result)); \
+        } \
+        if (result != static_cast<bool>(C)) { \
+            ++pc; \
+            DISPATCH(); \
+        } \
+        const i32 offset = pc->sax(); \
+        pc += offset + 1; \
+        if (offset < 0) { \
+            SAFEPOINT(); \
+            if (NATIVE(fn)) { \
+                ENTER_NATIVE(); \
+            } \
+        } \
+        DISPATCH(); \
+    }
+
+    BRANCH(BranchEqual, Equal, ==)
+    BRANCH(BranchLess, Less, <)
+    BRANCH(BranchLessEq, LessEq, <=)
+#undef BRANCH
+
+    CASE(ForRange) {
+        Value* const v = r + A;
+        if (v[0].is_small_int() && v[1].is_small_int()) {
+            const i64 i = v[0].as_small_int();
+            if (i < v[1].as_small_int()) {
+                v[2] = v[0];
+                v[0] = Value::from_small_int(i + 1);
+            } else {
+                pc += insn.sbx();
+            }
+            DISPATCH();
+        }
+
+        if (!v[0].is_int() || !v[1].is_int()) {
+            fail("range needs integers");
+            goto error;
+        }
+        const i64 i = v[0].as_int();
+        if (i < v[1].as_int()) {
+            v[2] = v[0];
+            v[0] = make_int(program.heap, i + 1);
+        } else {
+            pc += insn.sbx();
+        }
+        DISPATCH();
+    }
+
+    CASE(ForEach) {
+        Value* const v = r + A;
+        if (!is_object(v[1], ObjectKind::List)) {
+            fail(format("cannot iterate over {}", type_name(v[1])));
+            goto error;
+        }
+        const auto& items = as_list(v[1]).items;
+        const i64 i = v[0].as_small_int();
+        if (static_cast<u64>(i) < items.size()) {
+            v[2] = items[i];
+            v[0] = Value::from_small_int(i + 1);
+        } else {
+            pc += insn.sbx();
+        }
+        DISPATCH();
+    }
+
+    CASE(Call) {
+        SAFEPOINT();
+        Value* const callee = r + A;
+        const u32 num_args = B;
+
+        if (is_object(*callee, ObjectKind::Function)) {
+            Function* const function = static_cast<Function*>(callee->as_object());
+            if (function->code.empty()) {
+                CHECK(load(*function));
+            }
+            if (num_args != function->arity) {
+                fail(format("{} takes {} argument{}, got {}", function->name, function->arity, function->arity == 1 ? "" : "s", num_args));
+                goto error;
+            }
+
+            Value* const base = callee + 1;
+            if (function->num_registers > static_cast<usize>(stack_end - base) || frames.size() == max_frames) {
+                fail("stack overflow");
+                goto error;
+            }
+
+            frames.push_back(Frame{fn, pc, r});
+            for (u32 i = num_args; i < function->num_registers; ++i) {
+                base[i] = Value::none();
+            }
+            fn = function;
+            pc = function->code.data();
+            k = function->constants.data();
+            r = base;
+            if (NATIVE(fn)) {
+                ENTER_NATIVE();
+            }
+            DISPATCH();
+        }
+
+        if (is_object(*callee, ObjectKind::Builtin)) {
+            const Builtin* const builtin = static_cast<const Builtin*>(callee->as_object());
+            if (builtin->arity >= 0 && num_args != static_cast<u32>(builtin->arity)) {
+                fail(format("{} takes {} argument{}, got {}", builtin->name, builtin->arity, builtin->arity == 1 ? "" : "s", num_args));
+                goto error;
+            }
+            CHECK(builtin->native(*this, callee + 1, num_args, *callee));
+            DISPATCH();
+        }
+
+        fail(format("{} is not callable", type_name(*callee)));
+        goto error;
+    }
+
+    CASE(Return) {
+        const Value result = RA;
+        if (frames.empty()) {
+            return result;
+        }
+
+        r[-1] = result;
+        const Frame& caller = frames.back();
+        fn = caller.function;
+        pc = caller.pc;
+        r = caller.base;
+        k = fn->constants.data();
+        frames.pop_back();
+        if (fn->native) {
+            ENTER_NATIVE();
+        }
+        DISPATCH();
+    }
+
+    CASE(ReturnNone) {
+        if (frames.empty()) {
+            return Value::none();
+        }
+
+        r[-1] = Value::none();
+        const Frame& caller = frames.back();
+        fn = caller.function;
+        pc = caller.pc;
+        r = caller.base;
+        k = fn->constants.data();
+        frames.pop_back();
+        if (fn->native) {
+            ENTER_NATIVE();
+        }
+        DISPATCH();
+    }
+
+#ifndef KALPA_COMPUTED_GOTO
+        }
+    }
+#endif
+
+#undef A
+#undef B
+#undef C
+#undef RA
+#undef RB
+#undef RC
+#undef CHECK
+#undef NATIVE
+#undef ENTER_NATIVE
+#undef SAFEPOINT
+#undef CASE
+#undef DISPATCH
+
+error:
+    const u32 offset = error_offset ? *error_offset : fn->offsets[pc - 1 - fn->code.data()];
+    error_offset.reset();
+    frames.clear();
+    return RuntimeError{std::move(error), offset};
+}
+
+
+}
@@ -0,0 +1,105 @@
+#ifndef KALPA_VM_H
+#define KALPA_VM_H
+
+
+#include <memory>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "bytecode.h"
+#include "defs.h"
+#include "heap.h"
+#include "jit.h"
+#include "result.h"
+#include "value.h"
+#include "write_buffer.h"
+
+
+namespace klp {
+
+
+struct RuntimeError {
+    std::string message;
+    u32 offset;  // of the instruction that failed
+};
+
+
+struct VmOptions {
+    usize stack_size = 1 << 20;  // in values
+
+    // Calls plus backward jumps after which a function is compiled to
+    // machine code, or 0 to only interpret.
+    u32 jit_threshold = 1000;
+
+    // In bytes. Objects that outlive a collection of the nursery move to
+    // the old generation.
+    usize nursery_size = Heap::default_nursery_size;
+};
+
+
+//
+//  Runs a compiled Program. Every frame is a window of registers on one
+//  contiguous stack: a call puts the callee and its arguments in
+//  consecutive registers, the arguments become the first registers of the
+//  new frame, and the result replaces the callee. Calls thus copy nothing.
+//
+//  Dispatch jumps straight from one instruction's handler to the next
+//  through a table of label addresses where the compiler supports it, and
+//  goes through a switch otherwise, or when built with
+//  -DKALPA_SWITCH_DISPATCH.
+//
+//  Functions that get hot run as machine code from the JIT, which returns
+//  to the interpreter for anything it does not compile, including calls
+//  and returns. The interpreter goes back into the machine code after a
+//  call returns to it and on backward jumps.
+//
+class Vm {
+public:
+    static constexpr usize max_frames = 1 << 16;
+
+public:
+    // Installs the builtins in the globals of `program`. print writes to
+    // `out`.
+    Vm(Program& program, WriteBuffer& out, const VmOptions& options = VmOptions());
+
+    Vm(const Vm&) = delete;
+    Vm& operator=(const Vm&) = delete;
+
+    // Runs the module code of the program.
+    Result<Value, RuntimeError> run();
+
+    // Records the error of a builtin. Returns false, for `return vm.fail(...)`.
+    bool fail(std::string message);
+
+    Program& program;
+    WriteBuffer& out;
+
+private:
+    struct Frame {
+        Function* function;
+        const Instruction* pc;
+        Value* base;
+    };
+
+    std::unique_ptr<Value[]> stack;
+    usize stack_size;
+    std::vector<Frame> frames;
+    std::string error;
+    std::optional<u32> error_offset;  // if not that of the failing instruction
+    Jit jit;
+    u32 jit_threshold;
+
+    bool arithmetic(Opcode op, const Value& a, const Value& b, Value& result);
+    bool compare(Opcode op, const Value& a, const Value& b, bool& result);
+    bool get_index(const Value& object, const Value& index, Value& result);
+    bool set_index(const Value& object, const Value& index, const Value& value);
+    void collect_garbage(Function* fn, Value* r);
+    bool load(Function& function);
+};
+
+
+}
+
+
+#endif
@@ -0,0 +1,57 @@
+#include "write_buffer.h"
+
+#include <cerrno>
+
+#include <unistd.h>
+
+
+namespace klp {
+
+
+WriteBuffer::WriteBuffer(int fd, usize capacity) : fd(fd), capacity(capacity) {
+    buffer.reserve(capacity);
+}
+
+
+WriteBuffer::~WriteBuffer() {
+    flush();
+}
+
+
+void WriteBuffer::write(const void* data, usize size) {
+    const char* const bytes = static_cast<const char*>(data);
+
+    // Blocks as large as the buffer go out directly.
+    if (size >= capacity) {
+        flush();
+        write_out(bytes, size);
+        return;
+    }
+
+    buffer.append(bytes, bytes + size);
+    flush_if_full();
+}
+
+
+bool WriteBuffer::flush() {
+    write_out(buffer.data(), buffer.size());
+    buffer.clear();
+    return !failed;
+}
+
+
+void WriteBuffer::write_out(const char* data, usize size) {
+    while (size > 0 && !failed) {
+        const ssize_t n = ::write(fd, data, size);
+        if (n < 0) {
+            failed = errno != EINTR;
+            continue;
+        }
+
+        data += n;
+        size -= n;
+    }
+}
+
+
+}
@@ -0,0 +1,78 @@
+#ifndef KALPA_WRITE_BUFFER_H
+#define KALPA_WRITE_BUFFER_H
+
+
+#include <string_view>
+
+#include <fmt/format.h>
+
+#include "defs.h"
+
+
+namespace klp {
+
+
+//
+//  Output to a file descriptor, collected in a large user-space buffer so
+//  that dumping millions of small records costs a handful of write()
+//  calls. The buffer is flushed when it fills up and on destruction.
+//
+//  A failed write is remembered, and later output is dropped. Check ok()
+//  after the final flush().
+//
+class WriteBuffer {
+public:
+    static constexpr usize default_capacity = 1 << 20;
+
+public:
+    explicit WriteBuffer(int fd, usize capacity = default_capacity);
+
+    WriteBuffer(const WriteBuffer&) = delete;
+    WriteBuffer& operator=(const WriteBuffer&) = delete;
+
+    ~WriteBuffer();
+
+    void write(const void* data, usize size);
+
+    void write(std::string_view text) {
+        write(text.data(), text.size());
+    }
+
+    void put(char c) {
+        buffer.push_back(c);
+        flush_if_full();
+    }
+
+    template <typename S, typename... Args>
+    void print(const S& format, const Args&... args) {
+        fmt::format_to(fmt::appender(buffer), format, args...);
+        flush_if_full();
+    }
+
+    // Writes out everything buffered so far. Returns ok().
+    bool flush();
+
+    bool ok() const {
+        return !failed;
+    }
+
+private:
+    int fd;
+    usize capacity;
+    fmt::memory_buffer buffer;
+    bool failed = false;
+
+    void write_out(const char* data, usize size);
+
+    void flush_if_full() {
+        if (buffer.size() >= capacity) {
+            flush();
+        }
+    }
+};
+
+
+}
+
+
+#endif
@@ -0,0 +1,104 @@
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include <unistd.h>
+
+#include "corpus.h"
+#include "defs.h"
+#include "driver.h"
+#include "interner.h"
+#include "thread_pool.h"
+
+#include "test.h"
+
+
+namespace klp {
+
+
+KALPA_TEST(driver_check_files) {
+    namespace fs = std::filesystem;
+    const fs::path root = fs::temp_directory_path() / format("kalpa-driver-{}", getpid());
+    fs::create_directories(root / "b" / "c");
+
+    const std::vector<std::string> names = {"b/c/z.kl", "b/x.kl", "a.kl", "b/notes.txt", "b/y.kl"};
+    for (usize i = 0; i < names.size(); ++i) {
+        std::ofstream file(root / names[i]);
+        file << generate_corpus(i + 1, 20000);
+        if (i % 2 == 0) {
+            file << "let bad = 1 $ 2\n";
+        }
+    }
+
+    const auto sources = collect_sources({(root / "b").string(), (root / "a.kl").string()});
+    KALPA_VERIFY(sources.has_value());
+    const std::vector<std::string> expected = {
+        (root / "b/c/z.kl").string(), (root / "b/x.kl").string(), (root / "b/y.kl").string(), (root / "a.kl").string(),
+    };
+    KALPA_VERIFY(*sources == expected);
+    KALPA_VERIFY(!collect_sources({(root / "missing").string()}));
+
+    // Results come in input order, whatever the number of threads.
+    std::vector<CheckResult> runs[2];
+    for (usize run = 0; run < 2; ++run) {
+        ThreadPool pool(run == 0 ? 1 : 4);
+        Interner interner;
+        runs[run] = check_files(*sources, pool, interner);
+    }
+
+    for (usize i = 0; i < expected.size(); ++i) {
+        const CheckResult& result = runs[1][i];
+        verify_eq(result.path, expected[i]);
+        KALPA_VERIFY(result.read_ok);
+        verify_eq(result.num_errors, i == 1 ? 0u : 1u);
+        verify_eq(result.report, runs[0][i].report);
+        verify_eq(result.num_tokens, runs[0][i].num_tokens);
+    }
+
+    fs::remove_all(root);
+}
+
+
+
+// What collect_sources() prints for `path`, which it must reject.
+static std::string collect_error(const std::string& path) {
+    FILE* const file = std::tmpfile();
+    KALPA_VERIFY(file != nullptr);
+    const int saved = dup(STDERR_FILENO);
+    dup2(fileno(file), STDERR_FILENO);
+    const bool ok = collect_sources({path}).has_value();
+    dup2(saved, STDERR_FILENO);
+    close(saved);
+    KALPA_VERIFY(!ok);
+
+    std::string text;
+    std::rewind(file);
+    char buffer[256];
+    usize size;
+    while ((size = std::fread(buffer, 1, sizeof(buffer), file)) > 0) {
+        text.append(buffer, size);
+    }
+    std::fclose(file);
+    return text;
+}
+
+
+// A path that cannot be examined says why, rather than that it is missing.
+KALPA_TEST(driver_path_errors) {
+    namespace fs = std::filesystem;
+    const fs::path root = fs::temp_directory_path() / format("kalpa-driver-errors-{}", getpid());
+    fs::create_directories(root);
+    fs::create_symlink(root / "loop", root / "loop");
+
+    const std::string missing = (root / "missing.kl").string();
+    verify_eq(collect_error(missing), format("Error: {}: no such file or directory\n", missing));
+
+    const std::string looped = (root / "loop" / "a.kl").string();
+    verify_eq(collect_error(looped), format("Error: {}: Too many levels of symbolic links\n", looped));
+
+    fs::remove_all(root);
+}
+
+}
@@ -0,0 +1,129 @@
+#include <string>
+#include <vector>
+
+#include "defs.h"
+#include "heap.h"
+#include "value.h"
+
+#include "test.h"
+
+
+namespace klp {
+
+
+KALPA_TEST(heap_minor_collection) {
+    Heap heap;
+    heap.set_nursery_size(4096);
+
+    Value roots[2] = {
+        Value::from_object(heap.make<StringObject>("kept")),
+        Value::from_object(heap.make<ListObject>(std::vector<Value>{make_int(heap, i64(1) << 60)})),
+    };
+    for (int i = 0; i < 10; ++i) {
+        heap.make<StringObject>("garbage");
+    }
+    KALPA_VERIFY(heap.in_nursery(roots[0].as_object()));
+    verify_eq(heap.size(), usize(13));
+
+    // The survivors move, and whatever refers to them follows.
+    heap.collect({{roots, roots + 2}});
+    verify_eq(heap.size(), usize(3));
+    KALPA_VERIFY(!heap.in_nursery(roots[0].as_object()) && !heap.in_nursery(roots[1].as_object()));
+    verify_eq(as_string(roots[0]).text, std::string("kept"));
+    const Value& item = as_list(roots[1]).items[0];
+    KALPA_VERIFY(item.is_object(ObjectKind::Int) && !heap.in_nursery(item.as_object()));
+    verify_eq(item.as_int(), i64(1) << 60);
+    verify_eq(heap.stats.minor_collections, u64(1));
+    verify_eq(heap.stats.major_collections, u64(0));
+}
+
+
+KALPA_TEST(heap_write_barrier) {
+    Heap heap;
+    heap.set_nursery_size(4096);
+
+    Value root = Value::from_object(heap.make_tenured<ListObject>(std::vector<Value>()));
+    ListObject& old = as_list(root);
+    for (int i = 0; i < 3; ++i) {
+        const Value young = Value::from_object(heap.make<StringObject>(std::to_string(i)));
+        old.items.push_back(young);
+        heap.write_barrier(&old, young);
+        heap.collect({{&root, &root + 1}});
+    }
+
+    // A full nursery makes new objects old, and asks for a collection.
+    while (!heap.wants_collection()) {
+        heap.make<IntObject>(i64(1) << 60);
+    }
+    old.items.push_back(Value::from_object(heap.make<ListObject>(std::vector<Value>{
+        Value::from_object(heap.make<StringObject>("young")),
+    })));
+    heap.collect({{&root, &root + 1}});
+
+    verify_eq(old.items.size(), usize(4));
+    verify_eq(as_string(old.items[2]).text, std::string("2"));
+    verify_eq(as_string(as_list(old.items[3]).items[0]).text, std::string("young"));
+
+    // The int that did not fit in the nursery is old garbage, which only a
+    // major collection frees.
+    verify_eq(heap.size(), usize(7));
+}
+
+
+KALPA_TEST(heap_payloads) {
+    Heap heap;
+    heap.set_nursery_size(4096);
+
+    // A list's items count as allocated, and a few of them call for a
+    // collection long before the nursery is full.
+    Value root = Value::from_object(heap.make<ListObject>(std::vector<Value>(100, Value::none())));
+    verify_eq(heap.stats.payload_bytes, u64(100 * sizeof(Value)));
+    KALPA_VERIFY(!heap.wants_collection());
+    heap.make<ListObject>(std::vector<Value>(500, Value::none()));
+    KALPA_VERIFY(heap.wants_collection());
+
+    heap.collect({{&root, &root + 1}});
+    verify_eq(heap.stats.payload_bytes, u64(100 * sizeof(Value)));
+    KALPA_VERIFY(!heap.wants_collection());
+
+    // Growing an old list counts as well.
+    ListObject& list = as_list(root);
+    const usize payload = payload_bytes(list);
+    list.items.resize(1000, Value::none());
+    heap.payload_changed(list, payload);
+    verify_eq(heap.stats.payload_bytes, u64(list.items.capacity() * sizeof(Value)));
+    KALPA_VERIFY(heap.wants_collection());
+
+    heap.collect({}, true);
+    verify_eq(heap.stats.payload_bytes, u64(0));
+    verify_eq(heap.stats.freed_bytes, heap.stats.allocated_bytes);
+}
+
+
+KALPA_TEST(heap_major_collection) {
+    Heap heap;
+    Value root = Value::from_object(heap.make_tenured<ListObject>(std::vector<Value>()));
+
+    // A cycle, reachable and then not.
+    ListObject* const a = heap.make_tenured<ListObject>(std::vector<Value>());
+    ListObject* const b = heap.make_tenured<ListObject>(std::vector<Value>{Value::from_object(a)});
+    a->items.push_back(Value::from_object(b));
+    as_list(root).items.push_back(Value::from_object(a));
+
+    heap.collect({{&root, &root + 1}}, true);
+    verify_eq(heap.size(), usize(3));
+    const u64 old_bytes = heap.stats.old_bytes;
+
+    as_list(root).items.clear();
+    heap.collect({{&root, &root + 1}}, true);
+    verify_eq(heap.size(), usize(1));
+    verify_eq(heap.stats.old_bytes, old_bytes - 2 * sizeof(ListObject));
+    verify_eq(heap.stats.major_collections, u64(2));
+
+    // Freed cells are used again, the last one swept first.
+    KALPA_VERIFY(heap.make_tenured<ListObject>(std::vector<Value>()) == b);
+    KALPA_VERIFY(heap.make_tenured<ListObject>(std::vector<Value>()) == a);
+}
+
+
+}
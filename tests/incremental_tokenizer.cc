@@ -0,0 +1,134 @@
+#include <string>
+
+#include "corpus.h"
+#include "defs.h"
+#include "incremental_tokenizer.h"
+#include "interner.h"
+#include "rng.h"
+#include "tokenizer.h"
+
+#include "test.h"
+#include "verify_tokens.h"
+
+
+namespace klp {
+
+
+// Lines that were indented wrongly before the edit, or are after it, left
+// the tokenizer at the level of an earlier line.
+KALPA_TEST(incremental_tokenizer_indent_errors) {
+    const std::string text = "def f =\n    if a:\n        x\n        y\nz\n";
+    std::string edited = text;
+    edited.erase(8, 4);
+
+    TokenBuffer tokens = tokenize_all(text);
+    retokenize(tokens, edited, Edit{8, 4, ""});
+    verify_same_tokens(tokens, tokenize_all(edited));
+    verify_eq(collect_diagnostics(tokens).size(), usize(2));
+
+    retokenize(tokens, text, Edit{8, 0, "    "});
+    verify_same_tokens(tokens, tokenize_all(text));
+    KALPA_VERIFY(collect_diagnostics(tokens).empty());
+}
+
+
+// Typing and deleting lines full of payloads leaves the tables no larger
+// than the tokens need.
+KALPA_TEST(incremental_tokenizer_tables_stay_bounded) {
+    const std::string line = "let x = 12 + 3.5 + \"tab\\t\" + $\n";
+
+    Rng<u64> rng({0x7461626c, 0x6573});
+    std::string text = generate_corpus(3, 16 * 1024);
+    TokenBuffer tokens = tokenize_all(text);
+
+    for (usize round = 0; round < 2000; ++round) {
+        u32 offset = text.find('\n', rng.next() % text.size());
+        offset = offset == std::string::npos ? 0 : offset + 1;
+
+        text.insert(offset, line);
+        retokenize(tokens, text, Edit{offset, 0, line});
+        text.erase(offset, line.size());
+        retokenize(tokens, text, Edit{offset, static_cast<u32>(line.size()), ""});
+
+        const TokenTables& tables = tokens.tables;
+        KALPA_VERIFY(tables.ints.size() + tables.floats.size() + tables.strings.size() + tables.errors.size() <= tokens.size());
+        KALPA_VERIFY(tables.arena.reserved_bytes() <= 2 * Arena::default_block_size);
+    }
+    verify_same_tokens(tokens, tokenize_all(text));
+}
+
+
+// Removing or typing a '"' or '\\' can end a literal that ran unterminated
+// to the end of the file, or make it run on, lines after it started.
+KALPA_TEST(incremental_tokenizer_quotes_and_escapes) {
+    {
+        const std::string text = "a = \"abc\nb\\\"\nc\n";
+        std::string edited = text;
+        edited.erase(text.find('\\'), 1);
+
+        TokenBuffer tokens = tokenize_all(text);
+        retokenize(tokens, edited, Edit{static_cast<u32>(text.find('\\')), 1, ""});
+        verify_same_tokens(tokens, tokenize_all(edited));
+    }
+
+    static const char* const snippets[] = {"", "\"", "\\", "\\\"", "\n", "x", "# \"\n"};
+    static const char* const lines[] = {
+        "a = \"abc\n", "b\\\"\n", "c = \"d\\\\\" + \"e\"\n", "# say \"hi\n",
+        "    f \"\\n\"\n", "g\n", "\\\n",
+    };
+
+    Rng<u64> rng({0x71756f74, 0x6573});
+    for (usize round = 0; round < 200; ++round) {
+        std::string text;
+        for (usize i = 0; i < 12; ++i) {
+            text += lines[rng.next() % (sizeof(lines) / sizeof(lines[0]))];
+        }
+        TokenBuffer tokens = tokenize_all(text);
+
+        for (usize n = 0; n < 60; ++n) {
+            Edit edit;
+            edit.offset = rng.next() % (text.size() + 1);
+            edit.removed = std::min<u64>(rng.next() % 3, text.size() - edit.offset);
+            edit.inserted = snippets[rng.next() % (sizeof(snippets) / sizeof(snippets[0]))];
+
+            text.replace(edit.offset, edit.removed, edit.inserted);
+            retokenize(tokens, text, edit);
+            verify_same_tokens(tokens, tokenize_all(text));
+        }
+    }
+}
+
+
+// Random edits, with or without lexing errors before and after them.
+KALPA_TEST(incremental_tokenizer) {
+    static const char* const snippets[] = {
+        "", "x", " y2 ", "\n", "\n    ", "    ", "\"", "\"\n\"", "# note\n",
+        "let z = 1\n", "\n\n", "(", ")", "**", "=", "42", "3.5",
+        "  ", "\n        y\n", "\\", "$",
+    };
+
+    Rng<u64> rng({0x696e6372, 0x656d656e74});
+    std::string text = generate_corpus(5, 64 * 1024);
+    TokenBuffer tokens = tokenize_all(text);
+
+    usize num_edits = 0;
+    while (num_edits < 300) {
+        Edit edit;
+        edit.offset = rng.next() % (text.size() + 1);
+        edit.removed = std::min<u64>(rng.next() % 8, text.size() - edit.offset);
+        edit.inserted = snippets[rng.next() % (sizeof(snippets) / sizeof(snippets[0]))];
+
+        text.replace(edit.offset, edit.removed, edit.inserted);
+        const auto stats = retokenize(tokens, text, edit);
+        verify_same_tokens(tokens, tokenize_all(text));
+
+        // Far from the end of the file, an edit must not re-lex the rest.
+        if (edit.offset + 4096 < text.size() && stats.resync_offset == text.size()) {
+            verify(false, "re-lexed to the end of the file");
+        }
+        ++num_edits;
+    }
+}
+
+
+}
@@ -0,0 +1,50 @@
+#include <string>
+
+#include "defs.h"
+#include "interner.h"
+#include "tokenizer.h"
+
+#include "test.h"
+
+
+namespace klp {
+
+
+KALPA_TEST(interner) {
+    Interner interner;
+    std::vector<Atom> atoms;
+
+    for (int i = 0; i < 5000; ++i) {
+        const std::string name = "name" + std::to_string(i);
+        atoms.push_back(interner.intern(name));
+        verify_eq(atoms.back(), static_cast<Atom>(i));
+    }
+
+    for (int i = 0; i < 5000; ++i) {
+        const std::string name = "name" + std::to_string(i);
+        verify_eq(interner.intern(name), atoms[i]);
+        verify_eq(interner.name(atoms[i]), name);
+    }
+
+    Interner other;
+    other.intern("fresh");
+    other.intern("name42");
+    const auto mapping = interner.absorb(other);
+    verify_eq(mapping[0], static_cast<Atom>(5000));
+    verify_eq(mapping[1], atoms[42]);
+}
+
+
+KALPA_TEST(interner_across_files) {
+    const std::string first = "alpha beta";
+    const std::string second = "beta alpha";
+
+    const auto a = tokenize_all(first);
+    const auto b = tokenize_all(second);
+    verify_eq(a.tables.atom(a[0]), b.tables.atom(b[1]));
+    verify_eq(a.tables.atom(a[1]), b.tables.atom(b[0]));
+    verify_eq(shared_interner().name(a.tables.atom(a[0])), "alpha");
+}
+
+
+}
@@ -0,0 +1,131 @@
+#include <string_view>
+
+#include "ast.h"
+#include "bytecode.h"
+#include "compiler.h"
+#include "defs.h"
+#include "interner.h"
+#include "jit.h"
+#include "parser.h"
+#include "tokenizer.h"
+#include "value.h"
+
+#include "test.h"
+
+
+namespace klp {
+
+
+// Compiles `source`, whose first statement defines the function returned.
+static Function& compile_function(std::string_view source, Interner& interner, Program& program) {
+    const TokenBuffer tokens = tokenize_all(source, interner);
+    const Ast ast = parse(tokens);
+    KALPA_VERIFY(ast.diagnostics.empty());
+    KALPA_VERIFY(bool(compile(ast, tokens, program)));
+    return *static_cast<Function*>(program.main->constants[0].as_object());
+}
+
+
+static u32 find(const Function& function, Opcode op) {
+    for (u32 i = 0; i < function.code.size(); ++i) {
+        if (function.code[i].op() == op) {
+            return i;
+        }
+    }
+    verify(false, "no such instruction");
+    return 0;
+}
+
+
+KALPA_TEST(jit_arithmetic) {
+    if (!Jit::available) {
+        return;
+    }
+
+    Interner interner;
+    Program program(interner);
+    Function& f = compile_function("def f a b =\n    return (a + b) * (a - b) ^ -a\n", interner, program);
+    Jit jit;
+    KALPA_VERIFY(jit.compile(f));
+    KALPA_VERIFY(f.native != nullptr);
+
+    const u32 ret = find(f, Opcode::Return);
+    const i64 cases[][2] = {{7, 3}, {-5, 2}, {0, 0}, {100000, -99999}, {1 << 24, 1 << 24}};
+    for (const auto& [a, b] : cases) {
+        Value registers[8];
+        registers[0] = Value::from_small_int(a);
+        registers[1] = Value::from_small_int(b);
+        verify_eq(jit.enter(f, registers, program.globals.data(), 0), ret);
+        const Value result = registers[f.code[ret].a()];
+        KALPA_VERIFY(result.is_small_int());
+        verify_eq(result.as_small_int(), (a + b) * (a - b) ^ -a);
+    }
+}
+
+
+KALPA_TEST(jit_loops) {
+    if (!Jit::available) {
+        return;
+    }
+
+    Interner interner;
+    Program program(interner);
+    Function& f = compile_function(
+        "def f n =\n"
+        "    let total = 0\n"
+        "    for i in range n:\n"
+        "        let j = i\n"
+        "        while j > 0 and j != 7:\n"
+        "            j -= 2\n"
+        "        if j == 7 or not i < 20: total += 1\n"
+        "    return total\n",
+        interner, program
+    );
+    Jit jit;
+    KALPA_VERIFY(jit.compile(f));
+
+    // Entering in the middle works as well as at the start.
+    const u32 ret = find(f, Opcode::Return);
+    for (const u32 pc : {0u, 1u}) {
+        Value registers[16];
+        registers[0] = Value::from_small_int(50);
+        registers[1] = Value::from_small_int(0);
+        verify_eq(jit.enter(f, registers, program.globals.data(), pc), ret);
+        verify_eq(registers[f.code[ret].a()].as_int(), i64(37));
+    }
+}
+
+
+KALPA_TEST(jit_guards) {
+    if (!Jit::available) {
+        return;
+    }
+
+    Interner interner;
+    Program program(interner);
+    Function& f = compile_function("def f a b =\n    return a + b\n", interner, program);
+    Jit jit;
+    KALPA_VERIFY(jit.compile(f));
+    const u32 add = find(f, Opcode::Add);
+
+    // A result that must be promoted to a boxed int, and an operand that is
+    // not a small int, both return to the interpreter at the Add, and count
+    // as guard failures.
+    Value registers[8];
+    registers[0] = Value::from_small_int(Value::max_small_int);
+    registers[1] = Value::from_small_int(1);
+    verify_eq(jit.enter(f, registers, program.globals.data(), 0), add);
+
+    registers[1] = Value::from_float(1);
+    for (u32 i = 2; i < Jit::max_guard_failures; ++i) {
+        verify_eq(jit.enter(f, registers, program.globals.data(), 0), add);
+        KALPA_VERIFY(f.native != nullptr);
+    }
+
+    // After that many, the function goes back to the interpreter.
+    verify_eq(jit.enter(f, registers, program.globals.data(), 0), add);
+    KALPA_VERIFY(f.native == nullptr);
+}
+
+
+}
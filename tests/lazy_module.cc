@@ -0,0 +1,122 @@
+#include <string>
+#include <string_view>
+
+#include "corpus.h"
+#include "defs.h"
+#include "interner.h"
+#include "lazy_module.h"
+#include "tokenizer.h"
+
+#include "test.h"
+#include "verify_tokens.h"
+
+
+namespace klp {
+
+
+// Lexes every declaration of `module` and checks that, put back between
+// the top-level tokens, they are the tokens of the whole file.
+static void verify_matches_eager(LazyModule& module, std::string_view source, Interner& interner) {
+    const TokenBuffer expected = tokenize_all(source, interner);
+    const TokenBuffer& top = module.top_level();
+
+    usize j = 0;
+    usize t = 0;
+    for (usize i = 0; i < module.declarations().size(); ++i) {
+        const Declaration& decl = module.declarations()[i];
+        while (top.offsets[t] < decl.begin || (top.offsets[t] == decl.begin && top.types[t] == Token::Type::Dedent)) {
+            verify_same_token(top, t++, expected, j++);
+        }
+
+        const TokenBuffer& tokens = module.tokens(i);
+        KALPA_VERIFY(tokens.types[0] == decl.kind);
+        KALPA_VERIFY(tokens.types.back() == Token::Type::Eof);
+        for (usize k = 0; k + 1 < tokens.size(); ++k) {
+            verify_same_token(tokens, k, expected, j++);
+        }
+    }
+
+    while (t < top.size()) {
+        verify_same_token(top, t++, expected, j++);
+    }
+    verify_eq(j, expected.size());
+}
+
+
+KALPA_TEST(lazy_module) {
+    const std::string_view source =
+        "let a = 1\n"
+        "def f x =\n"
+        "    let s = \"one\n"
+        "two\"\n"
+        "# note\n"
+        "    return s\n"
+        "\n"
+        "class Point:\n"
+        "    let x = 0\n"
+        "x = f a\n"
+        "def g =\n"
+        "    if a:\n"
+        "        return 2";
+
+    Interner interner;
+    LazyModule module(source, interner);
+    const auto& decls = module.declarations();
+    verify_eq(decls.size(), usize(3));
+
+    KALPA_VERIFY(decls[0].kind == Token::Type::Def);
+    verify_eq(interner.name(decls[0].name), std::string_view("f"));
+    verify_eq(decls[0].begin, u32(source.find("def f")));
+    verify_eq(decls[0].end, u32(source.find("class")));
+
+    KALPA_VERIFY(decls[1].kind == Token::Type::Class);
+    verify_eq(interner.name(decls[1].name), std::string_view("Point"));
+    verify_eq(decls[1].end, u32(source.find("x = f")));
+
+    verify_eq(decls[2].end, u32(source.size()));
+    KALPA_VERIFY(module.find(interner.intern("g")) == usize(2));
+    KALPA_VERIFY(!module.find(interner.intern("a")));
+
+    // Only the top-level code is lexed up front.
+    verify_eq(module.num_lexed(), usize(0));
+    verify_eq(module.top_level().size(), usize(9));
+    KALPA_VERIFY(module.tokens(1).types[0] == Token::Type::Class);
+    KALPA_VERIFY(module.is_lexed(1) && !module.is_lexed(0));
+    verify_eq(module.num_lexed(), usize(1));
+
+    verify_matches_eager(module, source, interner);
+    verify_eq(module.num_lexed(), usize(3));
+}
+
+
+// A lexing error can leave the tokenizer somewhere the scan does not
+// expect, past the keyword of the next declaration. The rest is then
+// lexed as top-level code.
+KALPA_TEST(lazy_module_after_errors) {
+    for (const std::string_view source : {
+        std::string_view("\n     \"\n\"\ndef\n\""),
+        std::string_view("x = 1\n  \"a\ndef f =\n    return 1\n\"\ndef g = 2\n"),
+        std::string_view("x = $\ndef f =\n    return 1\n"),
+    }) {
+        Interner interner;
+        LazyModule module(source, interner);
+        verify_matches_eager(module, source, interner);
+    }
+}
+
+
+KALPA_TEST(lazy_module_corpus) {
+    CorpusMix mix;
+    mix.definitions = 2;
+
+    for (u64 seed = 1; seed <= 4; ++seed) {
+        const std::string source = generate_corpus(seed, 256 * 1024, mix);
+        Interner interner;
+        LazyModule module(source, interner);
+        KALPA_VERIFY(module.declarations().size() > 100);
+        verify_matches_eager(module, source, interner);
+    }
+}
+
+
+}
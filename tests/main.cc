@@ -1,29 +1,330 @@
+#include <fcntl.h>
+#include <spawn.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <string>
 #include <string_view>
 #include <unordered_set>
+#include <vector>
 
 #include "print.h"
+#include "thread_pool.h"
 
 #include "test.h"
 
 
+extern char** environ;
+
+
 namespace klp {
 
 
+namespace {
+
+
+using Clock = std::chrono::steady_clock;
+
+
+struct Options {
+    usize num_jobs = default_num_threads();
+    bool isolate = true;
+    bool benches = false;
+    std::unordered_set<std::string_view> names;  // empty for all
+};
+
+
+struct Outcome {
+    bool passed = false;
+    std::string status;
+    std::string output;
+    double seconds = 0;
+};
+
+
+}
+
+
+static double seconds_since(Clock::time_point start) {
+    return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+
+static std::string format_duration(double seconds) {
+    if (seconds < 1e-6) {
+        return format("{:.1f} ns", seconds * 1e9);
+    } else if (seconds < 1e-3) {
+        return format("{:.2f} us", seconds * 1e6);
+    } else if (seconds < 1) {
+        return format("{:.2f} ms", seconds * 1e3);
+    }
+    return format("{:.2f} s", seconds);
+}
+
+
+static std::string read_all(FILE* file) {
+    std::string text;
+    std::rewind(file);
+
+    char buffer[4096];
+    usize size;
+    while ((size = std::fread(buffer, 1, sizeof(buffer), file)) > 0) {
+        text.append(buffer, size);
+    }
+    return text;
+}
+
+
+// Like std::tmpfile(), but closed on exec, so that the children of the
+// tests running at the same time do not hold it open.
+static FILE* temporary_file() {
+    const char* const dir = std::getenv("TMPDIR");
+    std::string path = format("{}/kalpa-test-XXXXXX", dir && *dir ? dir : "/tmp");
+    const int fd = mkostemp(path.data(), O_CLOEXEC);
+    if (fd < 0) {
+        return nullptr;
+    }
+    unlink(path.c_str());
+
+    FILE* const file = fdopen(fd, "w+");
+    if (!file) {
+        close(fd);
+    }
+    return file;
+}
+
+
+//
+//  Runs a test in a child process, so that a failed verify() or a crash
+//  only takes down that test. The child is this executable again, running
+//  the one test in-process; its output goes to a temporary file that is
+//  shown if the test fails. Spawning a fresh image instead of forking is
+//  what makes this safe from a multithreaded parent.
+//
+static Outcome run_isolated(const Test& test) {
+    Outcome outcome;
+    FILE* output = temporary_file();
+    verify(output != nullptr, "cannot create a temporary file");
+
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    posix_spawn_file_actions_adddup2(&actions, fileno(output), 1);
+    posix_spawn_file_actions_adddup2(&actions, fileno(output), 2);
+
+    const char* const self = "/proc/self/exe";
+    std::string name(test.name);
+    char* argv[] = {const_cast<char*>(self), const_cast<char*>("--no-fork"), name.data(), nullptr};
+
+    const auto start = Clock::now();
+    pid_t pid;
+    const int error = posix_spawn(&pid, self, &actions, nullptr, argv, environ);
+    posix_spawn_file_actions_destroy(&actions);
+
+    if (error) {
+        outcome.status = format("cannot spawn: {}", std::strerror(error));
+        std::fclose(output);
+        return outcome;
+    }
+
+    int status = 0;
+    while (waitpid(pid, &status, 0) < 0 && errno == EINTR) {}
+    outcome.seconds = seconds_since(start);
+
+    if (WIFEXITED(status)) {
+        outcome.passed = WEXITSTATUS(status) == 0;
+        outcome.status = format("exit code {}", WEXITSTATUS(status));
+    } else if (WIFSIGNALED(status)) {
+        outcome.status = format("killed by {}", strsignal(WTERMSIG(status)));
+    }
+
+    outcome.output = read_all(output);
+    std::fclose(output);
+    return outcome;
+}
+
+
+static void print_outcome(const Test& test, const Outcome& outcome) {
+    if (outcome.passed) {
+        println("  ok    {} ({})", test.name, format_duration(outcome.seconds));
+        return;
+    }
+
+    println("  FAIL  {} ({}, {})", test.name, outcome.status, format_duration(outcome.seconds));
+    for (usize begin = 0; begin < outcome.output.size();) {
+        usize end = outcome.output.find('\n', begin);
+        end = end == std::string::npos ? outcome.output.size() : end;
+        println("        | {}", std::string_view(outcome.output).substr(begin, end - begin));
+        begin = end + 1;
+    }
+}
+
+
+static int run_tests(const Options& options, const std::vector<Test*>& tests) {
+    if (!options.isolate) {
+        for (const auto test : tests) {
+            const auto start = Clock::now();
+            test->run();
+            println("  ok    {} ({})", test->name, format_duration(seconds_since(start)));
+        }
+        return 0;
+    }
+
+    std::mutex mutex;
+    usize num_failed = 0;
+    const auto start = Clock::now();
+    {
+        ThreadPool pool(std::max<usize>(1, std::min(options.num_jobs, tests.size())));
+        for (const auto test : tests) {
+            pool.submit([&mutex, &num_failed, test] {
+                const Outcome outcome = run_isolated(*test);
+
+                std::lock_guard<std::mutex> lock(mutex);
+                print_outcome(*test, outcome);
+                num_failed += !outcome.passed;
+            });
+        }
+        pool.wait();
+    }
+
+    println(
+        "{} passed, {} failed in {}",
+        tests.size() - num_failed, num_failed, format_duration(seconds_since(start))
+    );
+    return num_failed ? 1 : 0;
+}
+
+
+//
+//  Benchmarks run in-process, one at a time. The iteration count grows
+//  from 1 until a run takes at least min_run_seconds, which also serves as
+//  warmup; then num_samples runs of that count are timed.
+//
+constexpr double min_run_seconds = 0.05;
+constexpr usize num_samples = 10;
+
+
+static double time_bench(Bench& bench, usize iterations, usize& bytes_per_iteration) {
+    BenchState state(iterations);
+    const auto start = Clock::now();
+    bench.run(state);
+    const double seconds = seconds_since(start);
+    bytes_per_iteration = state.get_bytes_per_iteration();
+    return seconds;
+}
+
+
+static void run_bench(Bench& bench) {
+    usize iterations = 1;
+    usize bytes_per_iteration = 0;
+    while (true) {
+        const double seconds = time_bench(bench, iterations, bytes_per_iteration);
+        if (seconds >= min_run_seconds) {
+            break;
+        }
+
+        const double scale = seconds > 0 ? min_run_seconds / seconds * 1.2 : 10;
+        iterations = std::max<usize>(iterations + 1, iterations * std::min(scale, 10.0));
+    }
+
+    std::vector<double> samples;
+    for (usize i = 0; i < num_samples; ++i) {
+        samples.push_back(time_bench(bench, iterations, bytes_per_iteration) / iterations);
+    }
+    std::sort(samples.begin(), samples.end());
+
+    double mean = 0;
+    for (const double sample : samples) {
+        mean += sample;
+    }
+    mean /= samples.size();
+
+    double variance = 0;
+    for (const double sample : samples) {
+        variance += (sample - mean) * (sample - mean);
+    }
+    const double stddev = std::sqrt(variance / (samples.size() - 1));
+    const double median = samples[samples.size() / 2];
+
+    std::string throughput;
+    if (bytes_per_iteration) {
+        throughput = format(", {:.1f} MB/s", bytes_per_iteration / median / 1e6);
+    }
+
+    println(
+        "  {:<24} median {:>10}  min {:>10}  mean {:>10} +- {:.1f}%  ({} x {}){}",
+        bench.name, format_duration(median), format_duration(samples.front()), format_duration(mean),
+        stddev / mean * 100, num_samples, iterations, throughput
+    );
+}
+
+
+static void print_usage() {
+    eputs("Usage: tests/run [--jobs=N] [--no-fork] [--bench] [NAME...]");
+    eputs("Runs all tests, or the ones named. --bench runs benchmarks instead.");
+}
+
+
+template <typename T>
+static std::vector<T*> select(const std::vector<T*>& all, const Options& options, bool& ok) {
+    std::vector<T*> selected;
+    std::unordered_set<std::string_view> found;
+    for (const auto item : all) {
+        if (options.names.empty() || options.names.count(item->name)) {
+            selected.push_back(item);
+            found.insert(item->name);
+        }
+    }
+
+    ok = true;
+    for (const auto name : options.names) {
+        if (!found.count(name)) {
+            eprintln("Error: no {} named {}", options.benches ? "benchmark" : "test", name);
+            ok = false;
+        }
+    }
+    return selected;
+}
+
+
 int main(int argc, char* argv[]) {
-    std::unordered_set<std::string_view> tests;
-    tests.reserve(argc - 1);
+    Options options;
 
     for (int i = 1; i < argc; ++i) {
-        tests.emplace(argv[i]);
+        const std::string_view arg = argv[i];
+        if (arg.substr(0, 7) == "--jobs=") {
+            options.num_jobs = std::max<usize>(1, std::strtoul(argv[i] + 7, nullptr, 10));
+        } else if (arg == "--no-fork") {
+            options.isolate = false;
+        } else if (arg == "--bench") {
+            options.benches = true;
+        } else if (arg.substr(0, 1) != "-") {
+            options.names.insert(arg);
+        } else {
+            print_usage();
+            return 1;
+        }
     }
 
-    for (const auto test : *shared_tests()) {
-        if (tests.count(test->name)) {
-            test->run();
+    bool ok;
+    if (options.benches) {
+        const auto benches = select(*shared_benches(), options, ok);
+        for (const auto bench : benches) {
+            run_bench(*bench);
         }
+        return ok ? 0 : 1;
     }
 
-    return 0;
+    const auto tests = select(*shared_tests(), options, ok);
+    const int status = run_tests(options, tests);
+    return ok ? status : 1;
 }
 
 
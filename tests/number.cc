@@ -0,0 +1,111 @@
+#include <cstring>
+#include <limits>
+#include <string>
+
+#include "defs.h"
+#include "number.h"
+
+#include "test.h"
+
+
+namespace klp {
+
+
+static Result<NumberLiteral, NumberError> parse(const char* text) {
+    return parse_number(text, text + std::strlen(text));
+}
+
+
+static void verify_int(const char* text, i64 value, u32 size) {
+    const auto number = parse(text);
+    KALPA_VERIFY(static_cast<bool>(number));
+    KALPA_VERIFY(!number->is_float);
+    verify_eq(number->int_value, value);
+    verify_eq(number->size, size);
+}
+
+
+static void verify_float(const char* text, double value, u32 size) {
+    const auto number = parse(text);
+    KALPA_VERIFY(static_cast<bool>(number));
+    KALPA_VERIFY(number->is_float);
+    verify_eq(number->float_value, value);
+    verify_eq(number->size, size);
+}
+
+
+static void verify_error(const char* text, NumberError error) {
+    const auto number = parse(text);
+    KALPA_VERIFY(!number);
+    KALPA_VERIFY(number.error() == error);
+}
+
+
+KALPA_TEST(number) {
+    verify_int("0", 0, 1);
+    verify_int("42)", 42, 2);
+    verify_int("1234567 + x * y", 1234567, 7);
+    verify_int("0x10 + x * y", 16, 4);
+    verify_float("3.5 + x * y", 3.5, 3);
+    verify_int("12345678", 12345678, 8);
+    verify_int("123456789012345678", 123456789012345678, 18);
+    verify_int("1_000_000 x", 1000000, 9);
+    verify_int("9223372036854775807", std::numeric_limits<i64>::max(), 19);
+    verify_int("0xff_FF", 0xffff, 7);
+    verify_int("0b1010", 10, 6);
+    verify_int("0o755", 0755, 5);
+    verify_int("0x7fffffffffffffff", std::numeric_limits<i64>::max(), 18);
+    verify_int("1else", 1, 1);
+    verify_int("1e", 1, 1);
+
+    verify_float("1.5", 1.5, 3);
+    verify_float(".5", 0.5, 2);
+    verify_float("1.", 1.0, 2);
+    verify_float("1.foo", 1.0, 2);
+    verify_float("0.1", 0.1, 3);
+    verify_float("6.02e23", 6.02e23, 7);
+    verify_float("1e-9", 1e-9, 4);
+    verify_float("2E+3", 2e3, 4);
+    verify_float("1_000.000_1", 1000.0001, 11);
+    verify_float("3.141592653589793238", 3.141592653589793, 20);
+
+    verify_error("9223372036854775808", NumberError::OutOfRange);
+    verify_error("123456789012345678901234567890", NumberError::OutOfRange);
+    verify_error("0x1_0000_0000_0000_0000", NumberError::OutOfRange);
+    verify_error("0x8000000000000000", NumberError::OutOfRange);
+    verify_error("1e400", NumberError::OutOfRange);
+    verify_error("0x", NumberError::Malformed);
+    verify_error("0b2", NumberError::Malformed);
+    verify_error("1_", NumberError::Malformed);
+    verify_error("1__0", NumberError::Malformed);
+    verify_error("1.5_", NumberError::Malformed);
+
+    // Reads stop at `end`, even in the middle of eight digits.
+    const std::string digits = "1234567890123";
+    for (usize size = 1; size <= digits.size(); ++size) {
+        const auto number = parse_number(digits.data(), digits.data() + size);
+        KALPA_VERIFY(static_cast<bool>(number));
+        verify_eq(number->int_value, std::stoll(digits.substr(0, size)));
+    }
+}
+
+
+KALPA_BENCH(parse_number) {
+    std::string text;
+    for (int i = 0; i < 1000; ++i) {
+        text += std::to_string(i * 7919 % 100000) + " 3.25 " + std::to_string(i * 104729ull * 104729) + " ";
+    }
+    state.set_bytes_per_iteration(text.size());
+
+    const char* const end = text.data() + text.size();
+    for (usize i = 0; i < state.iterations(); ++i) {
+        for (const char* p = text.data(); p < end;) {
+            const auto number = parse_number(p, end);
+            BenchState::keep(number);
+            p += number->size + 1;
+        }
+    }
+}
+
+
+}
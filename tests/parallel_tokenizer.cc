@@ -0,0 +1,70 @@
+#include <string>
+
+#include "corpus.h"
+#include "defs.h"
+#include "interner.h"
+#include "parallel_tokenizer.h"
+#include "thread_pool.h"
+#include "tokenizer.h"
+
+#include "test.h"
+#include "verify_tokens.h"
+
+
+namespace klp {
+
+
+KALPA_TEST(parallel_tokenizer) {
+    ThreadPool pool(4);
+
+    for (u64 seed = 1; seed <= 12; ++seed) {
+        std::string source = generate_corpus(seed, 4 * min_parallel_chunk_size + seed * 1000);
+
+        // Odd seeds get errors at some line starts, some of them right
+        // after chunk boundaries.
+        static const char* const errors[] = {"$", "        deep ", "   odd ", "\"\\q\" "};
+        for (usize i = 1; seed % 2 && i < 64; ++i) {
+            const usize line = source.find('\n', source.size() / 64 * i + seed);
+            if (line != std::string::npos) {
+                source.insert(line + 1, errors[(i + seed) % std::size(errors)]);
+            }
+        }
+
+        Interner sequential_interner;
+        Interner parallel_interner;
+        const TokenBuffer expected = tokenize_all(source, sequential_interner);
+        const TokenBuffer actual = tokenize_parallel(source, pool, parallel_interner);
+
+        verify_same_tokens(actual, expected);
+
+        const auto diagnostics = collect_diagnostics(expected);
+        KALPA_VERIFY(diagnostics.empty() == (seed % 2 == 0));
+        verify_eq(collect_diagnostics(actual).size(), diagnostics.size());
+    }
+}
+
+
+KALPA_TEST(parallel_tokenizer_comment_tail) {
+    ThreadPool pool(4);
+
+    // The last chunks hold no tokens, but the block before them still
+    // has to be closed.
+    std::string source;
+    while (source.size() < 2 * min_parallel_chunk_size) {
+        source += "def f x =\n    let y = x\n";
+    }
+    source += "if a:\n    let z = 1\n";
+    while (source.size() < 6 * min_parallel_chunk_size) {
+        source += "# comment\n";
+    }
+
+    Interner sequential_interner;
+    Interner parallel_interner;
+    const TokenBuffer expected = tokenize_all(source, sequential_interner);
+    const TokenBuffer actual = tokenize_parallel(source, pool, parallel_interner);
+    KALPA_VERIFY(expected[expected.size() - 2].type == Token::Type::Dedent);
+    verify_same_tokens(actual, expected);
+}
+
+
+}
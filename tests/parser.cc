@@ -0,0 +1,244 @@
+#include <string>
+#include <string_view>
+
+#include "ast.h"
+#include "corpus.h"
+#include "defs.h"
+#include "interner.h"
+#include "lazy_module.h"
+#include "parser.h"
+#include "tokenizer.h"
+
+#include "test.h"
+
+
+namespace klp {
+
+
+// Each top-level statement of `source`, formatted on its own line.
+static std::string parse_to_string(std::string_view source) {
+    Interner interner;
+    const TokenBuffer tokens = tokenize_all(source, interner);
+    const Ast ast = parse(tokens);
+
+    std::string result;
+    for (const u32 statement : ast.statements(ast.root)) {
+        result += format_ast(ast, tokens, statement);
+        result += '\n';
+    }
+    return result;
+}
+
+
+KALPA_TEST(parser_statements) {
+    verify_eq(
+        parse_to_string(
+            "def fac n =\n"
+            "    if n == 1:\n"
+            "        return 1\n"
+            "    else:\n"
+            "        return n * fac (n - 1)\n"
+            "\n"
+            "def square x = x * x\n"
+            "class Point:\n"
+            "    def norm self = self.x ** 2 + self.y ** 2\n"
+            "for i in range 10: total += i\n"
+            "while not done:\n"
+            "    if a: return\n"
+            "    elif b:\n"
+            "        items[i] = \"b\"\n"
+        ),
+        std::string(
+            "(def fac (n) (block (if (== n 1) (block (return 1)) (block (return (* n (call fac (- n 1))))))))\n"
+            "(def square (x) (block (return (* x x))))\n"
+            "(class Point (block (def norm (self) (block (return (+ (** (. self x) 2) (** (. self y) 2)))))))\n"
+            "(for i (call range 10) (block (+= total i)))\n"
+            "(while (not done) (block (if a (block (return)) (if b (block (= (index items i) \"b\"))))))\n"
+        )
+    );
+}
+
+
+KALPA_TEST(parser_expressions) {
+    verify_eq(
+        parse_to_string(
+            "a or b and not c == d\n"
+            "-x ** 2 ** y - 1\n"
+            "a + b * c // d ^ e < f\n"
+            "f x.y [1, 2,] (g z)[0]\n"
+            "f a[0] b\n"
+            "[]\n"
+        ),
+        std::string(
+            "(or a (and b (not (== c d))))\n"
+            "(- (- (** x (** 2 y))) 1)\n"
+            "(< (^ (+ a (// (* b c) d)) e) f)\n"
+            "(call f (. x y) (list 1 2) (index (call g z) 0))\n"
+            "(call f (index a 0) b)\n"
+            "(list)\n"
+        )
+    );
+}
+
+
+KALPA_TEST(parser_recovers_from_errors) {
+    const std::string_view source =
+        "let = 3\n"
+        "x = (1 +\n"
+        "y = 2\n"
+        "    z = 3\n"
+        "f x = 1\n"
+        "while x\n"
+        "    y\n"
+        "def g =\n"
+        "    a b c )\n"
+        "    return 1\n";
+
+    Interner interner;
+    const TokenBuffer tokens = tokenize_all(source, interner);
+    const Ast ast = parse(tokens);
+
+    verify_eq(
+        format_ast(ast, tokens, ast.root),
+        std::string("(module (error) (error) (= y 2) (error) (error) (error) (def g () (block (error) (return 1))))")
+    );
+
+    const ParseDiagnostic expected[] = {
+        {ParseError::ExpectedName, u32(source.find("= 3"))},
+        {ParseError::ExpectedExpression, u32(source.find("+\n"))},
+        {ParseError::UnexpectedIndent, u32(source.find("z = 3"))},
+        {ParseError::InvalidTarget, u32(source.find("= 1"))},
+        {ParseError::ExpectedColon, u32(source.find("x\n    y"))},
+        {ParseError::ExpectedLineEnd, u32(source.find(")"))},
+    };
+    verify_eq(ast.diagnostics.size(), std::size(expected));
+    for (usize i = 0; i < std::size(expected); ++i) {
+        KALPA_VERIFY(ast.diagnostics[i].error == expected[i].error);
+        verify_eq(ast.diagnostics[i].offset, expected[i].offset);
+    }
+}
+
+
+// Arguments after something that cannot be a function are most likely a
+// missing operator.
+KALPA_TEST(parser_rejects_calls_of_literals) {
+    const std::string_view sources[] = {
+        "x += 1 2\n",
+        "y = \"a\" b\n",
+        "(1) (2)\n",
+        "[1] [2]\n",
+        "(not a) b\n",
+        "(a < b) c\n",
+    };
+    for (const std::string_view source : sources) {
+        Interner interner;
+        const TokenBuffer tokens = tokenize_all(source, interner);
+        const Ast ast = parse(tokens);
+        verify_eq(ast.diagnostics.size(), usize(1));
+        KALPA_VERIFY(ast.diagnostics[0].error == ParseError::ExpectedOperator);
+        verify_eq(ast.diagnostics[0].offset, u32(source.rfind(' ') + 1));
+    }
+
+    verify_eq(
+        parse_to_string("(f x) y\n(a or f) x\nitems[0] x\nobj.method x\n"),
+        std::string(
+            "(call (call f x) y)\n"
+            "(call (or a f) x)\n"
+            "(call (index items 0) x)\n"
+            "(call (. obj method) x)\n"
+        )
+    );
+}
+
+
+// Nesting expressions or blocks past the limit is an error rather than a
+// stack overflow, for the parser and for whatever walks the tree after it.
+KALPA_TEST(parser_limits_nesting) {
+    const auto repeat = [](std::string_view text, usize n) {
+        std::string result;
+        for (usize i = 0; i < n; ++i) {
+            result += text;
+        }
+        return result;
+    };
+
+    const std::string deep_sources[] = {
+        "x = " + repeat("(", 100000) + "1\n",
+        "x = " + repeat("-", 200000) + "1\n",
+        "x = " + repeat("[", 200000) + "\n",
+        "x = 1" + repeat(" + 1", 200000) + "\n",
+        "x = a" + repeat("[0]", 200000) + "\n",
+        "x = 2" + repeat(" ** 2", 200000) + "\n",
+    };
+    for (const std::string& source : deep_sources) {
+        Interner interner;
+        const TokenBuffer tokens = tokenize_all(source, interner);
+        const Ast ast = parse(tokens);
+        verify_eq(ast.diagnostics.size(), usize(1));
+        KALPA_VERIFY(ast.diagnostics[0].error == ParseError::NestedTooDeeply);
+        verify_eq(format_ast(ast, tokens, ast.root), std::string("(module (error))"));
+    }
+
+    // Blocks only nest one level per line, so nesting them deeply takes
+    // text quadratic in the depth.
+    const auto nested_ifs = [&](u32 depth) {
+        std::string source;
+        for (u32 level = 0; level < depth; ++level) {
+            source += std::string(level * 4, ' ') + "if 1:\n";
+        }
+        return source + std::string(depth * 4, ' ') + "x = 1\ny = 2\n";
+    };
+    {
+        const std::string source = nested_ifs(max_block_depth + 50);
+        Interner interner;
+        const TokenBuffer tokens = tokenize_all(source, interner);
+        const Ast ast = parse(tokens);
+        verify_eq(ast.diagnostics.size(), usize(1));
+        KALPA_VERIFY(ast.diagnostics[0].error == ParseError::BlocksNestedTooDeeply);
+        verify_eq(ast.statements(ast.root).size(), usize(2));
+        verify_eq(format_ast(ast, tokens, ast.statements(ast.root)[1]), std::string("(= y 2)"));
+    }
+    {
+        const std::string source = nested_ifs(max_block_depth);
+        Interner interner;
+        const TokenBuffer tokens = tokenize_all(source, interner);
+        KALPA_VERIFY(parse(tokens).diagnostics.empty());
+    }
+
+    const std::string limit = "x = " + repeat("(", max_expression_depth - 1) + "1" + repeat(")", max_expression_depth - 1) + "\n";
+    Interner interner;
+    const TokenBuffer tokens = tokenize_all(limit, interner);
+    KALPA_VERIFY(parse(tokens).diagnostics.empty());
+}
+
+
+KALPA_TEST(parser_generated_programs) {
+    for (u64 seed = 1; seed <= 4; ++seed) {
+        const std::string source = generate_program(seed, 64 << 10);
+
+        Interner interner;
+        const TokenBuffer tokens = tokenize_all(source, interner);
+        KALPA_VERIFY(collect_diagnostics(tokens).empty());
+        const Ast ast = parse(tokens);
+        KALPA_VERIFY(ast.diagnostics.empty());
+
+        // The declarations of a lazy module parse on their own, with the
+        // same result as within the whole file.
+        LazyModule module(source, interner);
+        const NodeList statements = ast.statements(ast.root);
+        verify_eq(statements.size(), module.declarations().size());
+        for (usize i = 0; i < module.declarations().size(); ++i) {
+            const TokenBuffer& decl_tokens = module.tokens(i);
+            const Ast decl = parse(decl_tokens);
+            KALPA_VERIFY(decl.diagnostics.empty());
+            verify_eq(decl.statements(decl.root).size(), usize(1));
+            verify_eq(
+                format_ast(decl, decl_tokens, decl.statements(decl.root)[0]),
+                format_ast(ast, tokens, statements[i])
+            );
+        }
+    }
+}
+
+
+}
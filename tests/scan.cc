@@ -0,0 +1,118 @@
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "defs.h"
+#include "rng.h"
+#include "scan.h"
+
+#include "test.h"
+
+
+namespace klp {
+
+
+KALPA_TEST(scan_kernels) {
+    const auto& scalar = *scan_kernels_for(ScanIsa::Scalar);
+    const char alphabet[] = "  aZ09_\n\"\\#\x80\xff";
+
+    Rng<u64> rng({0x6b616c7061, 0x7363616e});
+    std::string buffer;
+
+    for (const auto isa : {ScanIsa::Sse2, ScanIsa::Avx2}) {
+        const auto kernels = scan_kernels_for(isa);
+        if (!kernels) {
+            continue;
+        }
+
+        for (int i = 0; i < 2000; ++i) {
+            buffer.resize(rng.next() % 100);
+            const u64 bias = rng.next() % (sizeof(alphabet) - 1);
+            for (auto& c : buffer) {
+                const u64 r = rng.next() % 8;
+                c = alphabet[r < 6 ? bias : rng.next() % (sizeof(alphabet) - 1)];
+            }
+
+            const char* begin = buffer.data();
+            const char* end = begin + buffer.size();
+            verify_eq(kernels->skip_spaces(begin, end) - begin, scalar.skip_spaces(begin, end) - begin);
+            verify_eq(kernels->skip_ident(begin, end) - begin, scalar.skip_ident(begin, end) - begin);
+            verify_eq(kernels->skip_digits(begin, end) - begin, scalar.skip_digits(begin, end) - begin);
+            verify_eq(kernels->find_newline(begin, end) - begin, scalar.find_newline(begin, end) - begin);
+            verify_eq(
+                kernels->find_string_special(begin, end) - begin,
+                scalar.find_string_special(begin, end) - begin
+            );
+
+            const usize num_newlines = scalar.count_newlines(begin, end);
+            verify_eq(kernels->count_newlines(begin, end), num_newlines);
+
+            std::vector<u32> expected(num_newlines);
+            std::vector<u32> actual(num_newlines);
+            KALPA_VERIFY(scalar.line_starts(begin, end, expected.data()) == expected.data() + num_newlines);
+            KALPA_VERIFY(kernels->line_starts(begin, end, actual.data()) == actual.data() + num_newlines);
+            KALPA_VERIFY(actual == expected);
+        }
+    }
+}
+
+
+KALPA_TEST(scan_validate_utf8) {
+    const auto& scalar = *scan_kernels_for(ScanIsa::Scalar);
+    const auto invalid_at = [&](std::string_view text) {
+        return scalar.validate_utf8(text.data(), text.data() + text.size()) - text.data();
+    };
+
+    verify_eq(invalid_at("let \xc3\xa9 = \xe2\x82\xac \xf0\x9f\x98\x80"), 17);
+    verify_eq(invalid_at("ab\x80"), 2);            // stray continuation
+    verify_eq(invalid_at("ab\xc0\xaf"), 2);        // overlong
+    verify_eq(invalid_at("ab\xe0\x9f\xbf"), 2);    // overlong
+    verify_eq(invalid_at("ab\xed\xa0\x80"), 2);    // surrogate
+    verify_eq(invalid_at("ab\xf4\x90\x80\x80"), 2);  // past U+10FFFF
+    verify_eq(invalid_at("ab\xf8"), 2);
+    verify_eq(invalid_at("ab\xe2\x82"), 2);        // truncated
+    verify_eq(invalid_at("\xe2\x82x"), 0);
+
+    // Valid and invalid pieces, so that sequences of every length cross
+    // block boundaries and errors land anywhere in a block.
+    static const char* const valid[] = {
+        "a", " ", "\n", "\xc3\xa9", "\xdf\xbf", "\xe2\x82\xac", "\xef\xbf\xbf", "\xed\x9f\xbf",
+        "\xf0\x9f\x98\x80", "\xf4\x8f\xbf\xbf", "\xe0\xa0\x80", "\xf0\x90\x80\x80",
+    };
+    static const char* const invalid[] = {
+        "\x80", "\xbf", "\xc3", "\xc1\xbf", "\xe0\x80\x80", "\xed\xa0\x80", "\xf0\x8f\xbf\xbf",
+        "\xf4\x90\x80\x80", "\xf5", "\xff", "\xe2\x82", "\xf0\x9f\x98",
+    };
+
+    Rng<u64> rng({0x75746638, 0x76616c69});
+    std::string buffer;
+
+    for (const auto isa : {ScanIsa::Sse2, ScanIsa::Avx2}) {
+        const auto kernels = scan_kernels_for(isa);
+        if (!kernels) {
+            continue;
+        }
+
+        for (int i = 0; i < 4000; ++i) {
+            buffer.clear();
+            const usize size = rng.next() % 160;
+            const bool ascii_runs = rng.next() % 2;
+            while (buffer.size() < size) {
+                if (ascii_runs && rng.next() % 2) {
+                    buffer.append(rng.next() % 40, 'x');
+                } else if (rng.next() % 64 == 0) {
+                    buffer += invalid[rng.next() % std::size(invalid)];
+                } else {
+                    buffer += valid[rng.next() % std::size(valid)];
+                }
+            }
+
+            const char* begin = buffer.data();
+            const char* end = begin + buffer.size();
+            verify_eq(kernels->validate_utf8(begin, end) - begin, scalar.validate_utf8(begin, end) - begin);
+        }
+    }
+}
+
+
+}
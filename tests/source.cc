@@ -0,0 +1,110 @@
+#include <algorithm>
+#include <cstdlib>
+#include <string>
+#include <string_view>
+#include <thread>
+
+#include <unistd.h>
+
+#include "defs.h"
+#include "print.h"
+#include "source.h"
+
+#include "test.h"
+
+
+namespace klp {
+
+
+// A file holding `text` that is removed when this goes out of scope.
+class TempFile {
+public:
+    explicit TempFile(std::string_view text) {
+        const char* const dir = std::getenv("TMPDIR");
+        path = format("{}/kalpa-source-XXXXXX", dir && *dir ? dir : "/tmp");
+        const int fd = mkstemp(path.data());
+        KALPA_VERIFY(fd >= 0);
+        KALPA_VERIFY(write(fd, text.data(), text.size()) == static_cast<ssize_t>(text.size()));
+        close(fd);
+    }
+
+    ~TempFile() {
+        unlink(path.c_str());
+    }
+
+    std::string path;
+};
+
+
+static void verify_padding(const SourceFile& file) {
+    const char* const end = file.text().data() + file.text().size();
+    for (usize i = 0; i < SourceFile::padding; ++i) {
+        verify_eq(int(end[i]), 0);
+    }
+}
+
+
+// The padding after a file that ends on a page boundary is the zeroed
+// memory reserved behind it, not more of the file's last page.
+KALPA_TEST(source_file_page_multiple) {
+    const usize page = sysconf(_SC_PAGESIZE);
+    std::string text(2 * page, 'x');
+    text.back() = '\n';
+    const TempFile temp(text);
+
+    auto file = SourceFile::open(temp.path.c_str());
+    KALPA_VERIFY(file.has_value());
+    KALPA_VERIFY(file->is_mapped());
+    verify_eq(file->text(), std::string_view(text));
+    verify_padding(*file);
+}
+
+
+KALPA_TEST(source_file_empty) {
+    const TempFile temp("");
+
+    auto file = SourceFile::open(temp.path.c_str());
+    KALPA_VERIFY(file.has_value());
+    KALPA_VERIFY(!file->is_mapped());
+    verify_eq(file->text().size(), usize(0));
+    verify_padding(*file);
+}
+
+
+// Pipes are read into a buffer, which grows past its first 64 KiB here.
+KALPA_TEST(source_file_pipe) {
+    std::string text;
+    for (usize i = 0; text.size() < 300 * 1024; ++i) {
+        text += format("let x{} = {}\n", i, i);
+    }
+
+    int fds[2];
+    KALPA_VERIFY(pipe(fds) == 0);
+    std::thread writer([&text, fd = fds[1]] {
+        for (usize i = 0; i < text.size(); i += 1000) {
+            const usize size = std::min<usize>(1000, text.size() - i);
+            verify(write(fd, text.data() + i, size) == static_cast<ssize_t>(size), "write to pipe");
+        }
+        close(fd);
+    });
+
+    const std::string path = format("/dev/fd/{}", fds[0]);
+    auto file = SourceFile::open(path.c_str());
+    writer.join();
+    close(fds[0]);
+
+    KALPA_VERIFY(file.has_value());
+    KALPA_VERIFY(!file->is_mapped());
+    verify_eq(file->text(), std::string_view(text));
+    verify_padding(*file);
+}
+
+
+KALPA_TEST(source_file_missing) {
+    std::string error;
+    KALPA_VERIFY(!SourceFile::open("/nonexistent/kalpa/missing.kl", &error));
+    verify_eq(error, std::string("Error: /nonexistent/kalpa/missing.kl: No such file or directory\n"));
+}
+
+
+}
@@ -0,0 +1,62 @@
+#include <algorithm>
+#include <iterator>
+#include <string>
+
+#include "defs.h"
+#include "source.h"
+#include "source_manager.h"
+
+#include "test.h"
+
+
+namespace klp {
+
+
+KALPA_TEST(source_manager) {
+    const std::string texts[] = {
+        "def f x =\n    return x\n",
+        "",
+        "\n\nlet y = 1",
+        std::string(5000, 'a') + "\n" + std::string(70, '\n') + "b",
+    };
+
+    SourceManager sources;
+    u32 expected_base = 0;
+    for (const auto& text : texts) {
+        const auto base = sources.add(SourceFile::from_string(text));
+        KALPA_VERIFY(base.has_value());
+        verify_eq(*base, expected_base);
+        expected_base += text.size() + 1;
+    }
+    verify_eq(sources.num_files(), std::size(texts));
+
+    // Every offset of every file, including the one past its end.
+    for (usize i = 0; i < sources.num_files(); ++i) {
+        const std::string& text = texts[i];
+        u32 line = 1;
+        u32 column = 1;
+        for (u32 local = 0; local <= text.size(); ++local) {
+            const u32 offset = sources.base(i) + local;
+            verify_eq(sources.file_index(offset), i);
+
+            const SourceLocation location = sources.locate(offset);
+            KALPA_VERIFY(location.file == &sources.file(i));
+            verify_eq(location.line, line);
+            verify_eq(location.column, column);
+
+            const usize line_begin = local - (column - 1);
+            const usize line_end = std::min(text.find('\n', line_begin), text.size());
+            verify_eq(sources.line_text(offset), std::string_view(text).substr(line_begin, line_end - line_begin));
+
+            if (local < text.size() && text[local] == '\n') {
+                ++line;
+                column = 1;
+            } else {
+                ++column;
+            }
+        }
+    }
+}
+
+
+}
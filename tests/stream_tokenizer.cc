@@ -0,0 +1,78 @@
+#include <algorithm>
+#include <string>
+#include <thread>
+
+#include <unistd.h>
+
+#include "corpus.h"
+#include "defs.h"
+#include "interner.h"
+#include "stream_tokenizer.h"
+#include "tokenizer.h"
+
+#include "test.h"
+#include "verify_tokens.h"
+
+
+namespace klp {
+
+
+// Streams `source` through a pipe, written in pieces of `piece` bytes, and
+// checks the tokens against tokenize_all(). Returns the final buffer size.
+static usize verify_stream(const std::string& source, usize buffer_size, usize piece) {
+    int fds[2];
+    KALPA_VERIFY(pipe(fds) == 0);
+
+    std::thread writer([&source, piece, fd = fds[1]] {
+        for (usize i = 0; i < source.size(); i += piece) {
+            const usize size = std::min(piece, source.size() - i);
+            verify(write(fd, source.data() + i, size) == static_cast<ssize_t>(size), "write to pipe");
+        }
+        close(fd);
+    });
+
+    Interner interner;
+    const TokenBuffer expected = tokenize_all(source, interner);
+
+    StreamTokenizer stream(fds[0], interner, buffer_size);
+    TokenBuffer tokens;
+    usize i = 0;
+    while (stream.next_chunk(tokens)) {
+        for (usize j = 0; j < tokens.size(); ++j, ++i) {
+            KALPA_VERIFY(i < expected.size());
+            verify_same_token(tokens, j, expected, i);
+
+            const Token a = tokens[j];
+            if (a.type == Token::Type::Error) {
+                const auto location = stream.locate(a.offset);
+                const usize line_start = source.rfind('\n', a.offset - 1) + 1;
+                const usize line_end = source.find('\n', a.offset);
+                verify_eq(location.line, static_cast<u64>(std::count(source.begin(), source.begin() + a.offset, '\n')) + 1);
+                verify_eq(location.column, a.offset - line_start + 1);
+                verify_eq(location.line_text, std::string_view(source).substr(line_start, line_end - line_start));
+            }
+        }
+    }
+
+    writer.join();
+    close(fds[0]);
+    KALPA_VERIFY(stream.ok());
+    verify_eq(i, expected.size());
+    return stream.buffer_capacity();
+}
+
+
+KALPA_TEST(stream_tokenizer) {
+    std::string source = generate_corpus(3, 512 * 1024);
+    source += "let bad = 1 $\n    \"a string longer than the buffer " + std::string(10000, 'x') + "\"\n";
+    source += "if x:\n    if y:\n        z\n";
+
+    // Long strings grow the buffer; everything else fits in it.
+    verify_eq(verify_stream(source, 64 * 1024, 1000), 64u * 1024);
+    KALPA_VERIFY(verify_stream(source, 4096, 333) >= 10000);
+    verify_stream("", 16, 1);
+    verify_stream("x", 16, 1);
+}
+
+
+}
@@ -15,4 +15,15 @@ std::vector<Test*>* shared_tests() {
 }
 
 
+static std::vector<Bench*>* _shared_benches = nullptr;
+
+std::vector<Bench*>* shared_benches() {
+    if (!_shared_benches) {
+        _shared_benches = new std::vector<Bench*>;
+    }
+
+    return _shared_benches;
+}
+
+
 }
@@ -12,8 +12,10 @@ namespace klp {
 
 
 class Test;
+class Bench;
 
 std::vector<Test*>* shared_tests();
+std::vector<Bench*>* shared_benches();
 
 
 class Test {
@@ -40,6 +42,64 @@ private:
     void test_ ## name()
 
 
+//
+//  What a benchmark body sees: it runs its measured work `iterations()`
+//  times. The runner picks the count so that one run takes long enough to
+//  time, after a warmup.
+//
+class BenchState {
+public:
+    explicit BenchState(usize num_iterations) : num_iterations(num_iterations) {}
+
+    usize iterations() const {
+        return num_iterations;
+    }
+
+    // Bytes processed per iteration, for a throughput figure.
+    void set_bytes_per_iteration(usize bytes) {
+        bytes_per_iteration = bytes;
+    }
+
+    usize get_bytes_per_iteration() const {
+        return bytes_per_iteration;
+    }
+
+    // Keeps the optimizer from dropping the computation of `value`.
+    template <typename T>
+    static void keep(const T& value) {
+        asm volatile("" : : "r"(&value) : "memory");
+    }
+
+private:
+    usize num_iterations;
+    usize bytes_per_iteration = 0;
+};
+
+
+class Bench {
+public:
+    const std::string_view name;
+
+public:
+    Bench(std::string_view name, void (*func)(BenchState&)) : name(name), func(func) {
+        shared_benches()->push_back(this);
+    }
+
+    void run(BenchState& state) {
+        func(state);
+    }
+
+private:
+    void (*func)(BenchState&);
+};
+
+
+#define KALPA_BENCH(name) \
+    void bench_ ## name(BenchState& state); \
+    Bench bench_ctor_ ## name(KALPA_STRINGIFY(name), bench_ ## name); \
+    void bench_ ## name(BenchState& state)
+
+
 }
 
 
@@ -0,0 +1,41 @@
+#include <atomic>
+
+#include "defs.h"
+#include "thread_pool.h"
+
+#include "test.h"
+
+
+namespace klp {
+
+
+KALPA_TEST(thread_pool) {
+    ThreadPool pool(4);
+    KALPA_VERIFY(pool.worker_index() == pool.size());
+
+    // Tasks that submit more tasks, unevenly, so that workers steal.
+    std::atomic<usize> num_done = 0;
+    std::atomic<bool> bad_index = false;
+    for (usize i = 0; i < 64; ++i) {
+        pool.submit([&pool, &num_done, &bad_index, i] {
+            for (usize j = 0; j < i % 8; ++j) {
+                pool.submit([&pool, &num_done, &bad_index] {
+                    bad_index = bad_index || pool.worker_index() >= pool.size();
+                    ++num_done;
+                });
+            }
+            ++num_done;
+        });
+    }
+    pool.wait();
+
+    usize expected = 0;
+    for (usize i = 0; i < 64; ++i) {
+        expected += 1 + i % 8;
+    }
+    verify_eq(num_done.load(), expected);
+    KALPA_VERIFY(!bad_index);
+}
+
+
+}
@@ -0,0 +1,103 @@
+#include <cstdio>
+#include <string>
+
+#include "corpus.h"
+#include "defs.h"
+#include "interner.h"
+#include "source.h"
+#include "token_dump.h"
+#include "tokenizer.h"
+#include "write_buffer.h"
+
+#include "test.h"
+
+
+namespace klp {
+
+
+static SourceFile read_back(FILE* file) {
+    std::string bytes;
+    std::rewind(file);
+    char buffer[4096];
+    usize size;
+    while ((size = std::fread(buffer, 1, sizeof(buffer), file)) > 0) {
+        bytes.append(buffer, size);
+    }
+    return SourceFile::from_string(bytes, "<dump>");
+}
+
+
+KALPA_TEST(token_dump_binary) {
+    const std::string source = generate_corpus(7, 256 * 1024) + "let bad = 1 $\n";
+    Interner interner;
+    interner.intern("unused");
+    const TokenBuffer tokens = tokenize_all(source, interner);
+
+    FILE* file = std::tmpfile();
+    KALPA_VERIFY(file != nullptr);
+    {
+        WriteBuffer out(fileno(file), 4096);
+        KALPA_VERIFY(write_token_dump(tokens, out));
+    }
+
+    auto dump = TokenDump::from_file(read_back(file));
+    std::fclose(file);
+    KALPA_VERIFY(dump.has_value());
+
+    verify_eq(dump->size(), tokens.size());
+    for (usize i = 0; i < tokens.size(); ++i) {
+        const Token a = (*dump)[i];
+        const Token e = tokens[i];
+        KALPA_VERIFY(a.type == e.type);
+        verify_eq(a.offset, e.offset);
+
+        switch (e.type) {
+            case Token::Type::Identifier: verify_eq(dump->identifier(a), tokens.tables.identifier(e)); break;
+            case Token::Type::Int: verify_eq(dump->int_value(a), tokens.tables.int_value(e)); break;
+            case Token::Type::Float: verify_eq(dump->float_value(a), tokens.tables.float_value(e)); break;
+            case Token::Type::String: verify_eq(dump->string(a), tokens.tables.string(e)); break;
+            case Token::Type::Error: KALPA_VERIFY(dump->error(a) == tokens.tables.error(e)); break;
+            default: break;
+        }
+    }
+
+    KALPA_VERIFY(!TokenDump::from_file(SourceFile::from_string("KLPTOKS")));
+}
+
+
+// A failed write drops the rest of the dump, which still goes through
+// every section.
+KALPA_TEST(token_dump_write_error) {
+    const std::string source = generate_corpus(8, 64 * 1024);
+    const TokenBuffer tokens = tokenize_all(source);
+
+    FILE* file = std::fopen("/dev/full", "w");
+    KALPA_VERIFY(file != nullptr);
+    {
+        WriteBuffer out(fileno(file), 16);
+        KALPA_VERIFY(!write_token_dump(tokens, out));
+    }
+    std::fclose(file);
+}
+
+
+KALPA_TEST(token_dump_text) {
+    const TokenBuffer tokens = tokenize_all("let s = \"a\\nb\" + x1 * 2.5\n");
+
+    FILE* file = std::tmpfile();
+    KALPA_VERIFY(file != nullptr);
+    {
+        WriteBuffer out(fileno(file));
+        write_token_dump_text(tokens, out);
+    }
+
+    const SourceFile text = read_back(file);
+    std::fclose(file);
+    verify_eq(
+        text.text(),
+        "0 Let\n4 Identifier s\n6 Assign\n8 String \"a\\nb\"\n15 Add\n17 Identifier x1\n20 Mul\n22 Float 2.5\n26 Eof\n"
+    );
+}
+
+
+}
@@ -1,4 +1,10 @@
+#include <string>
+
+#include "corpus.h"
 #include "defs.h"
+#include "interner.h"
+#include "keywords.h"
+#include "operators.h"
 #include "tokenizer.h"
 
 #include "test.h"
@@ -14,4 +20,110 @@ KALPA_TEST(tokenizer) {
 }
 
 
+KALPA_TEST(tokenizer_keywords) {
+    for (const auto& keyword : keyword_list) {
+        Tokenizer tokenizer(keyword.text);
+        KALPA_VERIFY(tokenizer.next().type == keyword.type);
+    }
+
+    for (const auto text : {"elif", "eli", "elifs", "Def", "x", "returns", "a1"}) {
+        const bool is_identifier = std::string_view(text) != "elif";
+        KALPA_VERIFY((keyword_type(text) == Token::Type::Identifier) == is_identifier);
+    }
+}
+
+
+KALPA_TEST(tokenizer_operators) {
+    for (const auto& op : operator_list) {
+        const std::string text = std::string(op.text) + " ";
+        Tokenizer tokenizer(text);
+        KALPA_VERIFY(tokenizer.next().type == op.type);
+        KALPA_VERIFY(tokenizer.next().type == Token::Type::Eof);
+    }
+
+    // Longest match first, with no space needed in between.
+    const TokenBuffer tokens = tokenize_all("a**=b//c**-d!=.5.e");
+    const Token::Type expected[] = {
+        Token::Type::Identifier, Token::Type::PowEq, Token::Type::Identifier, Token::Type::IntDiv,
+        Token::Type::Identifier, Token::Type::Pow, Token::Type::Sub, Token::Type::Identifier,
+        Token::Type::NotEqual, Token::Type::Float, Token::Type::Dot, Token::Type::Identifier, Token::Type::Eof,
+    };
+    verify_eq(tokens.size(), std::size(expected));
+    for (usize i = 0; i < tokens.size(); ++i) {
+        KALPA_VERIFY(tokens[i].type == expected[i]);
+    }
+}
+
+
+KALPA_TEST(tokenizer_tokenize_all) {
+    const std::string_view source = "def f x =\n    return x * 2.5 + \"a\\nb\" + \"cd\"\n";
+
+    const TokenBuffer tokens = tokenize_all(source);
+    Tokenizer tokenizer(source);
+    for (usize i = 0; i < tokens.size(); ++i) {
+        const Token token = tokenizer.next();
+        KALPA_VERIFY(tokens[i].type == token.type);
+        verify_eq(tokens[i].offset, token.offset);
+        verify_eq(tokens[i].payload, token.payload);
+    }
+
+    KALPA_VERIFY(tokens[tokens.size() - 1].type == Token::Type::Eof);
+    verify_eq(tokens.tables.identifier(tokens[1]), "f");
+    verify_eq(tokens.tables.float_value(tokens[8]), 2.5);
+    verify_eq(tokens.tables.string(tokens[10]), "a\nb");
+    verify_eq(tokens.tables.string(tokens[12]), "cd");
+
+    // Literals without escapes are views into the source.
+    KALPA_VERIFY(tokens.tables.string(tokens[12]).data() == source.data() + tokens[12].offset + 1);
+}
+
+
+KALPA_TEST(tokenizer_errors) {
+    const std::string_view source =
+        "let a = 1 $ 2\n"
+        "let b = \"x\\qy\" + 3\n"
+        "if b:\n"
+        "   let c = 0x\n"
+        "    let d = 99999999999999999999\n"
+        "            let e = 4\n"
+        "    let f = \"open\n";
+
+    const TokenBuffer tokens = tokenize_all(source);
+    const auto diagnostics = collect_diagnostics(tokens);
+
+    const LexError errors[] = {
+        LexError::UnexpectedChar, LexError::BadEscape, LexError::BadIndent, LexError::NumberOutOfRange,
+        LexError::IndentTooDeep, LexError::UnterminatedString,
+    };
+    const std::string_view at[] = {"$ 2", "\"x", "let c", "9999", "let e", "\"open"};
+
+    verify_eq(diagnostics.size(), std::size(errors));
+    for (usize i = 0; i < diagnostics.size(); ++i) {
+        KALPA_VERIFY(diagnostics[i].error == errors[i]);
+        verify_eq(source.substr(diagnostics[i].offset, at[i].size()), at[i]);
+    }
+
+    // Lexing goes on at the next line, at the level of the last good one.
+    usize num_lets = 0;
+    usize num_indents = 0;
+    for (usize i = 0; i < tokens.size(); ++i) {
+        num_lets += tokens[i].type == Token::Type::Let;
+        num_indents += tokens[i].type == Token::Type::Indent;
+    }
+    verify_eq(num_lets, 4u);
+    verify_eq(num_indents, 1u);
+}
+
+
+KALPA_BENCH(tokenize_all) {
+    const std::string source = generate_corpus(1, 1 << 20);
+    state.set_bytes_per_iteration(source.size());
+
+    for (usize i = 0; i < state.iterations(); ++i) {
+        Interner interner;
+        BenchState::keep(tokenize_all(source, interner).size());
+    }
+}
+
+
 }
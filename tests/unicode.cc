@@ -0,0 +1,70 @@
+#include <string_view>
+#include <vector>
+
+#include "defs.h"
+#include "interner.h"
+#include "scan.h"
+#include "tokenizer.h"
+#include "unicode.h"
+
+#include "test.h"
+
+
+namespace klp {
+
+
+KALPA_TEST(unicode_classes) {
+    constexpr std::string_view euro = "\xe2\x82\xac";
+    static_assert(decode_utf8(euro.data(), euro.data() + euro.size()).code_point == 0x20ac);
+
+    KALPA_VERIFY(is_xid_start(0xe9));      // é
+    KALPA_VERIFY(is_xid_start(0x3bb));     // λ
+    KALPA_VERIFY(is_xid_start(0x5909));    // 変
+    KALPA_VERIFY(is_xid_start(0x1d400));   // 𝐀
+    KALPA_VERIFY(!is_xid_start(0x300));    // combining grave accent
+    KALPA_VERIFY(is_xid_continue(0x300));
+    KALPA_VERIFY(!is_xid_start(0x0661) && is_xid_continue(0x0661));  // Arabic-Indic digit one
+    KALPA_VERIFY(!is_xid_continue(0x221e));  // ∞
+    KALPA_VERIFY(!is_xid_continue(0xa0));    // no-break space
+    KALPA_VERIFY(!is_xid_continue(0x10ffff));
+
+    verify_eq(validate_utf8("caf\xc3\xa9"), usize(5));
+    verify_eq(validate_utf8("caf\xc3"), usize(3));
+}
+
+
+KALPA_TEST(tokenizer_unicode_identifiers) {
+    const std::string_view source =
+        "let caf\xc3\xa9 = na\xc3\xafve + \xe5\xa4\x89\xe6\x95\xb0\n"   // café, naïve, 変数
+        "let \xce\xbb\xcc\x80 = 1 \xe2\x88\x9e\n"                         // λ̀ ... ∞
+        "x\xff y\n";
+
+    Interner interner;
+    const TokenBuffer tokens = tokenize_all(source, interner);
+    const auto diagnostics = collect_diagnostics(tokens);
+
+    std::vector<std::string_view> identifiers;
+    for (usize i = 0; i < tokens.size(); ++i) {
+        if (tokens.types[i] == Token::Type::Identifier) {
+            identifiers.push_back(tokens.tables.identifier(tokens[i]));
+        }
+    }
+
+    const std::string_view expected[] = {
+        "caf\xc3\xa9", "na\xc3\xafve", "\xe5\xa4\x89\xe6\x95\xb0", "\xce\xbb\xcc\x80", "x",
+    };
+    verify_eq(identifiers.size(), std::size(expected));
+    for (usize i = 0; i < identifiers.size(); ++i) {
+        verify_eq(identifiers[i], expected[i]);
+    }
+
+    // Not an identifier character, then a byte that is not UTF-8.
+    verify_eq(diagnostics.size(), usize(2));
+    KALPA_VERIFY(diagnostics[0].error == LexError::UnexpectedChar);
+    verify_eq(diagnostics[0].offset, u32(source.find("\xe2\x88\x9e")));
+    KALPA_VERIFY(diagnostics[1].error == LexError::InvalidUtf8);
+    verify_eq(diagnostics[1].offset, u32(source.find("\xff")));
+}
+
+
+}
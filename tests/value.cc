@@ -0,0 +1,89 @@
+#include <cmath>
+#include <limits>
+#include <string>
+
+#include "defs.h"
+#include "heap.h"
+#include "print.h"
+#include "value.h"
+
+#include "test.h"
+
+
+namespace klp {
+
+
+KALPA_TEST(value_encoding) {
+    const double floats[] = {
+        0.0, -0.0, 1.5, -2.25, 1e308, -1e-308,
+        std::numeric_limits<double>::infinity(),
+        -std::numeric_limits<double>::infinity(),
+        std::numeric_limits<double>::denorm_min(),
+    };
+    for (const double number : floats) {
+        const Value value = Value::from_float(number);
+        KALPA_VERIFY(value.is_float() && value.is_number());
+        KALPA_VERIFY(!value.is_small_int() && !value.is_object() && !value.is_bool() && !value.is_none());
+        verify_eq(std::signbit(value.as_float()), std::signbit(number));
+        verify_eq(value.as_float(), number);
+    }
+
+    // However a NaN is made, it must not look like a boxed value.
+    const double nans[] = {
+        std::numeric_limits<double>::quiet_NaN(),
+        -std::numeric_limits<double>::quiet_NaN(),
+        std::numeric_limits<double>::infinity() - std::numeric_limits<double>::infinity(),
+    };
+    for (const double number : nans) {
+        const Value value = Value::from_float(number);
+        KALPA_VERIFY(value.is_float());
+        KALPA_VERIFY(std::isnan(value.as_float()));
+        KALPA_VERIFY(!values_equal(value, value));
+    }
+
+    const i64 ints[] = {0, 1, -1, 42, Value::max_small_int, Value::min_small_int};
+    for (const i64 integer : ints) {
+        const Value value = Value::from_small_int(integer);
+        KALPA_VERIFY(value.is_small_int() && value.is_int() && value.is_number());
+        KALPA_VERIFY(!value.is_float() && !value.is_object());
+        verify_eq(value.as_small_int(), integer);
+        verify_eq(value.as_int(), integer);
+    }
+
+    KALPA_VERIFY(Value::from_bool(true).is_bool() && Value::from_bool(true).as_bool());
+    KALPA_VERIFY(Value::from_bool(false).is_bool() && !Value::from_bool(false).as_bool());
+    KALPA_VERIFY(Value::none().is_none() && !Value::none().is_bool());
+    KALPA_VERIFY(Value::undefined().is_undefined() && !Value::undefined().is_none());
+
+    StringObject string("text");
+    const Value object = Value::from_object(&string);
+    KALPA_VERIFY(object.is_object() && object.is_object(ObjectKind::String));
+    KALPA_VERIFY(!object.is_float() && !object.is_int());
+    KALPA_VERIFY(object.as_object() == &string);
+}
+
+
+KALPA_TEST(value_int_promotion) {
+    Heap heap;
+    const i64 ints[] = {
+        Value::max_small_int, Value::max_small_int + 1, Value::min_small_int, Value::min_small_int - 1,
+        std::numeric_limits<i64>::max(), std::numeric_limits<i64>::min(),
+    };
+    for (const i64 integer : ints) {
+        const Value value = make_int(heap, integer);
+        KALPA_VERIFY(value.is_int() && value.is_number() && !value.is_float());
+        verify_eq(value.is_small_int(), Value::fits_small_int(integer));
+        verify_eq(value.as_int(), integer);
+        verify_eq(format_value(value), fmt::to_string(integer));
+        verify_eq(std::string(type_name(value)), std::string("int"));
+    }
+    verify_eq(heap.size(), usize(4));
+
+    KALPA_VERIFY(values_equal(make_int(heap, i64(1) << 50), make_int(heap, i64(1) << 50)));
+    KALPA_VERIFY(values_equal(make_int(heap, i64(1) << 50), Value::from_float(std::ldexp(1.0, 50))));
+    KALPA_VERIFY(!values_equal(make_int(heap, i64(1) << 50), make_int(heap, (i64(1) << 50) + 1)));
+    KALPA_VERIFY(is_truthy(make_int(heap, i64(1) << 50)));
+}
+
+
+}
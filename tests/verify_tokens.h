@@ -0,0 +1,43 @@
+#ifndef KALPA_VERIFY_TOKENS_H
+#define KALPA_VERIFY_TOKENS_H
+
+
+#include "defs.h"
+#include "tokenizer.h"
+
+
+namespace klp {
+
+
+// Checks that token `i` of `actual` equals token `j` of `expected`,
+// payloads and errors included. Identifiers compare by atom, so both must
+// use the same interner.
+inline void verify_same_token(const TokenBuffer& actual, usize i, const TokenBuffer& expected, usize j) {
+    const Token a = actual[i];
+    const Token e = expected[j];
+    KALPA_VERIFY(a.type == e.type);
+    verify_eq(a.offset, e.offset);
+
+    switch (e.type) {
+        case Token::Type::Identifier: verify_eq(a.payload, e.payload); break;
+        case Token::Type::Int: verify_eq(actual.tables.int_value(a), expected.tables.int_value(e)); break;
+        case Token::Type::Float: verify_eq(actual.tables.float_value(a), expected.tables.float_value(e)); break;
+        case Token::Type::String: verify_eq(actual.tables.string(a), expected.tables.string(e)); break;
+        case Token::Type::Error: KALPA_VERIFY(actual.tables.error(a) == expected.tables.error(e)); break;
+        default: break;
+    }
+}
+
+
+inline void verify_same_tokens(const TokenBuffer& actual, const TokenBuffer& expected) {
+    verify_eq(actual.size(), expected.size());
+    for (usize i = 0; i < expected.size(); ++i) {
+        verify_same_token(actual, i, expected, i);
+    }
+}
+
+
+}
+
+
+#endif
@@ -0,0 +1,478 @@
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <string_view>
+
+#include "ast.h"
+#include "bytecode.h"
+#include "compiler.h"
+#include "defs.h"
+#include "interner.h"
+#include "lazy_module.h"
+#include "parser.h"
+#include "tokenizer.h"
+#include "vm.h"
+#include "write_buffer.h"
+
+#include "test.h"
+
+
+namespace klp {
+
+
+struct RunOutcome {
+    std::string output;
+    std::string error;  // empty on success
+    u32 error_offset = 0;
+};
+
+
+// With `lazy`, compiles each function on its first call.
+static RunOutcome run_source(std::string_view source, u32 jit_threshold, bool lazy = false) {
+    Interner interner;
+    const TokenBuffer eager_tokens = lazy ? TokenBuffer() : tokenize_all(source, interner);
+    LazyModule module(lazy ? source : std::string_view(), interner);
+    const TokenBuffer& tokens = lazy ? module.top_level() : eager_tokens;
+    KALPA_VERIFY(collect_diagnostics(tokens).empty());
+    const Ast ast = parse(tokens);
+    KALPA_VERIFY(ast.diagnostics.empty());
+
+    RunOutcome outcome;
+    Program program(interner);
+    const auto compiled = lazy ? compile_lazy(ast, module, program) : compile(ast, tokens, program);
+    if (!compiled) {
+        outcome.error = compiled.error().message;
+        outcome.error_offset = compiled.error().offset;
+        return outcome;
+    }
+
+    FILE* file = std::tmpfile();
+    KALPA_VERIFY(file != nullptr);
+    {
+        WriteBuffer out(fileno(file), 4096);
+        VmOptions options;
+        options.stack_size = 4096;
+        options.jit_threshold = jit_threshold;
+        options.nursery_size = 4096;  // so that most of these collect garbage
+        Vm vm(program, out, options);
+        const auto result = vm.run();
+        if (!result) {
+            outcome.error = result.error().message;
+            outcome.error_offset = result.error().offset;
+        }
+    }
+
+    std::rewind(file);
+    char buffer[4096];
+    usize size;
+    while ((size = std::fread(buffer, 1, sizeof(buffer), file)) > 0) {
+        outcome.output.append(buffer, size);
+    }
+    std::fclose(file);
+    return outcome;
+}
+
+
+// Both check the program interpreted, and with functions compiled to
+// machine code as soon as they are called or loop. verify_output() also
+// compiles the functions lazily.
+static void verify_output(std::string_view source, std::string_view expected) {
+    for (const u32 jit_threshold : {0, 1}) {
+        for (const bool lazy : {false, true}) {
+            const RunOutcome outcome = run_source(source, jit_threshold, lazy);
+            verify_eq(outcome.error, std::string());
+            verify_eq(outcome.output, std::string(expected));
+        }
+    }
+}
+
+
+static void verify_error(std::string_view source, std::string_view message, std::string_view at) {
+    for (const u32 jit_threshold : {0, 1}) {
+        const RunOutcome outcome = run_source(source, jit_threshold);
+        verify_eq(outcome.error, std::string(message));
+        verify_eq(outcome.error_offset, u32(source.find(at)));
+    }
+}
+
+
+KALPA_TEST(vm_functions) {
+    verify_output(
+        "def fac n =\n"
+        "    if n == 1:\n"
+        "        return 1\n"
+        "    else:\n"
+        "        return n * fac (n - 1)\n"
+        "\n"
+        "def fib n =\n"
+        "    if n < 2: return n\n"
+        "    return fib (n - 1) + fib (n - 2)\n"
+        "\n"
+        "def later x = helper x\n"
+        "def helper x = x * 10\n"
+        "def nothing x =\n"
+        "    x += 1\n"
+        "print (fac 20) (fib 20) (later 2) (nothing 1)\n",
+        "2432902008176640000 6765 20 none\n"
+    );
+}
+
+
+KALPA_TEST(vm_control_flow) {
+    verify_output(
+        "let total = 0\n"
+        "let i = 0\n"
+        "while i < 10 and not total > 20:\n"
+        "    total += i\n"
+        "    i += 1\n"
+        "print i total\n"
+        "let squares = []\n"
+        "for j in range 1 5: append squares (j * j)\n"
+        "for s in squares:\n"
+        "    if s > 9 or s == 1: print \"edge\" s\n"
+        "    elif s != 4: print \"odd\" s\n"
+        "    else: print \"even\" s\n"
+        "def count xs =\n"
+        "    let n = 0\n"
+        "    for x in xs:\n"
+        "        if x: n += 1\n"
+        "    return n\n"
+        "print (count [0, 1, \"\", \"a\", [], [0], none, true, 0.0]) (0 or \"b\") (1 and [])\n",
+        "7 21\n"
+        "edge 1\n"
+        "even 4\n"
+        "odd 9\n"
+        "edge 16\n"
+        "4 b []\n"
+    );
+}
+
+
+KALPA_TEST(vm_values) {
+    verify_output(
+        "print (7 // 2) (-7 // 2) (7 / 2) (2 ** 10) (2 ** -1) (2.5 * 2) (5 ^ 3) (-(3))\n"
+        "print (1 == 1.0) (\"ab\" < \"b\") (2 in [1, 2]) (\"bc\" in \"abc\") ([1, [2]] == [1, [2]])\n"
+        "let xs = [1, \"two\", 3.5, none]\n"
+        "xs[0] += 9\n"
+        "xs[-1] = xs[0] + len xs\n"
+        "print xs (\"a\" + str 1) ([1] + [2])\n",
+        "3 -4 3.5 1024 0.5 5.0 6 -3\n"
+        "true true true true true\n"
+        "[10, \"two\", 3.5, 14] a1 [1, 2]\n"
+    );
+}
+
+
+// Lists that hold themselves, and lists nested far deeper than the
+// native stack would allow recursion.
+KALPA_TEST(vm_cyclic_and_deep_lists) {
+    verify_output(
+        "let a = []\n"
+        "append a a\n"
+        "let b = []\n"
+        "append b b\n"
+        "print (a == b) (a in [1, b]) (a != [a])\n"
+        "if a == b:\n"
+        "    print a\n"
+        "append a a\n"
+        "print a (str a) (a == b)\n",
+        "true true false\n"
+        "[[...]]\n"
+        "[[...], [...]] [[...], [...]] false\n"
+    );
+
+    verify_output(
+        "let a = []\n"
+        "let b = []\n"
+        "let i = 0\n"
+        "while i < 300000:\n"
+        "    a = [a]\n"
+        "    b = [b]\n"
+        "    i += 1\n"
+        "print (a == b) (a == [b]) (len (str a))\n"
+        "append b 1\n"
+        "print (a == b)\n",
+        "true false 133\n"
+        "false\n"
+    );
+}
+
+
+// Objects kept in globals, in registers of suspended frames and in old
+// lists, while short-lived ones fill the nursery many times over.
+KALPA_TEST(vm_garbage_collection) {
+    verify_output(
+        "def build n =\n"
+        "    let items = []\n"
+        "    for i in range n: append items [i, str i, 2 ** 60 + i]\n"
+        "    return items\n"
+        "def churn n keep =\n"
+        "    let total = 0\n"
+        "    for i in range n: total += len (build 3)\n"
+        "    return total + len keep\n"
+        "let kept = build 300\n"
+        "let garbage = churn 500 (build 7)\n"
+        "kept[0] = [\"first\"]\n"
+        "let total = 0\n"
+        "for item in kept:\n"
+        "    if len item == 3 and item[2] - item[0] == 2 ** 60: total += item[0]\n"
+        "print (len kept) total kept[0] kept[299][1] garbage\n",
+        "300 44850 [\"first\"] 299 1507\n"
+    );
+}
+
+
+// Without the JIT, no amount of looping gets a function compiled.
+KALPA_TEST(vm_no_jit) {
+    Interner interner;
+    const TokenBuffer tokens = tokenize_all("let i = 0\nwhile i < 3: i += 1\n", interner);
+    const Ast ast = parse(tokens);
+    Program program(interner);
+    KALPA_VERIFY(bool(compile(ast, tokens, program)));
+
+    // As if it had looped 2^32 times already.
+    program.main->hotness = UINT32_MAX - 1;
+    WriteBuffer out(-1);
+    VmOptions options;
+    options.jit_threshold = 0;
+    Vm vm(program, out, options);
+    KALPA_VERIFY(bool(vm.run()));
+    KALPA_VERIFY(program.main->native == nullptr);
+}
+
+
+// Lists whose items take far more memory than the lists themselves get
+// collected as they go.
+KALPA_TEST(vm_collects_payloads) {
+    Interner interner;
+    const TokenBuffer tokens = tokenize_all(
+        "let i = 0\n"
+        "while i < 50:\n"
+        "    let items = range 100000\n"
+        "    i += 1\n",
+        interner
+    );
+    const Ast ast = parse(tokens);
+    Program program(interner);
+    KALPA_VERIFY(bool(compile(ast, tokens, program)));
+
+    WriteBuffer out(-1);
+    Vm vm(program, out);
+    KALPA_VERIFY(bool(vm.run()));
+    const GcStats& stats = program.heap.stats;
+    KALPA_VERIFY(stats.minor_collections >= 20 && stats.major_collections >= 1);
+
+    // Of the 50 lists of about 1 MB each, those still in the nursery and
+    // the old generation, which grows to its threshold, are left at most.
+    KALPA_VERIFY(stats.payload_bytes < Heap::min_major_threshold + 2 * Heap::default_nursery_size);
+}
+
+
+// Ints leave and re-enter the inline range through every fast path.
+KALPA_TEST(vm_int_promotion) {
+    verify_output(
+        "let big = 2 ** 49\n"
+        "let small = big - 1\n"
+        "print big (small + 1) (small * 2) (-big) (-(-big)) (big // 2) (big ^ 1)\n"
+        "print (big - 1 == small) (big > small) (big == 562949953421312) (big * 4 // 4)\n"
+        "let total = 0\n"
+        "for i in range (big - 2) (big + 2): total += i - big\n"
+        "let n = small\n"
+        "n += 1\n"
+        "print total n [big, 2 ** 62 + (2 ** 62 - 1)]\n",
+        "562949953421312 562949953421312 1125899906842622 -562949953421312 562949953421312 281474976710656 562949953421313\n"
+        "true true true 562949953421312\n"
+        "-2 562949953421312 [562949953421312, 9223372036854775807]\n"
+    );
+}
+
+
+// Values that machine code does not handle, turning up in a loop that has
+// been compiled.
+KALPA_TEST(vm_type_changes) {
+    verify_output(
+        "def mix n =\n"
+        "    let total = 0\n"
+        "    for i in range n:\n"
+        "        if i == 50: total = total + 0.5\n"
+        "        total += i\n"
+        "    return total\n"
+        "def grow n =\n"
+        "    let x = 1\n"
+        "    for i in range n: x = x * 3\n"
+        "    return x\n"
+        "def count xs limit =\n"
+        "    let n = 0\n"
+        "    let i = 0\n"
+        "    while i < limit and xs[i] != \"stop\":\n"
+        "        i += 1\n"
+        "        if xs[i - 1]: n = n + 1\n"
+        "    return n\n"
+        "print (mix 100) (grow 30) (grow 39) (count [1, 0, 2.5, \"\", [], \"stop\", 1] 7)\n",
+        "4950.5 205891132094649 4052555153018976267 2\n"
+    );
+}
+
+
+KALPA_TEST(vm_errors) {
+    verify_error("print missing\n", "missing is not defined", "missing");
+    verify_error("def f x = x\nf 1 2\n", "f takes 1 argument, got 2", "f 1 2");
+    verify_error("let x = 1\nx 2\n", "int is not callable", "x 2");
+    verify_error("let xs = [5]\nprint xs[1]\n", "index 1 out of range for length 1", "[1]");
+    verify_error("print (2 ** 62 * 4)\n", "integer overflow in *", "* 4");
+    verify_error("print (1 // 0)\n", "division by zero", "//");
+    verify_error("print (1 + \"a\")\n", "unsupported operands for +: int and string", "+");
+    verify_error("let s = \"a\"\nprint (s - 1)\n", "unsupported operands for -: string and int", "- 1");
+    verify_error("let s = \"a\"\ns -= 1\n", "unsupported operands for -: string and int", "-= 1");
+    verify_error("def down n = down (n + 1)\ndown 0\n", "stack overflow", "down (n");
+    verify_error("def f n =\n    for i in range n: n += i\n    return missing\nf 3\n", "missing is not defined", "missing");
+    verify_error("def f n =\n    for i in range n: n = n * n\n    return n\nf 10\n", "integer overflow in *", "* n");
+
+    verify_error("class A:\n    x = 1\n", "classes are not supported yet", "A:");
+    verify_error("return 1\n", "return outside a function", "return");
+    verify_error("def f =\n    def g = 1\n", "nested functions are not supported yet", "g = 1");
+}
+
+
+// The compiler recurses over expressions, as deep as the parser lets
+// them be.
+KALPA_TEST(vm_deepest_expressions) {
+    const std::string source = "x = " + std::string(max_expression_depth - 2, '-') + "1\nprint x\n";
+    verify_eq(run_source(source, 0).error, std::string("expression needs too many registers"));
+
+    std::string sum = "x = 0";
+    for (u32 i = 0; i < 100; ++i) {
+        sum += " + 1";
+    }
+    verify_output(sum + "\nprint x\n", "100\n");
+}
+
+
+KALPA_TEST(vm_branches_without_bools) {
+    Interner interner;
+    const TokenBuffer tokens = tokenize_all("def f n =\n    while n > 0 and n != 5:\n        n -= 1\n", interner);
+    const Ast ast = parse(tokens);
+    Program program(interner);
+    KALPA_VERIFY(bool(compile(ast, tokens, program)));
+
+    const Function& f = *static_cast<const Function*>(program.main->constants[0].as_object());
+    usize num_branches = 0;
+    for (const Instruction insn : f.code) {
+        KALPA_VERIFY(insn.op() != Opcode::Greater && insn.op() != Opcode::NotEqual);
+        num_branches += insn.op() == Opcode::BranchLess || insn.op() == Opcode::BranchEqual;
+    }
+    verify_eq(num_branches, usize(2));
+}
+
+
+// Bodies that are never called are never lexed, so their errors are not
+// reported either.
+KALPA_TEST(vm_lazy_functions) {
+    const std::string_view source =
+        "def unused x =\n"
+        "    return x $ 1\n"
+        "def double x = x * 2\n"
+        "let a = double 4\n"
+        "def also_unused =\n"
+        "    def nested = 1\n"
+        "print a (double a)\n";
+
+    Interner interner;
+    LazyModule module(source, interner);
+    const Ast ast = parse(module.top_level());
+    Program program(interner);
+    KALPA_VERIFY(bool(compile_lazy(ast, module, program)));
+    verify_eq(module.num_lexed(), usize(0));
+
+    FILE* file = std::tmpfile();
+    KALPA_VERIFY(file != nullptr);
+    {
+        WriteBuffer out(fileno(file), 4096);
+        Vm vm(program, out);
+        KALPA_VERIFY(bool(vm.run()));
+    }
+    std::rewind(file);
+    char output[16] = {};
+    KALPA_VERIFY(std::fread(output, 1, sizeof(output) - 1, file) > 0);
+    std::fclose(file);
+    verify_eq(std::string_view(output), std::string_view("8 16\n"));
+
+    KALPA_VERIFY(!module.is_lexed(0) && module.is_lexed(1) && !module.is_lexed(2));
+    verify_eq(module.num_lexed(), usize(1));
+}
+
+
+// Errors in a body are reported on the first call, where they are.
+KALPA_TEST(vm_lazy_errors) {
+    const auto verify_lazy_error = [](std::string_view source, std::string_view message, std::string_view at, std::string_view output) {
+        const RunOutcome outcome = run_source(source, 0, true);
+        verify_eq(outcome.error, std::string(message));
+        verify_eq(outcome.error_offset, u32(source.find(at)));
+        verify_eq(outcome.output, std::string(output));
+    };
+
+    verify_lazy_error("def f x =\n    return x +\nprint 1\nf 1\n", "expected an expression", "+\n", "1\n");
+    verify_lazy_error("def f x =\n    return $\nprint 1\nf 1\n", "unexpected character", "$", "1\n");
+    verify_lazy_error("def f x =\n    def g = 1\nf 1\n", "nested functions are not supported yet", "g = 1", "");
+    verify_lazy_error("def f x = x\nf 1 2\n", "f takes 1 argument, got 2", "f 1 2", "");
+    verify_lazy_error("print 1\nclass A:\n    x = 1\n", "classes are not supported yet", "A:", "");
+    verify_lazy_error("if 1:\n    print 1\ndef f = 1\nelse:\n    print 2\n", "expected an expression", "else", "");
+}
+
+
+static void bench_program(BenchState& state, std::string_view source, u32 jit_threshold) {
+    Interner interner;
+    const TokenBuffer tokens = tokenize_all(source, interner);
+    const Ast ast = parse(tokens);
+
+    for (usize i = 0; i < state.iterations(); ++i) {
+        Program program(interner);
+        KALPA_VERIFY(bool(compile(ast, tokens, program)));
+        WriteBuffer out(-1);
+        VmOptions options;
+        options.jit_threshold = jit_threshold;
+        Vm vm(program, out, options);
+        BenchState::keep(vm.run());
+    }
+}
+
+
+static constexpr std::string_view fib_source =
+    "def fib n =\n"
+    "    if n < 2: return n\n"
+    "    return fib (n - 1) + fib (n - 2)\n"
+    "let result = fib 25\n";
+
+
+static constexpr std::string_view while_source =
+    "def run n =\n"
+    "    let total = 0\n"
+    "    let i = 0\n"
+    "    while i < n:\n"
+    "        total += i ^ 3\n"
+    "        i += 1\n"
+    "    return total\n"
+    "let result = run 1000000\n";
+
+
+KALPA_BENCH(vm_fib) {
+    bench_program(state, fib_source, 0);
+}
+
+
+KALPA_BENCH(vm_fib_jit) {
+    bench_program(state, fib_source, VmOptions().jit_threshold);
+}
+
+
+KALPA_BENCH(vm_while) {
+    bench_program(state, while_source, 0);
+}
+
+
+KALPA_BENCH(vm_while_jit) {
+    bench_program(state, while_source, VmOptions().jit_threshold);
+}
+
+
+}
@@ -0,0 +1,70 @@
+#!/usr/bin/env python3
+#
+#  Writes src/unicode_tables.h: the XID_Start and XID_Continue ranges of
+#  the Unicode database Python was built with, outside of ASCII. Python
+#  identifiers are defined by the same properties, so str.isidentifier()
+#  is the classifier.
+#
+#      tools/gen_unicode_tables.py > src/unicode_tables.h
+#
+
+import sys
+import unicodedata
+
+
+def ranges(predicate):
+    result = []
+    for cp in range(0x80, sys.maxunicode + 1):
+        if predicate(chr(cp)):
+            if result and result[-1][1] == cp - 1:
+                result[-1][1] = cp
+            else:
+                result.append([cp, cp])
+    return result
+
+
+def write_table(name, table):
+    print(f"constexpr UnicodeRange {name}[] = {{")
+    for i in range(0, len(table), 4):
+        row = table[i:i + 4]
+        print("    " + " ".join(f"{{0x{a:05x}, 0x{b:05x}}}," for a, b in row))
+    print("};")
+
+
+def main():
+    xid_start = ranges(lambda c: c.isidentifier())
+    xid_continue = ranges(lambda c: ("a" + c).isidentifier())
+
+    print("// Generated by tools/gen_unicode_tables.py from Unicode "
+          f"{unicodedata.unidata_version}. Do not edit.")
+    print()
+    print("#ifndef KALPA_UNICODE_TABLES_H")
+    print("#define KALPA_UNICODE_TABLES_H")
+    print()
+    print()
+    print('#include "defs.h"')
+    print()
+    print()
+    print("namespace klp {")
+    print()
+    print()
+    print("// Inclusive code point ranges, sorted and disjoint.")
+    print("struct UnicodeRange {")
+    print("    u32 first;")
+    print("    u32 last;")
+    print("};")
+    print()
+    print()
+    write_table("xid_start_ranges", xid_start)
+    print()
+    print()
+    write_table("xid_continue_ranges", xid_continue)
+    print()
+    print()
+    print("}")
+    print()
+    print()
+    print("#endif")
+
+
+main()